@@ -0,0 +1,569 @@
+//
+//  affinity.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Placement of worker threads on CPUs and NUMA nodes, and NUMA allocation counters. Only Linux is
+// supported; elsewhere threads are left where the scheduler puts them.
+//
+
+#include "affinity.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#if USE_THREADS
+#include <thread>
+#endif
+
+#include "calc.h"
+
+using namespace std;
+
+// ========== Local Headers ========================================================================
+
+// node numbers under /sys/devices/system/node, in order; empty if there are none
+static void listNodes(std::vector<int>& nodes);
+
+// CPUs this process may run on, in order
+static void listAllowedCpus(std::vector<int>& cpus);
+
+// CPU quota of this process's cgroup (v2 cpu.max or v1 cfs quota and period); 0 if none
+static double cgroupCpuQuota();
+
+// ========== Globals ==============================================================================
+
+static const std::string gNodeDirectory = "/sys/devices/system/node";
+static const std::string gCgroupDirectory = "/sys/fs/cgroup";
+
+// ========== Classes ==============================================================================
+
+// all zero
+NumaCounts::NumaCounts() :
+hit(0),
+miss(0),
+local(0),
+other(0)
+{
+}
+
+// this minus earlier
+NumaCounts NumaCounts::since(const NumaCounts& earlier) const
+{
+    NumaCounts result;
+    result.hit = hit - earlier.hit;
+    result.miss = miss - earlier.miss;
+    result.local = local - earlier.local;
+    result.other = other - earlier.other;
+
+    return result;
+}
+
+// write key/value lines <prefix>.hit, .miss, .local, .other, and .hitRate and .localRate if
+// there were any allocations
+void NumaCounts::write(std::ostream& output, const std::string& prefix) const
+{
+    writeKeyValue<long long>(output, prefix + ".hit", hit);
+    writeKeyValue<long long>(output, prefix + ".miss", miss);
+    writeKeyValue<long long>(output, prefix + ".local", local);
+    writeKeyValue<long long>(output, prefix + ".other", other);
+
+    if (hit + miss > 0) {
+        writeKeyValue<double>(output, prefix + ".hitRate", hit / (double)(hit + miss));
+    }
+
+    if (local + other > 0) {
+        writeKeyValue<double>(output, prefix + ".localRate", local / (double)(local + other));
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+AffinityPlan::AffinityPlan(AffinityPolicy policy) :
+policy(policy)
+{
+    if (policy == AFFINITY_NONE) {
+        return;
+    }
+
+    vector<int> allowed;
+    listAllowedCpus(allowed);
+
+    vector<int> nodes;
+    listNodes(nodes);
+
+    // available CPUs of each node, skipping nodes with none
+    for (size_t n = 0; n < nodes.size(); n++) {
+        ostringstream oss;
+        oss << gNodeDirectory << "/node" << nodes[n] << "/cpulist";
+
+        ifstream input(oss.str().c_str());
+        string line;
+        getline(input, line);
+
+        vector<int> cpus;
+        parseCpuList(line, cpus);
+
+        vector<int> available;
+        for (size_t k = 0; k < cpus.size(); k++) {
+            if (find(allowed.begin(), allowed.end(), cpus[k]) != allowed.end()) {
+                available.push_back(cpus[k]);
+            }
+        }
+
+        if (!available.empty()) {
+            nodeCpus.push_back(available);
+        }
+    }
+
+    // no NUMA information, so one node
+    if (nodeCpus.empty() && !allowed.empty()) {
+        nodeCpus.push_back(allowed);
+    }
+}
+
+// with the given CPUs by node, instead of those available to this process
+AffinityPlan::AffinityPlan(AffinityPolicy policy,
+                           const std::vector< std::vector<int> >& nodeCpus) :
+policy(policy),
+nodeCpus(nodeCpus)
+{
+}
+
+// CPUs for thread k; empty if the thread is not to be pinned
+std::vector<int> AffinityPlan::cpusFor(int threadIndex) const
+{
+    vector<int> cpus;
+
+    if (policy == AFFINITY_NONE || nodeCpus.empty()) {
+        return cpus;
+    }
+
+    int nodeCount = (int)nodeCpus.size();
+
+    if (policy == AFFINITY_COMPACT) {
+        vector<int> all;
+        for (int n = 0; n < nodeCount; n++) {
+            all.insert(all.end(), nodeCpus[n].begin(), nodeCpus[n].end());
+        }
+
+        cpus.push_back(all[threadIndex % all.size()]);
+
+    } else if (policy == AFFINITY_SCATTER) {
+        const vector<int>& node = nodeCpus[threadIndex % nodeCount];
+        cpus.push_back(node[(threadIndex / nodeCount) % node.size()]);
+
+    } else if (policy == AFFINITY_NUMA) {
+        cpus = nodeCpus[threadIndex % nodeCount];
+    }
+
+    return cpus;
+}
+
+// restrict the calling thread to the CPUs for thread k; returns false if not pinned
+bool AffinityPlan::pin(int threadIndex) const
+{
+    vector<int> cpus = cpusFor(threadIndex);
+
+    if (cpus.empty()) {
+        return false;
+    }
+
+#ifdef __linux
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (size_t k = 0; k < cpus.size(); k++) {
+        CPU_SET(cpus[k], &set);
+    }
+
+    // 0 is the calling thread
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// ========== Functions ============================================================================
+
+// parse compact, scatter, numa or none; returns false if not recognized
+bool parseAffinityPolicy(const std::string& str, AffinityPolicy& policy)
+{
+    if (str == "none") {
+        policy = AFFINITY_NONE;
+
+    } else if (str == "compact") {
+        policy = AFFINITY_COMPACT;
+
+    } else if (str == "scatter") {
+        policy = AFFINITY_SCATTER;
+
+    } else if (str == "numa") {
+        policy = AFFINITY_NUMA;
+
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// name of policy, as accepted by parseAffinityPolicy
+const char *affinityName(AffinityPolicy policy)
+{
+    switch (policy) {
+        case AFFINITY_NONE:     return "none";
+        case AFFINITY_COMPACT:  return "compact";
+        case AFFINITY_SCATTER:  return "scatter";
+        case AFFINITY_NUMA:     return "numa";
+        default:                return "unknown";
+    }
+}
+
+// CPU the calling thread is running on; -1 if unknown
+int currentCpu()
+{
+#ifdef __linux
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+// number of CPUs this process can keep busy: those in its affinity mask, limited by any cgroup
+// CPU quota (rounded up); at least 1
+int availableCpus()
+{
+    vector<int> allowed;
+    listAllowedCpus(allowed);
+
+    int cpus = (int)allowed.size();
+
+#if USE_THREADS
+    if (cpus == 0) {
+        cpus = (int)thread::hardware_concurrency();
+    }
+#endif
+
+    // a quota of 1.5 CPUs can keep 2 threads partly busy
+    double quota = cgroupCpuQuota();
+    if (quota > 0 && (cpus == 0 || quota < cpus)) {
+        cpus = (int)ceil(quota);
+    }
+
+    return max(cpus, 1);
+}
+
+// parse a cgroup v2 cpu.max line such as "200000 100000" as CPUs (2); 0 for "max" or unparseable
+double parseCpuMax(const std::string& str)
+{
+    istringstream iss(str);
+    string quota;
+    double period = 0;
+    iss >> quota >> period;
+
+    if (quota == "max" || period <= 0 || atof(quota.c_str()) <= 0) {
+        return 0;
+    }
+
+    return atof(quota.c_str()) / period;
+}
+
+// parse a /sys cpulist such as "0-3,8-11"
+void parseCpuList(const std::string& str, std::vector<int>& cpus)
+{
+    istringstream iss(str);
+    string item;
+    while (getline(iss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+
+        size_t dash = item.find('-');
+        int first = atoi(item.c_str());
+        int last = dash == string::npos ? first : atoi(item.c_str() + dash + 1);
+
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+}
+
+// sum counters over nodes; returns false if there are no NUMA counters
+bool sampleNumaCounts(NumaCounts& counts)
+{
+    counts = NumaCounts();
+
+    vector<int> nodes;
+    listNodes(nodes);
+
+    for (size_t n = 0; n < nodes.size(); n++) {
+        ostringstream oss;
+        oss << gNodeDirectory << "/node" << nodes[n] << "/numastat";
+
+        // lines such as "numa_hit 123456"
+        ifstream input(oss.str().c_str());
+        string name;
+        long long value;
+        while (input >> name >> value) {
+            if (name == "numa_hit") {
+                counts.hit += value;
+
+            } else if (name == "numa_miss") {
+                counts.miss += value;
+
+            } else if (name == "local_node") {
+                counts.local += value;
+
+            } else if (name == "other_node") {
+                counts.other += value;
+            }
+        }
+    }
+
+    return !nodes.empty();
+}
+
+// ========== Local Functions ======================================================================
+
+// node numbers under /sys/devices/system/node, in order; empty if there are none
+static void listNodes(std::vector<int>& nodes)
+{
+#ifdef __linux
+    DIR *dir = opendir(gNodeDirectory.c_str());
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+
+        if (name.compare(0, 4, "node") == 0 && name.length() > 4 && isdigit(name[4])) {
+            nodes.push_back(atoi(name.c_str() + 4));
+        }
+    }
+
+    closedir(dir);
+
+    sort(nodes.begin(), nodes.end());
+#endif
+}
+
+// CPUs this process may run on, in order
+static void listAllowedCpus(std::vector<int>& cpus)
+{
+#ifdef __linux
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+}
+
+// CPU quota of this process's cgroup (v2 cpu.max or v1 cfs quota and period); 0 if none
+static double cgroupCpuQuota()
+{
+#ifdef __linux
+    // cgroup v2: a single "0::<path>" line; the quota may be set on the cgroup or the root
+    string path;
+    ifstream cgroup("/proc/self/cgroup");
+    string line;
+    while (getline(cgroup, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            path = line.substr(3);
+        }
+    }
+
+    string files[] = {gCgroupDirectory + path + "/cpu.max", gCgroupDirectory + "/cpu.max"};
+    for (int k = 0; k < 2; k++) {
+        ifstream input(files[k].c_str());
+        if (getline(input, line)) {
+            return parseCpuMax(line);
+        }
+    }
+
+    // cgroup v1: quota is -1 if unlimited
+    ifstream quotaInput((gCgroupDirectory + "/cpu/cpu.cfs_quota_us").c_str());
+    ifstream periodInput((gCgroupDirectory + "/cpu/cpu.cfs_period_us").c_str());
+    double quota = 0;
+    double period = 0;
+    if (quotaInput >> quota && periodInput >> period && quota > 0 && period > 0) {
+        return quota / period;
+    }
+#endif
+
+    return 0;
+}
+
+// ========== Tests ================================================================================
+
+#if USE_THREADS && defined(__linux)
+// pin this thread as thread 0 of plan, check where it runs
+static void pinAndCheck(const AffinityPlan& plan, bool& onCpu)
+{
+    vector<int> cpus = plan.cpusFor(0);
+    onCpu = plan.pin(0) && find(cpus.begin(), cpus.end(), currentCpu()) != cpus.end();
+}
+#endif
+
+// component tests
+void ctest_affinity(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // NumaCounts::since
+    // NumaCounts::write
+
+    {
+        NumaCounts earlier;
+        earlier.hit = 100;
+
+        NumaCounts later;
+        later.hit = 190;
+        later.miss = 10;
+        later.local = 150;
+        later.other = 50;
+
+        ostringstream oss;
+        later.since(earlier).write(oss, "numa");
+        const string expected = "numa.hit\t90\nnuma.miss\t10\nnuma.local\t150\nnuma.other\t50\n"
+                                "numa.hitRate\t0.9\nnuma.localRate\t0.75\n";
+
+        if (oss.str() == expected) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // AffinityPlan::cpusFor
+
+    {
+        vector< vector<int> > nodeCpus(2);
+        nodeCpus[0].push_back(0);
+        nodeCpus[0].push_back(1);
+        nodeCpus[1].push_back(2);
+        nodeCpus[1].push_back(3);
+
+        AffinityPlan compact(AFFINITY_COMPACT, nodeCpus);
+        AffinityPlan scatter(AFFINITY_SCATTER, nodeCpus);
+        AffinityPlan numa(AFFINITY_NUMA, nodeCpus);
+        AffinityPlan none(AFFINITY_NONE, nodeCpus);
+
+        if (compact.cpusFor(1)[0] == 1 && compact.cpusFor(2)[0] == 2 &&
+            compact.cpusFor(5)[0] == 1 &&
+            scatter.cpusFor(1)[0] == 2 && scatter.cpusFor(2)[0] == 1 &&
+            numa.cpusFor(3) == nodeCpus[1] && none.cpusFor(0).empty() &&
+            numa.getNodeCount() == 2) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // AffinityPlan::pin
+
+#if USE_THREADS && defined(__linux)
+    {
+        // on another thread, so that this one is left alone
+        AffinityPlan plan(AFFINITY_COMPACT);
+        bool onCpu = false;
+
+        thread other(pinAndCheck, cref(plan), ref(onCpu));
+        other.join();
+
+        if (onCpu && plan.getNodeCount() >= 1) passed++; else failed++;
+    }
+#endif
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseAffinityPolicy
+    // affinityName
+
+    {
+        AffinityPolicy policy = AFFINITY_NONE;
+        bool valid = parseAffinityPolicy("scatter", policy);
+
+        if (valid && string(affinityName(policy)) == "scatter" &&
+            !parseAffinityPolicy("tight", policy)) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // availableCpus
+    // parseCpuMax
+
+    {
+        int cpus = availableCpus();
+
+        if (cpus >= 1 && parseCpuMax("150000 100000\n") == 1.5 && parseCpuMax("max 100000") == 0 &&
+            parseCpuMax("") == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseCpuList
+
+    {
+        vector<int> cpus;
+        parseCpuList("0-3,8,10-11\n", cpus);
+
+        if (cpus.size() == 7 && cpus[3] == 3 && cpus[4] == 8 && cpus[6] == 11) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "affinity.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_affinity(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // AffinityPlan::pin
+
+    {
+        AffinityPlan plan(AFFINITY_NONE);
+        plan.pin(0);
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // affinityName
+
+    affinityName((AffinityPolicy)-1);
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // sampleNumaCounts
+
+    {
+        NumaCounts counts;
+        bool sampled = sampleNumaCounts(counts);
+
+        if (verbose) {
+            cerr << "NUMA counters " << (sampled ? "available" : "not available") << endl;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+//
+//  affinity.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Placement of worker threads on CPUs and NUMA nodes, and NUMA allocation counters. Only Linux is
+// supported; elsewhere threads are left where the scheduler puts them.
+//
+
+#ifndef parallelCalc_affinity_h
+#define parallelCalc_affinity_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ========== Constants ============================================================================
+
+enum AffinityPolicy {
+    AFFINITY_NONE,          // leave threads to the scheduler
+    AFFINITY_COMPACT,       // thread k on the k-th CPU, filling one node before the next
+    AFFINITY_SCATTER,       // thread k on a CPU of node k % nodes, spreading over nodes
+    AFFINITY_NUMA           // thread k on any CPU of node k % nodes
+};
+
+// ========== Structures ===========================================================================
+
+// system-wide NUMA allocation counters summed over nodes, from
+// /sys/devices/system/node/node<n>/numastat; counts are pages
+struct NumaCounts {
+    long long hit;          // allocated on the intended node
+    long long miss;         // intended for another node but allocated here
+    long long local;        // allocated here by a process running here
+    long long other;        // allocated here by a process running on another node
+
+    // all zero
+    NumaCounts();
+
+    // this minus earlier
+    NumaCounts since(const NumaCounts& earlier) const;
+
+    // write key/value lines <prefix>.hit, .miss, .local, .other, and .hitRate and .localRate if
+    // there were any allocations
+    void write(std::ostream& output, const std::string& prefix) const;
+};
+
+// ========== Class Declarations ===================================================================
+
+// which CPUs each worker thread may run on, worked out once from the CPUs this process may use
+// and the NUMA nodes they belong to
+class AffinityPlan {
+public:
+    AffinityPlan(AffinityPolicy policy);
+
+    // with the given CPUs by node, instead of those available to this process
+    AffinityPlan(AffinityPolicy policy, const std::vector< std::vector<int> >& nodeCpus);
+
+    AffinityPolicy getPolicy() const { return policy; };
+
+    // number of NUMA nodes with CPUs available to this process; 1 if unknown, 0 with AFFINITY_NONE
+    int getNodeCount() const { return (int)nodeCpus.size(); };
+
+    // CPUs for thread k; empty if the thread is not to be pinned
+    std::vector<int> cpusFor(int threadIndex) const;
+
+    // restrict the calling thread to the CPUs for thread k; returns false if not pinned
+    bool pin(int threadIndex) const;
+
+protected:
+    AffinityPolicy policy;
+    std::vector< std::vector<int> > nodeCpus;   // available CPUs, by node
+};
+
+// ========== Function Headers =====================================================================
+
+// parse compact, scatter, numa or none; returns false if not recognized
+bool parseAffinityPolicy(const std::string& str, AffinityPolicy& policy);
+
+// name of policy, as accepted by parseAffinityPolicy
+const char *affinityName(AffinityPolicy policy);
+
+// CPU the calling thread is running on; -1 if unknown
+int currentCpu();
+
+// number of CPUs this process can keep busy: those in its affinity mask, limited by any cgroup
+// CPU quota (rounded up); at least 1
+int availableCpus();
+
+// parse a cgroup v2 cpu.max line such as "200000 100000" as CPUs (2); 0 for "max" or unparseable
+double parseCpuMax(const std::string& str);
+
+// parse a /sys cpulist such as "0-3,8-11"
+void parseCpuList(const std::string& str, std::vector<int>& cpus);
+
+// sum counters over nodes; returns false if there are no NUMA counters
+bool sampleNumaCounts(NumaCounts& counts);
+
+// component tests
+void ctest_affinity(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_affinity(bool verbose);
+
+#endif
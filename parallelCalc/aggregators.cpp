@@ -0,0 +1,383 @@
+//
+//  aggregators.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Standard reduce aggregates (sum, count, min, max, mean, variance) with partial state that can be
+// merged, so that an aggregate can be computed in parts on several threads or used as a combiner.
+// Integer sums are kept to 128 bits, so they cannot overflow. Batch updates are written as simple
+// loops over arrays, without branches or carries, so that compilers can vectorize them. Distinct
+// counts and quantiles are estimated from sketches of bounded size (sketches.h).
+//
+
+#include "aggregators.h"
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// ========== Classes ==============================================================================
+
+// zero
+WideSum::WideSum() :
+low(0),
+high(0)
+{
+}
+
+void WideSum::addUnsigned(unsigned long long value)
+{
+    low += value;
+
+    // carry
+    if (low < value) {
+        high++;
+    }
+}
+
+void WideSum::addSigned(long long value)
+{
+    addUnsigned((unsigned long long)value);
+
+    // a negative value read as unsigned is 2^64 too large
+    if (value < 0) {
+        high--;
+    }
+}
+
+void WideSum::add(const WideSum& other)
+{
+    addUnsigned(other.low);
+    high += other.high;
+}
+
+// add value * 2^32
+void WideSum::addShifted32(unsigned long long value)
+{
+    addUnsigned(value << 32);
+    high += (long long)(value >> 32);
+}
+
+// whether the sum fits in 64 bits, signed or unsigned
+bool WideSum::fitsSigned() const
+{
+    // high is all copies of the sign bit of low
+    return high == ((low >> 63) != 0 ? -1 : 0);
+}
+
+bool WideSum::fitsUnsigned() const
+{
+    return high == 0;
+}
+
+double WideSum::toDouble() const
+{
+    const double TWO_TO_64 = 18446744073709551616.0;
+
+    // small negative sums would otherwise be lost in rounding low to double
+    if (fitsSigned()) {
+        return (double)(long long)low;
+    }
+
+    return high * TWO_TO_64 + low;
+}
+
+// ========== Functions ============================================================================
+
+// whether results of an aggregate over parts of the values can be combined into the result over
+// all of them, without the partial state (true for sum, count, min and max)
+bool isCombinable(AggregateKind kind)
+{
+    return kind == AGGREGATE_SUM || kind == AGGREGATE_COUNT || kind == AGGREGATE_MIN ||
+           kind == AGGREGATE_MAX;
+}
+
+// name of kind, such as "sum"
+const char *aggregateName(AggregateKind kind)
+{
+    switch (kind) {
+        case AGGREGATE_NONE:        return "none";
+        case AGGREGATE_SUM:         return "sum";
+        case AGGREGATE_COUNT:       return "count";
+        case AGGREGATE_MIN:         return "min";
+        case AGGREGATE_MAX:         return "max";
+        case AGGREGATE_MEAN:        return "mean";
+        case AGGREGATE_VARIANCE:    return "variance";
+        case AGGREGATE_DISTINCT:    return "distinct";
+        case AGGREGATE_QUANTILE:    return "quantile";
+        default:                    return "unknown";
+    }
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_aggregators(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // WideSum
+
+    {
+        const unsigned long long MAX = numeric_limits<unsigned long long>::max();
+
+        WideSum big;
+        big.addUnsigned(MAX);
+        big.addUnsigned(MAX);
+
+        WideSum minusOne;
+        minusOne.addSigned(-1);
+
+        WideSum shifted;
+        shifted.addShifted32(1ULL << 40);
+
+        if (big.high == 1 && big.low == MAX - 1 && !big.fitsUnsigned() && !big.fitsSigned() &&
+            fabs(big.toDouble() - 2 * (double)MAX) < 1e5 &&
+            minusOne.fitsSigned() && !minusOne.fitsUnsigned() && minusOne.toDouble() == -1 &&
+            shifted.high == 256 && shifted.low == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // addBatchToSum
+
+    {
+        // would overflow a plain 64-bit sum
+        const unsigned long long MAX = numeric_limits<unsigned long long>::max();
+        vector<unsigned long long> values(3, MAX);
+
+        WideSum sum;
+        addBatchToSum(sum, &values[0], values.size());
+
+        const long long signedValues[] = {-5, 3, -1};
+        WideSum signedSum;
+        addBatchToSum(signedSum, signedValues, 3);
+
+        const double doubles[] = {0.5, 1.5, 2.5, 3.5, 4.5};
+        double doubleSum = 0;
+        addBatchToSum(doubleSum, doubles, 5);
+
+        if (sum.high == 2 && sum.low == MAX - 2 && signedSum.fitsSigned() &&
+            (long long)signedSum.low == -3 && doubleSum == 12.5) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Aggregator::updateBatch
+    // Aggregator::result
+
+    {
+        const unsigned long values[] = {4, 1, 7, 3};
+
+        Aggregator<unsigned long> sum(AGGREGATE_SUM);
+        Aggregator<unsigned long> count(AGGREGATE_COUNT);
+        Aggregator<unsigned long> minimum(AGGREGATE_MIN);
+        Aggregator<unsigned long> maximum(AGGREGATE_MAX);
+        Aggregator<unsigned long> mean(AGGREGATE_MEAN);
+        Aggregator<unsigned long> empty(AGGREGATE_MIN);
+
+        sum.updateBatch(values, 4);
+        count.updateBatch(values, 4);
+        minimum.updateBatch(values, 4);
+        maximum.updateBatch(values, 4);
+        mean.updateBatch(values, 4);
+
+        if (sum.result() == 15 && count.result() == 4 && minimum.result() == 1 &&
+            maximum.result() == 7 && mean.getMean() == 3.75 && mean.result() == 3 &&
+            empty.result() == 0) passed++; else failed++;
+    }
+
+    {
+        // one value at a time is the same as a batch
+        const long long values[] = {-2, 9, 4, -7, 0};
+
+        Aggregator<long long> batch(AGGREGATE_MIN);
+        batch.updateBatch(values, 5);
+
+        Aggregator<long long> single(AGGREGATE_MIN);
+        for (int k = 0; k < 5; k++) {
+            single.update(values[k]);
+        }
+
+        if (batch.result() == -7 && single.result() == -7 && single.getCount() == 5) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Aggregator::merge
+
+    {
+        // variance of 1..10 is 8.25, whether all at once or merged from parts
+        vector<double> values;
+        for (int k = 1; k <= 10; k++) {
+            values.push_back(k);
+        }
+
+        Aggregator<double> whole(AGGREGATE_VARIANCE);
+        whole.updateBatch(&values[0], values.size());
+
+        Aggregator<double> first(AGGREGATE_VARIANCE);
+        first.updateBatch(&values[0], 3);
+
+        Aggregator<double> second(AGGREGATE_VARIANCE);
+        for (size_t k = 3; k < values.size(); k++) {
+            second.update(values[k]);
+        }
+
+        first.merge(second);
+
+        Aggregator<int> sum(AGGREGATE_SUM);
+        sum.update(5);
+        Aggregator<int> otherSum(AGGREGATE_SUM);
+        otherSum.update(6);
+        sum.merge(otherSum);
+
+        Aggregator<int> empty(AGGREGATE_MAX);
+        Aggregator<int> maximum(AGGREGATE_MAX);
+        maximum.update(-3);
+        empty.merge(maximum);
+
+        if (fabs(whole.getVariance() - 8.25) < 1e-9 && fabs(first.getVariance() - 8.25) < 1e-9 &&
+            fabs(first.getMean() - 5.5) < 1e-9 && first.getCount() == 10 && sum.result() == 11 &&
+            empty.result() == -3) passed++; else failed++;
+    }
+
+    {
+        // distinct count of 1..1000 each added twice, and quantiles of 1..1000, from sketches
+        // merged from parts
+        SketchOptions sketch;
+        sketch.quantile = 0.9;
+
+        Aggregator<unsigned long> distinct(AGGREGATE_DISTINCT);
+        Aggregator<unsigned long> otherDistinct(AGGREGATE_DISTINCT);
+        Aggregator<unsigned long> median(AGGREGATE_QUANTILE);
+        Aggregator<unsigned long> otherMedian(AGGREGATE_QUANTILE);
+        Aggregator<unsigned long> percentile(AGGREGATE_QUANTILE, sketch);
+
+        for (unsigned long value = 1; value <= 1000; value++) {
+            distinct.update(value);
+            otherDistinct.update(value);
+            (value % 2 == 0 ? median : otherMedian).update(value);
+            percentile.update(value);
+        }
+
+        distinct.merge(otherDistinct);
+        median.merge(otherMedian);
+
+        if (distinct.getCount() == 2000 && distinct.result() >= 990 && distinct.result() <= 1010 &&
+            median.result() >= 495 && median.result() <= 505 && percentile.result() >= 895 &&
+            percentile.result() <= 905) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Aggregator::write
+    // Aggregator::read
+
+    {
+        // each kind's state read back merges as the original would
+        const AggregateKind kinds[] = {AGGREGATE_SUM, AGGREGATE_COUNT, AGGREGATE_MIN,
+                                       AGGREGATE_MAX, AGGREGATE_MEAN, AGGREGATE_VARIANCE,
+                                       AGGREGATE_DISTINCT, AGGREGATE_QUANTILE};
+
+        int matched = 0;
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+            Aggregator<unsigned long> first(kinds[k]);
+            Aggregator<unsigned long> second(kinds[k]);
+            Aggregator<unsigned long> whole(kinds[k]);
+
+            for (unsigned long value = 1; value <= 100; value++) {
+                (value <= 40 ? first : second).update(value * value);
+                whole.update(value * value);
+            }
+
+            ostringstream oss;
+            first.write(oss);
+
+            Aggregator<unsigned long> readBack(kinds[k]);
+            istringstream iss(oss.str());
+            if (readBack.read(iss) && oss.str().find('\n') == string::npos) {
+                readBack.merge(second);
+                matched += readBack.result() == whole.result() ? 1 : 0;
+            }
+        }
+
+        // the empty state, and states of another kind or sketch bound
+        Aggregator<double> empty(AGGREGATE_VARIANCE);
+        ostringstream emptyOss;
+        empty.write(emptyOss);
+        istringstream emptyIss(emptyOss.str());
+
+        Aggregator<double> readEmpty(AGGREGATE_VARIANCE);
+        bool emptyValid = readEmpty.read(emptyIss) && readEmpty.getCount() == 0;
+
+        istringstream otherKind("sum 1 4 0");
+        Aggregator<double> maximum(AGGREGATE_MAX);
+
+        SketchOptions coarse;
+        coarse.relativeError = 0.05;
+        Aggregator<unsigned long> distinct(AGGREGATE_DISTINCT);
+        distinct.update(7);
+        ostringstream distinctOss;
+        distinct.write(distinctOss);
+        istringstream distinctIss(distinctOss.str());
+        Aggregator<unsigned long> coarseDistinct(AGGREGATE_DISTINCT, coarse);
+
+        if (matched == 8 && emptyValid && !maximum.read(otherKind) &&
+            !coarseDistinct.read(distinctIss)) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // isCombinable
+    // combineResults
+    // aggregateName
+
+    {
+        if (isCombinable(AGGREGATE_MAX) && !isCombinable(AGGREGATE_MEAN) &&
+            combineResults(AGGREGATE_SUM, 2, 3) == 5 && combineResults(AGGREGATE_MIN, 2, 3) == 2 &&
+            string(aggregateName(AGGREGATE_VARIANCE)) == "variance") passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "aggregators.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_aggregators(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // aggregateName
+
+    aggregateName((AggregateKind)-1);
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Aggregator::updateBatch
+
+    {
+        // more than one block
+        vector<unsigned long long> values((1 << 20) + 3, 1ULL << 40);
+
+        Aggregator<unsigned long long> sum(AGGREGATE_SUM);
+        sum.updateBatch(&values[0], values.size());
+
+        if (verbose) {
+            cerr << "sum of " << values.size() << " values " << sum.getSum().toDouble() << endl;
+        }
+    }
+}
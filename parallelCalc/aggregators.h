@@ -0,0 +1,483 @@
+//
+//  aggregators.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Standard reduce aggregates (sum, count, min, max, mean, variance) with partial state that can be
+// merged, so that an aggregate can be computed in parts on several threads or used as a combiner.
+// Integer sums are kept to 128 bits, so they cannot overflow. Batch updates are written as simple
+// loops over arrays, without branches or carries, so that compilers can vectorize them. Distinct
+// counts and quantiles are estimated from sketches of bounded size (sketches.h). The partial state
+// can be written as one line of text and read back.
+//
+
+#ifndef parallelCalc_aggregators_h
+#define parallelCalc_aggregators_h
+
+#include "shim.h"
+
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "sketches.h"
+
+// ========== Constants ============================================================================
+
+enum AggregateKind {
+    AGGREGATE_NONE,         // no standard aggregate; reduce is written by hand
+    AGGREGATE_SUM,
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_MEAN,
+    AGGREGATE_VARIANCE,     // population variance
+    AGGREGATE_DISTINCT,     // count of distinct values, estimated by HyperLogLog
+    AGGREGATE_QUANTILE      // value at a quantile, estimated by t-digest
+};
+
+// ========== Structures ===========================================================================
+
+// error bound of the sketch kept by a distinct or quantile aggregate, and the quantile it computes
+struct SketchOptions {
+    double relativeError;   // standard error of a distinct count, or rank error of a quantile
+    double quantile;        // 0.5 for the median
+
+    // 1% error; the median
+    SketchOptions() : relativeError(0.01), quantile(0.5) {};
+};
+
+// 128-bit two's complement integer, for sums of 64-bit values that cannot overflow
+struct WideSum {
+    unsigned long long low;
+    long long high;
+
+    // zero
+    WideSum();
+
+    void addUnsigned(unsigned long long value);
+    void addSigned(long long value);
+    void add(const WideSum& other);
+
+    // add value * 2^32
+    void addShifted32(unsigned long long value);
+
+    // whether the sum fits in 64 bits, signed or unsigned
+    bool fitsSigned() const;
+    bool fitsUnsigned() const;
+
+    double toDouble() const;
+};
+
+// ========== Function Headers =====================================================================
+
+// whether results of an aggregate over parts of the values can be combined into the result over
+// all of them, without the partial state (true for sum, count, min and max)
+bool isCombinable(AggregateKind kind);
+
+// name of kind, such as "sum"
+const char *aggregateName(AggregateKind kind);
+
+// component tests
+void ctest_aggregators(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_aggregators(bool verbose);
+
+// ========== Function Templates ===================================================================
+
+// add values[0..n) to a sum, for integer values; the low and high 32-bit halves are summed in
+// separate 64-bit lanes, which can't overflow for blocks of fewer than 2^32 values
+template <typename T> void addBatchToSum(WideSum& sum, const T *values, size_t n);
+
+template <typename T> void addBatchToSum(WideSum& sum, const T *values, size_t n)
+{
+    const size_t BLOCK_SIZE = 1 << 20;
+
+    for (size_t begin = 0; begin < n; begin += BLOCK_SIZE) {
+        size_t end = n - begin < BLOCK_SIZE ? n : begin + BLOCK_SIZE;
+
+        unsigned long long lowHalves = 0;
+        unsigned long long highHalves = 0;
+        unsigned long long negatives = 0;
+
+        for (size_t k = begin; k < end; k++) {
+            unsigned long long value = (unsigned long long)values[k];
+            lowHalves += value & 0xffffffffULL;
+            highHalves += value >> 32;
+            negatives += values[k] < 0 ? 1 : 0;
+        }
+
+        sum.addUnsigned(lowHalves);
+        sum.addShifted32(highHalves);
+
+        // a negative value read as unsigned is 2^64 too large
+        sum.high -= (long long)negatives;
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// as above, for floating-point values; four running sums, so that the additions are independent
+template <typename T> void addBatchToSum(double& sum, const T *values, size_t n);
+
+template <typename T> void addBatchToSum(double& sum, const T *values, size_t n)
+{
+    double sums[4] = {0, 0, 0, 0};
+
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        sums[0] += values[k];
+        sums[1] += values[k + 1];
+        sums[2] += values[k + 2];
+        sums[3] += values[k + 3];
+    }
+
+    for (; k < n; k++) {
+        sums[0] += values[k];
+    }
+
+    sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// sum type for values of type T: WideSum for integers, double otherwise
+template <typename T, bool isInteger = std::numeric_limits<T>::is_integer> struct SumOf {
+    typedef double Type;
+
+    static void add(double& sum, double other) { sum += other; };
+    static double toDouble(double sum) { return sum; };
+    static T toValue(double sum) { return (T)sum; };
+
+    static void write(std::ostream& output, double sum) { output << sum; };
+    static bool read(std::istream& input, double& sum) { return !(input >> sum).fail(); };
+};
+
+template <typename T> struct SumOf<T, true> {
+    typedef WideSum Type;
+
+    static void add(WideSum& sum, const WideSum& other) { sum.add(other); };
+    static double toDouble(const WideSum& sum) { return sum.toDouble(); };
+
+    // modulo 2^64, as for a plain integer sum
+    static T toValue(const WideSum& sum) { return (T)sum.low; };
+
+    static void write(std::ostream& output, const WideSum& sum)
+        { output << sum.low << " " << sum.high; };
+    static bool read(std::istream& input, WideSum& sum)
+        { return !(input >> sum.low >> sum.high).fail(); };
+};
+
+// ========== Class Templates ======================================================================
+
+// partial state of an aggregate of values of type T; only what the kind needs is kept
+template <typename T> class Aggregator {
+public:
+    // sketch is used only by distinct and quantile aggregates
+    Aggregator(AggregateKind kind, const SketchOptions& sketch = SketchOptions());
+
+    AggregateKind getKind() const { return kind; };
+
+    void update(T value);
+
+    // update with values[0..n)
+    void updateBatch(const T *values, size_t n);
+
+    // add the state of another aggregator of the same kind, as if its values had been added
+    void merge(const Aggregator<T>& other);
+
+    // write the state as one line of text, without the newline; read returns false if the line is
+    // malformed, or is for another kind or sketch bound
+    void write(std::ostream& output) const;
+    bool read(std::istream& input);
+
+    long long getCount() const { return count; };
+    const typename SumOf<T>::Type& getSum() const { return sum; };
+    T getMin() const { return minValue; };
+    T getMax() const { return maxValue; };
+    double getMean() const;
+    double getVariance() const;
+    const HyperLogLog& getDistinct() const { return distinct; };
+    const TDigest& getDigest() const { return digest; };
+
+    // the aggregate as a T: the sum modulo 2^64 for integers, and the mean, variance, distinct
+    // count or quantile truncated; 0 if there are no values
+    T result() const;
+
+protected:
+    AggregateKind kind;
+    long long count;
+    typename SumOf<T>::Type sum;    // for sum and mean
+    T minValue;
+    T maxValue;
+    double mean;                    // for variance, with m2
+    double m2;                      // sum of squared differences from mean
+    double quantile;                // for quantile, with digest
+    HyperLogLog distinct;           // for distinct; allocated by its first value
+    TDigest digest;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// sketch is used only by distinct and quantile aggregates
+template <typename T> Aggregator<T>::Aggregator(AggregateKind kind, const SketchOptions& sketch) :
+kind(kind),
+count(0),
+sum(),
+minValue(),
+maxValue(),
+mean(0),
+m2(0),
+quantile(sketch.quantile),
+distinct(sketch.relativeError),
+digest(sketch.relativeError)
+{
+}
+
+template <typename T> void Aggregator<T>::update(T value)
+{
+    updateBatch(&value, 1);
+}
+
+template <typename T> void Aggregator<T>::updateBatch(const T *values, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+
+    if (kind == AGGREGATE_SUM || kind == AGGREGATE_MEAN) {
+        addBatchToSum(sum, values, n);
+    }
+
+    if (kind == AGGREGATE_MIN) {
+        T batchMin = values[0];
+        for (size_t k = 1; k < n; k++) {
+            batchMin = values[k] < batchMin ? values[k] : batchMin;
+        }
+
+        minValue = count == 0 || batchMin < minValue ? batchMin : minValue;
+    }
+
+    if (kind == AGGREGATE_MAX) {
+        T batchMax = values[0];
+        for (size_t k = 1; k < n; k++) {
+            batchMax = values[k] > batchMax ? values[k] : batchMax;
+        }
+
+        maxValue = count == 0 || batchMax > maxValue ? batchMax : maxValue;
+    }
+
+    if (kind == AGGREGATE_DISTINCT) {
+        for (size_t k = 0; k < n; k++) {
+            distinct.add(sketchHash(values[k]));
+        }
+    }
+
+    if (kind == AGGREGATE_QUANTILE) {
+        for (size_t k = 0; k < n; k++) {
+            digest.add((double)values[k]);
+        }
+    }
+
+    if (kind == AGGREGATE_VARIANCE) {
+        // mean and squared differences of the batch in two passes, then merged
+        double batchSum = 0;
+        addBatchToSum(batchSum, values, n);
+        double batchMean = batchSum / n;
+
+        double batchM2 = 0;
+        for (size_t k = 0; k < n; k++) {
+            double difference = values[k] - batchMean;
+            batchM2 += difference * difference;
+        }
+
+        Aggregator<T> batch(kind);
+        batch.count = (long long)n;
+        batch.mean = batchMean;
+        batch.m2 = batchM2;
+        merge(batch);
+        return;
+    }
+
+    count += (long long)n;
+}
+
+// add the state of another aggregator of the same kind, as if its values had been added
+template <typename T> void Aggregator<T>::merge(const Aggregator<T>& other)
+{
+    if (other.count == 0) {
+        return;
+    }
+
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+
+    if (kind == AGGREGATE_SUM || kind == AGGREGATE_MEAN) {
+        SumOf<T>::add(sum, other.sum);
+    }
+
+    if (kind == AGGREGATE_MIN && other.minValue < minValue) {
+        minValue = other.minValue;
+    }
+
+    if (kind == AGGREGATE_MAX && other.maxValue > maxValue) {
+        maxValue = other.maxValue;
+    }
+
+    if (kind == AGGREGATE_VARIANCE) {
+        // Chan et al.'s formula for combining variances of two sets
+        double total = (double)(count + other.count);
+        double delta = other.mean - mean;
+        m2 += other.m2 + delta * delta * count * other.count / total;
+        mean += delta * other.count / total;
+    }
+
+    if (kind == AGGREGATE_DISTINCT) {
+        distinct.merge(other.distinct);
+    }
+
+    if (kind == AGGREGATE_QUANTILE) {
+        digest.merge(other.digest);
+    }
+
+    count += other.count;
+}
+
+// write the state as one line of text, without the newline: the kind's name, the count, then what
+// the kind keeps
+template <typename T> void Aggregator<T>::write(std::ostream& output) const
+{
+    std::streamsize precision = output.precision(17);
+
+    output << aggregateName(kind) << " " << count;
+
+    if (kind == AGGREGATE_SUM || kind == AGGREGATE_MEAN) {
+        output << " ";
+        SumOf<T>::write(output, sum);
+    }
+
+    if (kind == AGGREGATE_MIN) {
+        output << " " << minValue;
+    }
+
+    if (kind == AGGREGATE_MAX) {
+        output << " " << maxValue;
+    }
+
+    if (kind == AGGREGATE_VARIANCE) {
+        output << " " << mean << " " << m2;
+    }
+
+    if (kind == AGGREGATE_DISTINCT) {
+        output << " ";
+        distinct.write(output);
+    }
+
+    if (kind == AGGREGATE_QUANTILE) {
+        output << " ";
+        digest.write(output);
+    }
+
+    output.precision(precision);
+}
+
+// read a state written by write; false if the line is malformed, or is for another kind or sketch
+// bound
+template <typename T> bool Aggregator<T>::read(std::istream& input)
+{
+    std::string name;
+    input >> name >> count;
+    if (input.fail() || name != aggregateName(kind) || count < 0) {
+        return false;
+    }
+
+    bool valid = true;
+
+    if (kind == AGGREGATE_SUM || kind == AGGREGATE_MEAN) {
+        valid = SumOf<T>::read(input, sum);
+    }
+
+    if (kind == AGGREGATE_MIN) {
+        valid = !(input >> minValue).fail();
+    }
+
+    if (kind == AGGREGATE_MAX) {
+        valid = !(input >> maxValue).fail();
+    }
+
+    if (kind == AGGREGATE_VARIANCE) {
+        valid = !(input >> mean >> m2).fail();
+    }
+
+    if (kind == AGGREGATE_DISTINCT) {
+        valid = distinct.read(input);
+    }
+
+    if (kind == AGGREGATE_QUANTILE) {
+        valid = digest.read(input);
+    }
+
+    return valid;
+}
+
+template <typename T> double Aggregator<T>::getMean() const
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    return kind == AGGREGATE_VARIANCE ? mean : SumOf<T>::toDouble(sum) / count;
+}
+
+template <typename T> double Aggregator<T>::getVariance() const
+{
+    return count == 0 ? 0 : m2 / count;
+}
+
+// the aggregate as a T: the sum modulo 2^64 for integers, and the mean, variance, distinct count or
+// quantile truncated; 0 if there are no values
+template <typename T> T Aggregator<T>::result() const
+{
+    if (count == 0) {
+        return T();
+    }
+
+    switch (kind) {
+        case AGGREGATE_SUM:         return SumOf<T>::toValue(sum);
+        case AGGREGATE_COUNT:       return (T)count;
+        case AGGREGATE_MIN:         return minValue;
+        case AGGREGATE_MAX:         return maxValue;
+        case AGGREGATE_MEAN:        return (T)getMean();
+        case AGGREGATE_VARIANCE:    return (T)getVariance();
+        case AGGREGATE_DISTINCT:    return (T)(distinct.estimate() + 0.5);
+        case AGGREGATE_QUANTILE:    return (T)digest.quantile(quantile);
+        default:                    return T();
+    }
+}
+
+// ========== Function Templates ===================================================================
+
+// combine results of a combinable aggregate over two parts of the values
+template <typename T> T combineResults(AggregateKind kind, T result1, T result2);
+
+template <typename T> T combineResults(AggregateKind kind, T result1, T result2)
+{
+    switch (kind) {
+        case AGGREGATE_MIN:     return result2 < result1 ? result2 : result1;
+        case AGGREGATE_MAX:     return result2 > result1 ? result2 : result1;
+        default:                return result1 + result2;
+    }
+}
+
+#endif
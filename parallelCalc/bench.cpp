@@ -0,0 +1,498 @@
+//
+//  bench.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Benchmark sweep over row counts, thread counts and execution modes, reporting throughput,
+// median and 95th percentile wall time, speedup and parallel efficiency as CSV or JSON
+//
+
+#include "bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+#if USE_THREADS
+#include <thread>
+#endif
+
+#include "ringQueues.h"
+#include "sumSquare.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Classes ==============================================================================
+
+// default sweep
+BenchOptions::BenchOptions() :
+warmup(1),
+reps(5),
+json(false)
+{
+    rowCounts.push_back(10);
+    rowCounts.push_back(100);
+    rowCounts.push_back(1000);
+
+    modes.push_back("workers");
+    modes.push_back("direct");
+
+#if USE_THREADS
+    modes.push_back("threads");
+
+    // powers of two up to the number of hardware threads
+    int maxThreads = (int)thread::hardware_concurrency();
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+
+    for (int nthreads = 1; nthreads <= maxThreads; nthreads *= 2) {
+        threadCounts.push_back(nthreads);
+    }
+#endif
+
+    modes.push_back("fork");
+}
+
+// ========== Functions ============================================================================
+
+// run the sweep, write one CSV row or JSON object per result to output; returns 0 if every run
+// succeeded
+int bench(Calc& calc, const BenchOptions& options, std::ostream& output)
+{
+    int result = 0;
+
+    vector<BenchResult> results;
+
+    for (size_t r = 0; r < options.rowCounts.size(); r++) {
+        int nrows = options.rowCounts[r];
+
+        for (size_t m = 0; m < options.modes.size(); m++) {
+            const string& mode = options.modes[m];
+
+            // only modes that use threads are swept over thread counts
+            vector<int> threadCounts;
+            if (mode == "threads" || mode == "mpsc" || mode == "locked") {
+                threadCounts = options.threadCounts;
+
+            } else {
+                threadCounts.push_back(1);
+            }
+
+            for (size_t t = 0; t < threadCounts.size(); t++) {
+                BenchResult one = benchOne(calc, mode, nrows, threadCounts[t], options.warmup,
+                                           options.reps);
+                if (one.status != 0) {
+                    result = 1;
+                }
+
+                if (calc.isVerbose()) {
+                    cerr << mode << " " << nrows << " rows " << threadCounts[t] << " threads: ";
+                    cerr << one.medianMsec << " msec" << endl;
+                }
+
+                results.push_back(one);
+            }
+        }
+    }
+
+    benchSpeedup(results);
+    writeBenchResults(output, results, options.json);
+
+    return result;
+}
+
+// time one mode, row count and thread count
+BenchResult benchOne(Calc& calc, const std::string& mode, int nrows, int nthreads, int warmup,
+                     int reps)
+{
+    BenchResult result;
+    result.mode = mode;
+    result.nrows = nrows;
+    result.nthreads = nthreads;
+    result.status = 0;
+
+    for (int k = 0; k < warmup + reps && result.status == 0; k++) {
+        // results are discarded, but still formatted, as they would be in a real run
+        ostringstream oss;
+
+        long long startTime = nanosecondClock();
+
+        if (mode == "workers") {
+            result.status = calc.singleThreadWorkers(nrows, oss);
+
+        } else if (mode == "direct") {
+            result.status = calc.singleThreadDirect(nrows, oss);
+
+        } else if (mode == "threads") {
+            result.status = calc.multiThread(nrows, nthreads, oss);
+
+        } else if (mode == "fork") {
+            result.status = calc.forkWorkers(nrows, oss);
+
+#if USE_THREADS
+        } else if (mode == "spsc" || mode == "mpsc" || mode == "locked") {
+            result.status = benchQueue(mode, nrows, nthreads);
+#endif
+
+        } else {
+            RUNTIME_ERROR_IF(true, "unknown benchmark mode " + mode);
+        }
+
+        long long endTime = nanosecondClock();
+
+        if (k >= warmup) {
+            result.msec.push_back(0.000001 * (endTime - startTime));
+        }
+    }
+
+    result.medianMsec = percentile(result.msec, 50);
+    result.p95Msec = percentile(result.msec, 95);
+    result.rowsPerSecond = result.medianMsec > 0 ? 1000.0 * nrows / result.medianMsec : 0;
+    result.speedup = 0;
+    result.efficiency = 0;
+
+    return result;
+}
+
+// fill in speedup and efficiency relative to the "direct" result with the same row count, or for a
+// queue, speedup relative to the "locked" result with the same row and thread counts
+void benchSpeedup(std::vector<BenchResult>& results)
+{
+    for (size_t k = 0; k < results.size(); k++) {
+        const string& mode = results[k].mode;
+        bool queue = mode == "spsc" || mode == "mpsc" || mode == "locked";
+
+        for (size_t j = 0; j < results.size(); j++) {
+            if (results[j].mode == (queue ? "locked" : "direct") &&
+                results[j].nrows == results[k].nrows &&
+                (!queue || results[j].nthreads == results[k].nthreads) &&
+                results[k].medianMsec > 0) {
+
+                results[k].speedup = results[j].medianMsec / results[k].medianMsec;
+                results[k].efficiency = queue ? 0 : results[k].speedup / results[k].nthreads;
+            }
+        }
+    }
+}
+
+// write results as CSV with a header line, or as a JSON array
+void writeBenchResults(std::ostream& output, const std::vector<BenchResult>& results, bool json)
+{
+    ios::fmtflags flags = output.flags();
+    output << fixed << setprecision(3);
+
+    if (json) {
+        output << "[" << endl;
+
+        for (size_t k = 0; k < results.size(); k++) {
+            const BenchResult& r = results[k];
+
+            output << "  {\"mode\": \"" << r.mode << "\", \"nrows\": " << r.nrows;
+            output << ", \"threads\": " << r.nthreads << ", \"status\": " << r.status;
+            output << ", \"reps\": " << r.msec.size();
+            output << ", \"median_msec\": " << r.medianMsec << ", \"p95_msec\": " << r.p95Msec;
+            output << ", \"rows_per_sec\": " << r.rowsPerSecond;
+            output << ", \"speedup\": " << r.speedup << ", \"efficiency\": " << r.efficiency;
+            output << "}" << (k + 1 < results.size() ? "," : "") << endl;
+        }
+
+        output << "]" << endl;
+
+    } else {
+        output << "mode,nrows,threads,status,reps,median_msec,p95_msec,rows_per_sec,speedup,";
+        output << "efficiency" << endl;
+
+        for (size_t k = 0; k < results.size(); k++) {
+            const BenchResult& r = results[k];
+
+            output << r.mode << "," << r.nrows << "," << r.nthreads << "," << r.status << ",";
+            output << r.msec.size() << "," << r.medianMsec << "," << r.p95Msec << ",";
+            output << r.rowsPerSecond << "," << r.speedup << "," << r.efficiency << endl;
+        }
+    }
+
+    output.flags(flags);
+}
+
+// nearest-rank percentile (0 < p <= 100) of values; 0 if values is empty
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    sort(values.begin(), values.end());
+
+    int rank = (int)ceil(p / 100 * values.size());
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    return values[rank - 1];
+}
+
+// parse comma-separated list of integers; returns false if any item is not an integer
+bool parseIntList(const std::string& str, std::vector<int>& values)
+{
+    vector<string> items;
+    parseStringList(str, items);
+
+    bool valid = !items.empty();
+
+    for (size_t k = 0; k < items.size() && valid; k++) {
+        valid = isNumeric(items[k]) && items[k].find('.') == string::npos;
+
+        if (valid) {
+            values.push_back((int)toLong(items[k]));
+        }
+    }
+
+    return valid;
+}
+
+// parse comma-separated list of strings
+void parseStringList(const std::string& str, std::vector<std::string>& values)
+{
+    istringstream iss(str);
+    string item;
+    while (getline(iss, item, ',')) {
+        values.push_back(item);
+    }
+}
+
+// ========== Tests ================================================================================
+
+// SumSquare whose multiThread fails with one thread only
+class OneThreadFailingSumSquare : public SumSquare {
+public:
+    virtual int multiThread(int nrows, int nthreads, std::ostream& output)
+    {
+        return nthreads == 1 ? 1 : 0;
+    };
+};
+
+// component tests
+void ctest_bench(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // bench
+
+    {
+        SumSquare sumSquare;
+
+        BenchOptions options;
+        options.rowCounts.clear();
+        options.rowCounts.push_back(10);
+        options.modes.clear();
+        options.modes.push_back("direct");
+        options.modes.push_back("workers");
+        options.warmup = 0;
+        options.reps = 3;
+
+        ostringstream oss;
+        int status = bench(sumSquare, options, oss);
+
+        istringstream iss(oss.str());
+        string header;
+        string direct;
+        string workers;
+        getline(iss, header);
+        getline(iss, direct);
+        getline(iss, workers);
+
+        if (status == 0 &&
+            header.find("mode,nrows,threads,") == 0 &&
+            direct.find("direct,10,1,0,3,") == 0 &&
+            direct.find(",1.000,1.000") == direct.length() - 12 &&
+            workers.find("workers,10,1,0,3,") == 0) passed++; else failed++;
+    }
+
+    {
+        // a failure at any thread count fails the sweep, not only at the last; with no thread
+        // counts, threads mode has no results
+        OneThreadFailingSumSquare sumSquare;
+
+        BenchOptions options;
+        options.rowCounts.clear();
+        options.rowCounts.push_back(10);
+        options.modes.clear();
+        options.modes.push_back("threads");
+        options.threadCounts.clear();
+        options.threadCounts.push_back(1);
+        options.threadCounts.push_back(2);
+        options.warmup = 0;
+        options.reps = 1;
+
+        ostringstream failing;
+        int status = bench(sumSquare, options, failing);
+
+        options.modes.insert(options.modes.begin(), "direct");
+        options.threadCounts.clear();
+
+        ostringstream noThreads;
+        int noThreadsStatus = bench(sumSquare, options, noThreads);
+
+        if (status == 1 && noThreadsStatus == 0 &&
+            noThreads.str().find("\nthreads,") == string::npos) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // benchOne
+
+#if USE_THREADS
+    {
+        SumSquare sumSquare;
+        BenchResult result = benchOne(sumSquare, "mpsc", 10000, 2, 0, 2);
+
+        if (result.status == 0 && result.msec.size() == 2 && result.nthreads == 2 &&
+            result.rowsPerSecond > 0) passed++; else failed++;
+    }
+#endif
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // benchSpeedup
+
+    {
+        vector<BenchResult> results(2);
+        results[0].mode = "direct";
+        results[0].nrows = 100;
+        results[0].nthreads = 1;
+        results[0].medianMsec = 8;
+        results[1].mode = "threads";
+        results[1].nrows = 100;
+        results[1].nthreads = 4;
+        results[1].medianMsec = 4;
+
+        benchSpeedup(results);
+
+        if (results[1].speedup == 2 && results[1].efficiency == 0.5) passed++; else failed++;
+    }
+
+    {
+        // queues against the locked queue with the same number of producers
+        vector<BenchResult> results(3);
+        results[0].mode = "locked";
+        results[0].nrows = 1000;
+        results[0].nthreads = 2;
+        results[0].medianMsec = 6;
+        results[1].mode = "mpsc";
+        results[1].nrows = 1000;
+        results[1].nthreads = 2;
+        results[1].medianMsec = 2;
+        results[2].mode = "direct";
+        results[2].nrows = 1000;
+        results[2].nthreads = 1;
+        results[2].medianMsec = 1;
+
+        benchSpeedup(results);
+
+        if (results[1].speedup == 3 && results[1].efficiency == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // writeBenchResults
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // percentile
+
+    {
+        vector<double> values;
+        for (int k = 20; k >= 1; k--) {
+            values.push_back(k);
+        }
+
+        if (percentile(values, 50) == 10 && percentile(values, 95) == 19 &&
+            percentile(values, 100) == 20 && percentile(vector<double>(), 50) == 0)
+            passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseIntList
+
+    {
+        vector<int> values;
+        bool valid = parseIntList("1,20,300", values);
+
+        if (valid && values.size() == 3 && values[2] == 300) passed++; else failed++;
+    }
+
+    {
+        vector<int> values;
+        if (!parseIntList("1,x", values) && !parseIntList("1.5", values)) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseStringList
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "bench.cpp" << "\t\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_bench(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // bench
+
+    {
+        SumSquare sumSquare;
+
+        BenchOptions options;
+        options.rowCounts.clear();
+        options.rowCounts.push_back(10);
+        options.warmup = 1;
+        options.reps = 1;
+        options.json = true;
+
+        ostringstream oss;
+        bench(sumSquare, options, oss);
+
+        if (verbose) {
+            cerr << oss.str();
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // benchOne
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // benchSpeedup
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // writeBenchResults
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // percentile
+
+    percentile(vector<double>(1, 1.0), 95);
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseIntList
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseStringList
+
+    {
+        vector<string> values;
+        parseStringList("direct,threads", values);
+    }
+}
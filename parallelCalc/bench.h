@@ -0,0 +1,92 @@
+//
+//  bench.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Benchmark sweep over row counts, thread counts and execution modes, reporting throughput,
+// median and 95th percentile wall time, speedup and parallel efficiency as CSV or JSON
+//
+
+#ifndef parallelCalc_bench_h
+#define parallelCalc_bench_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "calc.h"
+
+// ========== Structures ===========================================================================
+
+// what to sweep; modes are "workers" (singleThreadWorkers), "direct" (singleThreadDirect),
+// "threads" (multiThread, once per thread count) and "fork" (forkWorkers), or, to time the queues
+// alone with nrows values and nthreads producers, "spsc", "mpsc" and "locked" (benchQueue)
+struct BenchOptions {
+    std::vector<int> rowCounts;
+    std::vector<int> threadCounts;
+    std::vector<std::string> modes;
+    int warmup;
+    int reps;
+    bool json;
+
+    // default sweep
+    BenchOptions();
+};
+
+// timing of one mode, row count and thread count
+struct BenchResult {
+    std::string mode;
+    int nrows;
+    int nthreads;
+    int status;
+    std::vector<double> msec;   // one per repetition
+    double medianMsec;
+    double p95Msec;
+    double rowsPerSecond;
+    double speedup;             // relative to "direct" with the same row count, or for a queue,
+                                // "locked" with the same thread count; 0 if unknown
+    double efficiency;          // speedup / nthreads; 0 for a queue
+};
+
+// ========== Function Headers =====================================================================
+
+// run the sweep, write one CSV row or JSON object per result to output; returns 0 if every run
+// succeeded
+int bench(Calc& calc, const BenchOptions& options, std::ostream& output);
+
+// time one mode, row count and thread count
+BenchResult benchOne(Calc& calc, const std::string& mode, int nrows, int nthreads, int warmup,
+                     int reps);
+
+// fill in speedup and efficiency relative to the "direct" result with the same row count, or for a
+// queue, speedup relative to the "locked" result with the same row and thread counts
+void benchSpeedup(std::vector<BenchResult>& results);
+
+// write results as CSV with a header line, or as a JSON array
+void writeBenchResults(std::ostream& output, const std::vector<BenchResult>& results, bool json);
+
+// nearest-rank percentile (0 < p <= 100) of values; 0 if values is empty
+double percentile(std::vector<double> values, double p);
+
+// parse comma-separated list of integers; returns false if any item is not an integer
+bool parseIntList(const std::string& str, std::vector<int>& values);
+
+// parse comma-separated list of strings
+void parseStringList(const std::string& str, std::vector<std::string>& values);
+
+// component tests
+void ctest_bench(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_bench(bool verbose);
+
+#endif
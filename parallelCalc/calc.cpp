@@ -25,10 +25,12 @@
 
 #include "calc.h"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
 #if USE_THREADS
+#include <functional>
 #include <thread>
 #endif
 
@@ -37,6 +39,25 @@
 
 using namespace std;
 
+// ========== Local Headers ========================================================================
+
+int timedForkPipeWait(const std::string& path, std::vector<std::string> args, std::istream& input,
+                      std::ostream& output, std::ostream& error, PhaseStats *phaseStats);
+
+void hadoopInputSetup(const std::string& hadoopPath,
+                      const std::string& tempInputName,
+                      const std::string& inputHash,
+                      const std::string& dirPrefix,
+                      bool verbose,
+                      std::vector<HadoopStep>& steps,
+                      int& result);
+
+void hadoopOutputSetup(const std::string& hadoopPath,
+                       const std::string& dirPrefix,
+                       bool verbose,
+                       std::vector<HadoopStep>& steps,
+                       int& result);
+
 // ========== Globals ==============================================================================
 
 #if USE_THREADS
@@ -46,11 +67,30 @@ const string gToolName = "parallelCalct";
 const string gToolName = "parallelCalcn";
 #endif
 
+// group of counters reported by map and reduce tasks
+const string gCounterGroup = "parallelCalc";
+
+// for multiThreadAuto, the largest share of the work that may go to starting threads and handing
+// out chunks, and the most rows timed to measure the cost of a row
+const double gMaxThreadOverhead = 0.05;
+const int gCalibrationRows = 16;
+
 // ========== Classes ==============================================================================
 
 Calc::Calc() :
 verbose(false),
-delay(0)
+delay(0),
+stats(NULL),
+report(NULL),
+phaseStats(NULL),
+affinity(AFFINITY_NONE),
+chunkRows(0),
+mapInFlight(0),
+shuffleQueues(false),
+memoryLimit(0),
+spillDirectory("."),
+mapCache(NULL),
+checkpoint(NULL)
 {
 }
 
@@ -76,6 +116,13 @@ int Calc::reduceWorker(std::istream& input, std::ostream& output)
     return 0;
 }
 
+// override to read key/value starting data until the end of input, which may never come, and
+// write reduced data for each window of rows as it ends
+int Calc::streamWorker(std::istream& input, std::ostream& output, const StreamWindow& window)
+{
+    return 0;
+}
+
 // call startWorker, mapWorker, reduceWorker in main thread, saving intermediate results to
 // strings for debugging
 int Calc::singleThreadWorkers(int nrows, std::ostream& output)
@@ -85,6 +132,8 @@ int Calc::singleThreadWorkers(int nrows, std::ostream& output)
     // start
     string startStr;
     if (result == 0) {
+        ScopedPhase scopedPhase(phaseStats, PHASE_START);
+        
         ostringstream oss;
         result = startWorker(nrows, oss);
         startStr = oss.str();
@@ -97,6 +146,8 @@ int Calc::singleThreadWorkers(int nrows, std::ostream& output)
     // map
     string mappedStr;
     if (result == 0) {
+        ScopedPhase scopedPhase(phaseStats, PHASE_MAP);
+        
         istringstream iss(startStr);
         ostringstream oss;
         result = mapWorker(iss, oss);
@@ -109,6 +160,8 @@ int Calc::singleThreadWorkers(int nrows, std::ostream& output)
     
     // reduce
     if (result == 0) {
+        ScopedPhase scopedPhase(phaseStats, PHASE_REDUCE);
+        
         istringstream iss(mappedStr);
         result = reduceWorker(iss, output);
     }
@@ -123,6 +176,14 @@ int Calc::singleThreadDirect(int nrows, std::ostream& output)
     return singleThreadWorkers(nrows, output);
 }
 
+// singleThreadDirect, keeping per-key partial results in directory, tagged with name() and the
+// rows they cover, so that a later run over more rows only calculates the new ones; override if
+// partial results can be merged
+int Calc::incrementalDirect(int nrows, const std::string& directory, std::ostream& output)
+{
+    return singleThreadDirect(nrows, output);
+}
+
 // for debugging and testing: fork and call via command-line:
 // parallelCalcn -start | parallelCalcn -map | parallelCalcn -reduce
 // or
@@ -155,7 +216,7 @@ int Calc::forkWorkers(int nrows, std::ostream& output)
         ostringstream oss;
         ostringstream error;
         
-        result = forkPipeWait(path + gToolName, args, iss, oss, error);
+        result = timedForkPipeWait(path + gToolName, args, iss, oss, error, phaseStats);
         startStr = oss.str();
         
         string errorStr = error.str();
@@ -176,7 +237,7 @@ int Calc::forkWorkers(int nrows, std::ostream& output)
         ostringstream oss;
         ostringstream error;
         
-        result = forkPipeWait(path + gToolName, args, iss, oss, error);
+        result = timedForkPipeWait(path + gToolName, args, iss, oss, error, phaseStats);
         mappedStr = oss.str();
         
         string errorStr = error.str();
@@ -194,10 +255,9 @@ int Calc::forkWorkers(int nrows, std::ostream& output)
         args.push_back("-reduce");
         
         istringstream iss(mappedStr);
-        ostringstream oss;
         ostringstream error;
         
-        result = forkPipeWait(path + gToolName, args, iss, output, error);
+        result = timedForkPipeWait(path + gToolName, args, iss, output, error, phaseStats);
         
         string errorStr = error.str();
         if (verbose && errorStr.length() > 0) {
@@ -215,15 +275,25 @@ int Calc::hadoop(int nrows, std::ostream& output)
     string tempInputName = tmpnam(NULL);
     ofstream ofs(tempInputName.c_str());
     
-    // write starting data to file
-    startWorker(nrows, ofs);
+    // write starting data to file, hashing it on the way so an unchanged upload can be skipped
+    HashingStreambuf hashBuf(ofs.rdbuf());
+    ostream hashStream(&hashBuf);
+    
+    startWorker(nrows, hashStream);
+    hashStream.flush();
     ofs.close();
     
-    int result = callHadoop(tempInputName, name(), verbose, output);
+    HadoopSummary summary;
+    int result = callHadoop(tempInputName, hashBuf.digest(), name(), verbose, output,
+                            stats == NULL ? NULL : &summary);
     
     // delete temp file
     remove(tempInputName.c_str());    
     
+    if (stats != NULL) {
+        writeHadoopSummary(*stats, summary);
+    }
+    
     return result;
 }
 
@@ -233,14 +303,161 @@ int Calc::multiThread(int nrows, int nthreads, std::ostream& output)
     return 0;
 }
 
+// multiThread with the thread count and chunk size chosen by calibrateThreads, or
+// singleThreadDirect if threads would not pay for themselves
+int Calc::multiThreadAuto(int nrows, std::ostream& output)
+{
+    ThreadTuning tuning;
+    calibrateThreads(nrows, tuning);
+    
+    if (verbose) {
+        cerr << "auto: " << tuning.cpus << " CPUs, " << tuning.threads << " threads, ";
+        cerr << tuning.chunkRows << " rows per chunk" << endl;
+    }
+    
+    if (stats != NULL) {
+        tuning.write(*stats, "threads.auto");
+    }
+    
+    if (tuning.threads == 0) {
+        return singleThreadDirect(nrows, output);
+    }
+    
+    int savedChunkRows = chunkRows;
+    chunkRows = tuning.chunkRows;
+    
+    int result = multiThread(nrows, tuning.threads, output);
+    
+    chunkRows = savedChunkRows;
+    
+    return result;
+}
+
+// measure the CPUs available and the costs of a row and a thread, and choose the thread count
+// and chunk size for nrows
+void Calc::calibrateThreads(int nrows, ThreadTuning& tuning)
+{
+    tuning.cpus = availableCpus();
+    tuning.sampleRows = min(nrows, gCalibrationRows);
+    
+    // no point measuring without a second CPU
+    if (tuning.cpus < 2 || tuning.sampleRows <= 0) {
+        return;
+    }
+    
+    // time a sample directly, keeping it out of the phase times, the summary and the map cache;
+    // best of a few runs when they are quick, since the first may be slowed by cold caches
+    PhaseStats *savedPhaseStats = phaseStats;
+    std::ostream *savedStats = stats;
+    bool savedVerbose = verbose;
+    MapCache *savedMapCache = mapCache;
+    phaseStats = NULL;
+    stats = NULL;
+    verbose = false;
+    mapCache = NULL;
+    
+    long long best = 0;
+    for (int k = 0; k < 3; k++) {
+        ostringstream oss;
+        long long startTime = nanosecondClock();
+        singleThreadDirect(tuning.sampleRows, oss);
+        long long elapsed = nanosecondClock() - startTime;
+        
+        if (k == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        
+        if (elapsed > 1000000) {
+            break;
+        }
+    }
+    
+    phaseStats = savedPhaseStats;
+    stats = savedStats;
+    verbose = savedVerbose;
+    mapCache = savedMapCache;
+    
+    tuning.rowNanos = best / (double)tuning.sampleRows;
+    tuning.threadNanos = measureThreadNanos();
+    
+    chooseThreads(nrows, gMaxThreadOverhead, tuning);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// does nothing if output is NULL
+TaskReporter::TaskReporter(std::ostream *output, long long intervalMsec) :
+output(output),
+intervalMsec(intervalMsec),
+nextFlushTime(millisecondTime() + intervalMsec),
+ticks(0)
+{
+}
+
+// add a counter; returns index for use with count()
+int TaskReporter::addCounter(const std::string& name)
+{
+    names.push_back(name);
+    increments.push_back(0);
+    totals.push_back(0);
+    
+    return (int)names.size() - 1;
+}
+
+// call once per row; writes counters and status if interval has elapsed
+void TaskReporter::tick()
+{
+    // check the clock only every so often
+    const int TICKS_PER_CHECK = 256;
+    
+    if (output != NULL && ++ticks >= TICKS_PER_CHECK) {
+        ticks = 0;
+        
+        if (millisecondTime() >= nextFlushTime) {
+            flush();
+        }
+    }
+}
+
+// write accumulated counter increments and a status line with counter totals
+void TaskReporter::flush()
+{
+    if (output != NULL) {
+        ostringstream status;
+        
+        for (size_t k = 0; k < names.size(); k++) {
+            if (increments[k] != 0) {
+                *output << "reporter:counter:" << gCounterGroup << "," << names[k] << ","
+                        << increments[k];
+                *output << endl;
+                
+                totals[k] += increments[k];
+                increments[k] = 0;
+            }
+            
+            if (k > 0) status << " ";
+            status << names[k] << "=" << totals[k];
+        }
+        
+        *output << "reporter:status:" << status.str() << endl;
+    }
+    
+    nextFlushTime = millisecondTime() + intervalMsec;
+}
+
 // ========== Functions ============================================================================
 
 // copy input data from path tempInputName to hdfs:, call Hadoop streaming, read results from hdfs:
-// (assumes all results are in the hdfs: file part-00000), write to output
+// (assumes all results are in the hdfs: file part-00000), write to output; independent setup
+// commands run concurrently when threads are available; if summary is not NULL, the elapsed time
+// of each command and the job's counters are appended to it; if inputHash is not empty, it is
+// stored in hdfs: next to the input and the upload is skipped when the stored hash matches
 int callHadoop(const std::string& tempInputName,
+               const std::string& inputHash,
                const std::string& dirPrefix,
                bool verbose,
-               std::ostream& output)
+               std::ostream& output,
+               HadoopSummary *summary)
 {
     int result = 0;
     
@@ -254,34 +471,35 @@ int callHadoop(const std::string& tempInputName,
     string stdoutStr;
     string stderrStr;
     
-    // make input directory
-    if (result == 0) {
-        // ignore failure - directory might already exist
-        callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
-                 "dfs", "-mkdir", (dirPrefix + "Input").c_str(), NULL);
-    }
+    long long totalStartTime = millisecondTime();
     
-    // remove previous input file (if any)
-    if (result == 0) {
-        // ignore failure - previous input file might not exist
-        callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
-                 "dfs", "-rm", (dirPrefix + "Input/input.txt").c_str(), NULL);
-    }
+    // replace input file and remove previous output directory; each is a separate JVM launch, and
+    // the two are independent of each other
+    vector<HadoopStep> inputSteps;
+    vector<HadoopStep> outputSteps;
+    int outputResult = 0;
     
-    // write new input file
-    if (result == 0) {
-        // must succeed to continue
-        result = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
-                          "dfs", "-put", tempInputName.c_str(),
-                          (dirPrefix + "Input/input.txt").c_str(), NULL);
-    }
+#if USE_THREADS
+    thread outputThread(bind(&hadoopOutputSetup,
+                             cref(hadoopPath),
+                             cref(dirPrefix),
+                             verbose,
+                             ref(outputSteps),
+                             ref(outputResult)));
     
-    // remove previous hdfs output directory (if any)
-    if (result == 0) {
-        // ignore failure - previous output directory might not exist
-        callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
-                 "dfs", "-rmr", (dirPrefix + "Output").c_str(), NULL);
-    }
+    hadoopInputSetup(hadoopPath, tempInputName, inputHash, dirPrefix, verbose, inputSteps, result);
+    
+    outputThread.join();
+    
+#else
+    hadoopInputSetup(hadoopPath, tempInputName, inputHash, dirPrefix, verbose, inputSteps, result);
+    hadoopOutputSetup(hadoopPath, dirPrefix, verbose, outputSteps, outputResult);
+#endif
+    
+    vector<HadoopStep> steps;
+    steps.insert(steps.end(), inputSteps.begin(), inputSteps.end());
+    steps.insert(steps.end(), outputSteps.begin(), outputSteps.end());
+    steps.push_back(HadoopStep("setup", millisecondTime() - totalStartTime, result));
     
     // run hadoop calculation
     string jarPath = hadoopInstall + "/contrib/streaming/hadoop-streaming-1.1.2.jar";
@@ -299,11 +517,14 @@ int callHadoop(const std::string& tempInputName,
     toolPath.append("/");
     toolPath.append(gToolName);
 
-    string mapperCmd = quote + gToolName + " -map" + quote;
-    string reducerCmd = quote + gToolName + " -reduce" + quote;
+    // tasks report counters and status to hadoop via stderr
+    string mapperCmd = quote + gToolName + " -map -report" + quote;
+    string reducerCmd = quote + gToolName + " -reduce -report" + quote;
     
     if (result == 0) {
         // must succeed to continue
+        long long startTime = millisecondTime();
+        
         result = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
                           "jar",
                           jarPath.c_str(),
@@ -318,15 +539,46 @@ int callHadoop(const std::string& tempInputName,
                           "-file",
                           toolPath.c_str(),
                           NULL);
+        
+        steps.push_back(HadoopStep("jar", millisecondTime() - startTime, result));
+    }
+    
+    // collect final counter values, from the job log if present, otherwise from the job status
+    vector< pair<string, long long> > counters;
+    if (result == 0 && summary != NULL) {
+        parseHadoopCounters(stderrStr, gCounterGroup, counters);
+        
+        const string runningJob = "Running job: ";
+        size_t jobPos = stderrStr.find(runningJob);
+        
+        if (counters.empty() && jobPos != string::npos) {
+            istringstream iss(stderrStr.substr(jobPos + runningJob.length()));
+            string jobId;
+            iss >> jobId;
+            
+            long long startTime = millisecondTime();
+            string statusStr;
+            
+            // ignore failure - counters are informational
+            int status = callTool("hadoop", hadoopPath, statusStr, stderrStr, verbose,
+                                  "job", "-status", jobId.c_str(), NULL);
+            
+            parseHadoopCounters(statusStr, gCounterGroup, counters);
+            steps.push_back(HadoopStep("counters", millisecondTime() - startTime, status));
+        }
     }
 
     // copy results to local file
     string tempOutputName = tmpnam(NULL);
     if (result == 0) {
         // must succeed to continue
+        long long startTime = millisecondTime();
+        
         result = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
                           "dfs", "-get", (dirPrefix + "Output/part-00000").c_str(),
                           tempOutputName.c_str(), NULL);
+        
+        steps.push_back(HadoopStep("get", millisecondTime() - startTime, result));
     }
     
     // copy results file to output
@@ -339,5 +591,217 @@ int callHadoop(const std::string& tempInputName,
         remove(tempOutputName.c_str());
     }
     
+    steps.push_back(HadoopStep("total", millisecondTime() - totalStartTime, result));
+    
+    if (summary != NULL) {
+        summary->steps.insert(summary->steps.end(), steps.begin(), steps.end());
+        summary->counters.insert(summary->counters.end(), counters.begin(), counters.end());
+    }
+    
     return result;
 }
+
+// write summary as key/value lines hadoop.<step>.msec, hadoop.<step>.status and
+// hadoop.counter.<name>
+void writeHadoopSummary(std::ostream& output, const HadoopSummary& summary)
+{
+    for (size_t k = 0; k < summary.steps.size(); k++) {
+        const HadoopStep& step = summary.steps[k];
+        
+        writeKeyValue<long long>(output, "hadoop." + step.name + ".msec", step.msec);
+        writeKeyValue<int>(output, "hadoop." + step.name + ".status", step.status);
+    }
+    
+    for (size_t k = 0; k < summary.counters.size(); k++) {
+        writeKeyValue<long long>(output,
+                                 "hadoop.counter." + summary.counters[k].first,
+                                 summary.counters[k].second);
+    }
+}
+
+// append counters of the specified group found in the log output of hadoop jar or hadoop job
+// -status, where the group name is on a line by itself, followed by lines of the form name=value
+void parseHadoopCounters(const std::string& log,
+                         const std::string& group,
+                         std::vector< std::pair<std::string, long long> >& counters)
+{
+    // log lines may have a prefix such as "13/07/20 10:00:00 INFO mapred.JobClient:"
+    const string prefixEnd = "JobClient:";
+    const string whitespace = " \t\r";
+    
+    bool inGroup = false;
+    
+    istringstream iss(log);
+    string line;
+    while (getline(iss, line)) {
+        size_t pos = line.find(prefixEnd);
+        if (pos != string::npos) {
+            line = line.substr(pos + prefixEnd.length());
+        }
+        
+        // trim
+        size_t first = line.find_first_not_of(whitespace);
+        size_t last = line.find_last_not_of(whitespace);
+        line = first == string::npos ? "" : line.substr(first, last - first + 1);
+        
+        size_t equals = line.find('=');
+        
+        if (line == group) {
+            inGroup = true;
+            
+        } else if (inGroup && equals != string::npos && isNumeric(line.substr(equals + 1))) {
+            counters.push_back(make_pair(line.substr(0, equals), toLong(line.substr(equals + 1))));
+            
+        } else {
+            inGroup = false;
+        }
+    }
+}
+
+// ========== Local Functions ======================================================================
+
+// call forkPipeWait; if phaseStats is not NULL, ask the tool for its phase times (and hardware
+// counts and memory use, if enabled), add them to phaseStats, and count the rest of the elapsed
+// time (process startup, pipes) as PHASE_IO
+int timedForkPipeWait(const std::string& path, std::vector<std::string> args, std::istream& input,
+                      std::ostream& output, std::ostream& error, PhaseStats *phaseStats)
+{
+    if (phaseStats == NULL) {
+        return forkPipeWait(path, args, input, output, error);
+    }
+    
+    args.push_back("-stats");
+    
+    if (phaseStats->isPerfEnabled()) {
+        args.push_back("-perf");
+    }
+    
+    if (phaseStats->isMemoryEnabled()) {
+        args.push_back("-mem");
+    }
+    
+    ostringstream toolError;
+    
+    long long startTime = nanosecondClock();
+    int result = forkPipeWait(path, args, input, output, toolError);
+    long long elapsed = nanosecondClock() - startTime;
+    
+    string toolErrorStr = toolError.str();
+    long long toolNanos = phaseStats->addFromLog(toolErrorStr, "phase");
+    phaseStats->add(PHASE_IO, elapsed - toolNanos);
+    
+    error << toolErrorStr;
+    
+    return result;
+}
+
+// make input directory, remove previous input file, write new input file; result is nonzero if the
+// new input file could not be written; if inputHash is not empty, skip all of this when the hash
+// stored with the previous input file matches, otherwise store inputHash with the new input file
+void hadoopInputSetup(const std::string& hadoopPath,
+                      const std::string& tempInputName,
+                      const std::string& inputHash,
+                      const std::string& dirPrefix,
+                      bool verbose,
+                      std::vector<HadoopStep>& steps,
+                      int& result)
+{
+    string stdoutStr;
+    string stderrStr;
+    
+    // the hash can't be stored in the input directory, or it would become part of the input
+    string hashPath = dirPrefix + "Input.hash";
+    
+    // compare with hash of previous input file (if any)
+    if (result == 0 && inputHash.length() > 0) {
+        // ignore failure - previous hash might not exist
+        long long startTime = millisecondTime();
+        
+        int status = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                              "dfs", "-cat", hashPath.c_str(), NULL);
+        
+        steps.push_back(HadoopStep("cat", millisecondTime() - startTime, status));
+        
+        istringstream iss(stdoutStr);
+        string previousHash;
+        iss >> previousHash;
+        
+        if (status == 0 && previousHash == inputHash) {
+            // input file is unchanged
+            return;
+        }
+    }
+    
+    // make input directory
+    if (result == 0) {
+        // ignore failure - directory might already exist
+        long long startTime = millisecondTime();
+        
+        int status = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                              "dfs", "-mkdir", (dirPrefix + "Input").c_str(), NULL);
+        
+        steps.push_back(HadoopStep("mkdir", millisecondTime() - startTime, status));
+    }
+    
+    // remove previous input file and its hash (if any)
+    if (result == 0) {
+        // ignore failure - previous input file might not exist
+        long long startTime = millisecondTime();
+        
+        int status = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                              "dfs", "-rm", (dirPrefix + "Input/input.txt").c_str(),
+                              hashPath.c_str(), NULL);
+        
+        steps.push_back(HadoopStep("rm", millisecondTime() - startTime, status));
+    }
+    
+    // write new input file
+    if (result == 0) {
+        // must succeed to continue
+        long long startTime = millisecondTime();
+        
+        result = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                          "dfs", "-put", tempInputName.c_str(),
+                          (dirPrefix + "Input/input.txt").c_str(), NULL);
+        
+        steps.push_back(HadoopStep("put", millisecondTime() - startTime, result));
+    }
+    
+    // write hash of new input file, only after the input file itself is in place
+    if (result == 0 && inputHash.length() > 0) {
+        // ignore failure - next call will upload again
+        string tempHashName = tmpnam(NULL);
+        stringToFile(inputHash + "\n", tempHashName);
+        
+        long long startTime = millisecondTime();
+        
+        int status = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                              "dfs", "-put", tempHashName.c_str(), hashPath.c_str(), NULL);
+        
+        steps.push_back(HadoopStep("puthash", millisecondTime() - startTime, status));
+        
+        remove(tempHashName.c_str());
+    }
+}
+
+// remove previous hdfs output directory (if any); result is unchanged, since failure is expected
+// when there is no previous output
+void hadoopOutputSetup(const std::string& hadoopPath,
+                       const std::string& dirPrefix,
+                       bool verbose,
+                       std::vector<HadoopStep>& steps,
+                       int& result)
+{
+    string stdoutStr;
+    string stderrStr;
+    
+    if (result == 0) {
+        // ignore failure - previous output directory might not exist
+        long long startTime = millisecondTime();
+        
+        int status = callTool("hadoop", hadoopPath, stdoutStr, stderrStr, verbose,
+                              "dfs", "-rmr", (dirPrefix + "Output").c_str(), NULL);
+        
+        steps.push_back(HadoopStep("rmr", millisecondTime() - startTime, status));
+    }
+}
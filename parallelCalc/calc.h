@@ -26,9 +26,21 @@
 #ifndef parallelCalc_calc_h
 #define parallelCalc_calc_h
 
+#include "shim.h"
+
 #include <iostream>
 #include <limits>
+#include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "affinity.h"
+#include "checkpoint.h"
+#include "mapCache.h"
+#include "phaseStats.h"
+#include "tuning.h"
+#include "windowedAggregates.h"
 
 // ========== Class Declarations ===================================================================
 
@@ -48,6 +60,61 @@ public:
     virtual void setDelay(int delay) { this->delay = delay; };
     virtual int getDelay() { return delay; };
     
+    // if stats is not NULL, write machine-readable key/value run summary to it
+    virtual void setStats(std::ostream *stats) { this->stats = stats; };
+    virtual std::ostream *getStats() { return stats; };
+    
+    // if report is not NULL, map and reduce workers write Hadoop streaming counter and status
+    // lines to it
+    virtual void setReport(std::ostream *report) { this->report = report; };
+    virtual std::ostream *getReport() { return report; };
+    
+    // if phaseStats is not NULL, add time spent in each phase of a calculation to it
+    virtual void setPhaseStats(PhaseStats *phaseStats) { this->phaseStats = phaseStats; };
+    virtual PhaseStats *getPhaseStats() { return phaseStats; };
+    
+    // placement of worker threads by multiThread
+    virtual void setAffinity(AffinityPolicy affinity) { this->affinity = affinity; };
+    virtual AffinityPolicy getAffinity() { return affinity; };
+    
+    // rows per map chunk for multiThread, handed out to whichever thread is free; 0 for one chunk
+    // per thread
+    virtual void setChunkRows(int chunkRows) { this->chunkRows = chunkRows; };
+    virtual int getChunkRows() { return chunkRows; };
+    
+    // if mapCache is not NULL, map output is looked up in it per chunk of rows, and stored in it
+    // when it has to be calculated
+    virtual void setMapCache(MapCache *mapCache) { this->mapCache = mapCache; };
+    virtual MapCache *getMapCache() { return mapCache; };
+    
+    // if checkpoint is not NULL, multiThread saves each map chunk and reduce thread's results as
+    // they finish, and reads back those saved by an earlier run of the same job
+    virtual void setCheckpoint(Checkpoint *checkpoint) { this->checkpoint = checkpoint; };
+    virtual Checkpoint *getCheckpoint() { return checkpoint; };
+    
+    // version of the map code, part of the map cache's key; override and increase it whenever the
+    // map output for the same starting data changes
+    virtual int mapVersion() { return 1; };
+    
+    // rows each map thread keeps in flight when the map waits on latency-bound work, such as the
+    // delay; 0 to map one row at a time
+    virtual void setMapInFlight(int mapInFlight) { this->mapInFlight = mapInFlight; };
+    virtual int getMapInFlight() { return mapInFlight; };
+    
+    // if true, multiThread passes mapped rows to the reduce threads through lock-free queues as
+    // they are mapped, instead of once every map thread has finished
+    virtual void setShuffleQueues(bool shuffleQueues) { this->shuffleQueues = shuffleQueues; };
+    virtual bool getShuffleQueues() { return shuffleQueues; };
+    
+    // if not 0, multiThread keeps the mapped rows its threads hold at once to about memoryLimit
+    // bytes: map threads wait for room, and reduce threads that can't fold rows into partial
+    // results as they arrive spill them to files in a directory of the run's own in spillDirectory
+    virtual void setMemoryLimit(long long memoryLimit) { this->memoryLimit = memoryLimit; };
+    virtual long long getMemoryLimit() { return memoryLimit; };
+    virtual void setSpillDirectory(const std::string& spillDirectory)
+        { this->spillDirectory = spillDirectory; };
+    virtual std::string getSpillDirectory() { return spillDirectory; };
+    
     // override to write key/value data usable as input to map operation
     virtual int startWorker(int nrows, std::ostream& output);
     
@@ -57,6 +124,11 @@ public:
     // override to read key/value mapped data, write reduced data
     virtual int reduceWorker(std::istream& input, std::ostream& output);
     
+    // override to read key/value starting data until the end of input, which may never come, and
+    // write reduced data for each window of rows as it ends
+    virtual int streamWorker(std::istream& input, std::ostream& output,
+                             const StreamWindow& window);
+    
     // call startWorker, mapWorker, reduceWorker in main thread, saving intermediate results to
     // strings for debugging
     virtual int singleThreadWorkers(int nrows, std::ostream& output);
@@ -65,6 +137,11 @@ public:
     // reading from intermediate text strings
     virtual int singleThreadDirect(int nrows, std::ostream& output);
     
+    // singleThreadDirect, keeping per-key partial results in directory, tagged with name() and the
+    // rows they cover, so that a later run over more rows only calculates the new ones; override
+    // if partial results can be merged
+    virtual int incrementalDirect(int nrows, const std::string& directory, std::ostream& output);
+    
     // for debugging and testing: fork and call via command-line:
     // parallelCalcn -start | parallelCalcn -map | parallelCalcn -reduce
     // or
@@ -77,19 +154,102 @@ public:
     // override to split map and reduce calculations over multiple threads
     virtual int multiThread(int nrows, int nthreads, std::ostream& output);
     
+    // multiThread with the thread count and chunk size chosen by calibrateThreads, or
+    // singleThreadDirect if threads would not pay for themselves
+    virtual int multiThreadAuto(int nrows, std::ostream& output);
+    
+    // measure the CPUs available and the costs of a row and a thread, and choose the thread count
+    // and chunk size for nrows
+    virtual void calibrateThreads(int nrows, ThreadTuning& tuning);
+    
 protected:
     bool verbose;
     int delay;
+    std::ostream *stats;
+    std::ostream *report;
+    PhaseStats *phaseStats;
+    AffinityPolicy affinity;
+    int chunkRows;
+    int mapInFlight;
+    bool shuffleQueues;
+    long long memoryLimit;
+    std::string spillDirectory;
+    MapCache *mapCache;
+    Checkpoint *checkpoint;
+};
+
+// writes Hadoop streaming "reporter:counter:" and "reporter:status:" lines; counter increments are
+// accumulated and written at most once per interval, so that reporting doesn't slow down the task
+class TaskReporter {
+public:
+    // does nothing if output is NULL
+    TaskReporter(std::ostream *output, long long intervalMsec = 1000);
+    
+    bool isEnabled() { return output != NULL; };
+    
+    // add a counter; returns index for use with count()
+    int addCounter(const std::string& name);
+    
+    // add increment to counter
+    void count(int counter, long long increment) { increments[counter] += increment; };
+    
+    // call once per row; writes counters and status if interval has elapsed
+    void tick();
+    
+    // write accumulated counter increments and a status line with counter totals
+    void flush();
+    
+protected:
+    std::ostream *output;
+    long long intervalMsec;
+    long long nextFlushTime;
+    int ticks;
+    std::vector<std::string> names;
+    std::vector<long long> increments;
+    std::vector<long long> totals;
+};
+
+// ========== Structures ===========================================================================
+
+// elapsed time and exit status of one command run by callHadoop
+struct HadoopStep {
+    std::string name;
+    long long msec;
+    int status;
+    
+    HadoopStep(const std::string& name, long long msec, int status) :
+    name(name), msec(msec), status(status) {};
+};
+
+// timing of the commands run by callHadoop, and final values of the job's counters
+struct HadoopSummary {
+    std::vector<HadoopStep> steps;
+    std::vector< std::pair<std::string, long long> > counters;
 };
 
 // ========== Function Headers =====================================================================
 
 // copy input data from path tempInputName to hdfs:, call Hadoop streaming, read results from hdfs:
-// (assumes all results are in the hdfs: file part-00000), write to output
+// (assumes all results are in the hdfs: file part-00000), write to output; independent setup
+// commands run concurrently when threads are available; if summary is not NULL, the elapsed time
+// of each command and the job's counters are appended to it; if inputHash is not empty, it is
+// stored in hdfs: next to the input and the upload is skipped when the stored hash matches
 int callHadoop(const std::string& tempInputName,
+               const std::string& inputHash,
                const std::string& dirPrefix,
                bool verbose,
-               std::ostream& output);
+               std::ostream& output,
+               HadoopSummary *summary);
+
+// write summary as key/value lines hadoop.<step>.msec, hadoop.<step>.status and
+// hadoop.counter.<name>
+void writeHadoopSummary(std::ostream& output, const HadoopSummary& summary);
+
+// append counters of the specified group found in the log output of hadoop jar or hadoop job
+// -status, where the group name is on a line by itself, followed by lines of the form name=value
+void parseHadoopCounters(const std::string& log,
+                         const std::string& group,
+                         std::vector< std::pair<std::string, long long> >& counters);
 
 // ========== Function Templates ===================================================================
 
@@ -112,6 +272,39 @@ template <typename Value> bool readKeyValue(std::istream& input, std::string& ke
 
 // -------------------------------------------------------------------------------------------------
 
+// as above, reading a whole line at a time; nbytes is set to the number of bytes read
+template <typename Value> bool readKeyValue(std::istream& input,
+                                            std::string& key,
+                                            Value& value,
+                                            size_t& nbytes);
+
+template <typename Value> bool readKeyValue(std::istream& input,
+                                            std::string& key,
+                                            Value& value,
+                                            size_t& nbytes)
+{
+    std::string line;
+    getline(input, line);
+    nbytes = line.length() + (input.eof() ? 0 : 1);
+    
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos) {
+        key.clear();
+        return false;
+    }
+    
+    key = line.substr(0, tab);
+    
+    std::istringstream iss(line.substr(tab + 1));
+    iss >> value;
+    
+    bool valid = key.length() > 0 && !iss.fail();
+    
+    return valid;
+}
+
+// -------------------------------------------------------------------------------------------------
+
 // write output stream of the form key-tab-value-newline where key is a string and value is a string
 // corresponding to the templated type
 template <typename Value> bool writeKeyValue(std::ostream& input,
@@ -19,6 +19,7 @@
 
 #if !WINDOWS
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #endif
@@ -26,10 +27,22 @@
 #include <cstdarg>
 #include <sstream>
 
+#if USE_THREADS
+#include <mutex>
+#endif
+
 #include "utils.h"
 
 using namespace std;
 
+// ========== Globals ==============================================================================
+
+#if USE_THREADS
+// serializes pipe creation and fork, so that a child forked by one thread does not inherit the
+// pipes another thread is creating for its own child
+static mutex gForkMutex;
+#endif
+
 // ========== Functions ============================================================================
 
 // fork process, call command-line tool with specified arguments, pipe stdin, stdout, sterr, wait
@@ -50,6 +63,18 @@ int forkPipeWait(const std::string& path, std::vector<std::string> args, std::is
     int childOutputPipe[2];
     int childErrorPipe[2];
     
+    // build argument list before forking; the child of a multithreaded process should not allocate
+    vector<const char *> argv;
+    for (size_t k = 0; k < args.size(); k++) {
+        argv.push_back(args[k].c_str());
+    }
+    
+    argv.push_back(NULL);
+    
+#if USE_THREADS
+    unique_lock<mutex> forkLock(gForkMutex);
+#endif
+    
     bool childInputPipeOK = pipe(childInputPipe) == 0;
     bool childOutputPipeOK = pipe(childOutputPipe) == 0;
     bool childErrorPipeOK = pipe(childErrorPipe) == 0;
@@ -57,8 +82,20 @@ int forkPipeWait(const std::string& path, std::vector<std::string> args, std::is
     if (childInputPipeOK && childOutputPipeOK && childErrorPipeOK) {
         // pipes OK
         
+        // don't leak pipes into children forked concurrently by other threads; dup2 clears the flag
+        // on the child's stdin, stdout, stderr
+        for (int k = 0; k < 2; k++) {
+            fcntl(childInputPipe[k], F_SETFD, FD_CLOEXEC);
+            fcntl(childOutputPipe[k], F_SETFD, FD_CLOEXEC);
+            fcntl(childErrorPipe[k], F_SETFD, FD_CLOEXEC);
+        }
+        
         pid_t pid = fork();
         
+#if USE_THREADS
+        forkLock.unlock();
+#endif
+        
         if (pid == 0) {
             // in child process
             
@@ -75,13 +112,6 @@ int forkPipeWait(const std::string& path, std::vector<std::string> args, std::is
             bool errDupOK = dup2(childErrorPipe[WRITE_END], STDERR_FILENO) >= 0;
             
             if (inDupOK && outDupOK&& errDupOK) {
-                vector<const char *> argv;
-                for (size_t k = 0; k < args.size(); k++) {
-                    argv.push_back(args[k].c_str());
-                }
-                
-                argv.push_back(NULL);
-                
                 if (path.length() == 0) {
                     // use search PATH
                     execvp(argv[0], (char * const *)&argv[0]);
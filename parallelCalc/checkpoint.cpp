@@ -0,0 +1,446 @@
+//
+//  checkpoint.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Checkpoints of a long calculation, so that a run that dies can be resumed without redoing the
+// parts that had finished. Each finished part (a chunk of map output, or a reduce thread's
+// results) is written to its own file by a background thread, then recorded in a manifest that
+// also describes the job, so that parts are only reused by a run of the same job.
+//
+
+#include <fstream>  // must precede .h includes
+
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include <string>
+
+#if USE_THREADS
+#include <functional>
+#endif
+
+#include "calc.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Local Headers ========================================================================
+
+// parts recorded in a manifest by lines of the form part-tab-name; a last line without a newline
+// was cut short, and is ignored
+static void parseManifestParts(const std::string& manifest, std::set<std::string>& parts);
+
+// ========== Classes ==============================================================================
+
+// checkpoints in an existing directory, with map chunks of chunkRows rows; if resume, parts saved
+// by an earlier run of the same job are used
+Checkpoint::Checkpoint(const std::string& directory, bool resume, int chunkRows) :
+directory(directory),
+resume(resume),
+chunkRows(chunkRows),
+jobName(),
+savedParts(),
+loadedCount(0),
+savedCount(0),
+writeNanos(0),
+writeFailed(false)
+#if USE_THREADS
+,
+queueMutex(),
+queueChanged(),
+queue(),
+writing(0),
+stopping(false),
+writer()
+#endif
+{
+    LOGIC_ERROR_IF(chunkRows <= 0, "checkpoint chunks must have at least one row");
+
+#if USE_THREADS
+    writer = thread(bind(&Checkpoint::writeQueued, this));
+#endif
+}
+
+// waits for parts still being written
+Checkpoint::~Checkpoint()
+{
+#if USE_THREADS
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+
+    queueChanged.notify_all();
+    writer.join();
+#endif
+}
+
+// start job jobName (usable as a file name), described by layout; parts saved by an earlier run
+// are kept if resuming the same job with the same layout, and removed otherwise
+void Checkpoint::begin(const std::string& jobName, const std::string& layout)
+{
+    flush();
+
+    this->jobName = jobName;
+
+    string manifest;
+    ifstream input(manifestPath().c_str(), ios::binary);
+    if (input.is_open()) {
+        ostringstream oss;
+        oss << input.rdbuf();
+        manifest = oss.str();
+    }
+
+    set<string> parts;
+    parseManifestParts(manifest, parts);
+
+#if USE_THREADS
+    lock_guard<mutex> lock(queueMutex);
+#endif
+
+    savedParts.clear();
+
+    if (resume && manifest.compare(0, layout.length(), layout) == 0) {
+        savedParts.swap(parts);
+        return;
+    }
+
+    // a different job, or starting over
+    set<string>::const_iterator iter = parts.begin();
+    while (iter != parts.end()) {
+        remove(pathOf(*iter).c_str());
+
+        iter++;
+    }
+
+    string tempPath = manifestPath() + ".tmp";
+    stringToFile(layout, tempPath);
+
+    remove(manifestPath().c_str());
+    RUNTIME_ERROR_IF(rename(tempPath.c_str(), manifestPath().c_str()) != 0,
+                     "can't write checkpoint manifest " + manifestPath());
+}
+
+// contents of a part saved by an earlier run of the job; false if there is none
+bool Checkpoint::load(const std::string& part, std::string& contents)
+{
+    {
+#if USE_THREADS
+        lock_guard<mutex> lock(queueMutex);
+#endif
+
+        if (savedParts.count(part) == 0) {
+            return false;
+        }
+    }
+
+    ifstream input(pathOf(part).c_str(), ios::binary);
+    if (!input.is_open()) {
+        return false;
+    }
+
+    ostringstream oss;
+    oss << input.rdbuf();
+    contents = oss.str();
+
+    {
+#if USE_THREADS
+        lock_guard<mutex> lock(queueMutex);
+#endif
+
+        loadedCount++;
+    }
+
+    return true;
+}
+
+// write a part in the background, replacing any earlier one
+void Checkpoint::save(const std::string& part, const std::string& contents)
+{
+#if USE_THREADS
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queue.push_back(make_pair(part, contents));
+    }
+
+    queueChanged.notify_all();
+
+#else
+    writePart(part, contents);
+#endif
+}
+
+// wait until all parts passed to save have been written
+void Checkpoint::flush()
+{
+#if USE_THREADS
+    unique_lock<mutex> lock(queueMutex);
+    while (!queue.empty() || writing > 0) {
+        queueChanged.wait(lock);
+    }
+#endif
+
+    RUNTIME_ERROR_IF(writeFailed, "can't write checkpoint to " + directory);
+}
+
+// remove the job's files once it has finished
+void Checkpoint::finish()
+{
+    flush();
+
+#if USE_THREADS
+    lock_guard<mutex> lock(queueMutex);
+#endif
+
+    set<string>::const_iterator iter = savedParts.begin();
+    while (iter != savedParts.end()) {
+        remove(pathOf(*iter).c_str());
+
+        iter++;
+    }
+
+    savedParts.clear();
+    remove(manifestPath().c_str());
+}
+
+// write key/value lines <prefix>.loadedParts, .savedParts and .writeNsec (time spent writing in
+// the background)
+void Checkpoint::writeStats(std::ostream& output, const std::string& prefix)
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(queueMutex);
+#endif
+
+    writeKeyValue<long long>(output, prefix + ".loadedParts", loadedCount);
+    writeKeyValue<long long>(output, prefix + ".savedParts", savedCount);
+    writeKeyValue<long long>(output, prefix + ".writeNsec", writeNanos);
+}
+
+// write queued parts until stopping, on the writer thread
+void Checkpoint::writeQueued()
+{
+#if USE_THREADS
+    unique_lock<mutex> lock(queueMutex);
+
+    while (true) {
+        while (queue.empty() && !stopping) {
+            queueChanged.wait(lock);
+        }
+
+        if (queue.empty()) {
+            break;
+        }
+
+        pair<string, string> next;
+        next.swap(queue.front());
+        queue.pop_front();
+        writing++;
+
+        // the workers can queue more parts while this one is written
+        lock.unlock();
+        writePart(next.first, next.second);
+        lock.lock();
+
+        writing--;
+        queueChanged.notify_all();
+    }
+#endif
+}
+
+// write a part to its file, then record it in the manifest
+void Checkpoint::writePart(const std::string& part, const std::string& contents)
+{
+    long long startTime = nanosecondClock();
+
+    // renamed once complete, so that a crash can't leave half a part
+    string path = pathOf(part);
+    string tempPath = path + ".tmp";
+    bool valid;
+
+    {
+        ofstream output(tempPath.c_str(), ios::binary);
+        output << contents;
+        valid = output.is_open() && !output.fail();
+    }
+
+    remove(path.c_str());
+    valid = valid && rename(tempPath.c_str(), path.c_str()) == 0;
+
+    if (valid) {
+        ofstream manifest(manifestPath().c_str(), ios::app | ios::binary);
+        manifest << "part\t" << part << '\n';
+        manifest.flush();
+        valid = manifest.is_open() && !manifest.fail();
+    }
+
+    long long elapsed = nanosecondClock() - startTime;
+
+#if USE_THREADS
+    lock_guard<mutex> lock(queueMutex);
+#endif
+
+    if (valid) {
+        savedParts.insert(part);
+        savedCount++;
+
+    } else {
+        writeFailed = true;
+    }
+
+    writeNanos += elapsed;
+}
+
+std::string Checkpoint::pathOf(const std::string& part) const
+{
+    return directory + "/" + jobName + "." + part;
+}
+
+std::string Checkpoint::manifestPath() const
+{
+    return directory + "/" + jobName + ".checkpoint";
+}
+
+// ========== Local Functions ======================================================================
+
+// parts recorded in a manifest by lines of the form part-tab-name; a last line without a newline
+// was cut short, and is ignored
+static void parseManifestParts(const std::string& manifest, std::set<std::string>& parts)
+{
+    const string PREFIX = "part\t";
+
+    size_t begin = 0;
+    size_t end = manifest.find('\n');
+    while (end != string::npos) {
+        if (manifest.compare(begin, PREFIX.length(), PREFIX) == 0 &&
+            end > begin + PREFIX.length()) {
+            parts.insert(manifest.substr(begin + PREFIX.length(), end - begin - PREFIX.length()));
+        }
+
+        begin = end + 1;
+        end = manifest.find('\n', begin);
+    }
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_checkpoint(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // a directory of this test only, removed at the end
+    const string dir = makeTempDir("checkpointTest");
+    const string layout = "rows\t10\n";
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Checkpoint::save
+    // Checkpoint::load
+    // Checkpoint::finish
+
+    {
+        // an earlier run saves two parts, then dies part way through a third
+        {
+            Checkpoint checkpoint(dir, false);
+            checkpoint.begin("checkpointTest", layout);
+            checkpoint.save("map.0", "EVEN\t4\n");
+            checkpoint.save("map.1", "ODD \t9\n");
+            checkpoint.flush();
+        }
+
+        {
+            ofstream manifest((dir + "/checkpointTest.checkpoint").c_str(), ios::app);
+            manifest << "part\tmap.";
+        }
+
+        // resuming the same job finds them, and saves more
+        string contents0;
+        string contents2;
+        Checkpoint checkpoint(dir, true);
+        checkpoint.begin("checkpointTest", layout);
+        bool resumed = checkpoint.load("map.0", contents0) && !checkpoint.load("map.", contents2);
+
+        checkpoint.save("map.2", "EVEN\t16\n");
+        checkpoint.flush();
+
+        ostringstream oss;
+        checkpoint.writeStats(oss, "checkpoint");
+        string outStr = oss.str();
+
+        // nothing left once the job has finished
+        checkpoint.finish();
+        bool removed = !ifstream((dir + "/checkpointTest.checkpoint").c_str()).is_open() &&
+                       !ifstream((dir + "/checkpointTest.map.2").c_str()).is_open();
+
+        if (resumed && contents0 == "EVEN\t4\n" && removed &&
+            outStr.find("checkpoint.loadedParts\t1\ncheckpoint.savedParts\t1\n") == 0) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Checkpoint::begin
+
+    {
+        {
+            Checkpoint checkpoint(dir, false);
+            checkpoint.begin("checkpointTest", layout);
+            checkpoint.save("map.0", "EVEN\t4\n");
+        }
+
+        // a different layout starts over, as does not resuming
+        string contents;
+        Checkpoint checkpoint(dir, true);
+        checkpoint.begin("checkpointTest", "rows\t20\n");
+        bool otherLayout = !checkpoint.load("map.0", contents) &&
+                           !ifstream((dir + "/checkpointTest.map.0").c_str()).is_open();
+
+        checkpoint.save("map.0", "EVEN\t4\n");
+        Checkpoint restart(dir, false);
+        restart.begin("checkpointTest", "rows\t20\n");
+        bool notResumed = !restart.load("map.0", contents);
+
+        restart.finish();
+
+        if (otherLayout && notResumed) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    removeDirFiles(dir);
+
+    if (verbose) {
+        cerr << "checkpoint.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_checkpoint(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Checkpoint::flush
+
+    try {
+        // no such directory
+        Checkpoint checkpoint("./checkpointTest.missing", false);
+        checkpoint.save("map.0", "EVEN\t4\n");
+        checkpoint.flush();
+
+    } catch (const runtime_error& x) {
+        if (verbose) {
+            cerr << "runtime_error: " << x.what() << endl;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+//
+//  checkpoint.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Checkpoints of a long calculation, so that a run that dies can be resumed without redoing the
+// parts that had finished. Each finished part (a chunk of map output, or a reduce thread's
+// results) is written to its own file by a background thread, then recorded in a manifest that
+// also describes the job, so that parts are only reused by a run of the same job.
+//
+
+#ifndef parallelCalc_checkpoint_h
+#define parallelCalc_checkpoint_h
+
+#include "shim.h"
+
+#include <deque>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+
+#if USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// ========== Class Declarations ===================================================================
+
+class Checkpoint {
+public:
+    // checkpoints in an existing directory, with map chunks of chunkRows rows; if resume, parts
+    // saved by an earlier run of the same job are used
+    Checkpoint(const std::string& directory, bool resume, int chunkRows = 128);
+
+    // waits for parts still being written
+    ~Checkpoint();
+
+    // rows per map chunk, so that a resumed run cuts its input at the same rows
+    int getChunkRows() const { return chunkRows; };
+
+    // start job jobName (usable as a file name), described by layout; parts saved by an earlier
+    // run are kept if resuming the same job with the same layout, and removed otherwise
+    void begin(const std::string& jobName, const std::string& layout);
+
+    // contents of a part saved by an earlier run of the job; false if there is none
+    bool load(const std::string& part, std::string& contents);
+
+    // write a part in the background, replacing any earlier one
+    void save(const std::string& part, const std::string& contents);
+
+    // wait until all parts passed to save have been written
+    void flush();
+
+    // remove the job's files once it has finished
+    void finish();
+
+    // write key/value lines <prefix>.loadedParts, .savedParts and .writeNsec (time spent writing
+    // in the background)
+    void writeStats(std::ostream& output, const std::string& prefix);
+
+protected:
+    // write queued parts until stopping, on the writer thread
+    void writeQueued();
+
+    // write a part to its file, then record it in the manifest
+    void writePart(const std::string& part, const std::string& contents);
+
+    std::string pathOf(const std::string& part) const;
+    std::string manifestPath() const;
+
+    std::string directory;
+    bool resume;
+    int chunkRows;
+    std::string jobName;
+    std::set<std::string> savedParts;   // parts with a complete file, listed in the manifest
+    long long loadedCount;              // counted under queueMutex, as map threads load parts
+    long long savedCount;
+    long long writeNanos;
+    bool writeFailed;
+
+#if USE_THREADS
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::deque< std::pair<std::string, std::string> > queue;
+    int writing;                        // parts taken from the queue but not yet written
+    bool stopping;
+    std::thread writer;
+#endif
+};
+
+// ========== Function Headers =====================================================================
+
+// component tests
+void ctest_checkpoint(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_checkpoint(bool verbose);
+
+#endif
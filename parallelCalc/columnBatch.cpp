@@ -0,0 +1,104 @@
+//
+//  columnBatch.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Rows of key-value data held as columns: a small key ID per row, from a dictionary of the
+// distinct keys, and a contiguous array of values. A row takes the size of an int and a value
+// instead of a std::string and a value, and loops over the values stream through a dense array
+// that compilers can vectorize and hardware can prefetch.
+//
+
+#include "columnBatch.h"
+
+#include <iostream>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_columnBatch(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ColumnBatch::append
+    // ColumnBatch::groupByKey
+
+    {
+        ColumnBatch<unsigned long> batch;
+        batch.append("ODD ", 1);
+        batch.append("EVEN", 2);
+        batch.append("ODD ", 3);
+        batch.append("EVEN", 4);
+        batch.append("ODD ", 5);
+
+        vector<int> keyOrder;
+        vector<size_t> keyBegins;
+        vector<unsigned long> grouped;
+        batch.groupByKey(keyOrder, keyBegins, grouped);
+
+        // EVEN sorts first, and each key's values keep their order
+        const unsigned long expected[] = {2, 4, 1, 3, 5};
+
+        if (batch.size() == 5 && batch.keyCount() == 2 && batch.keyName(keyOrder[0]) == "EVEN" &&
+            batch.keyName(keyOrder[1]) == "ODD " && keyBegins.size() == 3 && keyBegins[1] == 2 &&
+            keyBegins[2] == 5 && equal(grouped.begin(), grouped.end(), expected) &&
+            batch.rowBytes() == 5 * (sizeof(int) + sizeof(unsigned long))) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ColumnBatch::copyKeys
+
+    {
+        ColumnBatch<unsigned long> batch;
+        batch.append("b", 1);
+        batch.append("a", 2);
+
+        ColumnBatch<double> copy;
+        copy.copyKeys(batch);
+        copy.getValues()[1] = 0.5;
+        copy.append("a", 1.5);
+
+        if (copy.size() == 3 && copy.keyCount() == 2 && copy.getKeyIds()[2] == 1 &&
+            copy.getValues()[0] == 0 && copy.getValues()[1] == 0.5) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "columnBatch.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_columnBatch(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ColumnBatch::groupByKey
+
+    {
+        // no rows
+        ColumnBatch<int> batch;
+
+        vector<int> keyOrder;
+        vector<size_t> keyBegins;
+        vector<int> grouped;
+        batch.groupByKey(keyOrder, keyBegins, grouped);
+    }
+}
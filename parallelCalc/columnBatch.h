@@ -0,0 +1,159 @@
+//
+//  columnBatch.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Rows of key-value data held as columns: a small key ID per row, from a dictionary of the
+// distinct keys, and a contiguous array of values. A row takes the size of an int and a value
+// instead of a std::string and a value, and loops over the values stream through a dense array
+// that compilers can vectorize and hardware can prefetch.
+//
+
+#ifndef parallelCalc_columnBatch_h
+#define parallelCalc_columnBatch_h
+
+#include "shim.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// ========== Class Templates ======================================================================
+
+template <typename T> class ColumnBatch {
+public:
+    ColumnBatch() : keyNames(), keyIdsByName(), keyIds(), values() {};
+
+    void reserve(size_t rows);
+
+    // append a row, adding its key to the dictionary if it is new
+    void append(const std::string& key, T value);
+
+    // ID of a key, adding it to the dictionary if it is new
+    int keyId(const std::string& key);
+
+    // the same keys as other, row for row, each with the value T()
+    template <typename U> void copyKeys(const ColumnBatch<U>& other);
+
+    size_t size() const { return values.size(); };
+    size_t keyCount() const { return keyNames.size(); };
+
+    const std::string& keyName(int keyId) const { return keyNames[keyId]; };
+    const std::vector<std::string>& getKeyNames() const { return keyNames; };
+    const std::vector<int>& getKeyIds() const { return keyIds; };
+    const std::vector<T>& getValues() const { return values; };
+    std::vector<T>& getValues() { return values; };
+
+    // bytes held by the rows, not counting the dictionary
+    size_t rowBytes() const { return keyIds.size() * sizeof(int) + values.size() * sizeof(T); };
+
+    // the values of each key together, in order of key name, each key's in the order they were
+    // appended: keyOrder[k] is the ID of the k-th key, whose values are groupedValues[keyBegins[k]]
+    // up to groupedValues[keyBegins[k + 1]]
+    void groupByKey(std::vector<int>& keyOrder, std::vector<size_t>& keyBegins,
+                    std::vector<T>& groupedValues) const;
+
+protected:
+    std::vector<std::string> keyNames;          // by ID
+    std::map<std::string, int> keyIdsByName;
+    std::vector<int> keyIds;                    // per row
+    std::vector<T> values;                      // per row
+};
+
+// -------------------------------------------------------------------------------------------------
+
+template <typename T> void ColumnBatch<T>::reserve(size_t rows)
+{
+    keyIds.reserve(rows);
+    values.reserve(rows);
+}
+
+// append a row, adding its key to the dictionary if it is new
+template <typename T> void ColumnBatch<T>::append(const std::string& key, T value)
+{
+    keyIds.push_back(keyId(key));
+    values.push_back(value);
+}
+
+// ID of a key, adding it to the dictionary if it is new
+template <typename T> int ColumnBatch<T>::keyId(const std::string& key)
+{
+    std::map<std::string, int>::const_iterator iter = keyIdsByName.find(key);
+    if (iter != keyIdsByName.end()) {
+        return iter->second;
+    }
+
+    int id = (int)keyNames.size();
+    keyNames.push_back(key);
+    keyIdsByName.insert(std::make_pair(key, id));
+
+    return id;
+}
+
+// the same keys as other, row for row, each with the value T()
+template <typename T> template <typename U> void ColumnBatch<T>::copyKeys(
+    const ColumnBatch<U>& other)
+{
+    keyNames = other.getKeyNames();
+    keyIds = other.getKeyIds();
+    values.assign(keyIds.size(), T());
+
+    keyIdsByName.clear();
+    for (size_t k = 0; k < keyNames.size(); k++) {
+        keyIdsByName.insert(std::make_pair(keyNames[k], (int)k));
+    }
+}
+
+// the values of each key together, in order of key name, each key's in the order they were
+// appended: keyOrder[k] is the ID of the k-th key, whose values are groupedValues[keyBegins[k]] up
+// to groupedValues[keyBegins[k + 1]]
+template <typename T> void ColumnBatch<T>::groupByKey(std::vector<int>& keyOrder,
+                                                     std::vector<size_t>& keyBegins,
+                                                     std::vector<T>& groupedValues) const
+{
+    // the dictionary in order of name
+    keyOrder.clear();
+    std::map<std::string, int>::const_iterator iter = keyIdsByName.begin();
+    while (iter != keyIdsByName.end()) {
+        keyOrder.push_back(iter->second);
+
+        iter++;
+    }
+
+    // a counting sort by key, which keeps the order within a key
+    std::vector<size_t> counts(keyNames.size(), 0);
+    for (size_t k = 0; k < keyIds.size(); k++) {
+        counts[keyIds[k]]++;
+    }
+
+    std::vector<size_t> next(keyNames.size(), 0);
+    keyBegins.assign(1, 0);
+    for (size_t k = 0; k < keyOrder.size(); k++) {
+        next[keyOrder[k]] = keyBegins.back();
+        keyBegins.push_back(keyBegins.back() + counts[keyOrder[k]]);
+    }
+
+    groupedValues.resize(values.size());
+    for (size_t k = 0; k < values.size(); k++) {
+        groupedValues[next[keyIds[k]]++] = values[k];
+    }
+}
+
+// ========== Function Headers =====================================================================
+
+// component tests
+void ctest_columnBatch(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_columnBatch(bool verbose);
+
+#endif
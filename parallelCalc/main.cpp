@@ -38,14 +38,20 @@
 #endif
 
 #include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 
+#include "affinity.h"
+#include "bench.h"
+#include "mapCache.h"
+#include "phaseStats.h"
 #include "sumSquare.h"
 #include "test.h"
+#include "trace.h"
 #include "utils.h"
 
 using namespace std;
@@ -75,12 +81,53 @@ int main (int argc, const char * argv[])
     //  -start      send input rows to stdout
     //  -map        read rows from stdin, write mapped rows to stdout
     //  -reduce     read mapped rows from stdin, write reduced rows to stdout
+    //  -report     with -map or -reduce, write Hadoop streaming counters to stderr
+    //  -stream     read rows from stdin until it closes, write reduced rows for each window
+    //  -window     with -stream, rows per window (default 1000)
+    //  -window-ms  with -stream, msec of wall time per window instead
+    //  -slide      with -stream, rows or msec between the starts of windows, if they overlap
     //
-    //  -threads    number of threads to use with multithreading
+    //  -threads    number of threads to use with multithreading, or auto to choose the thread
+    //              count and chunk size from the CPUs available and a timed sample, calculating
+    //              directly if threads wouldn't pay
     //  -hadoop     use hadoop
     //  -fork       test fork
+    //  -incremental    calculate directly, keeping per-key partial results in a directory, so that
+    //                  a later run with more rows only calculates the new ones
+    //
+    //  -map-cache  with -threads, directory in which to keep map output per chunk of rows, so
+    //              that runs with unchanged starting data and map code only reduce
+    //  -map-cache-mb   size limit of -map-cache, least recently used chunks removed first
+    //  -checkpoint with -threads, directory in which to save map chunks and reduce results as
+    //              they finish, removed once the calculation is done
+    //  -resume     with -checkpoint, reuse what an interrupted run of the same job saved
+    //
+    //  -in-flight  with -threads or -bench, rows each map thread keeps waiting at once on the
+    //              delay, instead of sleeping through each row's
+    //  -queues     with -threads or -bench, pass mapped rows to the reduce threads through
+    //              lock-free queues as they are mapped; not with -affinity
+    //  -mem-limit  with -threads or -bench, megabytes of mapped rows the threads may hold
+    //              at once; map threads wait, and reduce threads spill, to stay within it.
+    //              Passes rows through queues as -queues does.
+    //  -spill      with -mem-limit, directory in which each run makes its own directory for
+    //              rows spilled by reduce threads (default .)
+    //
+    //  -affinity   with -threads, pin worker threads compact, scatter or numa; each map thread
+    //              generates its own rows
+    //
+    //  -bench      sweep modes, row and thread counts; write csv or json timing to stdout
+    //  -bench-rows     comma-separated row counts for -bench
+    //  -bench-threads  comma-separated thread counts for -bench
+    //  -bench-modes    comma-separated modes for -bench: workers,direct,threads,fork, or the
+    //                  queues alone, with rows as values and threads as producers: spsc,mpsc,locked
+    //  -warmup     untimed runs before each -bench measurement
+    //  -reps       timed runs for each -bench measurement
     //
     //  -v          verbose
+    //  -stats      write key/value run summary, including time per phase, to stderr
+    //  -perf       add hardware counters per phase to the run summary
+    //  -mem        add allocations and resident size per phase to the run summary
+    //  -trace      write timeline of phases and worker threads to file, in Chrome trace format
     //  -test       run tests
     
     int status = 1;
@@ -96,12 +143,38 @@ int main (int argc, const char * argv[])
         bool startFlag = false;
         bool mapFlag = false;
         bool reduceFlag = false;
+        bool streamFlag = false;
+        bool windowFlag = false;
+        bool slideFlag = false;
+        StreamWindow streamWindow;
         bool threadsFlag = false;
         int nthreads = 1;
+        bool threadsAutoFlag = false;
+        bool affinityFlag = false;
+        bool inFlightFlag = false;
+        bool queuesFlag = false;
+        bool memLimitFlag = false;
+        bool spillFlag = false;
+        bool checkpointFlag = false;
+        string checkpointDir;
+        bool resumeFlag = false;
+        bool mapCacheFlag = false;
+        string mapCacheDir;
+        int mapCacheMB = 256;
         bool hadoopFlag = false;
         bool forkFlag = false;
+        bool incrementalFlag = false;
+        string incrementalDir;
         bool testFlag = false;
         bool verboseFlag = false;
+        bool benchFlag = false;
+        BenchOptions benchOptions;
+        bool statsFlag = false;
+        bool perfFlag = false;
+        bool memFlag = false;
+        bool traceFlag = false;
+        string traceFile;
+        PhaseStats phaseStats;
         
         for (int index = 1; index < argc; index++) {
             if (strcmp(argv[index], "-n") == 0) {
@@ -131,6 +204,33 @@ int main (int argc, const char * argv[])
                 
             } else if (strcmp(argv[index], "-reduce") == 0) {
                 reduceFlag = true;
+                
+            } else if (strcmp(argv[index], "-stream") == 0) {
+                streamFlag = true;
+                
+            } else if (strcmp(argv[index], "-window") == 0 ||
+                       strcmp(argv[index], "-window-ms") == 0) {
+                
+                streamWindow.byTime = strcmp(argv[index], "-window-ms") == 0;
+                streamWindow.size = index + 1 < argc ? atoi(argv[++index]) : 0;
+                windowFlag = true;
+                
+                if (streamWindow.size <= 0 || streamWindow.size > 1000000000) {
+                    paramError = true;
+                    cerr << "-window value must be > 0 and <= 1000000000" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-slide") == 0) {
+                streamWindow.slide = index + 1 < argc ? atoi(argv[++index]) : 0;
+                slideFlag = true;
+                
+                if (streamWindow.slide <= 0 || streamWindow.slide > 1000000000) {
+                    paramError = true;
+                    cerr << "-slide value must be > 0 and <= 1000000000" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-report") == 0) {
+                calc->setReport(&cerr);
 
 #if USE_HADOOP
             } else if (strcmp(argv[index], "-hadoop") == 0) {
@@ -140,10 +240,99 @@ int main (int argc, const char * argv[])
             } else if (strcmp(argv[index], "-fork") == 0) {
                 forkFlag = true;
                 
+            } else if (strcmp(argv[index], "-incremental") == 0) {
+                incrementalFlag = true;
+                if (index + 1 < argc) {
+                    incrementalDir = argv[++index];
+                    
+                } else {
+                    paramError = true;
+                    cerr << "-incremental requires a directory" << endl;
+                }
+                
             } else if (strcmp(argv[index], "-test") == 0) {
                 testFlag = true;
                 
+            } else if (strcmp(argv[index], "-bench") == 0) {
+                string format = index + 1 < argc ? argv[++index] : "";
+                benchFlag = true;
+                if (format == "json") {
+                    benchOptions.json = true;
+                    
+                } else if (format != "csv") {
+                    paramError = true;
+                    cerr << "-bench value must be csv or json" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-bench-rows") == 0) {
+                benchOptions.rowCounts.clear();
+                bool valid = index + 1 < argc &&
+                             parseIntList(argv[++index], benchOptions.rowCounts);
+                for (size_t k = 0; k < benchOptions.rowCounts.size(); k++) {
+                    if (benchOptions.rowCounts[k] <= 0 || benchOptions.rowCounts[k] > 10000000) {
+                        valid = false;
+                    }
+                }
+                
+                if (!valid) {
+                    paramError = true;
+                    cerr << "-bench-rows values must be > 0 and <= 10000000" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-bench-threads") == 0) {
+                benchOptions.threadCounts.clear();
+                bool valid = index + 1 < argc &&
+                             parseIntList(argv[++index], benchOptions.threadCounts);
+                for (size_t k = 0; k < benchOptions.threadCounts.size(); k++) {
+                    if (benchOptions.threadCounts[k] <= 0 || benchOptions.threadCounts[k] > 64) {
+                        valid = false;
+                    }
+                }
+                
+                if (!valid) {
+                    paramError = true;
+                    cerr << "-bench-threads values must be > 0 and <= 64" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-bench-modes") == 0) {
+                benchOptions.modes.clear();
+                if (index + 1 < argc) {
+                    parseStringList(argv[++index], benchOptions.modes);
+                }
+                
+                for (size_t k = 0; k < benchOptions.modes.size(); k++) {
+                    const string& mode = benchOptions.modes[k];
+                    bool threadsMode = mode == "threads" || mode == "spsc" || mode == "mpsc" ||
+                                       mode == "locked";
+                    if (mode != "workers" && mode != "direct" && mode != "fork" &&
+                        (!threadsMode || !USE_THREADS)) {
+                        
+                        paramError = true;
+                        cerr << "unknown -bench-modes value " << mode << endl;
+                    }
+                }
+                
+            } else if (strcmp(argv[index], "-warmup") == 0) {
+                benchOptions.warmup = index + 1 < argc ? atoi(argv[++index]) : -1;
+                if (benchOptions.warmup < 0 || benchOptions.warmup > 1000) {
+                    paramError = true;
+                    cerr << "-warmup value must be >= 0 and <= 1000" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-reps") == 0) {
+                benchOptions.reps = index + 1 < argc ? atoi(argv[++index]) : 0;
+                if (benchOptions.reps <= 0 || benchOptions.reps > 1000) {
+                    paramError = true;
+                    cerr << "-reps value must be > 0 and <= 1000" << endl;
+                }
+                
 #if USE_THREADS
+            } else if (strcmp(argv[index], "-threads") == 0 && index + 1 < argc &&
+                       strcmp(argv[index + 1], "auto") == 0) {
+                index++;
+                threadsFlag = true;
+                threadsAutoFlag = true;
+                
             } else if (strcmp(argv[index], "-threads") == 0) {
                 nthreads = atoi(argv[++index]);
                 if (nthreads < 0 || nthreads > 64) {
@@ -153,12 +342,109 @@ int main (int argc, const char * argv[])
                 } else {
                     threadsFlag = true;
                 }
+                
+            } else if (strcmp(argv[index], "-in-flight") == 0) {
+                int mapInFlight = index + 1 < argc ? atoi(argv[++index]) : 0;
+                inFlightFlag = true;
+                
+                if (mapInFlight <= 0 || mapInFlight > 100000) {
+                    paramError = true;
+                    cerr << "-in-flight value must be > 0 and <= 100000" << endl;
+                    
+                } else {
+                    calc->setMapInFlight(mapInFlight);
+                }
+                
+            } else if (strcmp(argv[index], "-queues") == 0) {
+                calc->setShuffleQueues(true);
+                queuesFlag = true;
+                
+            } else if (strcmp(argv[index], "-mem-limit") == 0) {
+                int memLimitMB = index + 1 < argc ? atoi(argv[++index]) : 0;
+                memLimitFlag = true;
+                
+                if (memLimitMB <= 0 || memLimitMB > 1000000) {
+                    paramError = true;
+                    cerr << "-mem-limit value must be > 0 and <= 1000000" << endl;
+                    
+                } else {
+                    calc->setMemoryLimit(memLimitMB * 1024LL * 1024LL);
+                }
+                
+            } else if (strcmp(argv[index], "-spill") == 0) {
+                string spillDir = index + 1 < argc ? argv[++index] : "";
+                spillFlag = true;
+                
+                if (spillDir.empty()) {
+                    paramError = true;
+                    cerr << "-spill requires a directory" << endl;
+                    
+                } else {
+                    calc->setSpillDirectory(spillDir);
+                }
+                
+            } else if (strcmp(argv[index], "-checkpoint") == 0) {
+                checkpointDir = index + 1 < argc ? argv[++index] : "";
+                checkpointFlag = true;
+                
+                if (checkpointDir.empty()) {
+                    paramError = true;
+                    cerr << "-checkpoint requires a directory" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-resume") == 0) {
+                resumeFlag = true;
+                
+            } else if (strcmp(argv[index], "-map-cache") == 0) {
+                mapCacheDir = index + 1 < argc ? argv[++index] : "";
+                mapCacheFlag = true;
+                
+                if (mapCacheDir.empty()) {
+                    paramError = true;
+                    cerr << "-map-cache requires a directory" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-map-cache-mb") == 0) {
+                mapCacheMB = index + 1 < argc ? atoi(argv[++index]) : 0;
+                if (mapCacheMB <= 0 || mapCacheMB > 1000000) {
+                    paramError = true;
+                    cerr << "-map-cache-mb value must be > 0 and <= 1000000" << endl;
+                }
+                
+            } else if (strcmp(argv[index], "-affinity") == 0) {
+                AffinityPolicy affinity = AFFINITY_NONE;
+                if (index + 1 >= argc || !parseAffinityPolicy(argv[++index], affinity)) {
+                    paramError = true;
+                    cerr << "-affinity value must be compact, scatter, numa or none" << endl;
+                    
+                } else {
+                    calc->setAffinity(affinity);
+                    affinityFlag = true;
+                }
 #endif
                 
             } else if (strcmp(argv[index], "-v") == 0) {
                 calc->setVerbose(true);
                 verboseFlag = true; 
                 
+            } else if (strcmp(argv[index], "-stats") == 0) {
+                calc->setStats(&cerr);
+                statsFlag = true;
+                
+            } else if (strcmp(argv[index], "-perf") == 0) {
+                perfFlag = true;
+                
+            } else if (strcmp(argv[index], "-mem") == 0) {
+                memFlag = true;
+                
+            } else if (strcmp(argv[index], "-trace") == 0) {
+                traceFile = index + 1 < argc ? argv[++index] : "";
+                traceFlag = true;
+                if (traceFile.empty()) {
+                    paramError = true;
+                    cerr << "-trace value must be a file name" << endl;
+                }
+                
             } else {
                 printUsage = true;
             }
@@ -169,21 +455,128 @@ int main (int argc, const char * argv[])
         if (startFlag) atMostOne++;
         if (mapFlag) atMostOne++;
         if (reduceFlag) atMostOne++;
+        if (streamFlag) atMostOne++;
         if (threadsFlag) atMostOne++;
         if (hadoopFlag) atMostOne++;
         if (forkFlag) atMostOne++;
+        if (incrementalFlag) atMostOne++;
+        if (benchFlag) atMostOne++;
         
         if (atMostOne > 1) {
             paramError = true;
-            cerr << "use at most one of -start -map -reduce -hadoop -threads -fork" << endl;
+            cerr << "use at most one of -start -map -reduce -stream -hadoop -threads -fork";
+            cerr << " -incremental -bench" << endl;
         }
         
-        if (testFlag && (startFlag || mapFlag || reduceFlag || threadsFlag || forkFlag ||
-                         nrowsFlag || delayFlag)) {
+        if (testFlag && (startFlag || mapFlag || reduceFlag || streamFlag || threadsFlag ||
+                         forkFlag || incrementalFlag || benchFlag || nrowsFlag || delayFlag)) {
             paramError = true;
             cerr << "-test can only be combined with -hadoop or -v" << endl;
         }
         
+        // tumbling windows unless a slide is given
+        if (!slideFlag) {
+            streamWindow.slide = streamWindow.size;
+        }
+        
+        if ((windowFlag || slideFlag) && !streamFlag) {
+            paramError = true;
+            cerr << "-window, -window-ms and -slide require -stream" << endl;
+            
+        } else if (streamWindow.slide > 0 && streamWindow.size % streamWindow.slide != 0) {
+            paramError = true;
+            cerr << "-window value must be a multiple of -slide value" << endl;
+        }
+        
+        if (affinityFlag && (!threadsFlag || nthreads == 0)) {
+            paramError = true;
+            cerr << "-affinity requires -threads with at least one thread" << endl;
+        }
+        
+        if (inFlightFlag && !threadsFlag && !benchFlag) {
+            paramError = true;
+            cerr << "-in-flight requires -threads or -bench" << endl;
+        }
+        
+        if (queuesFlag && !threadsFlag && !benchFlag) {
+            paramError = true;
+            cerr << "-queues requires -threads or -bench" << endl;
+        }
+        
+        if (queuesFlag && (mapCacheFlag || checkpointFlag || affinityFlag)) {
+            paramError = true;
+            cerr << "-queues can't be combined with -map-cache, -checkpoint or -affinity" << endl;
+        }
+        
+        if (memLimitFlag && !threadsFlag && !benchFlag) {
+            paramError = true;
+            cerr << "-mem-limit requires -threads or -bench" << endl;
+        }
+        
+        if (memLimitFlag && (mapCacheFlag || checkpointFlag || affinityFlag)) {
+            paramError = true;
+            cerr << "-mem-limit can't be combined with -map-cache, -checkpoint or -affinity";
+            cerr << endl;
+        }
+        
+        if (spillFlag && !memLimitFlag) {
+            paramError = true;
+            cerr << "-spill requires -mem-limit" << endl;
+        }
+        
+        if (checkpointFlag && (!threadsFlag || nthreads == 0)) {
+            paramError = true;
+            cerr << "-checkpoint requires -threads with at least one thread" << endl;
+        }
+        
+        if (resumeFlag && !checkpointFlag) {
+            paramError = true;
+            cerr << "-resume requires -checkpoint" << endl;
+        }
+        
+        if (mapCacheFlag && !threadsFlag) {
+            paramError = true;
+            cerr << "-map-cache requires -threads" << endl;
+        }
+        
+        if (traceFlag && (testFlag || benchFlag)) {
+            paramError = true;
+            cerr << "-trace can't be combined with -test or -bench" << endl;
+        }
+        
+        // per-phase timing of the calculation, written as a summary or recorded in the trace
+        bool summaryFlag = verboseFlag || statsFlag || perfFlag || memFlag;
+        bool phaseFlag = (summaryFlag || traceFlag) && !testFlag && !benchFlag;
+        if (phaseFlag) {
+            calc->setPhaseStats(&phaseStats);
+        }
+        
+        if (traceFlag && !paramError) {
+            traceEnable();
+            traceThreadName("main");
+        }
+        
+        // hardware counters per phase; row count is unknown to -map and -reduce
+        if (phaseFlag && perfFlag) {
+            phaseStats.enablePerf();
+            
+            if (!mapFlag && !reduceFlag) {
+                phaseStats.setRows(nrows);
+            }
+            
+            if (verboseFlag && !phaseStats.isPerfAvailable()) {
+                cerr << "hardware counters not available (see perf_event_paranoid)" << endl;
+            }
+        }
+        
+        // allocations and resident size per phase
+        if (phaseFlag && memFlag) {
+            phaseStats.enableMemory();
+        }
+        
+        // each mode sets the exit status from its own result
+        status = 0;
+        
         if (paramError) {
             // skip
             
@@ -212,6 +605,15 @@ int main (int argc, const char * argv[])
             cerr << (status ? "FAILURE " : "OK ");
             cerr << fixed << setprecision(3) << 0.001 * (endTime - startTime) << " seconds" << endl;
             
+        } else if (incrementalFlag) {
+            long long startTime = millisecondTime();
+            
+            status = calc->incrementalDirect(nrows, incrementalDir, cout);
+            
+            long long endTime = millisecondTime();
+            cerr << (status ? "FAILURE " : "OK ");
+            cerr << fixed << setprecision(3) << 0.001 * (endTime - startTime) << " seconds" << endl;
+            
         } else if (hadoopFlag) {
             long long startTime = millisecondTime();
             
@@ -222,9 +624,28 @@ int main (int argc, const char * argv[])
             cerr << fixed << setprecision(3) << 0.001 * (endTime - startTime) << " seconds" << endl;
             
         } else if (threadsFlag) {
+            // system-wide NUMA allocation counters around the run, to compare placements
+            NumaCounts numaStart;
+            bool numaFlag = summaryFlag && sampleNumaCounts(numaStart);
+            
+            MapCache *mapCache = NULL;
+            if (mapCacheFlag) {
+                mapCache = new MapCache(mapCacheDir, mapCacheMB * 1024LL * 1024LL);
+                calc->setMapCache(mapCache);
+            }
+            
+            Checkpoint *checkpoint = NULL;
+            if (checkpointFlag) {
+                checkpoint = new Checkpoint(checkpointDir, resumeFlag);
+                calc->setCheckpoint(checkpoint);
+            }
+            
             long long startTime = millisecondTime();
             
-            if (nthreads == 0) {
+            if (threadsAutoFlag) {
+                status = calc->multiThreadAuto(nrows, cout);
+                
+            } else if (nthreads == 0) {
                 // for testing direct access methods
                 status = calc->singleThreadDirect(nrows, cout);
                 
@@ -236,26 +657,79 @@ int main (int argc, const char * argv[])
             cerr << (status ? "FAILURE " : "OK ");
             cerr << fixed << setprecision(3) << 0.001 * (endTime - startTime) << " seconds" << endl;
             
+            if (summaryFlag && affinityFlag) {
+                AffinityPlan plan(calc->getAffinity());
+                writeKeyValue<string>(cerr, "affinity.policy", affinityName(plan.getPolicy()));
+                writeKeyValue<int>(cerr, "affinity.nodes", plan.getNodeCount());
+            }
+            
+            NumaCounts numaEnd;
+            if (numaFlag && sampleNumaCounts(numaEnd)) {
+                numaEnd.since(numaStart).write(cerr, "numa");
+            }
+            
+            // saves the cache's index
+            if (mapCache != NULL) {
+                if (summaryFlag) {
+                    mapCache->writeStats(cerr, "mapCache");
+                }
+                
+                calc->setMapCache(NULL);
+                delete mapCache;
+            }
+            
+            // waits for parts still being written
+            if (checkpoint != NULL) {
+                if (summaryFlag) {
+                    checkpoint->writeStats(cerr, "checkpoint");
+                }
+                
+                calc->setCheckpoint(NULL);
+                delete checkpoint;
+            }
+            
+        } else if (benchFlag) {
+            status = bench(*calc, benchOptions, cout);
+            
         } else if (startFlag) {
+            ScopedPhase scopedPhase(calc->getPhaseStats(), PHASE_START);
             status = calc->startWorker(nrows, cout);
             
         } else if (mapFlag) {
+            ScopedPhase scopedPhase(calc->getPhaseStats(), PHASE_MAP);
             status = calc->mapWorker(cin, cout);
             
         } else if (reduceFlag) {
+            ScopedPhase scopedPhase(calc->getPhaseStats(), PHASE_REDUCE);
             status = calc->reduceWorker(cin, cout);
+            
+        } else if (streamFlag) {
+            status = calc->streamWorker(cin, cout, streamWindow);
         }
         
-        status = 0;
+        if (traceFlag && !paramError && !printUsage) {
+            traceDisable();
+            
+            ofstream traceOutput(traceFile.c_str());
+            RUNTIME_ERROR_IF(!traceOutput.is_open(), "can't open trace file " + traceFile);
+            traceWrite(traceOutput);
+        }
+        
+        if (phaseFlag && summaryFlag && !paramError && !printUsage) {
+            phaseStats.write(cerr, "phase");
+        }
         
     } catch (const logic_error& x) {
         std::cerr << "logic_error: " << x.what() << endl;
+        status = 1;
         
     } catch (const runtime_error& x) {
         std::cerr << "runtime_error: " << x.what() << endl;
+        status = 1;
         
     } catch (...) {
         std::cerr << "unknown error" << endl;
+        status = 1;
     }
     
     return status;
@@ -283,10 +757,21 @@ void usage()
     "  -d       additional delay per map calculation in milliseconds" << endl <<
     "  -start   send input rows to stdout" << endl <<
     "  -map     read rows from stdin, write mapped rows to stdout" << endl <<
-    "  -reduce  read mapped rows from stdin, write reduced rows to stdout" << endl;
+    "  -reduce  read mapped rows from stdin, write reduced rows to stdout" << endl <<
+    "  -report  with -map or -reduce, write Hadoop streaming counters to stderr" << endl <<
+    "  -stream  read rows from stdin until it closes, write reduced rows for each window" << endl <<
+    "           [-window <nrows> | -window-ms <msec>] [-slide <nrows | msec>]" << endl;
     
 #if USE_THREADS
-    cerr << "  -threads number of threads to use with multithreading" << endl;
+    cerr << "  -threads number of threads to use with multithreading, or auto" << endl;
+    cerr << "  -affinity <compact | scatter | numa> pin threads; each generates its own rows";
+    cerr << endl;
+    cerr << "  -in-flight <n> rows each map thread keeps waiting on the delay at once" << endl;
+    cerr << "  -queues  pass mapped rows to reduce threads through queues as they are mapped";
+    cerr << endl;
+    cerr << "  -mem-limit <mb> bound the mapped rows threads hold at once [-spill <dir>]" << endl;
+    cerr << "  -map-cache <dir> reuse map output of unchanged chunks [-map-cache-mb <n>]" << endl;
+    cerr << "  -checkpoint <dir> save finished chunks as the run goes [-resume]" << endl;
 #endif
 
 #if USE_HADOOP
@@ -294,6 +779,28 @@ void usage()
 #endif
     
     cerr << "  -fork    call command-line tools" << endl;
+    cerr << "  -incremental <dir> keep partial results in dir; later runs only add new rows";
+    cerr << endl;
+    
+    cerr << "  -bench   <csv | json> sweep modes, row and thread counts, write timing to stdout";
+    cerr << endl;
+    cerr << "           [-bench-rows <n,...>] [-bench-modes <workers,direct,threads,fork>]";
+    cerr << endl;
+    
+#if USE_THREADS
+    cerr << "           [-bench-threads <n,...>]";
+#endif
+    
+    cerr << " [-warmup <n>] [-reps <n>]" << endl;
+    
+#if USE_THREADS
+    cerr << "           -bench-modes <spsc,mpsc,locked> times the queues alone" << endl;
+#endif
     
     cerr << "  -v       verbose" << endl;
+    cerr << "  -stats   write key/value run summary, including time per phase, to stderr" << endl;
+    cerr << "  -perf    add hardware counters per phase (IPC, misses per row) to run summary";
+    cerr << endl;
+    cerr << "  -mem     add allocations and resident size per phase to run summary" << endl;
+    cerr << "  -trace   <file> write timeline of phases and threads as Chrome trace JSON" << endl;
 }
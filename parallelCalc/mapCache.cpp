@@ -0,0 +1,478 @@
+//
+//  mapCache.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// On-disk cache of map output per chunk of input rows, addressed by the calculation's name, the
+// version of its map code and a hash of the chunk's starting data, so that a run whose map hasn't
+// changed only needs to reduce. Each entry is a file in the cache directory; an index file keeps
+// their sizes and order of last use, and the least recently used are removed when the total size
+// would exceed the limit. Entry files are read and written outside the cache's lock, so that map
+// threads only wait for each other to update the index in memory, which is saved every so many
+// stores and when the cache is destroyed.
+//
+
+#include <fstream>  // must precede .h includes
+
+#include "mapCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "calc.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Constants ============================================================================
+
+// index of entries, in the cache directory
+static const char *INDEX_NAME = "mapCache.index";
+
+// stores between saves of the index, so that saving isn't a rewrite of it for every chunk
+static const int INDEX_SAVE_STORES = 64;
+
+// ========== Classes ==============================================================================
+
+// cache in an existing directory, holding at most maxBytes of entries, for chunks of chunkRows
+// rows; reads the index left by earlier runs
+MapCache::MapCache(const std::string& directory, long long maxBytes, int chunkRows) :
+directory(directory),
+maxBytes(maxBytes),
+chunkRows(chunkRows),
+totalBytes(0),
+entries(),
+uses(),
+storesSinceSave(0),
+hits(0),
+misses(0),
+stores(0),
+evictions(0)
+{
+    LOGIC_ERROR_IF(chunkRows <= 0, "map cache chunks must have at least one row");
+
+    // lines of the form <entry> <tab> <bytes> <order of use>; a missing index is an empty cache
+    ifstream index(pathOf(INDEX_NAME).c_str());
+
+    vector< pair< long long, pair<string, long long> > > indexed;
+
+    string line;
+    while (getline(index, line)) {
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            continue;
+        }
+
+        long long bytes;
+        long long lastUse;
+        istringstream iss(line.substr(tab + 1));
+        if (iss >> bytes >> lastUse) {
+            indexed.push_back(make_pair(lastUse, make_pair(line.substr(0, tab), bytes)));
+        }
+    }
+
+    sort(indexed.begin(), indexed.end());
+
+    for (size_t k = 0; k < indexed.size(); k++) {
+        Entry& cached = touch(indexed[k].second.first);
+        totalBytes += indexed[k].second.second - cached.bytes;
+        cached.bytes = indexed[k].second.second;
+    }
+}
+
+// saves the index
+MapCache::~MapCache()
+{
+    save();
+}
+
+// name of the entry for a chunk of starting data; inputDigest is from contentDigest
+std::string MapCache::entryName(const std::string& calcName, int mapVersion,
+                                const std::string& inputDigest)
+{
+    ostringstream oss;
+    oss << calcName << ".v" << mapVersion << "." << inputDigest;
+
+    return oss.str();
+}
+
+// set contents to the entry and mark it as most recently used; false if it isn't cached
+bool MapCache::load(const std::string& entry, std::string& contents)
+{
+    // read before locking, so that other threads can use the cache meanwhile
+    ostringstream oss;
+    bool found = false;
+    {
+        ifstream input(pathOf(entry).c_str(), ios::binary);
+        if (input.is_open()) {
+            oss << input.rdbuf();
+            found = true;
+        }
+    }
+
+#if USE_THREADS
+    lock_guard<mutex> lock(entriesMutex);
+#endif
+
+    if (!found) {
+        // removed from the directory since the index was written
+        map<string, Entry>::iterator iter = entries.find(entry);
+        if (iter != entries.end()) {
+            totalBytes -= iter->second.bytes;
+            uses.erase(iter->second.use);
+            entries.erase(iter);
+        }
+
+        misses++;
+        return false;
+    }
+
+    contents = oss.str();
+
+    // a file left by a run that stopped before saving the index is adopted
+    Entry& cached = touch(entry);
+    totalBytes += (long long)contents.length() - cached.bytes;
+    cached.bytes = contents.length();
+
+    hits++;
+    return true;
+}
+
+// add or replace an entry, then remove the least recently used until the total size is within the
+// limit; entries larger than the limit aren't stored
+void MapCache::store(const std::string& entry, const std::string& contents)
+{
+    if ((long long)contents.length() > maxBytes) {
+        return;
+    }
+
+    // written, before locking, to a temporary file of this store's own, then renamed, so that a
+    // crash can't leave half an entry
+    string path = pathOf(entry);
+    string tempPath = makeTempFile(path);
+
+    bool written;
+    {
+        ofstream output(tempPath.c_str(), ios::binary);
+        output << contents;
+        written = output.is_open() && !output.fail();
+    }
+
+    if (!written) {
+        remove(tempPath.c_str());
+    }
+
+    RUNTIME_ERROR_IF(!written, "can't write map cache entry " + tempPath);
+
+    bool saveIndex;
+    {
+#if USE_THREADS
+        lock_guard<mutex> lock(entriesMutex);
+#endif
+
+        // Windows won't rename over an existing file
+        remove(path.c_str());
+        if (rename(tempPath.c_str(), path.c_str()) != 0) {
+            remove(tempPath.c_str());
+            RUNTIME_ERROR_IF(true, "can't write map cache entry " + path);
+        }
+
+        Entry& cached = touch(entry);
+        totalBytes += (long long)contents.length() - cached.bytes;
+        cached.bytes = contents.length();
+        stores++;
+
+        evict();
+
+        saveIndex = ++storesSinceSave >= INDEX_SAVE_STORES;
+    }
+
+    if (saveIndex) {
+        save();
+    }
+}
+
+// remove all entries and the index
+void MapCache::clear()
+{
+    {
+#if USE_THREADS
+        lock_guard<mutex> lock(entriesMutex);
+#endif
+
+        map<string, Entry>::const_iterator iter = entries.begin();
+        while (iter != entries.end()) {
+            remove(pathOf(iter->first).c_str());
+
+            iter++;
+        }
+
+        entries.clear();
+        uses.clear();
+        totalBytes = 0;
+    }
+
+    save();
+}
+
+// write the index, so that the next run knows the order of use, or remove it if there are no
+// entries; false if it can't be written. Called on destruction and every INDEX_SAVE_STORES stores.
+bool MapCache::save()
+{
+#if USE_THREADS
+    lock_guard<mutex> saveLock(saveMutex);
+#endif
+
+    // a copy of the index, in order of use, written after unlocking
+    ostringstream index;
+    {
+#if USE_THREADS
+        lock_guard<mutex> lock(entriesMutex);
+#endif
+
+        long long lastUse = 0;
+        list<string>::const_iterator iter = uses.begin();
+        while (iter != uses.end()) {
+            index << *iter << '\t' << entries[*iter].bytes << ' ' << ++lastUse << '\n';
+
+            iter++;
+        }
+
+        storesSinceSave = 0;
+    }
+
+    string path = pathOf(INDEX_NAME);
+    string tempPath = path + ".tmp";
+
+    // an empty cache leaves nothing behind
+    if (index.str().empty()) {
+        remove(path.c_str());
+        return true;
+    }
+
+    {
+        ofstream output(tempPath.c_str());
+        if (!output.is_open()) {
+            return false;
+        }
+
+        output << index.str();
+
+        if (output.fail()) {
+            return false;
+        }
+    }
+
+    remove(path.c_str());
+
+    return rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+// write key/value lines <prefix>.hits, .misses, .stores, .evictions, .entries and .bytes
+void MapCache::writeStats(std::ostream& output, const std::string& prefix)
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(entriesMutex);
+#endif
+
+    writeKeyValue<long long>(output, prefix + ".hits", hits);
+    writeKeyValue<long long>(output, prefix + ".misses", misses);
+    writeKeyValue<long long>(output, prefix + ".stores", stores);
+    writeKeyValue<long long>(output, prefix + ".evictions", evictions);
+    writeKeyValue<size_t>(output, prefix + ".entries", entries.size());
+    writeKeyValue<long long>(output, prefix + ".bytes", totalBytes);
+}
+
+// the entry, added if it's new, moved to the most recently used end of uses
+MapCache::Entry& MapCache::touch(const std::string& entry)
+{
+    map<string, Entry>::iterator iter = entries.find(entry);
+
+    if (iter == entries.end()) {
+        Entry added;
+        added.bytes = 0;
+        added.use = uses.insert(uses.end(), entry);
+
+        return entries.insert(make_pair(entry, added)).first->second;
+    }
+
+    uses.splice(uses.end(), uses, iter->second.use);
+
+    return iter->second;
+}
+
+// remove least recently used entries until the total size is within maxBytes
+void MapCache::evict()
+{
+    while (totalBytes > maxBytes && !uses.empty()) {
+        map<string, Entry>::iterator oldest = entries.find(uses.front());
+
+        remove(pathOf(oldest->first).c_str());
+        totalBytes -= oldest->second.bytes;
+        entries.erase(oldest);
+        uses.pop_front();
+        evictions++;
+    }
+}
+
+std::string MapCache::pathOf(const std::string& entry) const
+{
+    return directory + "/" + entry;
+}
+
+// ========== Functions ============================================================================
+
+// hash and length of data, in the form <16 hex digits>-<decimal length>
+std::string contentDigest(const std::string& data)
+{
+    ostringstream oss;
+    oss << hex << setw(16) << setfill('0') << fnv1aHash(data.data(), data.length());
+    oss << dec << "-" << data.length();
+
+    return oss.str();
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_mapCache(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // a directory of this test only, removed at the end
+    const string dir = makeTempDir("mapCacheTest");
+    const string entry1 = MapCache::entryName("mapCacheTest", 1, contentDigest("a"));
+    const string entry2 = MapCache::entryName("mapCacheTest", 1, contentDigest("b"));
+    const string entry3 = MapCache::entryName("mapCacheTest", 2, contentDigest("a"));
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // contentDigest
+    // MapCache::entryName
+
+    {
+        if (contentDigest("") == "cbf29ce484222325-0" && contentDigest("a") != contentDigest("b") &&
+            entry1 == "mapCacheTest.v1." + contentDigest("a") && entry1 != entry3) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MapCache::load
+    // MapCache::store
+
+    {
+        // room for two entries of 10 bytes
+        MapCache cache(dir, 25);
+
+        string contents;
+        bool missed = !cache.load(entry1, contents);
+
+        cache.store(entry1, "0123456789");
+        cache.store(entry2, "abcdefghij");
+        bool hit = cache.load(entry1, contents) && contents == "0123456789";
+
+        // entry2 is now least recently used
+        cache.store(entry3, "ABCDEFGHIJ");
+
+        string contents2;
+        string contents3;
+        bool evicted = !cache.load(entry2, contents2) && cache.load(entry3, contents3) &&
+                       contents3 == "ABCDEFGHIJ";
+
+        // too large to keep
+        cache.store(entry2, string(30, 'x'));
+
+        ostringstream oss;
+        cache.writeStats(oss, "mapCache");
+        string outStr = oss.str();
+
+        if (missed && hit && evicted && !cache.load(entry2, contents2) &&
+            outStr == "mapCache.hits\t2\nmapCache.misses\t2\nmapCache.stores\t3\n"
+                      "mapCache.evictions\t1\nmapCache.entries\t2\nmapCache.bytes\t20\n") passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MapCache::MapCache
+    // MapCache::clear
+
+    {
+        // the index is read by the next cache in the same directory, which evicts in the same
+        // order: entry1 before entry3
+        string contents;
+        MapCache cache(dir, 25);
+        cache.store(entry2, "abcdefghij");
+
+        bool reordered = !cache.load(entry1, contents) && cache.load(entry3, contents);
+
+        cache.clear();
+
+        if (reordered && !cache.load(entry2, contents) &&
+            !ifstream((dir + "/" + INDEX_NAME).c_str()).is_open()) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // writeCompacted
+    // readCompacted
+
+    {
+        multimap<string, unsigned long> pairs;
+        pairs.insert(make_pair("ODD ", 1UL));
+        pairs.insert(make_pair("EVEN", 4UL));
+        pairs.insert(make_pair("ODD ", 9UL));
+
+        ostringstream oss;
+        writeCompacted(oss, pairs);
+        string outStr = oss.str();
+
+        multimap<string, unsigned long> readPairs;
+        istringstream iss(outStr);
+        bool valid = readCompacted(iss, readPairs);
+
+        istringstream bad("EVEN\t4 x\n");
+        bool invalid = !readCompacted(bad, readPairs);
+
+        if (outStr == "EVEN\t4\nODD \t1 9\n" && valid && invalid && readPairs == pairs) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    removeDirFiles(dir);
+
+    if (verbose) {
+        cerr << "mapCache.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_mapCache(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MapCache::MapCache
+
+    try {
+        MapCache cache(".", 0, 0);
+
+    } catch (const logic_error& x) {
+        if (verbose) {
+            cerr << "logic_error: " << x.what() << endl;
+        }
+    }
+}
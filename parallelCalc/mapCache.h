@@ -0,0 +1,179 @@
+//
+//  mapCache.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// On-disk cache of map output per chunk of input rows, addressed by the calculation's name, the
+// version of its map code and a hash of the chunk's starting data, so that a run whose map hasn't
+// changed only needs to reduce. Each entry is a file in the cache directory; an index file keeps
+// their sizes and order of last use, and the least recently used are removed when the total size
+// would exceed the limit. Entry files are read and written outside the cache's lock, so that map
+// threads only wait for each other to update the index in memory, which is saved every so many
+// stores and when the cache is destroyed.
+//
+
+#ifndef parallelCalc_mapCache_h
+#define parallelCalc_mapCache_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+
+#if USE_THREADS
+#include <mutex>
+#endif
+
+// ========== Class Declarations ===================================================================
+
+class MapCache {
+public:
+    // cache in an existing directory, holding at most maxBytes of entries, for chunks of chunkRows
+    // rows; reads the index left by earlier runs
+    MapCache(const std::string& directory, long long maxBytes, int chunkRows = 128);
+
+    // saves the index
+    ~MapCache();
+
+    // rows per chunk, for callers to cut their input at the same rows on every run
+    int getChunkRows() const { return chunkRows; };
+
+    // name of the entry for a chunk of starting data; inputDigest is from contentDigest
+    static std::string entryName(const std::string& calcName, int mapVersion,
+                                 const std::string& inputDigest);
+
+    // set contents to the entry and mark it as most recently used; false if it isn't cached
+    bool load(const std::string& entry, std::string& contents);
+
+    // add or replace an entry, then remove the least recently used until the total size is
+    // within the limit; entries larger than the limit aren't stored
+    void store(const std::string& entry, const std::string& contents);
+
+    // remove all entries and the index
+    void clear();
+
+    // write the index, so that the next run knows the order of use, or remove it if there are no
+    // entries; false if it can't be written. Called on destruction and every INDEX_SAVE_STORES
+    // stores.
+    bool save();
+
+    // write key/value lines <prefix>.hits, .misses, .stores, .evictions, .entries and .bytes
+    void writeStats(std::ostream& output, const std::string& prefix);
+
+protected:
+    struct Entry {
+        long long bytes;
+        std::list<std::string>::iterator use;   // position in uses
+    };
+
+    // the entry, added if it's new, moved to the most recently used end of uses
+    Entry& touch(const std::string& entry);
+
+    // remove least recently used entries until the total size is within maxBytes
+    void evict();
+
+    std::string pathOf(const std::string& entry) const;
+
+    std::string directory;
+    long long maxBytes;
+    int chunkRows;
+    long long totalBytes;
+    std::map<std::string, Entry> entries;
+    std::list<std::string> uses;        // entries from least to most recently used
+    int storesSinceSave;
+
+    long long hits;
+    long long misses;
+    long long stores;
+    long long evictions;
+
+#if USE_THREADS
+    std::mutex entriesMutex;
+    std::mutex saveMutex;               // one writer of the index at a time; taken before the other
+#endif
+};
+
+// ========== Function Headers =====================================================================
+
+// hash and length of data, in the form <16 hex digits>-<decimal length>
+std::string contentDigest(const std::string& data);
+
+// component tests
+void ctest_mapCache(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_mapCache(bool verbose);
+
+// ========== Function Templates ===================================================================
+
+// write pairs as one line per key, of the form key-tab-values, with the values separated by
+// spaces, so that each key is written only once
+template <typename Value> void writeCompacted(std::ostream& output,
+                                              const std::multimap<std::string, Value>& pairs);
+
+template <typename Value> void writeCompacted(std::ostream& output,
+                                              const std::multimap<std::string, Value>& pairs)
+{
+    typename std::multimap<std::string, Value>::const_iterator iter = pairs.begin();
+    while (iter != pairs.end()) {
+        const std::string& key = iter->first;
+        output << key << '\t' << iter->second;
+
+        iter++;
+        while (iter != pairs.end() && iter->first == key) {
+            output << ' ' << iter->second;
+
+            iter++;
+        }
+
+        output << '\n';
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// append pairs written by writeCompacted; false, with nothing appended, if input is malformed
+template <typename Value> bool readCompacted(std::istream& input,
+                                             std::multimap<std::string, Value>& pairs);
+
+template <typename Value> bool readCompacted(std::istream& input,
+                                             std::multimap<std::string, Value>& pairs)
+{
+    std::multimap<std::string, Value> readPairs;
+
+    std::string line;
+    while (getline(input, line)) {
+        size_t tab = line.find('\t');
+        if (tab == 0 || tab == std::string::npos) {
+            return false;
+        }
+
+        std::string key = line.substr(0, tab);
+        std::istringstream values(line.substr(tab + 1));
+
+        Value value;
+        while (values >> value) {
+            readPairs.insert(readPairs.end(), std::make_pair(key, value));
+        }
+
+        if (!values.eof()) {
+            return false;
+        }
+    }
+
+    pairs.insert(readPairs.begin(), readPairs.end());
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,263 @@
+//
+//  memBudget.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// A limit on the bytes of intermediate data that the threads of a calculation hold at once.
+// Producers take bytes from the budget before they make more data, and wait while it is used up;
+// consumers give bytes back as they free data, and free what they can early, by spilling it, when
+// the budget is pressed.
+//
+
+#include "memBudget.h"
+
+#include <sstream>
+#include <utility>
+
+#if USE_THREADS
+#include <functional>
+#include <thread>
+#endif
+
+#include "calc.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Classes ==============================================================================
+
+// limitBytes 0 for no limit
+MemoryBudget::MemoryBudget(long long limitBytes) :
+limit(limitBytes),
+used(0),
+peak(0),
+waits(0),
+waitNanos(0),
+spills(0),
+spillBytes(0),
+waiting(0)
+#if USE_THREADS
+,
+budgetMutex(),
+released()
+#endif
+{
+}
+
+// take bytes from the budget, waiting while that would go over the limit, unless nothing is taken,
+// so that a request larger than the limit still goes through on its own
+void MemoryBudget::acquire(long long bytes)
+{
+#if USE_THREADS
+    unique_lock<mutex> lock(budgetMutex);
+
+    if (limit > 0 && used > 0 && used + bytes > limit) {
+        long long startTime = nanosecondClock();
+        waits++;
+        waiting++;
+
+        while (used > 0 && used + bytes > limit) {
+            released.wait(lock);
+        }
+
+        waiting--;
+        waitNanos += nanosecondClock() - startTime;
+    }
+#endif
+
+    used += bytes;
+    if (used > peak) {
+        peak = used;
+    }
+}
+
+// give bytes back, waking producers waiting for them
+void MemoryBudget::release(long long bytes)
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    used -= bytes;
+
+#if USE_THREADS
+    if (waiting > 0) {
+        released.notify_all();
+    }
+#endif
+}
+
+// true if a producer is waiting, or more than three quarters of the limit is taken, so that holders
+// of bytes should free what they can
+bool MemoryBudget::isPressed()
+{
+    // the limit never changes, so without one there is no need to lock
+    if (limit <= 0) {
+        return false;
+    }
+
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    return waiting > 0 || used * 4 > limit * 3;
+}
+
+long long MemoryBudget::getUsed()
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    return used;
+}
+
+long long MemoryBudget::getPeak()
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    return peak;
+}
+
+// count data spilled to free bytes early
+void MemoryBudget::addSpill(long long bytes)
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    spills++;
+    spillBytes += bytes;
+}
+
+// write key/value lines <prefix>.limitBytes, .peakBytes, .waits (times a producer waited),
+// .waitNsec, .spills and .spillBytes
+void MemoryBudget::writeStats(std::ostream& output, const std::string& prefix)
+{
+#if USE_THREADS
+    lock_guard<mutex> lock(budgetMutex);
+#endif
+
+    writeKeyValue<long long>(output, prefix + ".limitBytes", limit);
+    writeKeyValue<long long>(output, prefix + ".peakBytes", peak);
+    writeKeyValue<long long>(output, prefix + ".waits", waits);
+    writeKeyValue<long long>(output, prefix + ".waitNsec", waitNanos);
+    writeKeyValue<long long>(output, prefix + ".spills", spills);
+    writeKeyValue<long long>(output, prefix + ".spillBytes", spillBytes);
+}
+
+// ========== Functions ============================================================================
+
+// estimated bytes of a key-value pair held in a multimap or queue: the pair and the tree node
+// around it, and the key's characters if they don't fit in the string itself
+long long pairBytes(const std::string& key, size_t valueBytes)
+{
+    // color and parent, left and right links
+    const size_t NODE_BYTES = 4 * sizeof(void *);
+
+    // common libraries keep up to 15 characters in the string itself
+    long long bytes = NODE_BYTES + sizeof(std::string) + valueBytes;
+    if (key.capacity() > 15) {
+        bytes += key.capacity() + 1;
+    }
+
+    return bytes;
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_memBudget(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MemoryBudget::acquire
+    // MemoryBudget::release
+    // MemoryBudget::isPressed
+
+    {
+        MemoryBudget budget(1000);
+        budget.acquire(700);
+        bool pressedAt700 = budget.isPressed();
+        budget.acquire(100);
+        bool pressedAt800 = budget.isPressed();
+        budget.release(800);
+
+        // more than the limit goes through alone
+        budget.acquire(1500);
+        budget.release(1500);
+
+        if (!pressedAt700 && pressedAt800 && budget.getUsed() == 0 &&
+            budget.getPeak() == 1500) passed++; else failed++;
+    }
+
+#if USE_THREADS
+    {
+        // a producer waits until the bytes it needs are released
+        MemoryBudget budget(1000);
+        budget.acquire(600);
+
+        thread producer(bind(&MemoryBudget::acquire, &budget, 600LL));
+
+        while (!budget.isPressed() || budget.getUsed() != 600) {
+            this_thread::yield();
+        }
+
+        budget.release(600);
+        producer.join();
+
+        ostringstream oss;
+        budget.writeStats(oss, "memory");
+
+        if (budget.getUsed() == 600 && budget.getPeak() == 600 &&
+            oss.str().find("memory.limitBytes\t1000\nmemory.peakBytes\t600\nmemory.waits\t1\n")
+            == 0) passed++; else failed++;
+    }
+#endif
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // pairBytes
+
+    {
+        long long shortKey = pairBytes("EVEN", sizeof(unsigned long));
+        long long longKey = pairBytes(string(100, 'x'), sizeof(unsigned long));
+
+        if (shortKey >= (long long)sizeof(pair<string, unsigned long>) &&
+            longKey >= shortKey + 100) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "memBudget.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_memBudget(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MemoryBudget::addSpill
+
+    {
+        MemoryBudget budget(0);
+        budget.addSpill(100);
+
+        ostringstream oss;
+        budget.writeStats(oss, "memory");
+    }
+}
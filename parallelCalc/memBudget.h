@@ -0,0 +1,89 @@
+//
+//  memBudget.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// A limit on the bytes of intermediate data that the threads of a calculation hold at once.
+// Producers take bytes from the budget before they make more data, and wait while it is used up;
+// consumers give bytes back as they free data, and free what they can early, by spilling it, when
+// the budget is pressed.
+//
+
+#ifndef parallelCalc_memBudget_h
+#define parallelCalc_memBudget_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+
+#if USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// ========== Class Declarations ===================================================================
+
+class MemoryBudget {
+public:
+    // limitBytes 0 for no limit
+    MemoryBudget(long long limitBytes);
+
+    // take bytes from the budget, waiting while that would go over the limit, unless nothing is
+    // taken, so that a request larger than the limit still goes through on its own
+    void acquire(long long bytes);
+
+    // give bytes back, waking producers waiting for them
+    void release(long long bytes);
+
+    // true if a producer is waiting, or more than three quarters of the limit is taken, so that
+    // holders of bytes should free what they can
+    bool isPressed();
+
+    long long getLimit() const { return limit; };
+    long long getUsed();
+    long long getPeak();
+
+    // count data spilled to free bytes early
+    void addSpill(long long bytes);
+
+    // write key/value lines <prefix>.limitBytes, .peakBytes, .waits (times a producer waited),
+    // .waitNsec, .spills and .spillBytes
+    void writeStats(std::ostream& output, const std::string& prefix);
+
+protected:
+    long long limit;
+    long long used;
+    long long peak;
+    long long waits;
+    long long waitNanos;
+    long long spills;
+    long long spillBytes;
+    int waiting;                        // producers waiting now
+
+#if USE_THREADS
+    std::mutex budgetMutex;
+    std::condition_variable released;
+#endif
+};
+
+// ========== Function Headers =====================================================================
+
+// estimated bytes of a key-value pair held in a multimap or queue: the pair and the tree node
+// around it, and the key's characters if they don't fit in the string itself
+long long pairBytes(const std::string& key, size_t valueBytes);
+
+// component tests
+void ctest_memBudget(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_memBudget(bool verbose);
+
+#endif
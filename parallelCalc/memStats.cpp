@@ -0,0 +1,513 @@
+//
+//  memStats.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Memory accounting: allocation counts per thread, from a hook in global operator new and delete
+// (see USE_ALLOC_HOOK in shim.h), and resident set size of the process
+//
+
+#include "memStats.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+
+#if WINDOWS
+#include <malloc.h>
+
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+
+#elif defined(__linux)
+#include <malloc.h>
+
+#else
+#include <sys/resource.h>
+#endif
+
+#include "calc.h"
+
+using namespace std;
+
+// ========== Local Headers ========================================================================
+
+#if USE_ALLOC_HOOK
+// size of block from malloc
+static size_t allocSize(void *p);
+
+// malloc, or new_handler and retry, or throw bad_alloc
+static void *countedNew(std::size_t size);
+
+static void countedDelete(void *p);
+
+#if __cplusplus >= 201703L && !WINDOWS
+// aligned malloc, or new_handler and retry, or throw bad_alloc
+static void *countedAlignedNew(std::size_t size, std::size_t alignment);
+#endif
+#endif
+
+// ========== Globals ==============================================================================
+
+#if USE_ALLOC_HOOK
+// plain data, so that they can be thread-local without C++11
+static THREAD_LOCAL long long tAllocations = 0;
+static THREAD_LOCAL long long tAllocBytes = 0;
+static THREAD_LOCAL long long tFrees = 0;
+static THREAD_LOCAL long long tFreeBytes = 0;
+#endif
+
+// ========== Classes ==============================================================================
+
+// all zero
+AllocCounts::AllocCounts() :
+allocations(0),
+allocBytes(0),
+frees(0),
+freeBytes(0)
+{
+}
+
+void AllocCounts::add(const AllocCounts& other)
+{
+    allocations += other.allocations;
+    allocBytes += other.allocBytes;
+    frees += other.frees;
+    freeBytes += other.freeBytes;
+}
+
+// this minus earlier, for counts from the same thread
+AllocCounts AllocCounts::since(const AllocCounts& earlier) const
+{
+    AllocCounts result;
+    result.allocations = allocations - earlier.allocations;
+    result.allocBytes = allocBytes - earlier.allocBytes;
+    result.frees = frees - earlier.frees;
+    result.freeBytes = freeBytes - earlier.freeBytes;
+
+    return result;
+}
+
+// write key/value lines <prefix>.allocations, <prefix>.allocBytes, <prefix>.frees,
+// <prefix>.freeBytes
+void AllocCounts::write(std::ostream& output, const std::string& prefix) const
+{
+    writeKeyValue<long long>(output, prefix + ".allocations", allocations);
+    writeKeyValue<long long>(output, prefix + ".allocBytes", allocBytes);
+    writeKeyValue<long long>(output, prefix + ".frees", frees);
+    writeKeyValue<long long>(output, prefix + ".freeBytes", freeBytes);
+}
+
+// ========== Functions ============================================================================
+
+// allocation counts for the calling thread since it started; all zero without USE_ALLOC_HOOK
+AllocCounts threadAllocCounts()
+{
+    AllocCounts counts;
+
+#if USE_ALLOC_HOOK
+    counts.allocations = tAllocations;
+    counts.allocBytes = tAllocBytes;
+    counts.frees = tFrees;
+    counts.freeBytes = tFreeBytes;
+#endif
+
+    return counts;
+}
+
+// whether threadAllocCounts() counts anything
+bool isAllocHookEnabled()
+{
+    return USE_ALLOC_HOOK != 0;
+}
+
+// current and peak resident set size of the process in KB, from /proc/self/status, or getrusage()
+// for the peak where there is no /proc (current is then -1); returns false if neither is available
+bool sampleResidentSize(long long& rssKB, long long& peakKB)
+{
+    rssKB = -1;
+    peakKB = -1;
+
+#if WINDOWS
+    return false;
+
+#elif defined(__linux)
+    // lines such as "VmRSS:	    1234 kB"
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            rssKB = atoll(line.c_str() + 6);
+
+        } else if (line.compare(0, 6, "VmHWM:") == 0) {
+            peakKB = atoll(line.c_str() + 6);
+        }
+    }
+
+    return rssKB >= 0 && peakKB >= 0;
+
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return false;
+    }
+
+#ifdef __APPLE__
+    peakKB = usage.ru_maxrss / 1024;    // bytes
+#else
+    peakKB = usage.ru_maxrss;
+#endif
+
+    return true;
+#endif
+}
+
+// ========== Local Functions ======================================================================
+
+#if USE_ALLOC_HOOK
+// size of block from malloc
+static size_t allocSize(void *p)
+{
+#if WINDOWS
+    return _msize(p);
+#elif defined(__APPLE__)
+    return malloc_size(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+// malloc, or new_handler and retry, or throw bad_alloc
+static void *countedNew(std::size_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    for (;;) {
+        void *p = malloc(size);
+
+        if (p != NULL) {
+            tAllocations++;
+            tAllocBytes += allocSize(p);
+            return p;
+        }
+
+        new_handler handler = set_new_handler(NULL);
+        set_new_handler(handler);
+
+        if (handler == NULL) {
+            throw bad_alloc();
+        }
+
+        handler();
+    }
+}
+
+static void countedDelete(void *p)
+{
+    if (p != NULL) {
+        tFrees++;
+        tFreeBytes += allocSize(p);
+        free(p);
+    }
+}
+
+#if __cplusplus >= 201703L && !WINDOWS
+// aligned malloc, or new_handler and retry, or throw bad_alloc
+static void *countedAlignedNew(std::size_t size, std::size_t alignment)
+{
+    if (size == 0) {
+        size = 1;
+    }
+
+    // posix_memalign takes no alignment smaller than a pointer
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+
+    for (;;) {
+        void *p = NULL;
+
+        if (posix_memalign(&p, alignment, size) == 0) {
+            tAllocations++;
+            tAllocBytes += allocSize(p);
+            return p;
+        }
+
+        new_handler handler = set_new_handler(NULL);
+        set_new_handler(handler);
+
+        if (handler == NULL) {
+            throw bad_alloc();
+        }
+
+        handler();
+    }
+}
+#endif
+
+// -------------------------------------------------------------------------------------------------
+// replacements for the library's operator new and delete
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+void *operator new(std::size_t size) THROW_BAD_ALLOC
+{
+    return countedNew(size);
+}
+
+void *operator new[](std::size_t size) THROW_BAD_ALLOC
+{
+    return countedNew(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) throw()
+{
+    try {
+        return countedNew(size);
+
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t&) throw()
+{
+    try {
+        return countedNew(size);
+
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void operator delete(void *p) throw()
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    countedDelete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) throw()
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) throw()
+{
+    countedDelete(p);
+}
+
+// sized forms, which the library would otherwise send to its own free
+#if __cplusplus >= 201402L
+void operator delete(void *p, std::size_t) throw()
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p, std::size_t) throw()
+{
+    countedDelete(p);
+}
+#endif
+
+// aligned forms, for types aligned more than malloc aligns; blocks from posix_memalign are
+// released with free, as others are (Windows would need _aligned_free, so is left alone)
+#if __cplusplus >= 201703L && !WINDOWS
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return countedAlignedNew(size, (std::size_t)alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return countedAlignedNew(size, (std::size_t)alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    try {
+        return countedAlignedNew(size, (std::size_t)alignment);
+
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept
+{
+    try {
+        return countedAlignedNew(size, (std::size_t)alignment);
+
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    countedDelete(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedDelete(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    countedDelete(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    countedDelete(p);
+}
+#endif
+#endif
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_memStats(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // AllocCounts::add
+    // AllocCounts::since
+
+    {
+        AllocCounts earlier;
+        earlier.allocations = 2;
+        earlier.allocBytes = 64;
+
+        AllocCounts later = earlier;
+        later.allocations = 5;
+        later.allocBytes = 160;
+        later.frees = 1;
+        later.freeBytes = 32;
+
+        AllocCounts sum = later.since(earlier);
+        sum.add(sum);
+
+        if (sum.allocations == 6 && sum.allocBytes == 192 && sum.frees == 2 &&
+            sum.netBytes() == 128) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // AllocCounts::write
+
+    {
+        AllocCounts counts;
+        counts.allocations = 3;
+        counts.allocBytes = 100;
+        counts.frees = 1;
+        counts.freeBytes = 40;
+
+        ostringstream oss;
+        counts.write(oss, "mem");
+        const string expected = "mem.allocations\t3\nmem.allocBytes\t100\nmem.frees\t1\n"
+                                "mem.freeBytes\t40\n";
+
+        if (oss.str() == expected) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // threadAllocCounts
+
+    {
+        AllocCounts before = threadAllocCounts();
+        int *block = new int[1000];
+        AllocCounts allocated = threadAllocCounts().since(before);
+        delete [] block;
+        AllocCounts freed = threadAllocCounts().since(before);
+
+        bool counted = allocated.allocations == 1 &&
+                       allocated.allocBytes >= (long long)sizeof(int) * 1000 &&
+                       allocated.frees == 0 && freed.frees == 1 && freed.netBytes() == 0;
+
+        if (isAllocHookEnabled() ? counted : freed.allocations == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // sampleResidentSize
+
+    {
+        long long rssKB;
+        long long peakKB;
+        bool sampled = sampleResidentSize(rssKB, peakKB);
+
+#ifdef __linux
+        if (sampled && rssKB > 0 && peakKB >= rssKB) passed++; else failed++;
+#else
+        if (!sampled || peakKB > 0) passed++; else failed++;
+#endif
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "memStats.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_memStats(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // operator new (nothrow)
+
+    {
+        int *value = new (nothrow) int(7);
+        delete value;
+
+        char *chars = new (nothrow) char[10];
+        delete [] chars;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // sampleResidentSize
+
+    {
+        long long rssKB;
+        long long peakKB;
+        sampleResidentSize(rssKB, peakKB);
+
+        if (verbose) {
+            cerr << "resident " << rssKB << " KB, peak " << peakKB << " KB" << endl;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  memStats.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Memory accounting: allocation counts per thread, from a hook in global operator new and delete
+// (see USE_ALLOC_HOOK in shim.h), and resident set size of the process
+//
+
+#ifndef parallelCalc_memStats_h
+#define parallelCalc_memStats_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+
+// ========== Structures ===========================================================================
+
+// allocations and frees through operator new and delete; bytes are as allocated by malloc, which
+// may be more than requested
+struct AllocCounts {
+    long long allocations;
+    long long allocBytes;
+    long long frees;
+    long long freeBytes;
+
+    // all zero
+    AllocCounts();
+
+    // bytes allocated and not freed; negative if more was freed than allocated, for example by a
+    // thread that frees what other threads allocated
+    long long netBytes() const { return allocBytes - freeBytes; };
+
+    void add(const AllocCounts& other);
+
+    // this minus earlier, for counts from the same thread
+    AllocCounts since(const AllocCounts& earlier) const;
+
+    // write key/value lines <prefix>.allocations, <prefix>.allocBytes, <prefix>.frees,
+    // <prefix>.freeBytes
+    void write(std::ostream& output, const std::string& prefix) const;
+};
+
+// ========== Function Headers =====================================================================
+
+// allocation counts for the calling thread since it started; all zero without USE_ALLOC_HOOK
+AllocCounts threadAllocCounts();
+
+// whether threadAllocCounts() counts anything
+bool isAllocHookEnabled();
+
+// current and peak resident set size of the process in KB, from /proc/self/status, or getrusage()
+// for the peak where there is no /proc (current is then -1); returns false if neither is available
+bool sampleResidentSize(long long& rssKB, long long& peakKB);
+
+// component tests
+void ctest_memStats(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_memStats(bool verbose);
+
+#endif
@@ -0,0 +1,383 @@
+//
+//  perfCounters.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Hardware performance counters for the calling thread, via perf_event_open on Linux. Elsewhere,
+// or when perf events aren't permitted (see /proc/sys/kernel/perf_event_paranoid), the counters
+// are simply unavailable.
+//
+
+#include "perfCounters.h"
+
+#include <cstring>
+#include <sstream>
+
+#ifdef __linux
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "calc.h"
+
+using namespace std;
+
+// ========== Local Headers ========================================================================
+
+#ifdef __linux
+// open a counter for the calling thread, as a member of group (or as group leader if group is -1);
+// returns -1 if the event can't be counted
+static int openEvent(PerfEvent event, int group);
+#endif
+
+// ========== Classes ==============================================================================
+
+// all zero, all invalid
+PerfCounts::PerfCounts()
+{
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        values[k] = 0;
+        valid[k] = false;
+    }
+}
+
+bool PerfCounts::anyValid() const
+{
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        if (valid[k]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// add values; an event is valid in the sum if it is valid in either
+void PerfCounts::add(const PerfCounts& other)
+{
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        values[k] += other.values[k];
+        valid[k] = valid[k] || other.valid[k];
+    }
+}
+
+// this minus earlier, for counts read from the same PerfCounters
+PerfCounts PerfCounts::since(const PerfCounts& earlier) const
+{
+    PerfCounts result;
+
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        result.values[k] = values[k] - earlier.values[k];
+        result.valid[k] = valid[k];
+    }
+
+    return result;
+}
+
+// write key/value lines <prefix>.<event> for valid events, plus <prefix>.ipc, and, if rows is
+// positive, <prefix>.llcMissesPerRow and <prefix>.dtlbMissesPerRow
+void PerfCounts::write(std::ostream& output, const std::string& prefix, long long rows) const
+{
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        if (valid[k]) {
+            writeKeyValue<long long>(output, prefix + "." + perfEventName((PerfEvent)k), values[k]);
+        }
+    }
+
+    if (valid[PERF_CYCLES] && valid[PERF_INSTRUCTIONS] && values[PERF_CYCLES] > 0) {
+        double ipc = values[PERF_INSTRUCTIONS] / (double)values[PERF_CYCLES];
+        writeKeyValue<double>(output, prefix + ".ipc", ipc);
+    }
+
+    if (rows > 0) {
+        if (valid[PERF_LLC_MISSES]) {
+            writeKeyValue<double>(output, prefix + ".llcMissesPerRow",
+                                  values[PERF_LLC_MISSES] / (double)rows);
+        }
+
+        if (valid[PERF_DTLB_MISSES]) {
+            writeKeyValue<double>(output, prefix + ".dtlbMissesPerRow",
+                                  values[PERF_DTLB_MISSES] / (double)rows);
+        }
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+PerfCounters::PerfCounters()
+{
+    int group = -1;
+
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+#ifdef __linux
+        // one group, so that all counters cover the same interval and are read with one call
+        fds[k] = openEvent((PerfEvent)k, group);
+
+        if (group == -1) {
+            group = fds[k];
+        }
+#else
+        fds[k] = -1;
+#endif
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        if (fds[k] != -1) {
+            close(fds[k]);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::isAvailable() const
+{
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        if (fds[k] != -1) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// current values since construction, scaled up if the kernel had to multiplex the counters
+void PerfCounters::read(PerfCounts& counts) const
+{
+    counts = PerfCounts();
+
+#ifdef __linux
+    int group = -1;
+    for (int k = 0; k < PERF_EVENT_COUNT && group == -1; k++) {
+        group = fds[k];
+    }
+
+    if (group == -1) {
+        return;
+    }
+
+    // nr, time enabled, time running, then one value per open event in the order they were opened
+    unsigned long long buffer[3 + PERF_EVENT_COUNT];
+    ssize_t nbytes = ::read(group, buffer, sizeof(buffer));
+
+    if (nbytes < (ssize_t)(3 * sizeof(unsigned long long)) || buffer[2] == 0) {
+        // error, or the group never got onto the hardware
+        return;
+    }
+
+    double scale = buffer[1] / (double)buffer[2];
+
+    int index = 3;
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        if (fds[k] != -1 && index < 3 + (int)buffer[0]) {
+            counts.values[k] = (long long)(buffer[index++] * scale + 0.5);
+            counts.valid[k] = true;
+        }
+    }
+#endif
+}
+
+// ========== Functions ============================================================================
+
+// name of event, as used in key/value output
+const char *perfEventName(PerfEvent event)
+{
+    switch (event) {
+        case PERF_CYCLES:           return "cycles";
+        case PERF_INSTRUCTIONS:     return "instructions";
+        case PERF_LLC_MISSES:       return "llcMisses";
+        case PERF_DTLB_MISSES:      return "dtlbMisses";
+        case PERF_CONTEXT_SWITCHES: return "contextSwitches";
+        default:                    return "unknown";
+    }
+}
+
+// ========== Local Functions ======================================================================
+
+#ifdef __linux
+// open a counter for the calling thread, as a member of group (or as group leader if group is -1);
+// returns -1 if the event can't be counted
+static int openEvent(PerfEvent event, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // user space only; kernel profiling usually needs privileges
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    switch (event) {
+        case PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+
+        case PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+
+        case PERF_LLC_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+
+        case PERF_DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+
+        case PERF_CONTEXT_SWITCHES:
+            // switches happen in the kernel, so try counting there first
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+            attr.exclude_kernel = 0;
+            break;
+
+        default:
+            return -1;
+    }
+
+    // this thread, any cpu
+    int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+
+    if (fd == -1 && attr.exclude_kernel == 0) {
+        attr.exclude_kernel = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    return fd;
+}
+#endif
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_perfCounters(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PerfCounts::add
+    // PerfCounts::since
+
+    {
+        PerfCounts earlier;
+        earlier.values[PERF_CYCLES] = 100;
+        earlier.valid[PERF_CYCLES] = true;
+
+        PerfCounts later = earlier;
+        later.values[PERF_CYCLES] = 250;
+
+        PerfCounts delta = later.since(earlier);
+
+        PerfCounts sum;
+        sum.add(delta);
+        sum.add(delta);
+
+        if (delta.values[PERF_CYCLES] == 150 && sum.values[PERF_CYCLES] == 300 &&
+            sum.valid[PERF_CYCLES] && !sum.valid[PERF_INSTRUCTIONS] && !PerfCounts().anyValid())
+            passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PerfCounts::write
+
+    {
+        PerfCounts counts;
+        counts.values[PERF_CYCLES] = 200;
+        counts.valid[PERF_CYCLES] = true;
+        counts.values[PERF_INSTRUCTIONS] = 300;
+        counts.valid[PERF_INSTRUCTIONS] = true;
+        counts.values[PERF_LLC_MISSES] = 5;
+        counts.valid[PERF_LLC_MISSES] = true;
+
+        ostringstream oss;
+        counts.write(oss, "perf", 10);
+        const string expected = "perf.cycles\t200\nperf.instructions\t300\nperf.llcMisses\t5\n"
+                                "perf.ipc\t1.5\nperf.llcMissesPerRow\t0.5\n";
+
+        if (oss.str() == expected) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PerfCounters::read
+
+    {
+        // counters may legitimately be unavailable; they must agree with what is read
+        PerfCounters counters;
+
+        unsigned long sum = 0;
+        for (unsigned long k = 0; k < 100000; k++) {
+            sum += k * k;
+        }
+
+        PerfCounts counts;
+        counters.read(counts);
+
+        bool counted = !counts.valid[PERF_INSTRUCTIONS] || counts.values[PERF_INSTRUCTIONS] > 0;
+
+        if (sum != 0 && counted && counts.anyValid() == counters.isAvailable()) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // perfEventName
+
+    if (string(perfEventName(PERF_DTLB_MISSES)) == "dtlbMisses") passed++; else failed++;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "perfCounters.cpp" << "\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_perfCounters(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PerfCounters::isAvailable
+
+    {
+        PerfCounters counters;
+
+        if (verbose) {
+            cerr << "perf counters " << (counters.isAvailable() ? "available" : "not available");
+            cerr << endl;
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PerfCounts::write
+
+    {
+        PerfCounts counts;
+        ostringstream oss;
+        counts.write(oss, "perf", 0);
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // perfEventName
+
+    perfEventName(PERF_EVENT_COUNT);
+}
@@ -0,0 +1,94 @@
+//
+//  perfCounters.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Hardware performance counters for the calling thread, via perf_event_open on Linux. Elsewhere,
+// or when perf events aren't permitted (see /proc/sys/kernel/perf_event_paranoid), the counters
+// are simply unavailable.
+//
+
+#ifndef parallelCalc_perfCounters_h
+#define parallelCalc_perfCounters_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+
+// ========== Constants ============================================================================
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_CONTEXT_SWITCHES,
+
+    PERF_EVENT_COUNT
+};
+
+// ========== Structures ===========================================================================
+
+// counter values; an event is valid only if it could be counted
+struct PerfCounts {
+    long long values[PERF_EVENT_COUNT];
+    bool valid[PERF_EVENT_COUNT];
+
+    // all zero, all invalid
+    PerfCounts();
+
+    bool anyValid() const;
+
+    // add values; an event is valid in the sum if it is valid in either
+    void add(const PerfCounts& other);
+
+    // this minus earlier, for counts read from the same PerfCounters
+    PerfCounts since(const PerfCounts& earlier) const;
+
+    // write key/value lines <prefix>.<event> for valid events, plus <prefix>.ipc, and, if rows is
+    // positive, <prefix>.llcMissesPerRow and <prefix>.dtlbMissesPerRow
+    void write(std::ostream& output, const std::string& prefix, long long rows) const;
+};
+
+// ========== Class Declarations ===================================================================
+
+// counters for the thread that constructs the object; they count from construction on
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    bool isAvailable() const;
+
+    // current values since construction, scaled up if the kernel had to multiplex the counters
+    void read(PerfCounts& counts) const;
+
+protected:
+    int fds[PERF_EVENT_COUNT];
+
+private:
+    // not copyable; owns file descriptors
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+};
+
+// ========== Function Headers =====================================================================
+
+// name of event, as used in key/value output
+const char *perfEventName(PerfEvent event);
+
+// component tests
+void ctest_perfCounters(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_perfCounters(bool verbose);
+
+#endif
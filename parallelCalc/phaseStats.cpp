@@ -0,0 +1,765 @@
+//
+//  phaseStats.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Per-phase timing of a calculation. Phases nest: time spent in an inner phase is not counted in
+// the enclosing phase, so the phase times add up to the elapsed time. Optionally also hardware
+// counters and memory use per phase. Phases are also recorded in the trace, if enabled.
+//
+
+#include "phaseStats.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "calc.h"
+#include "trace.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Classes ==============================================================================
+
+// all zero, cpu unknown
+WorkerStats::WorkerStats() :
+rows(0),
+keys(0),
+values(0),
+busyNanos(0),
+cpu(-1)
+{
+}
+
+// -------------------------------------------------------------------------------------------------
+
+PhaseStats::PhaseStats() :
+perfCounters(NULL),
+rows(0),
+memoryEnabled(false)
+{
+    reset();
+}
+
+PhaseStats::~PhaseStats()
+{
+    delete perfCounters;
+}
+
+void PhaseStats::reset()
+{
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        nanos[k] = 0;
+        counts[k] = 0;
+        perf[k] = PerfCounts();
+        alloc[k] = AllocCounts();
+        residentKB[k] = -1;
+        peakGrowthKB[k] = 0;
+        workers[k].clear();
+    }
+
+    depth = 0;
+    currentStartTime = 0;
+    outerStartResidentKB = -1;
+    outerStartPeakKB = -1;
+}
+
+// start timing phase, pausing the current phase (if any) until end() is called
+void PhaseStats::begin(Phase phase)
+{
+    // sampling resident size reads a file, so keep it out of the phase
+    if (depth == 0 && memoryEnabled) {
+        sampleResidentSize(outerStartResidentKB, outerStartPeakKB);
+    }
+
+    long long now = nanosecondClock();
+
+    if (depth > 0) {
+        nanos[stack[depth - 1]] += now - currentStartTime;
+        noteCounters(stack[depth - 1]);
+
+    } else {
+        startCounters();
+    }
+
+    LOGIC_ERROR_IF(depth >= MAX_DEPTH, "phases nested too deeply");
+
+    stack[depth++] = phase;
+    counts[phase]++;
+    currentStartTime = now;
+
+    traceBegin(phaseName(phase), "phase");
+}
+
+// stop timing the current phase, resume the enclosing phase (if any)
+void PhaseStats::end()
+{
+    LOGIC_ERROR_IF(depth <= 0, "end() without begin()");
+
+    long long now = nanosecondClock();
+
+    traceEnd(phaseName(stack[depth - 1]), "phase");
+
+    nanos[stack[--depth]] += now - currentStartTime;
+    noteCounters(stack[depth]);
+    currentStartTime = now;
+
+    if (depth == 0 && memoryEnabled) {
+        long long endResidentKB;
+        long long endPeakKB;
+        sampleResidentSize(endResidentKB, endPeakKB);
+
+        Phase phase = stack[depth];
+        residentKB[phase] = max(residentKB[phase], max(outerStartResidentKB, endResidentKB));
+
+        if (outerStartPeakKB >= 0 && endPeakKB >= 0) {
+            peakGrowthKB[phase] += endPeakKB - outerStartPeakKB;
+        }
+    }
+}
+
+// add time to phase without starting or stopping it
+void PhaseStats::add(Phase phase, long long nanos)
+{
+    this->nanos[phase] += nanos;
+    counts[phase]++;
+}
+
+long long PhaseStats::getTotalNanos() const
+{
+    long long total = 0;
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        total += nanos[k];
+    }
+
+    return total;
+}
+
+// count hardware events per phase for the calling thread, which must be the thread that
+// calls begin() and end()
+void PhaseStats::enablePerf()
+{
+    LOGIC_ERROR_IF(depth > 0, "enablePerf() inside a phase");
+
+    if (perfCounters == NULL) {
+        perfCounters = new PerfCounters();
+    }
+}
+
+// add hardware counts from another thread (or process) to phase
+void PhaseStats::addPerf(Phase phase, const PerfCounts& counts)
+{
+    perf[phase].add(counts);
+}
+
+// count allocations per phase for the calling thread, which must be the thread that calls
+// begin() and end(), and sample resident size when an outermost phase begins and ends
+void PhaseStats::enableMemory()
+{
+    LOGIC_ERROR_IF(depth > 0, "enableMemory() inside a phase");
+
+    memoryEnabled = true;
+}
+
+// add allocation counts from another thread to phase
+void PhaseStats::addAlloc(Phase phase, const AllocCounts& counts)
+{
+    alloc[phase].add(counts);
+}
+
+// add counts from a worker thread to phase, and keep them for the load-imbalance report
+void PhaseStats::addWorker(Phase phase, const WorkerStats& workerStats)
+{
+    addPerf(phase, workerStats.perf);
+    addAlloc(phase, workerStats.alloc);
+
+    workers[phase].push_back(workerStats);
+}
+
+// write key/value lines <prefix>.<phase>.nsec for phases with any intervals, and
+// <prefix>.total.nsec; for phases with worker threads, also the load-imbalance report (see
+// writeWorkers); with perf enabled, also hardware counts per phase and in total (see
+// PerfCounts::write), and <prefix>.perf.available; with memory enabled, also allocations per
+// phase and in total (see AllocCounts::write), <prefix>.<phase>.residentKB and
+// <prefix>.<phase>.peakGrowthKB, and <prefix>.total.peakKB
+void PhaseStats::write(std::ostream& output, const std::string& prefix) const
+{
+    PerfCounts totalPerf;
+    AllocCounts totalAlloc;
+
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        if (counts[k] > 0) {
+            string key = prefix + "." + phaseName((Phase)k);
+            writeKeyValue<long long>(output, key + ".nsec", nanos[k]);
+
+            if (!workers[k].empty()) {
+                writeWorkers(output, key, workers[k], nanos[k]);
+            }
+
+            if (perfCounters != NULL) {
+                perf[k].write(output, key, rows);
+                totalPerf.add(perf[k]);
+            }
+
+            if (memoryEnabled) {
+                alloc[k].write(output, key);
+                totalAlloc.add(alloc[k]);
+
+                if (residentKB[k] >= 0) {
+                    writeKeyValue<long long>(output, key + ".residentKB", residentKB[k]);
+                    writeKeyValue<long long>(output, key + ".peakGrowthKB", peakGrowthKB[k]);
+                }
+            }
+        }
+    }
+
+    writeKeyValue<long long>(output, prefix + ".total.nsec", getTotalNanos());
+
+    if (perfCounters != NULL) {
+        totalPerf.write(output, prefix + ".total", rows);
+        writeKeyValue<int>(output, prefix + ".perf.available", totalPerf.anyValid() ? 1 : 0);
+    }
+
+    if (memoryEnabled) {
+        totalAlloc.write(output, prefix + ".total");
+
+        long long nowResidentKB;
+        long long peakKB;
+        if (sampleResidentSize(nowResidentKB, peakKB)) {
+            writeKeyValue<long long>(output, prefix + ".total.peakKB", peakKB);
+        }
+    }
+}
+
+// add times from lines <prefix>.<phase>.nsec, hardware counts from lines
+// <prefix>.<phase>.<event>, and allocation counts and resident size, in the output of write(),
+// for example from the stderr of a forked tool; returns total time added
+long long PhaseStats::addFromLog(const std::string& log, const std::string& prefix)
+{
+    long long total = 0;
+
+    // skip lines that aren't key/value lines
+    istringstream iss(log);
+    while (!iss.eof()) {
+        string key;
+        long long value;
+        size_t nbytes;
+        if (readKeyValue<long long>(iss, key, value, nbytes)) {
+            for (int k = 0; k < PHASE_COUNT; k++) {
+                string phasePrefix = prefix + "." + phaseName((Phase)k) + ".";
+
+                if (key == phasePrefix + "nsec") {
+                    add((Phase)k, value);
+                    total += value;
+                }
+
+                for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+                    if (key == phasePrefix + perfEventName((PerfEvent)e)) {
+                        perf[k].values[e] += value;
+                        perf[k].valid[e] = true;
+                    }
+                }
+
+                if (key == phasePrefix + "allocations") {
+                    alloc[k].allocations += value;
+
+                } else if (key == phasePrefix + "allocBytes") {
+                    alloc[k].allocBytes += value;
+
+                } else if (key == phasePrefix + "frees") {
+                    alloc[k].frees += value;
+
+                } else if (key == phasePrefix + "freeBytes") {
+                    alloc[k].freeBytes += value;
+
+                } else if (key == phasePrefix + "residentKB") {
+                    // a different process, so the largest rather than the sum
+                    residentKB[k] = max(residentKB[k], value);
+                }
+            }
+        }
+    }
+
+    return total;
+}
+
+// start hardware and allocation counts for the current phase
+void PhaseStats::startCounters()
+{
+    if (perfCounters != NULL) {
+        perfCounters->read(currentStartPerf);
+    }
+
+    if (memoryEnabled) {
+        currentStartAlloc = threadAllocCounts();
+    }
+}
+
+// add hardware and allocation counts since the current phase started (or resumed) to phase
+void PhaseStats::noteCounters(Phase phase)
+{
+    if (perfCounters != NULL) {
+        PerfCounts now;
+        perfCounters->read(now);
+
+        perf[phase].add(now.since(currentStartPerf));
+        currentStartPerf = now;
+    }
+
+    if (memoryEnabled) {
+        AllocCounts now = threadAllocCounts();
+
+        alloc[phase].add(now.since(currentStartAlloc));
+        currentStartAlloc = now;
+    }
+}
+
+// write <prefix>.threads, <prefix>.thread.<n>.rows, .keys, .values, .busyNsec and .cpu (if
+// known) for each thread, <prefix>.imbalance and <prefix>.valueImbalance (max / mean of busy time
+// and of values over threads), and <prefix>.criticalPathShare (slowest thread's busy time /
+// phaseNanos, the phase's own time)
+void PhaseStats::writeWorkers(std::ostream& output, const std::string& prefix,
+                              const std::vector<WorkerStats>& phaseWorkers,
+                              long long phaseNanos) const
+{
+    long long maxBusy = 0;
+    long long totalBusy = 0;
+    long long maxValues = 0;
+    long long totalValues = 0;
+
+    writeKeyValue<size_t>(output, prefix + ".threads", phaseWorkers.size());
+
+    for (size_t k = 0; k < phaseWorkers.size(); k++) {
+        const WorkerStats& worker = phaseWorkers[k];
+
+        ostringstream oss;
+        oss << prefix << ".thread." << k;
+        string key = oss.str();
+
+        writeKeyValue<long long>(output, key + ".rows", worker.rows);
+        writeKeyValue<long long>(output, key + ".keys", worker.keys);
+        writeKeyValue<long long>(output, key + ".values", worker.values);
+        writeKeyValue<long long>(output, key + ".busyNsec", worker.busyNanos);
+
+        if (worker.cpu >= 0) {
+            writeKeyValue<int>(output, key + ".cpu", worker.cpu);
+        }
+
+        maxBusy = max(maxBusy, worker.busyNanos);
+        totalBusy += worker.busyNanos;
+        maxValues = max(maxValues, worker.values);
+        totalValues += worker.values;
+    }
+
+    // 1 is perfectly balanced; n means one of n threads did all the work
+    double count = (double)phaseWorkers.size();
+
+    if (totalBusy > 0) {
+        writeKeyValue<double>(output, prefix + ".imbalance", maxBusy / (totalBusy / count));
+    }
+
+    if (totalValues > 0) {
+        double valueImbalance = maxValues / (totalValues / count);
+        writeKeyValue<double>(output, prefix + ".valueImbalance", valueImbalance);
+    }
+
+    if (phaseNanos > 0) {
+        writeKeyValue<double>(output, prefix + ".criticalPathShare", maxBusy / (double)phaseNanos);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+ScopedPhase::ScopedPhase(PhaseStats *stats, Phase phase) :
+stats(stats)
+{
+    if (stats != NULL) {
+        stats->begin(phase);
+    }
+}
+
+ScopedPhase::~ScopedPhase()
+{
+    if (stats != NULL) {
+        stats->end();
+    }
+}
+
+// end the current phase and begin another, for code that runs phases one after another
+void ScopedPhase::change(Phase phase)
+{
+    if (stats != NULL) {
+        stats->end();
+        stats->begin(phase);
+    }
+}
+
+// -------------------------------------------------------------------------------------------------
+
+ScopedWorker::ScopedWorker(const PhaseStats *stats, WorkerStats& workerStats) :
+workerStats(workerStats),
+perfCounters(NULL),
+countAlloc(stats != NULL && stats->isMemoryEnabled()),
+startTime(-1)
+{
+    if (stats != NULL && stats->isPerfEnabled()) {
+        perfCounters = new PerfCounters();
+    }
+
+    // after allocating the counters, so that they are not counted
+    if (countAlloc) {
+        startAlloc = threadAllocCounts();
+    }
+
+    if (stats != NULL) {
+        startTime = nanosecondClock();
+    }
+}
+
+ScopedWorker::~ScopedWorker()
+{
+    if (startTime >= 0) {
+        workerStats.busyNanos = nanosecondClock() - startTime;
+    }
+
+    if (countAlloc) {
+        workerStats.alloc = threadAllocCounts().since(startAlloc);
+    }
+
+    if (perfCounters != NULL) {
+        perfCounters->read(workerStats.perf);
+        delete perfCounters;
+    }
+}
+
+// ========== Functions ============================================================================
+
+// name of phase, as used in key/value output
+const char *phaseName(Phase phase)
+{
+    switch (phase) {
+        case PHASE_START:   return "start";
+        case PHASE_MAP:     return "map";
+        case PHASE_MERGE:   return "merge";
+        case PHASE_KEYS:    return "keys";
+        case PHASE_REDUCE:  return "reduce";
+        case PHASE_OUTPUT:  return "output";
+        case PHASE_IO:      return "io";
+        default:            return "unknown";
+    }
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_phaseStats(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::begin
+    // PhaseStats::end
+
+    {
+        PhaseStats stats;
+
+        stats.begin(PHASE_MAP);
+        sleepFor(20);
+        stats.begin(PHASE_OUTPUT);
+        sleepFor(100);
+        stats.end();
+        stats.end();
+
+        // nested time is not counted in the enclosing phase, which would otherwise take longer
+        // than the nested one; only lower bounds on the times, as a loaded machine may sleep long
+        const long long msec = 1000000LL;
+        long long mapNanos = stats.getNanos(PHASE_MAP);
+        long long outputNanos = stats.getNanos(PHASE_OUTPUT);
+
+        if (mapNanos >= 20 * msec && outputNanos >= 100 * msec && mapNanos < outputNanos &&
+            stats.getTotalNanos() == mapNanos + outputNanos &&
+            stats.getCount(PHASE_MAP) == 1 && stats.getCount(PHASE_REDUCE) == 0)
+            passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::write
+    // PhaseStats::addFromLog
+
+    {
+        PhaseStats stats;
+        stats.add(PHASE_START, 100);
+        stats.add(PHASE_REDUCE, 250);
+
+        ostringstream oss;
+        stats.write(oss, "phase");
+        string outStr = oss.str();
+        const string expected = "phase.start.nsec\t100\nphase.reduce.nsec\t250\n"
+                                "phase.total.nsec\t350\n";
+
+        PhaseStats other;
+        long long added = other.addFromLog("OK\n" + outStr + "other\t7\n", "phase");
+
+        if (outStr == expected && added == 350 && other.getNanos(PHASE_REDUCE) == 250)
+            passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::enablePerf
+    // PhaseStats::addPerf
+
+    {
+        PhaseStats stats;
+        stats.enablePerf();
+
+        stats.begin(PHASE_MAP);
+        stats.end();
+
+        // another thread's counts, as from a worker thread or a forked tool
+        PerfCounts counts;
+        counts.values[PERF_LLC_MISSES] = 40;
+        counts.valid[PERF_LLC_MISSES] = true;
+        stats.addPerf(PHASE_MAP, counts);
+        stats.setRows(20);
+
+        ostringstream oss;
+        stats.write(oss, "phase");
+        string outStr = oss.str();
+
+        PhaseStats other;
+        other.addFromLog(outStr, "phase");
+
+        if (stats.isPerfEnabled() && !other.isPerfEnabled() &&
+            stats.getPerf(PHASE_MAP).values[PERF_LLC_MISSES] >= 40 &&
+            other.getPerf(PHASE_MAP).values[PERF_LLC_MISSES] >= 40 &&
+            outStr.find("phase.map.llcMissesPerRow\t") != string::npos &&
+            outStr.find("phase.total.llcMisses\t") != string::npos &&
+            outStr.find("phase.perf.available\t1\n") != string::npos) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::enableMemory
+    // PhaseStats::addWorker
+
+    {
+        PhaseStats stats;
+        stats.enableMemory();
+
+        stats.begin(PHASE_START);
+        vector<int> *values = new vector<int>(1000);
+        stats.begin(PHASE_OUTPUT);
+        delete values;
+        stats.end();
+        stats.end();
+
+        WorkerStats workerStats;
+        workerStats.alloc.allocations = 2;
+        stats.addWorker(PHASE_START, workerStats);
+
+        ostringstream oss;
+        stats.write(oss, "phase");
+        string outStr = oss.str();
+
+        PhaseStats other;
+        other.addFromLog(outStr, "phase");
+
+        // the new vector and its storage, plus the worker's, in start, their deletion in output
+        const AllocCounts& start = stats.getAlloc(PHASE_START);
+        const AllocCounts& output = stats.getAlloc(PHASE_OUTPUT);
+        bool counted = start.allocations == 4 &&
+                       start.allocBytes >= (long long)sizeof(int) * 1000 && start.frees == 0 &&
+                       output.allocations == 0 && output.frees == 2 &&
+                       output.freeBytes == start.allocBytes;
+
+        if ((counted || !isAllocHookEnabled()) &&
+            other.getAlloc(PHASE_START).allocations == start.allocations &&
+            outStr.find("phase.total.allocations\t") != string::npos) passed++; else failed++;
+
+#ifdef __linux
+        if (stats.getResidentKB(PHASE_START) > 0 && stats.getResidentKB(PHASE_OUTPUT) == -1 &&
+            other.getResidentKB(PHASE_START) == stats.getResidentKB(PHASE_START))
+            passed++; else failed++;
+#endif
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::writeWorkers
+
+    {
+        // the share is of the map phase's time, not the total with other phases
+        PhaseStats stats;
+        stats.add(PHASE_MAP, 1000);
+        stats.add(PHASE_OUTPUT, 1000);
+
+        WorkerStats workerStats;
+        workerStats.values = 10;
+        workerStats.busyNanos = 100;
+        stats.addWorker(PHASE_MAP, workerStats);
+
+        workerStats.values = 30;
+        workerStats.busyNanos = 300;
+        workerStats.cpu = 2;
+        stats.addWorker(PHASE_MAP, workerStats);
+
+        ostringstream oss;
+        stats.write(oss, "phase");
+        string outStr = oss.str();
+
+        if (stats.getWorkers(PHASE_MAP).size() == 2 &&
+            outStr.find("phase.map.threads\t2\n") != string::npos &&
+            outStr.find("phase.map.thread.1.busyNsec\t300\n") != string::npos &&
+            outStr.find("phase.map.thread.0.cpu") == string::npos &&
+            outStr.find("phase.map.thread.1.cpu\t2\n") != string::npos &&
+            outStr.find("phase.map.imbalance\t1.5\n") != string::npos &&
+            outStr.find("phase.map.valueImbalance\t1.5\n") != string::npos &&
+            outStr.find("phase.map.criticalPathShare\t0.3\n") != string::npos) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ScopedWorker
+
+    {
+        PhaseStats stats;
+        stats.enableMemory();
+
+        WorkerStats workerStats;
+        {
+            ScopedWorker scopedWorker(&stats, workerStats);
+            vector<int> *values = new vector<int>(1000);
+            delete values;
+        }
+
+        WorkerStats nothing;
+        {
+            ScopedWorker scopedWorker(NULL, nothing);
+            vector<int> *values = new vector<int>(1000);
+            delete values;
+        }
+
+        bool counted = workerStats.alloc.allocations == 2 && workerStats.alloc.frees == 2;
+
+        if ((counted || !isAllocHookEnabled()) && nothing.alloc.allocations == 0 &&
+            !workerStats.perf.anyValid() && workerStats.busyNanos > 0 && nothing.busyNanos == 0)
+            passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ScopedPhase
+
+    {
+        PhaseStats stats;
+        {
+            ScopedPhase scopedPhase(&stats, PHASE_KEYS);
+        }
+
+        {
+            ScopedPhase scopedPhase(&stats, PHASE_MAP);
+            scopedPhase.change(PHASE_MERGE);
+        }
+
+        ScopedPhase nothing(NULL, PHASE_KEYS);
+        nothing.change(PHASE_MAP);
+
+        if (stats.getCount(PHASE_KEYS) == 1 && stats.getCount(PHASE_MAP) == 1 &&
+            stats.getCount(PHASE_MERGE) == 1) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // phaseName
+
+    if (string(phaseName(PHASE_IO)) == "io") passed++; else failed++;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "phaseStats.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_phaseStats(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::end
+
+    try {
+        PhaseStats stats;
+        stats.end();
+
+    } catch(logic_error e) {
+        if (verbose) {
+            cerr << "one \"end() without begin()\" error follows:" << endl;
+            cerr << e.what() << endl;
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::enablePerf
+
+    try {
+        PhaseStats stats;
+        stats.begin(PHASE_MAP);
+        stats.enablePerf();
+
+    } catch(logic_error e) {
+        if (verbose) {
+            cerr << "one \"enablePerf() inside a phase\" error follows:" << endl;
+            cerr << e.what() << endl;
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::enableMemory
+
+    try {
+        PhaseStats stats;
+        stats.begin(PHASE_MAP);
+        stats.enableMemory();
+
+    } catch(logic_error e) {
+        if (verbose) {
+            cerr << "one \"enableMemory() inside a phase\" error follows:" << endl;
+            cerr << e.what() << endl;
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // PhaseStats::write
+
+    {
+        PhaseStats stats;
+        ostringstream oss;
+        stats.write(oss, "phase");
+    }
+
+    {
+        // hardware counters without rows, possibly unavailable
+        PhaseStats stats;
+        stats.enablePerf();
+        {
+            ScopedPhase scopedPhase(&stats, PHASE_START);
+        }
+
+        ostringstream oss;
+        stats.write(oss, "phase");
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // phaseName
+
+    phaseName(PHASE_COUNT);
+}
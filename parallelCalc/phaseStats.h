@@ -0,0 +1,214 @@
+//
+//  phaseStats.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Per-phase timing of a calculation. Phases nest: time spent in an inner phase is not counted in
+// the enclosing phase, so the phase times add up to the elapsed time. Optionally also hardware
+// counters and memory use per phase. Phases are also recorded in the trace, if enabled.
+//
+
+#ifndef parallelCalc_phaseStats_h
+#define parallelCalc_phaseStats_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "memStats.h"
+#include "perfCounters.h"
+
+// ========== Constants ============================================================================
+
+enum Phase {
+    PHASE_START,        // generate starting data
+    PHASE_MAP,          // map rows
+    PHASE_MERGE,        // shuffle: sort and join mapped data from several sources
+    PHASE_KEYS,         // count keys, divide work among reduce threads
+    PHASE_REDUCE,       // reduce values for each key
+    PHASE_OUTPUT,       // format and write results
+    PHASE_IO,           // parse input, pipe data to and from forked tools
+
+    PHASE_COUNT
+};
+
+// ========== Structures ===========================================================================
+
+// counts from one worker thread, to be added to a phase after the thread is joined
+struct WorkerStats {
+    long long rows;         // rows read (map) or written (reduce)
+    long long keys;         // distinct keys written (map) or reduced (reduce)
+    long long values;       // values written (map) or read (reduce)
+    long long busyNanos;    // lifetime of the thread's ScopedWorker
+    int cpu;                // CPU the thread finished on; -1 if unknown
+    PerfCounts perf;
+    AllocCounts alloc;
+
+    // all zero, cpu unknown
+    WorkerStats();
+};
+
+// ========== Class Declarations ===================================================================
+
+// accumulated time and number of intervals per phase, and optionally hardware counters and memory
+// use per phase; not thread-safe, so each thread needs its own
+class PhaseStats {
+public:
+    PhaseStats();
+    ~PhaseStats();
+
+    void reset();
+
+    // start timing phase, pausing the current phase (if any) until end() is called
+    void begin(Phase phase);
+
+    // stop timing the current phase, resume the enclosing phase (if any)
+    void end();
+
+    // add time to phase without starting or stopping it
+    void add(Phase phase, long long nanos);
+
+    long long getNanos(Phase phase) const { return nanos[phase]; };
+    int getCount(Phase phase) const { return counts[phase]; };
+    long long getTotalNanos() const;
+
+    // count hardware events per phase for the calling thread, which must be the thread that
+    // calls begin() and end()
+    void enablePerf();
+    bool isPerfEnabled() const { return perfCounters != NULL; };
+    bool isPerfAvailable() const { return perfCounters != NULL && perfCounters->isAvailable(); };
+
+    // add hardware counts from another thread (or process) to phase
+    void addPerf(Phase phase, const PerfCounts& counts);
+    const PerfCounts& getPerf(Phase phase) const { return perf[phase]; };
+
+    // count allocations per phase for the calling thread, which must be the thread that calls
+    // begin() and end(), and sample resident size when an outermost phase begins and ends
+    void enableMemory();
+    bool isMemoryEnabled() const { return memoryEnabled; };
+
+    // add allocation counts from another thread to phase
+    void addAlloc(Phase phase, const AllocCounts& counts);
+    const AllocCounts& getAlloc(Phase phase) const { return alloc[phase]; };
+
+    // largest resident size sampled at the start or end of phase; -1 if never sampled
+    long long getResidentKB(Phase phase) const { return residentKB[phase]; };
+
+    // add counts from a worker thread to phase, and keep them for the load-imbalance report
+    void addWorker(Phase phase, const WorkerStats& workerStats);
+    const std::vector<WorkerStats>& getWorkers(Phase phase) const { return workers[phase]; };
+
+    // number of rows in the calculation, for misses per row
+    void setRows(long long rows) { this->rows = rows; };
+
+    // write key/value lines <prefix>.<phase>.nsec for phases with any intervals, and
+    // <prefix>.total.nsec; for phases with worker threads, also the load-imbalance report (see
+    // writeWorkers); with perf enabled, also hardware counts per phase and in total (see
+    // PerfCounts::write), and <prefix>.perf.available; with memory enabled, also allocations per
+    // phase and in total (see AllocCounts::write), <prefix>.<phase>.residentKB and
+    // <prefix>.<phase>.peakGrowthKB, and <prefix>.total.peakKB
+    void write(std::ostream& output, const std::string& prefix) const;
+
+    // add times from lines <prefix>.<phase>.nsec, hardware counts from lines
+    // <prefix>.<phase>.<event>, and allocation counts and resident size, in the output of write(),
+    // for example from the stderr of a forked tool; returns total time added
+    long long addFromLog(const std::string& log, const std::string& prefix);
+
+protected:
+    static const int MAX_DEPTH = 8;
+
+    long long nanos[PHASE_COUNT];
+    int counts[PHASE_COUNT];
+
+    Phase stack[MAX_DEPTH];
+    int depth;
+    long long currentStartTime;
+
+    PerfCounters *perfCounters;
+    PerfCounts perf[PHASE_COUNT];
+    PerfCounts currentStartPerf;
+    long long rows;
+
+    bool memoryEnabled;
+    AllocCounts alloc[PHASE_COUNT];
+    AllocCounts currentStartAlloc;
+    long long residentKB[PHASE_COUNT];
+    long long peakGrowthKB[PHASE_COUNT];
+    long long outerStartResidentKB;
+    long long outerStartPeakKB;
+
+    std::vector<WorkerStats> workers[PHASE_COUNT];
+
+    // start hardware and allocation counts for the current phase
+    void startCounters();
+
+    // add hardware and allocation counts since the current phase started (or resumed) to phase
+    void noteCounters(Phase phase);
+
+    // write <prefix>.threads, <prefix>.thread.<n>.rows, .keys, .values, .busyNsec and .cpu (if
+    // known) for each thread, <prefix>.imbalance and <prefix>.valueImbalance (max / mean of busy
+    // time and of values over threads), and <prefix>.criticalPathShare (slowest thread's busy
+    // time / phaseNanos, the phase's own time)
+    void writeWorkers(std::ostream& output, const std::string& prefix,
+                      const std::vector<WorkerStats>& phaseWorkers, long long phaseNanos) const;
+
+private:
+    // not copyable; owns counters
+    PhaseStats(const PhaseStats&);
+    PhaseStats& operator=(const PhaseStats&);
+};
+
+// times a phase from construction to destruction; does nothing if stats is NULL
+class ScopedPhase {
+public:
+    ScopedPhase(PhaseStats *stats, Phase phase);
+    ~ScopedPhase();
+
+    // end the current phase and begin another, for code that runs phases one after another
+    void change(Phase phase);
+
+protected:
+    PhaseStats *stats;
+};
+
+// times the calling worker thread from construction to destruction, and counts hardware events (if
+// enabled in stats) and allocations (if enabled); does nothing if stats is NULL
+class ScopedWorker {
+public:
+    ScopedWorker(const PhaseStats *stats, WorkerStats& workerStats);
+    ~ScopedWorker();
+
+protected:
+    WorkerStats& workerStats;
+    PerfCounters *perfCounters;
+    bool countAlloc;
+    AllocCounts startAlloc;
+    long long startTime;
+
+private:
+    // not copyable; owns counters
+    ScopedWorker(const ScopedWorker&);
+    ScopedWorker& operator=(const ScopedWorker&);
+};
+
+// ========== Function Headers =====================================================================
+
+// name of phase, as used in key/value output
+const char *phaseName(Phase phase);
+
+// component tests
+void ctest_phaseStats(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_phaseStats(bool verbose);
+
+#endif
@@ -0,0 +1,304 @@
+//
+//  ringQueues.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Bounded queues for passing values between threads while they run. SpscQueue (one producer, one
+// consumer) and MpscQueue (many producers, one consumer) are lock-free ring buffers: a push or pop
+// of a batch of values is a few atomic loads and stores, and the producers' and consumer's indices
+// are kept on separate cache lines so that they don't contend for one. LockedQueue is the same
+// with a mutex and condition variables, for comparison.
+//
+
+#include "ringQueues.h"
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if USE_THREADS
+#include <functional>
+#include <thread>
+#endif
+
+#include "utils.h"
+
+using namespace std;
+
+// ========== Constants ============================================================================
+
+#if USE_THREADS
+const size_t BENCH_QUEUE_CAPACITY = 4096;
+const size_t BENCH_QUEUE_BATCH = 64;
+#endif
+
+// ========== Local Headers ========================================================================
+
+#if USE_THREADS
+// push the values first up to end, in batches, waiting while the queue is full
+template <typename Queue> void pushRange(Queue& queue, unsigned long first, unsigned long end);
+
+// pop every value until the queue is closed and empty; returns their sum
+template <typename Queue> unsigned long long popAll(Queue& queue);
+
+// pushRange, then close the queue, on a producer thread
+template <typename Queue> void producerWorker(Queue& queue, unsigned long first, unsigned long end);
+
+// pass values 1 to items from producers threads to this one; returns 0 if every value arrived
+template <typename Queue> int passValues(Queue& queue, int items, int producers);
+
+// push the values first up to end, in batches, then close the queue, on a producer thread
+void lockedProducerWorker(LockedQueue<unsigned long>& queue, unsigned long first,
+                          unsigned long end);
+#endif
+
+// ========== Functions ============================================================================
+
+#if USE_THREADS
+// for benchmarking: pass items values from producers threads to one consumer through a queue of
+// kind "spsc" (one producer only), "mpsc" or "locked", in batches; returns 0 if every value arrived
+int benchQueue(const std::string& kind, int items, int producers)
+{
+    if (kind == "spsc") {
+        SpscQueue<unsigned long> queue(BENCH_QUEUE_CAPACITY);
+        return passValues(queue, items, 1);
+
+    } else if (kind == "mpsc") {
+        MpscQueue<unsigned long> queue(BENCH_QUEUE_CAPACITY, producers);
+        return passValues(queue, items, producers);
+    }
+
+    RUNTIME_ERROR_IF(kind != "locked", "unknown queue kind " + kind);
+
+    LockedQueue<unsigned long> queue(BENCH_QUEUE_CAPACITY, producers);
+
+    vector<thread> producerThreads;
+    for (int k = 0; k < producers; k++) {
+        unsigned long first = 1 + (unsigned long)k * items / producers;
+        unsigned long end = 1 + (unsigned long)(k + 1) * items / producers;
+        producerThreads.push_back(thread(bind(&lockedProducerWorker, ref(queue), first, end)));
+    }
+
+    unsigned long long sum = 0;
+    vector<unsigned long> values(BENCH_QUEUE_BATCH);
+
+    size_t count = queue.popBatch(&values[0], values.size());
+    while (count > 0) {
+        for (size_t k = 0; k < count; k++) {
+            sum += values[k];
+        }
+
+        count = queue.popBatch(&values[0], values.size());
+    }
+
+    for (int k = 0; k < producers; k++) {
+        producerThreads[k].join();
+    }
+
+    return sum == (unsigned long long)items * (items + 1) / 2 ? 0 : 1;
+}
+#endif
+
+// ========== Local Functions ======================================================================
+
+#if USE_THREADS
+// push the values first up to end, in batches, waiting while the queue is full
+template <typename Queue> void pushRange(Queue& queue, unsigned long first, unsigned long end)
+{
+    vector<unsigned long> values;
+    values.reserve(BENCH_QUEUE_BATCH);
+
+    while (first < end) {
+        values.clear();
+        while (first < end && values.size() < BENCH_QUEUE_BATCH) {
+            values.push_back(first++);
+        }
+
+        size_t pushed = 0;
+        while (pushed < values.size()) {
+            size_t count = queue.tryPushBatch(&values[pushed], values.size() - pushed);
+            if (count == 0) {
+                this_thread::yield();
+            }
+
+            pushed += count;
+        }
+    }
+}
+
+// pop every value until the queue is closed and empty; returns their sum
+template <typename Queue> unsigned long long popAll(Queue& queue)
+{
+    unsigned long long sum = 0;
+    vector<unsigned long> values(BENCH_QUEUE_BATCH);
+
+    while (true) {
+        bool closed = queue.isClosed();
+
+        size_t count = queue.tryPopBatch(&values[0], values.size());
+        for (size_t k = 0; k < count; k++) {
+            sum += values[k];
+        }
+
+        if (count == 0) {
+            if (closed) {
+                break;
+            }
+
+            this_thread::yield();
+        }
+    }
+
+    return sum;
+}
+
+// pushRange, then close the queue, on a producer thread
+template <typename Queue> void producerWorker(Queue& queue, unsigned long first, unsigned long end)
+{
+    pushRange(queue, first, end);
+    queue.close();
+}
+
+// pass values 1 to items from producers threads to this one; returns 0 if every value arrived
+template <typename Queue> int passValues(Queue& queue, int items, int producers)
+{
+    vector<thread> producerThreads;
+    for (int k = 0; k < producers; k++) {
+        unsigned long first = 1 + (unsigned long)k * items / producers;
+        unsigned long end = 1 + (unsigned long)(k + 1) * items / producers;
+        producerThreads.push_back(thread(bind(&producerWorker<Queue>, ref(queue), first, end)));
+    }
+
+    unsigned long long sum = popAll(queue);
+
+    for (int k = 0; k < producers; k++) {
+        producerThreads[k].join();
+    }
+
+    return sum == (unsigned long long)items * (items + 1) / 2 ? 0 : 1;
+}
+
+// push the values first up to end, in batches, then close the queue, on a producer thread
+void lockedProducerWorker(LockedQueue<unsigned long>& queue, unsigned long first,
+                          unsigned long end)
+{
+    vector<unsigned long> values;
+    values.reserve(BENCH_QUEUE_BATCH);
+
+    while (first < end) {
+        values.clear();
+        while (first < end && values.size() < BENCH_QUEUE_BATCH) {
+            values.push_back(first++);
+        }
+
+        queue.pushBatch(&values[0], values.size());
+    }
+
+    queue.close();
+}
+#endif
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_ringQueues(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+#if USE_THREADS
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SpscQueue::tryPushBatch
+    // SpscQueue::tryPopBatch
+
+    {
+        // room for 4; pushes stop when full, and positions wrap around
+        SpscQueue<string> queue(3);
+
+        const string values[] = {"a", "b", "c", "d", "e", "f"};
+        size_t pushed = queue.tryPushBatch(values, 6);
+
+        string popped[4];
+        size_t poppedCount = queue.tryPopBatch(popped, 3);
+        pushed += queue.tryPushBatch(values + 4, 2);
+
+        string rest[4];
+        size_t restCount = queue.tryPopBatch(rest, 4);
+        bool closed = queue.isClosed();
+        queue.close();
+
+        if (queue.getCapacity() == 4 && pushed == 6 && poppedCount == 3 && popped[2] == "c" &&
+            restCount == 3 && rest[0] == "d" && rest[2] == "f" && !closed &&
+            queue.isClosed() && !queue.tryPop(rest[0])) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // MpscQueue::tryPushBatch
+    // MpscQueue::tryPopBatch
+
+    {
+        MpscQueue<int> queue(4, 1);
+
+        const int values[] = {1, 2, 3, 4, 5};
+        size_t pushed = queue.tryPushBatch(values, 5);
+
+        int popped[2];
+        size_t poppedCount = queue.tryPopBatch(popped, 2);
+        pushed += queue.tryPushBatch(values + 4, 1);
+
+        int rest[4];
+        size_t restCount = queue.tryPopBatch(rest, 4);
+        queue.close();
+
+        if (pushed == 5 && poppedCount == 2 && popped[1] == 2 && restCount == 3 && rest[2] == 5 &&
+            queue.isClosed()) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // benchQueue
+
+    {
+        // values from several threads at once, with the queues full much of the time
+        int status = benchQueue("spsc", 100000, 1);
+        status += benchQueue("mpsc", 100000, 4);
+        status += benchQueue("locked", 100000, 4);
+
+        if (status == 0) passed++; else failed++;
+    }
+#endif
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "ringQueues.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_ringQueues(bool verbose)
+{
+#if USE_THREADS
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // LockedQueue::popBatch
+
+    {
+        // nothing pushed before closing
+        LockedQueue<int> queue(1, 1);
+        queue.close();
+
+        int value = 0;
+        queue.popBatch(&value, 1);
+    }
+#endif
+}
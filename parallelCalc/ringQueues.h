@@ -0,0 +1,386 @@
+//
+//  ringQueues.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Bounded queues for passing values between threads while they run. SpscQueue (one producer, one
+// consumer) and MpscQueue (many producers, one consumer) are lock-free ring buffers: a push or pop
+// of a batch of values is a few atomic loads and stores, and the producers' and consumer's indices
+// are kept on separate cache lines so that they don't contend for one. LockedQueue is the same
+// with a mutex and condition variables, for comparison.
+//
+
+#ifndef parallelCalc_ringQueues_h
+#define parallelCalc_ringQueues_h
+
+#include "shim.h"
+
+#include <cstddef>
+#include <string>
+
+#if USE_THREADS
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#endif
+
+// ========== Constants ============================================================================
+
+#if USE_THREADS
+const size_t CACHE_LINE_BYTES = 64;
+#endif
+
+// ========== Class Templates ======================================================================
+
+#if USE_THREADS
+template <typename T> class SpscQueue {
+public:
+    // room for capacity values, rounded up to a power of two
+    SpscQueue(size_t capacity);
+
+    // producer: push up to n values, as many as there is room for; returns the number pushed
+    size_t tryPushBatch(const T *values, size_t n);
+    bool tryPush(const T& value) { return tryPushBatch(&value, 1) == 1; };
+
+    // producer: no more values will be pushed
+    void close() { closed.store(true, std::memory_order_release); };
+
+    // consumer: pop up to n values, as many as are waiting; returns the number popped
+    size_t tryPopBatch(T *values, size_t n);
+    bool tryPop(T& value) { return tryPopBatch(&value, 1) == 1; };
+
+    // consumer: true once the producer has closed; check before a pop that finds nothing, as values
+    // pushed before closing may still be waiting
+    bool isClosed() const { return closed.load(std::memory_order_acquire); };
+
+    size_t getCapacity() const { return slots.size(); };
+
+protected:
+    std::vector<T> slots;
+    size_t mask;
+
+    // each side's index on its own cache line, with its copy of the other's, which it reads again
+    // only when the copy says the queue is full or empty
+    char pad0[CACHE_LINE_BYTES];
+    std::atomic<size_t> tail;           // next slot to push into
+    size_t cachedHead;
+    char pad1[CACHE_LINE_BYTES];
+    std::atomic<size_t> head;           // next slot to pop from
+    size_t cachedTail;
+    char pad2[CACHE_LINE_BYTES];
+    std::atomic<bool> closed;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+template <typename T> class MpscQueue {
+public:
+    // room for capacity values, rounded up to a power of two, pushed by producers threads
+    MpscQueue(size_t capacity, int producers);
+
+    // producer: push up to n values, as many as there is room for; returns the number pushed
+    size_t tryPushBatch(const T *values, size_t n);
+    bool tryPush(const T& value) { return tryPushBatch(&value, 1) == 1; };
+
+    // producer: this producer will push no more values
+    void close() { openProducers.fetch_sub(1, std::memory_order_release); };
+
+    // consumer: pop up to n values, as many as are waiting; returns the number popped
+    size_t tryPopBatch(T *values, size_t n);
+    bool tryPop(T& value) { return tryPopBatch(&value, 1) == 1; };
+
+    // consumer: true once every producer has closed; check before a pop that finds nothing, as
+    // values pushed before closing may still be waiting
+    bool isClosed() const { return openProducers.load(std::memory_order_acquire) <= 0; };
+
+    size_t getCapacity() const { return capacity; };
+
+protected:
+    // a slot holds a value to pop at position sequence - 1, or is free to push into at position
+    // sequence
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+
+        Slot() : sequence(0), value() {};
+    };
+
+    size_t capacity;
+    size_t mask;
+    std::vector<Slot> slots;
+
+    char pad0[CACHE_LINE_BYTES];
+    std::atomic<size_t> tail;           // next position to push into, claimed by producers
+    char pad1[CACHE_LINE_BYTES];
+    size_t head;                        // next position to pop from
+    char pad2[CACHE_LINE_BYTES];
+    std::atomic<int> openProducers;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+template <typename T> class LockedQueue {
+public:
+    // room for capacity values, pushed by producers threads
+    LockedQueue(size_t capacity, int producers);
+
+    // producer: push n values, waiting while the queue is full
+    void pushBatch(const T *values, size_t n);
+
+    // producer: this producer will push no more values
+    void close();
+
+    // consumer: pop up to n values, waiting until there are some; returns 0 once every producer
+    // has closed and nothing is left
+    size_t popBatch(T *values, size_t n);
+
+protected:
+    std::mutex queueMutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::vector<T> slots;
+    size_t head;                        // next slot to pop from
+    size_t count;
+    int openProducers;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// room for capacity values, rounded up to a power of two
+template <typename T> SpscQueue<T>::SpscQueue(size_t capacity) :
+slots(),
+mask(0),
+tail(0),
+cachedHead(0),
+head(0),
+cachedTail(0),
+closed(false)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    slots.resize(size);
+    mask = size - 1;
+}
+
+// producer: push up to n values, as many as there is room for; returns the number pushed
+template <typename T> size_t SpscQueue<T>::tryPushBatch(const T *values, size_t n)
+{
+    size_t first = tail.load(std::memory_order_relaxed);
+
+    if (first + n > cachedHead + slots.size()) {
+        cachedHead = head.load(std::memory_order_acquire);
+    }
+
+    size_t count = std::min(n, cachedHead + slots.size() - first);
+    for (size_t k = 0; k < count; k++) {
+        slots[(first + k) & mask] = values[k];
+    }
+
+    tail.store(first + count, std::memory_order_release);
+
+    return count;
+}
+
+// consumer: pop up to n values, as many as are waiting; returns the number popped
+template <typename T> size_t SpscQueue<T>::tryPopBatch(T *values, size_t n)
+{
+    size_t first = head.load(std::memory_order_relaxed);
+
+    if (first + n > cachedTail) {
+        cachedTail = tail.load(std::memory_order_acquire);
+    }
+
+    // swapped out rather than copied, so that the slot keeps any storage for the next push
+    size_t count = std::min(n, cachedTail - first);
+    for (size_t k = 0; k < count; k++) {
+        std::swap(values[k], slots[(first + k) & mask]);
+    }
+
+    head.store(first + count, std::memory_order_release);
+
+    return count;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// room for capacity values, rounded up to a power of two, pushed by producers threads
+template <typename T> MpscQueue<T>::MpscQueue(size_t capacity, int producers) :
+capacity(1),
+mask(0),
+slots(),
+tail(0),
+head(0),
+openProducers(producers)
+{
+    while (this->capacity < capacity) {
+        this->capacity *= 2;
+    }
+
+    mask = this->capacity - 1;
+
+    std::vector<Slot> newSlots(this->capacity);
+    slots.swap(newSlots);
+
+    for (size_t k = 0; k < this->capacity; k++) {
+        slots[k].sequence.store(k, std::memory_order_relaxed);
+    }
+}
+
+// producer: push up to n values, as many as there is room for; returns the number pushed
+template <typename T> size_t MpscQueue<T>::tryPushBatch(const T *values, size_t n)
+{
+    size_t first = tail.load(std::memory_order_relaxed);
+    size_t count = 0;
+
+    while (true) {
+        size_t sequence = slots[first & mask].sequence.load(std::memory_order_acquire);
+        if (sequence < first) {
+            // full
+            return 0;
+
+        } else if (sequence > first) {
+            // another producer has pushed there
+            first = tail.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        // the consumer frees slots in order, so positions up to the last are free if it is
+        count = std::min(n, capacity);
+        while (count > 1) {
+            size_t last = first + count - 1;
+            if (slots[last & mask].sequence.load(std::memory_order_acquire) == last) {
+                break;
+            }
+
+            count /= 2;
+        }
+
+        if (tail.compare_exchange_weak(first, first + count, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        Slot& slot = slots[(first + k) & mask];
+        slot.value = values[k];
+        slot.sequence.store(first + k + 1, std::memory_order_release);
+    }
+
+    return count;
+}
+
+// consumer: pop up to n values, as many as are waiting; returns the number popped
+template <typename T> size_t MpscQueue<T>::tryPopBatch(T *values, size_t n)
+{
+    size_t count = 0;
+
+    while (count < n) {
+        Slot& slot = slots[head & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            break;
+        }
+
+        std::swap(values[count], slot.value);
+        slot.sequence.store(head + capacity, std::memory_order_release);
+
+        head++;
+        count++;
+    }
+
+    return count;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// room for capacity values, pushed by producers threads
+template <typename T> LockedQueue<T>::LockedQueue(size_t capacity, int producers) :
+queueMutex(),
+notFull(),
+notEmpty(),
+slots(capacity > 0 ? capacity : 1),
+head(0),
+count(0),
+openProducers(producers)
+{
+}
+
+// producer: push n values, waiting while the queue is full
+template <typename T> void LockedQueue<T>::pushBatch(const T *values, size_t n)
+{
+    size_t pushed = 0;
+    while (pushed < n) {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (count == slots.size()) {
+            notFull.wait(lock);
+        }
+
+        while (pushed < n && count < slots.size()) {
+            slots[(head + count) % slots.size()] = values[pushed];
+            count++;
+            pushed++;
+        }
+
+        notEmpty.notify_one();
+    }
+}
+
+// producer: this producer will push no more values
+template <typename T> void LockedQueue<T>::close()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    openProducers--;
+
+    notEmpty.notify_all();
+}
+
+// consumer: pop up to n values, waiting until there are some; returns 0 once every producer has
+// closed and nothing is left
+template <typename T> size_t LockedQueue<T>::popBatch(T *values, size_t n)
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (count == 0 && openProducers > 0) {
+        notEmpty.wait(lock);
+    }
+
+    size_t popped = 0;
+    while (popped < n && count > 0) {
+        std::swap(values[popped], slots[head]);
+        head = (head + 1) % slots.size();
+        count--;
+        popped++;
+    }
+
+    notFull.notify_all();
+
+    return popped;
+}
+#endif
+
+// ========== Function Headers =====================================================================
+
+#if USE_THREADS
+// for benchmarking: pass items values from producers threads to one consumer through a queue of
+// kind "spsc" (one producer only), "mpsc" or "locked", in batches; returns 0 if every value
+// arrived
+int benchQueue(const std::string& kind, int items, int producers);
+#endif
+
+// component tests
+void ctest_ringQueues(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_ringQueues(bool verbose);
+
+#endif
@@ -39,4 +39,17 @@
 
 #endif
 
+// build with USE_ALLOC_HOOK=1 to count allocations in global operator new and delete
+// (memStats.h); off by default, so that other builds don't pay for counting every allocation
+#ifndef USE_ALLOC_HOOK
+#define USE_ALLOC_HOOK 0
+#endif
+
+// thread-local storage for plain data
+#if WINDOWS
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #endif
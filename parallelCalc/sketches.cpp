@@ -0,0 +1,665 @@
+//
+//  sketches.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Sketches of a stream of values in bounded memory: HyperLogLog for the count of distinct values,
+// count-min for the frequency of each value, and t-digest for quantiles. Each has an error bound
+// chosen when it is made, and can merge another made with the same bound as if its values had been
+// added, so that sketches of parts of the values can be made on different threads, processes or
+// tasks. Each can be written as one line of text and read back, to be passed between them.
+//
+
+#include "sketches.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "utils.h"
+
+using namespace std;
+
+// ========== Classes ==============================================================================
+
+// relative standard error of about relativeError; 0.01 takes 16 KB, allocated by the first add
+HyperLogLog::HyperLogLog(double relativeError) :
+precision(4),
+registers()
+{
+    LOGIC_ERROR_IF(relativeError <= 0, "sketch error must be > 0");
+
+    // the standard error is 1.04 / sqrt(registers)
+    double needed = (1.04 / relativeError) * (1.04 / relativeError);
+    while (precision < 18 && (double)(1 << precision) < needed) {
+        precision++;
+    }
+}
+
+// add a value by its hash, such as from sketchHash
+void HyperLogLog::add(unsigned long long hash)
+{
+    if (registers.empty()) {
+        registers.assign((size_t)1 << precision, 0);
+    }
+
+    // the top bits choose a register, which keeps the longest run of leading zeros in the rest
+    size_t index = (size_t)(hash >> (64 - precision));
+    unsigned long long rest = hash << precision;
+
+    unsigned char rank = 1;
+    while (rank <= 64 - precision && (rest & (1ULL << 63)) == 0) {
+        rest <<= 1;
+        rank++;
+    }
+
+    if (rank > registers[index]) {
+        registers[index] = rank;
+    }
+}
+
+// add the values of another made with the same relativeError
+void HyperLogLog::merge(const HyperLogLog& other)
+{
+    LOGIC_ERROR_IF(other.precision != precision, "can't merge sketches of different sizes");
+
+    if (other.registers.empty()) {
+        return;
+    }
+
+    if (registers.empty()) {
+        registers = other.registers;
+        return;
+    }
+
+    for (size_t k = 0; k < registers.size(); k++) {
+        registers[k] = max(registers[k], other.registers[k]);
+    }
+}
+
+// estimated count of distinct values added
+double HyperLogLog::estimate() const
+{
+    if (registers.empty()) {
+        return 0;
+    }
+
+    double m = (double)registers.size();
+
+    double inverseSum = 0;
+    int zeros = 0;
+    for (size_t k = 0; k < registers.size(); k++) {
+        inverseSum += ldexp(1.0, -registers[k]);
+        zeros += registers[k] == 0 ? 1 : 0;
+    }
+
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double estimate = alpha * m * m / inverseSum;
+
+    // small counts are more accurate from the registers still empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+
+    return estimate;
+}
+
+// write as one line of text, without the newline; read returns false if the line is malformed
+void HyperLogLog::write(std::ostream& output) const
+{
+    output << "hll " << precision << " ";
+
+    if (registers.empty()) {
+        output << "-";
+    }
+
+    // ranks are at most 61, so one printable character each
+    for (size_t k = 0; k < registers.size(); k++) {
+        output << (char)('0' + registers[k]);
+    }
+}
+
+bool HyperLogLog::read(std::istream& input)
+{
+    string tag;
+    int readPrecision = 0;
+    string readRegisters;
+
+    input >> tag >> readPrecision >> readRegisters;
+    if (input.fail() || tag != "hll" || readPrecision != precision) {
+        return false;
+    }
+
+    if (readRegisters == "-") {
+        registers.clear();
+        return true;
+    }
+
+    if (readRegisters.length() != (size_t)1 << precision) {
+        return false;
+    }
+
+    vector<unsigned char> values(readRegisters.length());
+    for (size_t k = 0; k < values.size(); k++) {
+        int rank = readRegisters[k] - '0';
+        if (rank < 0 || rank > 64 - precision + 1) {
+            return false;
+        }
+
+        values[k] = (unsigned char)rank;
+    }
+
+    registers.swap(values);
+
+    return true;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// counts overestimated by at most epsilon times the total count, with probability 1 - delta;
+// allocated by the first add
+CountMinSketch::CountMinSketch(double epsilon, double delta) :
+width(0),
+depth(0),
+total(0),
+counts()
+{
+    LOGIC_ERROR_IF(epsilon <= 0 || delta <= 0 || delta >= 1, "sketch error must be > 0");
+
+    width = max(1, (int)ceil(exp(1.0) / epsilon));
+    depth = max(1, (int)ceil(log(1 / delta)));
+}
+
+// add count occurrences of a value by its hash, such as from sketchHash
+void CountMinSketch::add(unsigned long long hash, long long count)
+{
+    if (counts.empty()) {
+        counts.assign((size_t)width * depth, 0);
+    }
+
+    for (int row = 0; row < depth; row++) {
+        counts[cell(hash, row)] += count;
+    }
+
+    total += count;
+}
+
+// add the counts of another made with the same epsilon and delta
+void CountMinSketch::merge(const CountMinSketch& other)
+{
+    LOGIC_ERROR_IF(other.width != width || other.depth != depth,
+                   "can't merge sketches of different sizes");
+
+    if (other.counts.empty()) {
+        return;
+    }
+
+    if (counts.empty()) {
+        counts = other.counts;
+
+    } else {
+        for (size_t k = 0; k < counts.size(); k++) {
+            counts[k] += other.counts[k];
+        }
+    }
+
+    total += other.total;
+}
+
+// estimated occurrences of a value by its hash
+long long CountMinSketch::estimate(unsigned long long hash) const
+{
+    if (counts.empty()) {
+        return 0;
+    }
+
+    long long least = counts[cell(hash, 0)];
+    for (int row = 1; row < depth; row++) {
+        least = min(least, counts[cell(hash, row)]);
+    }
+
+    return least;
+}
+
+// write as one line of text, without the newline; read returns false if the line is malformed
+void CountMinSketch::write(std::ostream& output) const
+{
+    output << "cms " << width << " " << depth << " " << total;
+
+    if (counts.empty()) {
+        output << " -";
+    }
+
+    for (size_t k = 0; k < counts.size(); k++) {
+        output << " " << counts[k];
+    }
+}
+
+bool CountMinSketch::read(std::istream& input)
+{
+    string tag;
+    int readWidth = 0;
+    int readDepth = 0;
+    long long readTotal = 0;
+
+    input >> tag >> readWidth >> readDepth >> readTotal;
+    if (input.fail() || tag != "cms" || readWidth != width || readDepth != depth) {
+        return false;
+    }
+
+    if (input.peek() == ' ') {
+        input.get();
+    }
+
+    if (input.peek() == '-') {
+        input.get();
+        counts.clear();
+        total = 0;
+        return true;
+    }
+
+    vector<long long> values((size_t)width * depth);
+    for (size_t k = 0; k < values.size(); k++) {
+        input >> values[k];
+    }
+
+    if (input.fail()) {
+        return false;
+    }
+
+    counts.swap(values);
+    total = readTotal;
+
+    return true;
+}
+
+// index in counts of a value's count in a row
+size_t CountMinSketch::cell(unsigned long long hash, int row) const
+{
+    // two halves of the hash combine into an independent-enough hash per row
+    unsigned long long low = hash & 0xffffffffULL;
+    unsigned long long high = (hash >> 32) | 1;
+
+    return (size_t)row * width + (size_t)((low + row * high) % (unsigned long long)width);
+}
+
+// -------------------------------------------------------------------------------------------------
+
+// quantiles within about relativeError of their rank, closer toward the tails
+TDigest::TDigest(double relativeError) :
+compression(0),
+total(0),
+minValue(0),
+maxValue(0),
+centroids(),
+pending()
+{
+    LOGIC_ERROR_IF(relativeError <= 0, "sketch error must be > 0");
+
+    compression = max(20.0, 1 / relativeError);
+}
+
+void TDigest::add(double value)
+{
+    if (total == 0 || value < minValue) {
+        minValue = value;
+    }
+
+    if (total == 0 || value > maxValue) {
+        maxValue = value;
+    }
+
+    pending.push_back(make_pair(value, 1.0));
+    total += 1;
+
+    if ((double)pending.size() >= 5 * compression) {
+        compress();
+    }
+}
+
+// add the values of another
+void TDigest::merge(const TDigest& other)
+{
+    if (other.total == 0) {
+        return;
+    }
+
+    minValue = total == 0 ? other.minValue : min(minValue, other.minValue);
+    maxValue = total == 0 ? other.maxValue : max(maxValue, other.maxValue);
+
+    pending.insert(pending.end(), other.centroids.begin(), other.centroids.end());
+    pending.insert(pending.end(), other.pending.begin(), other.pending.end());
+    total += other.total;
+
+    compress();
+}
+
+// estimated value at quantile q (0.5 for the median); 0 if there are no values
+double TDigest::quantile(double q) const
+{
+    if (total == 0) {
+        return 0;
+    }
+
+    TDigest digest(*this);
+    digest.compress();
+    const vector< pair<double, double> >& c = digest.centroids;
+
+    if (c.size() == 1) {
+        return c[0].first;
+    }
+
+    // each centroid's weight is centered on its mean; interpolate between neighboring centers,
+    // and between the outer centers and the smallest and largest values
+    double target = max(0.0, min(1.0, q)) * total;
+
+    double firstCenter = c[0].second / 2;
+    if (target <= firstCenter) {
+        return minValue + (c[0].first - minValue) * target / firstCenter;
+    }
+
+    double cumulative = 0;
+    for (size_t k = 0; k + 1 < c.size(); k++) {
+        double center = cumulative + c[k].second / 2;
+        double nextCenter = cumulative + c[k].second + c[k + 1].second / 2;
+
+        if (target <= nextCenter) {
+            return c[k].first + (c[k + 1].first - c[k].first) * (target - center) /
+                   (nextCenter - center);
+        }
+
+        cumulative += c[k].second;
+    }
+
+    double lastCenter = total - c.back().second / 2;
+
+    return c.back().first + (maxValue - c.back().first) * (target - lastCenter) /
+           (total - lastCenter);
+}
+
+// write as one line of text, without the newline; read returns false if the line is malformed
+void TDigest::write(std::ostream& output) const
+{
+    TDigest digest(*this);
+    digest.compress();
+
+    output << setprecision(17);
+    output << "tdigest " << total << " " << minValue << " " << maxValue << " ";
+    output << digest.centroids.size();
+
+    for (size_t k = 0; k < digest.centroids.size(); k++) {
+        output << " " << digest.centroids[k].first << " " << digest.centroids[k].second;
+    }
+}
+
+bool TDigest::read(std::istream& input)
+{
+    string tag;
+    double readTotal = 0;
+    double readMin = 0;
+    double readMax = 0;
+    size_t count = 0;
+
+    input >> tag >> readTotal >> readMin >> readMax >> count;
+    if (input.fail() || tag != "tdigest") {
+        return false;
+    }
+
+    vector< pair<double, double> > values(count);
+    for (size_t k = 0; k < count; k++) {
+        input >> values[k].first >> values[k].second;
+    }
+
+    if (input.fail()) {
+        return false;
+    }
+
+    total = readTotal;
+    minValue = readMin;
+    maxValue = readMax;
+    centroids.swap(values);
+    pending.clear();
+
+    return true;
+}
+
+// merge pending values into the centroids, combining neighbors while they stay within the size
+// allowed at their quantile
+void TDigest::compress()
+{
+    if (pending.empty()) {
+        return;
+    }
+
+    pending.insert(pending.end(), centroids.begin(), centroids.end());
+    sort(pending.begin(), pending.end());
+    centroids.clear();
+
+    // a centroid may hold about 4 * total * q * (1 - q) / compression values, so that those near
+    // the tails stay small
+    double soFar = 0;
+    pair<double, double> current = pending[0];
+    for (size_t k = 1; k < pending.size(); k++) {
+        double proposed = current.second + pending[k].second;
+        double q = (soFar + proposed / 2) / total;
+        double limit = 4 * total * q * (1 - q) / compression;
+
+        if (proposed <= limit) {
+            current.first += (pending[k].first - current.first) * pending[k].second / proposed;
+            current.second = proposed;
+
+        } else {
+            centroids.push_back(current);
+            soFar += current.second;
+            current = pending[k];
+        }
+    }
+
+    centroids.push_back(current);
+    pending.clear();
+}
+
+// ========== Functions ============================================================================
+
+// spread the bits of x, so that every bit of the result depends on every bit of x
+unsigned long long mixBits(unsigned long long x)
+{
+    // the finalizer of splitmix64
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+
+    return x;
+}
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_sketches(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // HyperLogLog::add
+    // HyperLogLog::merge
+    // HyperLogLog::estimate
+
+    {
+        // 100000 distinct values, each added twice, half to each of two sketches
+        HyperLogLog whole;
+        HyperLogLog first;
+        HyperLogLog second;
+
+        for (unsigned long value = 0; value < 100000; value++) {
+            whole.add(sketchHash(value));
+            whole.add(sketchHash(value));
+            (value % 2 == 0 ? first : second).add(sketchHash(value));
+        }
+
+        first.merge(second);
+
+        HyperLogLog small;
+        for (int value = 0; value < 100; value++) {
+            small.add(sketchHash(value));
+        }
+
+        if (fabs(whole.estimate() - 100000) < 3000 && first.estimate() == whole.estimate() &&
+            fabs(small.estimate() - 100) < 2 && whole.getBytes() == 16384 &&
+            HyperLogLog().estimate() == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // CountMinSketch::add
+    // CountMinSketch::merge
+    // CountMinSketch::estimate
+
+    {
+        // value k occurs k times, for k in 1..1000, split over two sketches
+        CountMinSketch first(0.001, 0.01);
+        CountMinSketch second(0.001, 0.01);
+
+        for (int value = 1; value <= 1000; value++) {
+            (value % 3 == 0 ? first : second).add(sketchHash(value), value);
+        }
+
+        first.merge(second);
+
+        // never under, and over by at most 0.1% of the total for nearly all
+        bool valid = first.getTotal() == 500500;
+        int over = 0;
+        for (int value = 1; value <= 1000; value++) {
+            long long estimate = first.estimate(sketchHash(value));
+            valid = valid && estimate >= value;
+            over += estimate > value + 501 ? 1 : 0;
+        }
+
+        if (valid && over <= 10 && first.estimate(sketchHash(5000)) <= 501) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // TDigest::add
+    // TDigest::merge
+    // TDigest::quantile
+
+    {
+        // 1..100000 in a scattered order, split over two digests
+        TDigest first;
+        TDigest second;
+
+        for (unsigned long k = 0; k < 100000; k++) {
+            double value = (double)((k * 7919) % 100000 + 1);
+            (k < 30000 ? first : second).add(value);
+        }
+
+        first.merge(second);
+
+        bool valid = first.getCount() == 100000 && first.getCentroidCount() < 1000 &&
+                     first.quantile(0) == 1 && first.quantile(1) == 100000;
+
+        const double QUANTILES[] = {0.001, 0.01, 0.25, 0.5, 0.75, 0.99, 0.999};
+        for (int k = 0; k < 7; k++) {
+            valid = valid && fabs(first.quantile(QUANTILES[k]) - QUANTILES[k] * 100000) < 1000;
+        }
+
+        if (valid && TDigest().quantile(0.5) == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // HyperLogLog::write
+    // HyperLogLog::read
+    // CountMinSketch::write
+    // CountMinSketch::read
+    // TDigest::write
+    // TDigest::read
+
+    {
+        HyperLogLog hll;
+        CountMinSketch cms(0.1, 0.1);
+        TDigest digest;
+
+        for (int value = 1; value <= 1000; value++) {
+            hll.add(sketchHash(value));
+            cms.add(sketchHash(value % 10));
+            digest.add(value);
+        }
+
+        ostringstream oss;
+        hll.write(oss);
+        oss << "\n";
+        cms.write(oss);
+        oss << "\n";
+        digest.write(oss);
+        oss << "\n";
+        HyperLogLog().write(oss);
+        oss << "\n";
+        CountMinSketch(0.1, 0.1).write(oss);
+
+        HyperLogLog readHll;
+        CountMinSketch readCms(0.1, 0.1);
+        TDigest readDigest;
+        HyperLogLog emptyHll;
+        CountMinSketch emptyCms(0.1, 0.1);
+
+        istringstream iss(oss.str());
+        bool valid = readHll.read(iss) && readCms.read(iss) && readDigest.read(iss) &&
+                     emptyHll.read(iss) && emptyCms.read(iss);
+
+        // another size doesn't read
+        istringstream other(oss.str());
+        bool invalid = !HyperLogLog(0.1).read(other);
+
+        if (valid && invalid && readHll.estimate() == hll.estimate() &&
+            readCms.estimate(sketchHash(3)) == cms.estimate(sketchHash(3)) &&
+            readCms.getTotal() == 1000 && readDigest.quantile(0.3) == digest.quantile(0.3) &&
+            emptyHll.estimate() == 0 && emptyCms.getTotal() == 0) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "sketches.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_sketches(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // HyperLogLog::merge
+
+    try {
+        HyperLogLog small(0.1);
+        HyperLogLog large(0.01);
+        small.merge(large);
+
+    } catch (const logic_error& x) {
+        if (verbose) {
+            cerr << "logic_error: " << x.what() << endl;
+        }
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // TDigest::read
+
+    {
+        TDigest digest;
+        istringstream iss("tdigest 3 1 2 2 1.5");
+        digest.read(iss);
+    }
+}
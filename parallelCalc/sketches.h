@@ -0,0 +1,150 @@
+//
+//  sketches.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Sketches of a stream of values in bounded memory: HyperLogLog for the count of distinct values,
+// count-min for the frequency of each value, and t-digest for quantiles. Each has an error bound
+// chosen when it is made, and can merge another made with the same bound as if its values had been
+// added, so that sketches of parts of the values can be made on different threads, processes or
+// tasks. Each can be written as one line of text and read back, to be passed between them.
+//
+
+#ifndef parallelCalc_sketches_h
+#define parallelCalc_sketches_h
+
+#include "shim.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// ========== Class Declarations ===================================================================
+
+// count of distinct values, from their hashes
+class HyperLogLog {
+public:
+    // relative standard error of about relativeError; 0.01 takes 16 KB, allocated by the first add
+    HyperLogLog(double relativeError = 0.01);
+
+    // add a value by its hash, such as from sketchHash
+    void add(unsigned long long hash);
+
+    // add the values of another made with the same relativeError
+    void merge(const HyperLogLog& other);
+
+    // estimated count of distinct values added
+    double estimate() const;
+
+    size_t getBytes() const { return registers.size(); };
+
+    // write as one line of text, without the newline; read returns false if the line is malformed
+    void write(std::ostream& output) const;
+    bool read(std::istream& input);
+
+protected:
+    int precision;                          // log2 of the number of registers
+    std::vector<unsigned char> registers;   // empty until the first add
+};
+
+// frequency of each value, from their hashes; never underestimated
+class CountMinSketch {
+public:
+    // counts overestimated by at most epsilon times the total count, with probability 1 - delta;
+    // allocated by the first add
+    CountMinSketch(double epsilon = 0.001, double delta = 0.01);
+
+    // add count occurrences of a value by its hash, such as from sketchHash
+    void add(unsigned long long hash, long long count = 1);
+
+    // add the counts of another made with the same epsilon and delta
+    void merge(const CountMinSketch& other);
+
+    // estimated occurrences of a value by its hash
+    long long estimate(unsigned long long hash) const;
+
+    long long getTotal() const { return total; };
+    size_t getBytes() const { return counts.size() * sizeof(long long); };
+
+    // write as one line of text, without the newline; read returns false if the line is malformed
+    void write(std::ostream& output) const;
+    bool read(std::istream& input);
+
+protected:
+    // index in counts of a value's count in a row
+    size_t cell(unsigned long long hash, int row) const;
+
+    int width;
+    int depth;
+    long long total;
+    std::vector<long long> counts;          // depth rows of width; empty until the first add
+};
+
+// quantiles of values, as weighted centroids that are smallest toward the tails
+class TDigest {
+public:
+    // quantiles within about relativeError of their rank, closer toward the tails
+    TDigest(double relativeError = 0.01);
+
+    void add(double value);
+
+    // add the values of another
+    void merge(const TDigest& other);
+
+    // estimated value at quantile q (0.5 for the median); 0 if there are no values
+    double quantile(double q) const;
+
+    double getCount() const { return total; };
+    size_t getCentroidCount() const { return centroids.size() + pending.size(); };
+
+    // write as one line of text, without the newline; read returns false if the line is malformed
+    void write(std::ostream& output) const;
+    bool read(std::istream& input);
+
+protected:
+    // merge pending values into the centroids, combining neighbors while they stay within the size
+    // allowed at their quantile
+    void compress();
+
+    double compression;                                 // 1 / relativeError
+    double total;
+    double minValue;
+    double maxValue;
+    std::vector< std::pair<double, double> > centroids; // mean and weight, in order of mean
+    std::vector< std::pair<double, double> > pending;   // added since the last compress
+};
+
+// ========== Function Headers =====================================================================
+
+// spread the bits of x, so that every bit of the result depends on every bit of x
+unsigned long long mixBits(unsigned long long x);
+
+// component tests
+void ctest_sketches(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_sketches(bool verbose);
+
+// ========== Function Templates ===================================================================
+
+// 64-bit hash of a value of up to 8 bytes, for HyperLogLog and CountMinSketch
+template <typename T> unsigned long long sketchHash(T value);
+
+template <typename T> unsigned long long sketchHash(T value)
+{
+    unsigned long long bits = 0;
+    memcpy(&bits, &value, sizeof(T) < sizeof(bits) ? sizeof(T) : sizeof(bits));
+
+    return mixBits(bits);
+}
+
+#endif
@@ -16,25 +16,66 @@
 
 #include "sumSquare.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
 #include <map>
 #include <sstream>
 #include <string>
+#include <typeinfo>
 #include <vector>
 
 #include "callWithFork.h"
+#include "timerQueue.h"
+#include "trace.h"
 #include "utils.h"
 
 using namespace std;
 
+// ========== Local Headers ========================================================================
+
+// number of distinct keys in a range of pairs
+template <typename T>
+static long long countKeys(const std::multimap<std::string, T>& pairs,
+                           const typename std::multimap<std::string, T>::const_iterator& begin,
+                           const typename std::multimap<std::string, T>::const_iterator& end);
+
+// end of the values for iter's key within a range ending at end, which may be part way through
+// them
+template <typename T>
+static typename std::multimap<std::string, T>::const_iterator keyRangeEnd(
+    const std::multimap<std::string, T>& pairs,
+    const typename std::multimap<std::string, T>::const_iterator& iter,
+    const typename std::multimap<std::string, T>::const_iterator& end);
+
+// split a map into parts ranges of about the same size, in order, appending their ends to begins
+// and ends
+template <typename T>
+static void splitPairs(const std::multimap<std::string, T>& pairs, int parts,
+                       std::vector<typename std::multimap<std::string, T>::const_iterator>& begins,
+                       std::vector<typename std::multimap<std::string, T>::const_iterator>& ends);
+
 // ========== Classes ==============================================================================
 
 SumSquare::SumSquare()
 {
 }
 
+// rows each map thread keeps in flight between mapBegin and mapEnd; throws logic_error if
+// isMapInFlight is false, since mapRange would bypass an overridden mapOne or mapBatch
+void SumSquare::setMapInFlight(int mapInFlight)
+{
+    LOGIC_ERROR_IF(mapInFlight > 0 && !isMapInFlight(),
+                   name() + " overrides mapOne or mapBatch, so can't keep rows in flight");
+    
+    this->mapInFlight = mapInFlight;
+}
+
 // write key/value data usable as input to map operation
 int SumSquare::startWorker(int nrows, std::ostream& output)
 {
@@ -53,19 +94,58 @@ int SumSquare::startWorker(int nrows, std::ostream& output)
 // read key/value starting data, write mapped data
 int SumSquare::mapWorker(std::istream& input, std::ostream& output)
 {
+    // counters for Hadoop streaming
+    TaskReporter reporter(report);
+    int rowsRead = reporter.addCounter("mapRowsRead");
+    int rowsEmitted = reporter.addCounter("mapRowsEmitted");
+    int bytesParsed = reporter.addCounter("mapBytesParsed");
+    int parseMicros = reporter.addCounter("mapParseMicros");
+    int mapMicros = reporter.addCounter("mapMicros");
+    
+    bool reporting = reporter.isEnabled();
+    
     bool valid = true;
     while (!input.eof() && valid) {
         // read next row
         string startKey;
         StartValue startValue;
-        valid = readKeyValue<StartValue>(input, startKey, startValue);
+        
+        ScopedPhase scopedPhase(phaseStats, PHASE_IO);
+        
+        if (reporting) {
+            long long startTime = microsecondTime();
+            size_t nbytes;
+            valid = readKeyValue<StartValue>(input, startKey, startValue, nbytes);
+            
+            reporter.count(parseMicros, microsecondTime() - startTime);
+            reporter.count(bytesParsed, (long long)nbytes);
+            
+        } else {
+            valid = readKeyValue<StartValue>(input, startKey, startValue);
+        }
         
         if (valid) {
             // calculate
             multimap<string, MappedValue> mappedValues;
-            mapOne(startKey, startValue, mappedValues);
+            
+            scopedPhase.change(PHASE_MAP);
+            
+            if (reporting) {
+                long long startTime = microsecondTime();
+                mapOne(startKey, startValue, mappedValues);
+                
+                reporter.count(mapMicros, microsecondTime() - startTime);
+                reporter.count(rowsRead, 1);
+                reporter.count(rowsEmitted, (long long)mappedValues.size());
+                reporter.tick();
+                
+            } else {
+                mapOne(startKey, startValue, mappedValues);
+            }
             
             // write mapped row
+            scopedPhase.change(PHASE_OUTPUT);
+            
             for (multimap<string, MappedValue>::const_iterator iter = mappedValues.begin();
                  iter != mappedValues.end();
                  iter++) {
@@ -75,12 +155,25 @@ int SumSquare::mapWorker(std::istream& input, std::ostream& output)
         }
     }
     
+    reporter.flush();
+    
     return 0;
 }
 
 // read key/value mapped data, write reduced data
 int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
 {
+    // counters for Hadoop streaming
+    TaskReporter reporter(report);
+    int rowsRead = reporter.addCounter("reduceRowsRead");
+    int bytesParsed = reporter.addCounter("reduceBytesParsed");
+    int parseMicros = reporter.addCounter("reduceParseMicros");
+    int keysReduced = reporter.addCounter("reduceKeys");
+    int rowsEmitted = reporter.addCounter("reduceRowsEmitted");
+    int reduceMicros = reporter.addCounter("reduceMicros");
+    
+    bool reporting = reporter.isEnabled();
+    
     multimap<string, MappedValue> mappedPairs;
     
     // accumulate & sort
@@ -89,10 +182,28 @@ int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
         // read next row
         string mappedKey;
         MappedValue mappedValue;
-        valid = readKeyValue<MappedValue>(input, mappedKey, mappedValue);
+        
+        ScopedPhase scopedPhase(phaseStats, PHASE_IO);
+        
+        if (reporting) {
+            long long startTime = microsecondTime();
+            size_t nbytes;
+            valid = readKeyValue<MappedValue>(input, mappedKey, mappedValue, nbytes);
+            
+            reporter.count(parseMicros, microsecondTime() - startTime);
+            reporter.count(bytesParsed, (long long)nbytes);
+            
+        } else {
+            valid = readKeyValue<MappedValue>(input, mappedKey, mappedValue);
+        }
         
         if (valid) {
+            scopedPhase.change(PHASE_MERGE);
+            
             mappedPairs.insert(make_pair(mappedKey, mappedValue));
+            
+            reporter.count(rowsRead, 1);
+            reporter.tick();
         }
     }
     
@@ -104,6 +215,8 @@ int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
         // next key
         const string& mappedKey = iterMapped->first;
         
+        ScopedPhase scopedPhase(phaseStats, PHASE_REDUCE);
+        
         // get range for next key
         pair<   multimap<string, MappedValue>::const_iterator,
                 multimap<string, MappedValue>::const_iterator> range;
@@ -111,10 +224,21 @@ int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
         range = mappedPairs.equal_range(mappedKey);
         
         // reduce over next range
+        long long startTime = reporting ? microsecondTime() : 0;
+        
         vector<ReducedValue> reducedValues;
         reduce(iterMapped->first, range.first, range.second, reducedValues);
         
+        if (reporting) {
+            reporter.count(reduceMicros, microsecondTime() - startTime);
+            reporter.count(keysReduced, 1);
+            reporter.count(rowsEmitted, (long long)reducedValues.size());
+            reporter.tick();
+        }
+        
         // write reduced rows
+        scopedPhase.change(PHASE_OUTPUT);
+        
         vector<ReducedValue>::const_iterator iterReduced = reducedValues.begin();
         while (iterReduced != reducedValues.end() && valid) {
             valid = writeKeyValue<ReducedValue>(output, mappedKey, *iterReduced);
@@ -125,6 +249,146 @@ int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
         iterMapped = range.second;
     }
     
+    reporter.flush();
+    
+    return 0;
+}
+
+// read key/value starting data until the end of input, which may never come, and write reduced
+// data for each window of rows as it ends, headed by a line window-tab-index; with stats, the
+// latency of each window; for use only if reduceAggregate is a standard aggregate
+int SumSquare::streamWorker(std::istream& input, std::ostream& output, const StreamWindow& window)
+{
+    AggregateKind kind = reduceAggregate();
+    RUNTIME_ERROR_IF(kind == AGGREGATE_NONE, "streaming requires a standard aggregate for reduce");
+    
+    WindowedAggregates<MappedValue> windows(kind, window, nanosecondClock(),
+                                            reduceSketchOptions());
+    
+    long long rowCount = 0;
+    long long windowCount = 0;
+    long long totalLatency = 0;
+    long long maxLatency = 0;
+    
+    // reused from row to row
+    string startKey;
+    StartValue startValue;
+    multimap<string, MappedValue> mappedValues;
+    
+    // with threads, rows of windows by time are read on their own thread, so that a window ends
+    // when its time is up even if no row comes; without, it ends with the first row after it
+    const bool timed = USE_THREADS && window.byTime;
+    
+#if USE_THREADS
+    deque< pair<string, StartValue> > rows;
+    bool ended = false;
+    mutex rowsMutex;
+    condition_variable rowsChanged;
+    thread reader;
+    
+    if (timed) {
+        reader = thread(bind(&SumSquare::workerReadStream, this, ref(input), ref(rows), ref(ended),
+                             ref(rowsMutex), ref(rowsChanged)));
+    }
+#endif
+    
+    bool valid = true;
+    while (valid) {
+        ScopedPhase scopedPhase(phaseStats, PHASE_IO);
+        
+        // false if the wait for a row ended with the pane in progress due instead
+        bool hasRow = false;
+        
+        if (timed) {
+#if USE_THREADS
+            unique_lock<mutex> lock(rowsMutex);
+            
+            while (rows.empty() && !ended && !windows.isPaneDue(nanosecondClock())) {
+                rowsChanged.wait_for(lock,
+                                     chrono::nanoseconds(windows.getPaneEnd() - nanosecondClock()));
+            }
+            
+            if (!rows.empty()) {
+                startKey = rows.front().first;
+                startValue = rows.front().second;
+                rows.pop_front();
+                hasRow = true;
+            }
+            
+            valid = hasRow || !ended;
+#endif
+            
+        } else {
+            valid = readKeyValue<StartValue>(input, startKey, startValue);
+            hasRow = valid;
+        }
+        
+        long long arrival = nanosecondClock();
+        
+        // windows by time end when their time is up, and after an idle gap, the empty windows
+        // are skipped
+        scopedPhase.change(PHASE_OUTPUT);
+        
+        while (windows.isPaneDue(arrival)) {
+            long long paneEnd = windows.getPaneEnd();
+            windows.closePane();
+            
+            long long latency = writeWindow(windows, paneEnd, output);
+            if (latency >= 0) {
+                windowCount++;
+                totalLatency += latency;
+                maxLatency = max(maxLatency, latency);
+            }
+            
+            windows.skipIdlePanes(arrival);
+        }
+        
+        if (hasRow) {
+            scopedPhase.change(PHASE_MAP);
+            
+            mappedValues.clear();
+            mapOne(startKey, startValue, mappedValues);
+            
+            multimap<string, MappedValue>::const_iterator iter = mappedValues.begin();
+            while (iter != mappedValues.end()) {
+                windows.add(iter->first, iter->second);
+                
+                iter++;
+            }
+            
+            rowCount++;
+        }
+        
+        // windows by rows end with their last row, and the rows since the last window are a last
+        // one at the end of input
+        scopedPhase.change(PHASE_OUTPUT);
+        
+        if (windows.isPaneDue(arrival) || (!valid && windows.getPaneRows() > 0)) {
+            windows.closePane();
+            
+            long long latency = writeWindow(windows, arrival, output);
+            if (latency >= 0) {
+                windowCount++;
+                totalLatency += latency;
+                maxLatency = max(maxLatency, latency);
+            }
+        }
+    }
+    
+#if USE_THREADS
+    if (timed) {
+        reader.join();
+    }
+#endif
+    
+    if (stats != NULL) {
+        writeKeyValue<long long>(*stats, "stream.rows", rowCount);
+        writeKeyValue<long long>(*stats, "stream.windows", windowCount);
+        writeKeyValue<long long>(*stats, "stream.meanLatencyNsec",
+                                 windowCount > 0 ? totalLatency / windowCount : 0);
+        writeKeyValue<long long>(*stats, "stream.maxLatencyNsec", maxLatency);
+    }
+    
     return 0;
 }
 
@@ -132,19 +396,45 @@ int SumSquare::reduceWorker(std::istream& input, std::ostream& output)
 // reading from intermediate text strings
 int SumSquare::singleThreadDirect(int nrows, std::ostream& output)
 {
+    // nothing needs the rows kept between steps
+    if (mapCache == NULL && delay == 0 && isFusedDirect()) {
+        return fusedDirect(nrows, output);
+    }
+    
+    // the rows kept as columns
+    if (mapCache == NULL && delay == 0 && isColumnar()) {
+        return columnarDirect(nrows, output);
+    }
+    
     // start
+    ScopedPhase scopedPhase(phaseStats, PHASE_START);
+    
     vector< pair<string, StartValue> > startPairs;
     start(nrows, startPairs);
     
     // map
+    scopedPhase.change(PHASE_MAP);
+    
+    // with a map cache, in its chunks of rows, so that later runs find the same chunks
+    int rowCount = (int)startPairs.size();
+    int mapChunkRows = mapCache != NULL ? mapCache->getChunkRows() : rowCount;
+    
     multimap<string, MappedValue> mappedPairs;
-    mapRange(startPairs.begin(), startPairs.end(), mappedPairs);
+    for (int beginRow = 0; beginRow < rowCount; beginRow += mapChunkRows) {
+        int endRow = min(beginRow + mapChunkRows, rowCount);
+        
+        mapRangeCached(startPairs.begin() + beginRow, startPairs.begin() + endRow, mappedPairs);
+    }
     
     // reduce
+    scopedPhase.change(PHASE_REDUCE);
+    
     multimap<string, ReducedValue> reducedPairs;
     reduceRange(mappedPairs, mappedPairs.begin(), mappedPairs.end(), reducedPairs);
     
     // output
+    scopedPhase.change(PHASE_OUTPUT);
+    
     multimap<string, ReducedValue>::const_iterator iterOut = reducedPairs.begin();
     bool valid = true;
     while (iterOut != reducedPairs.end() && valid) {
@@ -160,9 +450,25 @@ int SumSquare::singleThreadDirect(int nrows, std::ostream& output)
 int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
 {
 #if USE_THREADS
+    // a memory limit is kept only where mapped rows are passed between threads as they go, and
+    // map threads generate their own rows
+    if ((shuffleQueues || memoryLimit > 0) && mapCache == NULL && checkpoint == NULL &&
+        isStartRange()) {
+        return queuedMultiThread(nrows, nthreads, output);
+    }
+    
     // start
+    ScopedPhase scopedPhase(phaseStats, PHASE_START);
+    
+    // with an affinity policy, threads are pinned and each map thread generates its own rows if
+    // isStartRange, so that they are first touched (and allocated) on the thread's NUMA node
+    AffinityPlan plan(affinity);
+    bool firstTouch = plan.getPolicy() != AFFINITY_NONE && isStartRange();
+    
     vector< pair<string, StartValue> > startPairs;
-    start(nrows, startPairs);
+    if (!firstTouch) {
+        start(nrows, startPairs);
+    }
     
     // can't have more map threads than rows
     int mapThreadCount = nthreads;
@@ -170,34 +476,86 @@ int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
         mapThreadCount = nrows;
     }
     
-    // divide up work among map threads
-    vector< vector< pair<string, StartValue> >::const_iterator > startIters;
-    startIters.push_back(startPairs.begin());
+    // divide up work among map threads: thread k takes chunk k, then any further chunks go to
+    // whichever thread is free first
+    int chunkCount = mapThreadCount;
+    if (chunkRows > 0 && nrows > chunkRows * mapThreadCount) {
+        chunkCount = (nrows + chunkRows - 1) / chunkRows;
+    }
+    
+    vector<int> chunkOffsets;
+    chunkOffsets.push_back(0);
+    
+    // with a map cache or checkpoints, chunks of a fixed size, so that later runs find the same
+    // chunks whatever the threads
+    int fixedChunkRows = 0;
+    if (mapCache != NULL) {
+        fixedChunkRows = mapCache->getChunkRows();
+        
+    } else if (checkpoint != NULL) {
+        fixedChunkRows = checkpoint->getChunkRows();
+    }
     
-    for (int k = 1; k < mapThreadCount; k++) {
-        int offset = (int)round(k * nrows / (double)mapThreadCount);
+    if (fixedChunkRows > 0) {
+        int mapChunkRows = fixedChunkRows;
+        
+        for (int offset = mapChunkRows; offset < nrows; offset += mapChunkRows) {
+            chunkOffsets.push_back(offset);
+        }
         
-        startIters.push_back(startPairs.begin() + offset);
+        chunkCount = (int)chunkOffsets.size();
+        mapThreadCount = min(mapThreadCount, chunkCount);
+        
+    } else {
+        for (int k = 1; k < chunkCount; k++) {
+            int offset = (int)round(k * nrows / (double)chunkCount);
+            
+            chunkOffsets.push_back(offset);
+        }
     }
     
-    startIters.push_back(startPairs.end());
+    chunkOffsets.push_back(nrows);
+    
+    atomic<int> nextChunk(mapThreadCount);
+    
+    // parts saved by an earlier run are kept only if it was the same job, cut into the same chunks
+    if (checkpoint != NULL) {
+        ostringstream layout;
+        writeKeyValue<string>(layout, "calc", name());
+        writeKeyValue<int>(layout, "mapVersion", mapVersion());
+        writeKeyValue<int>(layout, "rows", nrows);
+        writeKeyValue<int>(layout, "chunkRows", fixedChunkRows);
+        writeKeyValue<string>(layout, "aggregate", aggregateName(reduceAggregate()));
+        
+        checkpoint->begin(name(), layout.str());
+    }
 
 #undef DEBUG_WITHOUT_THREADS
 
     // map
+    scopedPhase.change(PHASE_MAP);
+    
     vector<thread> mapThreads;
     vector< multimap<string, MappedValue> > mappedPairsVector(mapThreadCount);
+    vector<WorkerStats> mapThreadStats(mapThreadCount);
+    vector< vector< pair<string, StartValue> > > startSlices(mapThreadCount);
     for (int k = 0; k < mapThreadCount; k++) {
 #ifdef DEBUG_WITHOUT_THREADS
-        mapRange(startIters[k], startIters[k + 1], mappedPairsVector[k]);
+        workerMapChunks(plan, k, chunkOffsets, nextChunk, startPairs, startSlices[k],
+                        mappedPairsVector[k], mapThreadStats[k]);
         
 #else
         mapThreads.push_back(
-            thread(bind(&SumSquare::mapRange,
+            thread(bind(&SumSquare::workerMapChunks,
                         this,
-                        ref(startIters[k]),
-                        ref(startIters[k + 1]),
-                        ref(mappedPairsVector[k]))
+                        cref(plan),
+                        k,
+                        cref(chunkOffsets),
+                        ref(nextChunk),
+                        cref(startPairs),
+                        ref(startSlices[k]),
+                        ref(mappedPairsVector[k]),
+                        ref(mapThreadStats[k]))
                    ));
 #endif
     }
@@ -206,16 +564,36 @@ int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
     // join threads
     for (int k = 0; k < mapThreadCount; k++) {
         mapThreads[k].join();
+        
+        if (phaseStats != NULL) {
+            phaseStats->addWorker(PHASE_MAP, mapThreadStats[k]);
+        }
     }
 #endif
     
+    // each stage's data is freed as soon as the next has taken it in, rather than when done
+    {
+        vector< pair<string, StartValue> > emptyPairs;
+        startPairs.swap(emptyPairs);
+        
+        vector< vector< pair<string, StartValue> > > emptySlices;
+        startSlices.swap(emptySlices);
+    }
+    
     // join results
+    scopedPhase.change(PHASE_MERGE);
+    
     multimap<string, MappedValue> mappedPairs;
     for (int k = 0; k < mapThreadCount; k++) {
         mappedPairs.insert(mappedPairsVector[k].begin(), mappedPairsVector[k].end());
+        
+        multimap<string, MappedValue> emptyPairs;
+        mappedPairsVector[k].swap(emptyPairs);
     }
     
     // count mapped keys
+    scopedPhase.change(PHASE_KEYS);
+    
     int numMappedKeys = 0;
     multimap<string, MappedValue>::const_iterator iterMapped = mappedPairs.begin();
     while (iterMapped != mappedPairs.end()) {
@@ -228,19 +606,38 @@ int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
         iterMapped = range.second;
     }
 
-    // can't have more reduce threads than keys
+    // can't have more reduce threads than keys, unless partial results for a key can be merged,
+    // in which case the values of a key can be split over threads
+    bool partialReduce = isAssociativeReduce() && nthreads > numMappedKeys;
+    
     int reduceThreadCount = nthreads;
-    if (reduceThreadCount > numMappedKeys) {
+    if (reduceThreadCount > numMappedKeys && !partialReduce) {
         reduceThreadCount = numMappedKeys;
     }
     
-    // divide up work among reduce threads
+    if (reduceThreadCount > (int)mappedPairs.size()) {
+        reduceThreadCount = (int)mappedPairs.size();
+    }
+    
+    // divide up work among reduce threads, by values if keys may be split, else by keys
     vector< multimap<string, MappedValue>::const_iterator > mappedIters;
     mappedIters.push_back(mappedPairs.begin());
     
     iterMapped = mappedPairs.begin();
+    int valueCount = 0;
+    for (int k = 1; k < reduceThreadCount && partialReduce; k++) {
+        int nextValueCount = (int)round(k * mappedPairs.size() / (double)reduceThreadCount);
+        
+        while (valueCount < nextValueCount) {
+            valueCount++;
+            iterMapped++;
+        }
+        
+        mappedIters.push_back(iterMapped);
+    }
+    
     int keyCount = 0;
-    for (int k = 1; k < reduceThreadCount; k++) {
+    for (int k = 1; k < reduceThreadCount && !partialReduce; k++) {
         int nextKeyCount = (k * numMappedKeys + reduceThreadCount / 2) / reduceThreadCount;
         
         while (keyCount < nextKeyCount) {
@@ -259,20 +656,46 @@ int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
     mappedIters.push_back(mappedPairs.end());
 
     // reduce
+    scopedPhase.change(PHASE_REDUCE);
+    
     vector<thread> reduceThreads;
     vector< multimap<string, ReducedValue> > reducePairsVector(reduceThreadCount);
+    vector<PartialPairs> partialPairsVector(reduceThreadCount);
+    vector<WorkerStats> reduceThreadStats(reduceThreadCount);
+    
+    // checkpoint parts, named for the division of the work, which the mapped data and the thread
+    // count determine
+    vector<string> reduceParts(reduceThreadCount);
+    for (int k = 0; k < reduceThreadCount; k++) {
+        ostringstream part;
+        part << (partialReduce ? "partial." : "reduce.") << reduceThreadCount << "." << k;
+        reduceParts[k] = part.str();
+    }
+    
     for (int k = 0; k < reduceThreadCount; k++) {
 #ifdef DEBUG_WITHOUT_THREADS
-        reduceRange(mappedPairs, mappedIters[k], mappedIters[k + 1], reducePairsVector[k]);
+        if (partialReduce) {
+            reducePartialRange(mappedPairs, mappedIters[k], mappedIters[k + 1],
+                               partialPairsVector[k]);
+            
+        } else {
+            reduceRange(mappedPairs, mappedIters[k], mappedIters[k + 1], reducePairsVector[k]);
+        }
         
 #else
         reduceThreads.push_back(
-                             thread(bind(&SumSquare::reduceRange,
+                             thread(bind(&SumSquare::workerReduceRange,
                                          this,
+                                         cref(plan),
+                                         k,
+                                         partialReduce,
                                          ref(mappedPairs),
                                          ref(mappedIters[k]),
                                          ref(mappedIters[k + 1]),
-                                         ref(reducePairsVector[k]))
+                                         cref(reduceParts[k]),
+                                         ref(reducePairsVector[k]),
+                                         ref(partialPairsVector[k]),
+                                         ref(reduceThreadStats[k]))
                                     ));
 #endif
     }
@@ -281,161 +704,2419 @@ int SumSquare::multiThread(int nrows, int nthreads, std::ostream& output)
     // join threads
     for (int k = 0; k < reduceThreadCount; k++) {
         reduceThreads[k].join();
+        
+        if (phaseStats != NULL) {
+            phaseStats->addWorker(PHASE_REDUCE, reduceThreadStats[k]);
+        }
     }
 #endif
     
-    // join results
-    multimap<string, ReducedValue> reducedPairs;
-    for (int k = 0; k < reduceThreadCount; k++) {
-        reducedPairs.insert(reducePairsVector[k].begin(), reducePairsVector[k].end());
+    {
+        multimap<string, MappedValue> emptyPairs;
+        mappedPairs.swap(emptyPairs);
     }
-
-    // output
-    multimap<string, ReducedValue>::const_iterator iterOut = reducedPairs.begin();
-    bool valid = true;
-    while (iterOut != reducedPairs.end() && valid) {
-        valid = writeKeyValue<ReducedValue>(output, iterOut->first, iterOut->second);
+    
+    // join results, as ranges of keys that follow one another in order: each thread's results if
+    // the threads reduced ranges of keys, else parts of the merged partial results
+    scopedPhase.change(PHASE_MERGE);
+    
+    vector< multimap<string, ReducedValue>::const_iterator > beginReducedIters;
+    vector< multimap<string, ReducedValue>::const_iterator > endReducedIters;
+    if (partialReduce) {
+        mergePartialsInTree(partialPairsVector);
         
-        iterOut++;
-    }
-
-#endif
-    return 0;
-}
-
-// write starting data as vector of key-value pairs
-void SumSquare::start(int nrows, std::vector< std::pair<std::string, StartValue> >& startPairs)
-{
-    for (int k = 1; k <= nrows; k++) {
-        if (k % 2 == 0) {
-            startPairs.push_back(make_pair("EVEN", k));
+        // the merged results, in as many parts as there were threads
+        if (reduceThreadCount > 0) {
+            partialResults(partialPairsVector[0], reducePairsVector[0]);
+            partialPairsVector[0].clear();
             
-        } else {
-            startPairs.push_back(make_pair("ODD ", k));
+            splitPairs(reducePairsVector[0], reduceThreadCount, beginReducedIters,
+                       endReducedIters);
         }
-    }
-}
-
-// read a range starting data from vector of key-value pairs, append mapped data to a multimap
-void SumSquare::mapRange(
-    const vector< pair<string, StartValue> >::const_iterator& beginStartValues,
-    const vector< pair<string, StartValue> >::const_iterator& endStartValues,
-    multimap<string, MappedValue>& mappedValues)
-{
-    vector< pair<string, StartValue> >::const_iterator iter = beginStartValues;
-    while (iter != endStartValues) {
-        mapOne(iter->first, iter->second, mappedValues);
         
-        iter++;
+    } else {
+        for (int k = 0; k < reduceThreadCount; k++) {
+            beginReducedIters.push_back(reducePairsVector[k].begin());
+            endReducedIters.push_back(reducePairsVector[k].end());
+        }
     }
-}
 
-// map a single key-value pair, append mapped data to a multimap
-void SumSquare::mapOne(const std::string& keyIn, StartValue valueIn,
-                       std::multimap<std::string, MappedValue>& mappedValues)
-{
-    mappedValues.insert(make_pair(keyIn, valueIn * valueIn));
+    // output
+    scopedPhase.change(PHASE_OUTPUT);
     
-    if (delay != 0) {
-        sleepFor(delay);
+    int status = writeReducedRanges(beginReducedIters, endReducedIters, output);
+    
+    // nothing to resume once the job is done
+    if (checkpoint != NULL) {
+        checkpoint->finish();
     }
-}
 
-// read a range of mapped data from a multimap, append reduced data to a multimap; the range of
-// mapped data must include ALL values for a key if ANY values for that key are included
-void SumSquare::reduceRange(
-    const std::multimap<std::string, MappedValue>& mappedPairs,
-    const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
-    const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
-    std::multimap<std::string, ReducedValue>& reducedPairs)
-{
-    multimap<string, MappedValue>::const_iterator iterMapped = beginMappedPairs;
-    while (iterMapped != endMappedPairs) {
-        // next key
-        const string& mappedKey = iterMapped->first;
-        
-        // get range for next key
-        pair<   multimap<string, MappedValue>::const_iterator,
-                multimap<string, MappedValue>::const_iterator> range;
-        
-        range = mappedPairs.equal_range(mappedKey);
-        
-        // reduce over next range
-        vector<ReducedValue> reducedValues;
-        reduce(mappedKey, range.first, range.second, reducedValues);
-        
-        // write reduced rows
-        vector<ReducedValue>::const_iterator iterReduced = reducedValues.begin();
-        while (iterReduced != reducedValues.end()) {
-            reducedPairs.insert(make_pair(mappedKey, *iterReduced));
-            
-            iterReduced++;
-        }
-        
-        iterMapped = range.second;
-    }
+    return status;
+#else
+    return 0;
+#endif
 }
 
-// reduce values for a particular key; the range of mapped values must include all the values
-// for the specified key
-void SumSquare::reduce(const std::string& keyMapped,
-                    std::multimap<std::string, MappedValue>::const_iterator& beginMappedValues,
-                    std::multimap<std::string, MappedValue>::const_iterator& endMappedValues,
-                    std::vector<ReducedValue>& reducedValues)
+#if USE_THREADS
+// multiThread with each mapped row pushed, as soon as it is mapped, to a reduce thread through an
+// SpscQueue per pair of map and reduce threads; for use only if isStartRange, and without a map
+// cache, checkpoint or affinity policy. If isAssociativeReduce, the rows of each key are spread
+// over the reduce threads, which fold them into partial results as they arrive, so that reducing
+// overlaps mapping, and the partial results are merged in a tree. Otherwise each reduce thread
+// takes a range of keys, split at keys sampled by sampleSplitKeys, and holds their rows until
+// mapping is done; its results are then written as they are. With a memory limit, the mapped rows
+// in the queues and held by reduce threads are kept within it.
+int SumSquare::queuedMultiThread(int nrows, int nthreads, std::ostream& output)
 {
-    map<string, ReducedValue> mapSum;
+    // the queues hold about this many rows in all, but no fewer than the minimum each
+    const size_t SHUFFLE_QUEUE_ROWS = 65536;
+    const size_t SHUFFLE_QUEUE_MIN_ROWS = 256;
     
-    multimap<string, MappedValue>::const_iterator iterMapped = beginMappedValues;
-    while (iterMapped != endMappedValues) {
-        map<string, ReducedValue>::iterator iterReduced = mapSum.find(iterMapped->first);
-        
-        if (iterReduced == mapSum.end()) {
-            // first value for new key
-            mapSum.insert(make_pair(iterMapped->first, iterMapped->second));
-            
-        } else {
-            // sum
-            iterReduced->second += iterMapped->second;
-        }
-
-        iterMapped++;
+    // start; each map thread generates its own rows, so that they are never all held at once
+    ScopedPhase scopedPhase(phaseStats, PHASE_START);
+    
+    // can't have more map threads than rows, nor more reduce threads than ranges of keys, unless
+    // the rows of a key can be spread over threads
+    bool foldable = isAssociativeReduce();
+    int mapThreadCount = min(nthreads, nrows);
+    int reduceThreadCount = nthreads;
+    
+    if (mapThreadCount < 1 || reduceThreadCount < 1) {
+        return 0;
     }
     
-    for (map<string, ReducedValue>::const_iterator iter = mapSum.begin();
-         iter != mapSum.end();
-         iter++) {
-        
-        reducedValues.push_back(iter->second);
+    vector<string> splitKeys;
+    if (!foldable) {
+        sampleSplitKeys(nrows, reduceThreadCount, splitKeys);
+        reduceThreadCount = (int)splitKeys.size() + 1;
     }
-}
-
-
-// ========== Tests ================================================================================
-
-// component tests
-void ctest_sumSquare(int& totalPassed, int& totalFailed, bool useHadoop, bool verbose)
+    
+    // divide up work among map threads as multiThread does: thread k takes chunk k, then any
+    // further chunks go to whichever thread is free first
+    int chunkCount = mapThreadCount;
+    if (chunkRows > 0 && nrows > chunkRows * mapThreadCount) {
+        chunkCount = (nrows + chunkRows - 1) / chunkRows;
+    }
+    
+    vector<int> startRows;
+    for (int k = 0; k <= chunkCount; k++) {
+        startRows.push_back(1 + (int)((long long)k * nrows / chunkCount));
+    }
+    
+    atomic<int> nextChunk(mapThreadCount);
+    
+    // a reduce thread frees the rows it holds by spilling them once they are a share of the limit,
+    // or at a quarter of that if nothing else is left to free
+    MemoryBudget budget(memoryLimit);
+    long long spillBytes = memoryLimit / (2 * reduceThreadCount);
+    
+    // runs spilled by reduce threads go in a directory of this run's own, removed at the end
+    string spillDir;
+    if (memoryLimit > 0 && !foldable) {
+        spillDir = makeTempDirIn(spillDirectory, name() + ".spill");
+    }
+    
+    // a queue from each map thread to each reduce thread
+    size_t queueRows = max(SHUFFLE_QUEUE_MIN_ROWS,
+                           SHUFFLE_QUEUE_ROWS / (mapThreadCount * reduceThreadCount));
+    
+    vector< vector<ShuffleQueue *> > mapQueues(mapThreadCount);
+    vector< vector<ShuffleQueue *> > reduceQueues(reduceThreadCount);
+    for (int m = 0; m < mapThreadCount; m++) {
+        for (int r = 0; r < reduceThreadCount; r++) {
+            ShuffleQueue *queue = new ShuffleQueue(queueRows);
+            mapQueues[m].push_back(queue);
+            reduceQueues[r].push_back(queue);
+        }
+    }
+    
+    // map, with reduce threads taking rows as they are mapped
+    scopedPhase.change(PHASE_MAP);
+    
+    vector<long long> pushWaits(mapThreadCount, 0);
+    vector<long long> popWaits(reduceThreadCount, 0);
+    vector< multimap<string, ReducedValue> > reducePairsVector(reduceThreadCount);
+    vector<PartialPairs> partialPairsVector(reduceThreadCount);
+    vector<string> reduceErrors(reduceThreadCount);
+    vector<thread> reduceThreads;
+    vector<thread> mapThreads;
+    
+    for (int r = 0; r < reduceThreadCount; r++) {
+        reduceThreads.push_back(thread(bind(&SumSquare::workerReduceFromQueues,
+                                            this,
+                                            r,
+                                            cref(reduceQueues[r]),
+                                            ref(budget),
+                                            spillBytes,
+                                            cref(spillDir),
+                                            ref(reducePairsVector[r]),
+                                            ref(partialPairsVector[r]),
+                                            ref(reduceErrors[r]),
+                                            ref(popWaits[r]))
+                                       ));
+    }
+    
+    for (int m = 0; m < mapThreadCount; m++) {
+        mapThreads.push_back(thread(bind(&SumSquare::workerMapToQueues,
+                                         this,
+                                         m,
+                                         cref(startRows),
+                                         ref(nextChunk),
+                                         cref(splitKeys),
+                                         cref(mapQueues[m]),
+                                         ref(budget),
+                                         ref(pushWaits[m]))
+                                    ));
+    }
+    
+    for (size_t k = 0; k < mapThreads.size(); k++) {
+        mapThreads[k].join();
+    }
+    
+    // reduce what the reduce threads still hold once all rows are mapped
+    scopedPhase.change(PHASE_REDUCE);
+    
+    for (size_t k = 0; k < reduceThreads.size(); k++) {
+        reduceThreads[k].join();
+    }
+    
+    for (int m = 0; m < mapThreadCount; m++) {
+        for (int r = 0; r < reduceThreadCount; r++) {
+            delete mapQueues[m][r];
+        }
+    }
+    
+    if (!spillDir.empty()) {
+        removeDirFiles(spillDir);
+    }
+    
+    for (int r = 0; r < reduceThreadCount; r++) {
+        RUNTIME_ERROR_IF(!reduceErrors[r].empty(), reduceErrors[r]);
+    }
+    
+    // join results, as ranges of keys that follow one another in order: parts of the merged
+    // partial results if the rows of a key were spread, else each thread's results
+    scopedPhase.change(PHASE_MERGE);
+    
+    vector< multimap<string, ReducedValue>::const_iterator > beginReducedIters;
+    vector< multimap<string, ReducedValue>::const_iterator > endReducedIters;
+    if (foldable) {
+        mergePartialsInTree(partialPairsVector);
+        
+        partialResults(partialPairsVector[0], reducePairsVector[0]);
+        partialPairsVector[0].clear();
+        
+        splitPairs(reducePairsVector[0], reduceThreadCount, beginReducedIters, endReducedIters);
+        
+    } else {
+        for (int r = 0; r < reduceThreadCount; r++) {
+            beginReducedIters.push_back(reducePairsVector[r].begin());
+            endReducedIters.push_back(reducePairsVector[r].end());
+        }
+    }
+    
+    if (stats != NULL) {
+        long long totalPushWaits = 0;
+        for (int m = 0; m < mapThreadCount; m++) {
+            totalPushWaits += pushWaits[m];
+        }
+        
+        long long totalPopWaits = 0;
+        for (int r = 0; r < reduceThreadCount; r++) {
+            totalPopWaits += popWaits[r];
+        }
+        
+        writeKeyValue<int>(*stats, "queues.mapThreads", mapThreadCount);
+        writeKeyValue<int>(*stats, "queues.reduceThreads", reduceThreadCount);
+        writeKeyValue<size_t>(*stats, "queues.queueRows", queueRows);
+        writeKeyValue<long long>(*stats, "queues.pushWaits", totalPushWaits);
+        writeKeyValue<long long>(*stats, "queues.popWaits", totalPopWaits);
+        
+        if (memoryLimit > 0) {
+            budget.writeStats(*stats, "memory");
+        }
+    }
+    
+    // output
+    scopedPhase.change(PHASE_OUTPUT);
+    
+    return writeReducedRanges(beginReducedIters, endReducedIters, output);
+}
+
+// keys at which to split the mapped keys into parts ranges, for a reduce thread each, in splitKeys:
+// part k takes the keys from splitKeys[k - 1] up to splitKeys[k]. The keys are those mapped from a
+// sample of rows spread evenly over the starting data, at even shares of the sampled rows, so
+// there are fewer than parts - 1 of them if the sample has fewer keys.
+void SumSquare::sampleSplitKeys(int nrows, int parts, std::vector<std::string>& splitKeys)
+{
+    const int SAMPLE_ROWS = 1024;
+    
+    int sampleRows = min(nrows, SAMPLE_ROWS);
+    
+    vector< pair<string, StartValue> > startPairs;
+    for (int k = 0; k < sampleRows; k++) {
+        int row = 1 + (int)((long long)k * nrows / sampleRows);
+        startRange(row, row + 1, startPairs);
+    }
+    
+    multimap<string, MappedValue> mappedPairs;
+    mapRange(startPairs.begin(), startPairs.end(), mappedPairs);
+    
+    splitKeys.clear();
+    if (mappedPairs.empty()) {
+        return;
+    }
+    
+    // each split is at a key after the first and the split before it, so no range is left empty
+    multimap<string, MappedValue>::const_iterator iterMapped = mappedPairs.begin();
+    size_t position = 0;
+    for (int k = 1; k < parts; k++) {
+        size_t nextPosition = (size_t)k * mappedPairs.size() / parts;
+        
+        while (position < nextPosition) {
+            position++;
+            iterMapped++;
+        }
+        
+        const string& lastKey = splitKeys.empty() ? mappedPairs.begin()->first : splitKeys.back();
+        if (lastKey < iterMapped->first) {
+            splitKeys.push_back(iterMapped->first);
+        }
+    }
+}
+
+// merge partial results in a tree, into partialPairsVector[0]: in each round, result k takes in
+// result k + stride, with the pairs merged in parallel
+void SumSquare::mergePartialsInTree(std::vector<PartialPairs>& partialPairsVector)
+{
+    int count = (int)partialPairsVector.size();
+    
+    for (int stride = 1; stride < count; stride *= 2) {
+        vector<thread> mergeThreads;
+        for (int k = 0; k + stride < count; k += 2 * stride) {
+            mergeThreads.push_back(
+                thread(bind(&SumSquare::workerMergePartials,
+                            this,
+                            ref(partialPairsVector[k]),
+                            cref(partialPairsVector[k + stride]))
+                       ));
+        }
+        
+        for (size_t k = 0; k < mergeThreads.size(); k++) {
+            mergeThreads[k].join();
+        }
+    }
+}
+
+// format ranges of reduced data that follow one another in key order, each on its own thread, then
+// write them to output together with writeBuffers; returns 0 if they were written
+int SumSquare::writeReducedRanges(
+    const std::vector< std::multimap<std::string, ReducedValue>::const_iterator >& begins,
+    const std::vector< std::multimap<std::string, ReducedValue>::const_iterator >& ends,
+    std::ostream& output)
+{
+    vector<string> outputBuffers(begins.size());
+    vector<thread> outputThreads;
+    
+    for (size_t k = 0; k < outputBuffers.size(); k++) {
+#ifdef DEBUG_WITHOUT_THREADS
+        formatRange(begins[k], ends[k], outputBuffers[k]);
+        
+#else
+        outputThreads.push_back(
+                             thread(bind(&SumSquare::workerFormatRange,
+                                         this,
+                                         cref(begins[k]),
+                                         cref(ends[k]),
+                                         ref(outputBuffers[k]))
+                                    ));
+#endif
+    }
+    
+    for (size_t k = 0; k < outputThreads.size(); k++) {
+        outputThreads[k].join();
+    }
+    
+    return writeBuffers(output, outputBuffers) ? 0 : 1;
+}
+#endif
+
+// singleThreadDirect over only the rows not covered by partial results saved in directory by an
+// earlier run, merged with those results, which are then replaced; if isAssociativeReduce and
+// isStartRange, so that the new rows can be generated alone. The partial results of a standard
+// aggregate are its aggregators' states, so that means, variances and sketches can be extended too.
+int SumSquare::incrementalDirect(int nrows, const std::string& directory, std::ostream& output)
+{
+    if (!isAssociativeReduce() || !isStartRange()) {
+        return singleThreadDirect(nrows, output);
+    }
+    
+    string path = directory + "/" + name() + ".partials";
+    
+    // earlier results can be used if they cover a prefix of the rows
+    PartialPairs partialPairs;
+    int savedRows = 0;
+    if (!readPartials(path, savedRows, partialPairs) || savedRows > nrows) {
+        partialPairs.clear();
+        savedRows = 0;
+    }
+    
+    if (stats != NULL) {
+        writeKeyValue<int>(*stats, "incremental.savedRows", savedRows);
+        writeKeyValue<int>(*stats, "incremental.newRows", nrows - savedRows);
+    }
+    
+    // start
+    ScopedPhase scopedPhase(phaseStats, PHASE_START);
+    
+    vector< pair<string, StartValue> > startPairs;
+    startRange(savedRows + 1, nrows + 1, startPairs);
+    
+    // map
+    scopedPhase.change(PHASE_MAP);
+    
+    multimap<string, MappedValue> mappedPairs;
+    mapRange(startPairs.begin(), startPairs.end(), mappedPairs);
+    
+    // reduce
+    scopedPhase.change(PHASE_REDUCE);
+    
+    PartialPairs newPartials;
+    reducePartialRange(mappedPairs, mappedPairs.begin(), mappedPairs.end(), newPartials);
+    
+    // merge with earlier results
+    scopedPhase.change(PHASE_MERGE);
+    
+    mergePartials(partialPairs, newPartials);
+    
+    // output
+    scopedPhase.change(PHASE_OUTPUT);
+    
+    writePartials(path, nrows, partialPairs);
+    
+    multimap<string, ReducedValue> reducedPairs;
+    partialResults(partialPairs, reducedPairs);
+    
+    multimap<string, ReducedValue>::const_iterator iterOut = reducedPairs.begin();
+    bool valid = true;
+    while (iterOut != reducedPairs.end() && valid) {
+        valid = writeKeyValue<ReducedValue>(output, iterOut->first, iterOut->second);
+        
+        iterOut++;
+    }
+    
+    return valid ? 0 : 1;
+}
+
+// write starting data as vector of key-value pairs
+void SumSquare::start(int nrows, std::vector< std::pair<std::string, StartValue> >& startPairs)
+{
+    startRange(1, nrows + 1, startPairs);
+}
+
+// append rows beginRow <= row < endRow of the starting data (numbered from 1) to a vector of
+// key-value pairs, so that a worker thread can generate its own share
+void SumSquare::startRange(int beginRow, int endRow,
+                           std::vector< std::pair<std::string, StartValue> >& startPairs)
+{
+    startPairs.reserve(startPairs.size() + max(endRow - beginRow, 0));
+    
+    pair<string, StartValue> startPair;
+    for (int k = beginRow; k < endRow; k++) {
+        startRow(k, startPair.first, startPair.second);
+        startPairs.push_back(startPair);
+    }
+}
+
+// set key and value to row (numbered from 1) of the starting data; startRange and fusedDirect
+// generate rows with it
+void SumSquare::startRow(int row, std::string& key, StartValue& value)
+{
+    key = row % 2 == 0 ? "EVEN" : "ODD ";
+    value = row;
+}
+
+// read a range starting data from vector of key-value pairs, append mapped data to a multimap; in
+// batches by mapBatch, or with mapInFlight, up to that many rows at a time between mapBegin and
+// mapEnd, finished in the order they are ready, which can change the order of a key's values
+void SumSquare::mapRange(
+    const vector< pair<string, StartValue> >::const_iterator& beginStartValues,
+    const vector< pair<string, StartValue> >::const_iterator& endStartValues,
+    multimap<string, MappedValue>& mappedValues)
+{
+    // small enough for a batch's rows to stay in cache
+    const size_t BATCH_ROWS = 256;
+    
+    vector< pair<string, StartValue> >::const_iterator iter = beginStartValues;
+    
+    if (mapInFlight <= 0 || !isMapInFlight()) {
+        while (iter != endStartValues) {
+            size_t n = min(BATCH_ROWS, (size_t)(endStartValues - iter));
+            mapBatch(&*iter, n, mappedValues);
+            
+            iter += n;
+        }
+        
+        return;
+    }
+    
+    // start rows until mapInFlight are waiting, then finish whichever is due first, so that this
+    // thread only sleeps when none is ready
+    TimerQueue<vector< pair<string, StartValue> >::const_iterator> inFlight;
+    while (iter != endStartValues || !inFlight.empty()) {
+        while (iter != endStartValues && (int)inFlight.size() < mapInFlight) {
+            inFlight.push(mapBegin(iter->first, iter->second), iter);
+            
+            iter++;
+        }
+        
+        vector< pair<string, StartValue> >::const_iterator ready = inFlight.waitNext();
+        mapEnd(ready->first, ready->second, mappedValues);
+    }
+}
+
+// mapRange, looking the range up in mapCache first if there is one, and storing the mapped data
+// there if it wasn't found; the range should be one of the cache's chunks of rows
+void SumSquare::mapRangeCached(
+    const vector< pair<string, StartValue> >::const_iterator& beginStartValues,
+    const vector< pair<string, StartValue> >::const_iterator& endStartValues,
+    multimap<string, MappedValue>& mappedValues)
+{
+    if (mapCache == NULL) {
+        mapRange(beginStartValues, endStartValues, mappedValues);
+        return;
+    }
+    
+    // the entry is named by a hash of the starting data as -start would write it
+    ostringstream startOss;
+    vector< pair<string, StartValue> >::const_iterator iter = beginStartValues;
+    while (iter != endStartValues) {
+        writeKeyValue<StartValue>(startOss, iter->first, iter->second);
+        
+        iter++;
+    }
+    
+    string entry = MapCache::entryName(name(), mapVersion(), contentDigest(startOss.str()));
+    
+    string contents;
+    if (mapCache->load(entry, contents)) {
+        istringstream iss(contents);
+        if (readCompacted<MappedValue>(iss, mappedValues)) {
+            return;
+        }
+    }
+    
+    multimap<string, MappedValue> chunkValues;
+    mapRange(beginStartValues, endStartValues, chunkValues);
+    
+    ostringstream oss;
+    writeCompacted<MappedValue>(oss, chunkValues);
+    mapCache->store(entry, oss.str());
+    
+    mappedValues.insert(chunkValues.begin(), chunkValues.end());
+}
+
+// map rows[0..n) of starting data, append mapped data to a multimap; by default mapOne for each
+// row. Override to map a whole batch in one loop, without a virtual call per row.
+void SumSquare::mapBatch(const std::pair<std::string, StartValue> *rows, size_t n,
+                         std::multimap<std::string, MappedValue>& mappedValues)
+{
+    for (size_t k = 0; k < n; k++) {
+        mapOne(rows[k].first, rows[k].second, mappedValues);
+    }
+}
+
+// map a single key-value pair, append mapped data to a multimap; by default mapBegin, then a wait
+// until it is ready, then mapEnd
+void SumSquare::mapOne(const std::string& keyIn, StartValue valueIn,
+                       std::multimap<std::string, MappedValue>& mappedValues)
+{
+    long long readyTime = mapBegin(keyIn, valueIn);
+    
+    if (delay != 0) {
+        sleepUntil(readyTime);
+    }
+    
+    mapEnd(keyIn, valueIn, mappedValues);
+}
+
+// start mapping a key-value pair whose map waits on latency-bound work (by default the delay),
+// returning the nanosecondClock time at which mapEnd can finish it
+long long SumSquare::mapBegin(const std::string& keyIn, StartValue valueIn)
+{
+    if (delay == 0) {
+        return 0;
+    }
+    
+    return nanosecondClock() + delay * 1000000LL;
+}
+
+// finish mapping a key-value pair started by mapBegin, append mapped data to a multimap
+void SumSquare::mapEnd(const std::string& keyIn, StartValue valueIn,
+                       std::multimap<std::string, MappedValue>& mappedValues)
+{
+    mappedValues.insert(make_pair(keyIn, mapValue(keyIn, valueIn)));
+}
+
+// value a key-value pair maps to, under the same key; mapEnd and fusedDirect map with it
+SumSquare::MappedValue SumSquare::mapValue(const std::string& keyIn, StartValue valueIn)
+{
+    return valueIn * valueIn;
+}
+
+// read a range of mapped data from a multimap, append reduced data to a multimap; the range of
+// mapped data must include ALL values for a key if ANY values for that key are included
+void SumSquare::reduceRange(
+    const std::multimap<std::string, MappedValue>& mappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+    std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    reduceKeyGroups(mappedPairs, beginMappedPairs, endMappedPairs, reducedPairs);
+}
+
+// reduce groups of mapped values, each all the values of one key, append reduced data to a
+// multimap; by default reduce for each group. Override to reduce a whole batch in one loop.
+void SumSquare::reduceBatch(const std::vector<KeyGroup>& groups,
+                            std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    // reused from key to key
+    vector<ReducedValue> reducedValues;
+    
+    for (size_t k = 0; k < groups.size(); k++) {
+        multimap<string, MappedValue>::const_iterator beginKey = groups[k].first;
+        multimap<string, MappedValue>::const_iterator endKey = groups[k].second;
+        const string& mappedKey = beginKey->first;
+        
+        reducedValues.clear();
+        reduce(mappedKey, beginKey, endKey, reducedValues);
+        
+        // keys come in order, so each goes at the end
+        for (size_t n = 0; n < reducedValues.size(); n++) {
+            reducedPairs.insert(reducedPairs.end(), make_pair(mappedKey, reducedValues[n]));
+        }
+    }
+}
+
+// standard aggregate computed by reduce; override to use another, or override reduce itself
+// and return AGGREGATE_NONE
+AggregateKind SumSquare::reduceAggregate()
+{
+    return AGGREGATE_SUM;
+}
+
+// error bound of the sketch kept for each key, and the quantile, if reduceAggregate is distinct or
+// quantile; by default 1% and the median
+SketchOptions SumSquare::reduceSketchOptions()
+{
+    return SketchOptions();
+}
+
+// reduce values for a particular key with reduceAggregate; the range of mapped values must
+// include all the values for the specified key
+void SumSquare::reduce(const std::string& keyMapped,
+                    std::multimap<std::string, MappedValue>::const_iterator& beginMappedValues,
+                    std::multimap<std::string, MappedValue>::const_iterator& endMappedValues,
+                    std::vector<ReducedValue>& reducedValues)
+{
+    AggregateKind kind = reduceAggregate();
+    LOGIC_ERROR_IF(kind == AGGREGATE_NONE, "override reduce or reduceAggregate");
+    
+    // values are copied a small block at a time, for batch update, so that memory doesn't grow
+    // with the number of values
+    const size_t BLOCK_VALUES = 256;
+    MappedValue block[BLOCK_VALUES];
+    size_t blockCount = 0;
+    
+    Aggregator<MappedValue> aggregator(kind, reduceSketchOptions());
+    
+    multimap<string, MappedValue>::const_iterator iterMapped = beginMappedValues;
+    while (iterMapped != endMappedValues) {
+        block[blockCount++] = iterMapped->second;
+        
+        if (blockCount == BLOCK_VALUES) {
+            aggregator.updateBatch(block, blockCount);
+            blockCount = 0;
+        }
+        
+        iterMapped++;
+    }
+    
+    aggregator.updateBatch(block, blockCount);
+    
+    if (aggregator.getCount() > 0) {
+        reducedValues.push_back(aggregator.result());
+    }
+}
+
+// reduce a range of mapped data, which may begin or end part way through a key's values, into the
+// partial result of each key in partialPairs, one value at a time for a standard aggregate; for use
+// only if isAssociativeReduce
+void SumSquare::reducePartialRange(
+    const std::multimap<std::string, MappedValue>& mappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+    PartialPairs& partialPairs)
+{
+    AggregateKind kind = reduceAggregate();
+    SketchOptions sketch = reduceSketchOptions();
+    
+    // a reduce written by hand gives a result per key, combined with any earlier one
+    if (kind == AGGREGATE_NONE) {
+        multimap<string, ReducedValue> reducedPairs;
+        reduceKeyGroups(mappedPairs, beginMappedPairs, endMappedPairs, reducedPairs);
+        
+        PartialPairs newPartials;
+        multimap<string, ReducedValue>::const_iterator iterReduced = reducedPairs.begin();
+        while (iterReduced != reducedPairs.end()) {
+            Partial partial(kind, sketch);
+            partial.value = iterReduced->second;
+            newPartials.insert(newPartials.end(), make_pair(iterReduced->first, partial));
+            
+            iterReduced++;
+        }
+        
+        mergePartials(partialPairs, newPartials);
+        return;
+    }
+    
+    // keys come in order, so each key's state is looked up once
+    PartialPairs::iterator iterPartial = partialPairs.end();
+    
+    multimap<string, MappedValue>::const_iterator iterMapped = beginMappedPairs;
+    while (iterMapped != endMappedPairs) {
+        if (iterPartial == partialPairs.end() || iterPartial->first != iterMapped->first) {
+            iterPartial = partialPairs.find(iterMapped->first);
+            
+            if (iterPartial == partialPairs.end()) {
+                iterPartial = partialPairs.insert(make_pair(iterMapped->first,
+                                                            Partial(kind, sketch))).first;
+            }
+        }
+        
+        iterPartial->second.state.update(iterMapped->second);
+        
+        iterMapped++;
+    }
+}
+
+// reduceBatch over the keys of a range of mapped data, in batches; a key's values are clipped to
+// the range
+void SumSquare::reduceKeyGroups(
+    const std::multimap<std::string, MappedValue>& mappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+    const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+    std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    const size_t BATCH_KEYS = 256;
+    
+    // reused from batch to batch
+    vector<KeyGroup> groups;
+    
+    multimap<string, MappedValue>::const_iterator iterMapped = beginMappedPairs;
+    while (iterMapped != endMappedPairs) {
+        groups.clear();
+        
+        while (iterMapped != endMappedPairs && groups.size() < BATCH_KEYS) {
+            multimap<string, MappedValue>::const_iterator endKey =
+                keyRangeEnd(mappedPairs, iterMapped, endMappedPairs);
+            
+            groups.push_back(make_pair(iterMapped, endKey));
+            iterMapped = endKey;
+        }
+        
+        reduceBatch(groups, reducedPairs);
+    }
+}
+
+// merge partial results from reducePartialRange into others, merging the states (or combining the
+// values) of keys that are in both
+void SumSquare::mergePartials(PartialPairs& partialPairs, const PartialPairs& otherPairs)
+{
+    bool byHand = reduceAggregate() == AGGREGATE_NONE;
+    
+    PartialPairs::const_iterator iterOther = otherPairs.begin();
+    while (iterOther != otherPairs.end()) {
+        PartialPairs::iterator iterPartial = partialPairs.find(iterOther->first);
+        
+        if (iterPartial == partialPairs.end()) {
+            partialPairs.insert(*iterOther);
+            
+        } else if (byHand) {
+            iterPartial->second.value = combine(iterOther->first, iterPartial->second.value,
+                                                iterOther->second.value);
+            
+        } else {
+            iterPartial->second.state.merge(iterOther->second.state);
+        }
+        
+        iterOther++;
+    }
+}
+
+// append the reduced data that partial results stand for to a multimap
+void SumSquare::partialResults(const PartialPairs& partialPairs,
+                               std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    bool byHand = reduceAggregate() == AGGREGATE_NONE;
+    
+    PartialPairs::const_iterator iterPartial = partialPairs.begin();
+    while (iterPartial != partialPairs.end()) {
+        ReducedValue value = byHand ? iterPartial->second.value :
+                                      iterPartial->second.state.result();
+        reducedPairs.insert(reducedPairs.end(), make_pair(iterPartial->first, value));
+        
+        iterPartial++;
+    }
+}
+
+// write partial results as lines of key, tab, then the state (or value)
+void SumSquare::writePartialPairs(std::ostream& output, const PartialPairs& partialPairs)
+{
+    bool byHand = reduceAggregate() == AGGREGATE_NONE;
+    
+    PartialPairs::const_iterator iterPartial = partialPairs.begin();
+    while (iterPartial != partialPairs.end()) {
+        output << iterPartial->first << '\t';
+        
+        if (byHand) {
+            output << iterPartial->second.value;
+            
+        } else {
+            iterPartial->second.state.write(output);
+        }
+        
+        output << '\n';
+        
+        iterPartial++;
+    }
+}
+
+// read partial results written by writePartialPairs; false if a line is malformed
+bool SumSquare::readPartialPairs(std::istream& input, PartialPairs& partialPairs)
+{
+    AggregateKind kind = reduceAggregate();
+    SketchOptions sketch = reduceSketchOptions();
+    
+    string line;
+    while (getline(input, line)) {
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            return false;
+        }
+        
+        Partial partial(kind, sketch);
+        istringstream iss(line.substr(tab + 1));
+        
+        bool valid = kind == AGGREGATE_NONE ? !(iss >> partial.value).fail() :
+                                              partial.state.read(iss);
+        if (!valid) {
+            return false;
+        }
+        
+        partialPairs.insert(partialPairs.end(), make_pair(line.substr(0, tab), partial));
+    }
+    
+    return true;
+}
+
+// format a range of reduced data as writeKeyValue would write it, into buffer
+void SumSquare::formatRange(
+    const std::multimap<std::string, ReducedValue>::const_iterator& beginReducedPairs,
+    const std::multimap<std::string, ReducedValue>::const_iterator& endReducedPairs,
+    std::string& buffer)
+{
+    ostringstream oss;
+    
+    multimap<string, ReducedValue>::const_iterator iterReduced = beginReducedPairs;
+    while (iterReduced != endReducedPairs) {
+        oss << iterReduced->first << '\t' << iterReduced->second << '\n';
+        
+        iterReduced++;
+    }
+    
+    buffer = oss.str();
+}
+
+// override to return false if reduce does not give one value per key, or if reducing parts of a
+// key's values and combining the results could differ from reducing them all at once; if true,
+// multiThread may split a key's values over threads. True if reduceAggregate is a standard
+// aggregate, whose partial states are merged; a reduce written by hand that overrides this to
+// return true also overrides combine.
+bool SumSquare::isAssociativeReduce()
+{
+    return reduceAggregate() != AGGREGATE_NONE;
+}
+
+// override to return true if the steps are still startRow, mapValue or mapColumns, and
+// reduceAggregate, a standard aggregate; if true, singleThreadDirect (only) may use columnarDirect.
+// True for SumSquare itself, false for a class derived from it unless it overrides this.
+bool SumSquare::isColumnar()
+{
+    return typeid(*this) == typeid(SumSquare) && reduceAggregate() != AGGREGATE_NONE;
+}
+
+// override to return true if the steps are still startRow, mapValue and reduceAggregate, and it is
+// combinable; if true, singleThreadDirect may use fusedDirect. True for SumSquare itself, false for
+// a class derived from it unless it overrides this.
+bool SumSquare::isFusedDirect()
+{
+    return typeid(*this) == typeid(SumSquare) && isAssociativeReduce();
+}
+
+// override to return true if mapBatch still maps each row by mapOne, and mapOne is still mapBegin,
+// a wait, then mapEnd; if true, mapRange may keep rows between mapBegin and mapEnd. True for
+// SumSquare itself, false for a class derived from it unless it overrides this.
+bool SumSquare::isMapInFlight()
+{
+    return typeid(*this) == typeid(SumSquare);
+}
+
+// override to return true if start still generates its rows by startRange; if true, worker threads
+// may call startRange for their own share of the rows instead of start for them all. True for
+// SumSquare itself, false for a class derived from it unless it overrides this.
+bool SumSquare::isStartRange()
+{
+    return typeid(*this) == typeid(SumSquare);
+}
+
+// map the rows of starting data into mapped rows with the same keys; by default mapValue for each
+// row. Override with a loop over the value arrays, for a map that doesn't depend on the key, so
+// that compilers can vectorize it.
+void SumSquare::mapColumns(const ColumnBatch<StartValue>& startColumns,
+                           ColumnBatch<MappedValue>& mappedColumns)
+{
+    mappedColumns.copyKeys(startColumns);
+    
+    const vector<int>& keyIds = startColumns.getKeyIds();
+    const vector<StartValue>& startValues = startColumns.getValues();
+    vector<MappedValue>& mappedValues = mappedColumns.getValues();
+    
+    for (size_t k = 0; k < startValues.size(); k++) {
+        mappedValues[k] = mapValue(startColumns.keyName(keyIds[k]), startValues[k]);
+    }
+}
+
+// singleThreadDirect with starting and mapped data held as ColumnBatches, and each key's values
+// reduced by one batch update of an Aggregator; for use only if isColumnar
+int SumSquare::columnarDirect(int nrows, std::ostream& output)
+{
+    // start
+    ScopedPhase scopedPhase(phaseStats, PHASE_START);
+    
+    ColumnBatch<StartValue> startColumns;
+    startColumns.reserve(max(nrows, 0));
+    
+    // reused from row to row
+    string key;
+    StartValue value;
+    
+    for (int row = 1; row <= nrows; row++) {
+        startRow(row, key, value);
+        startColumns.append(key, value);
+    }
+    
+    // map
+    scopedPhase.change(PHASE_MAP);
+    
+    ColumnBatch<MappedValue> mappedColumns;
+    mapColumns(startColumns, mappedColumns);
+    
+    // reduce
+    scopedPhase.change(PHASE_REDUCE);
+    
+    vector<int> keyOrder;
+    vector<size_t> keyBegins;
+    vector<MappedValue> groupedValues;
+    mappedColumns.groupByKey(keyOrder, keyBegins, groupedValues);
+    
+    AggregateKind kind = reduceAggregate();
+    SketchOptions sketch = reduceSketchOptions();
+    
+    vector<ReducedValue> reducedValues;
+    for (size_t k = 0; k < keyOrder.size(); k++) {
+        Aggregator<MappedValue> aggregator(kind, sketch);
+        aggregator.updateBatch(&groupedValues[0] + keyBegins[k], keyBegins[k + 1] - keyBegins[k]);
+        
+        reducedValues.push_back(aggregator.result());
+    }
+    
+    // output
+    scopedPhase.change(PHASE_OUTPUT);
+    
+    bool valid = true;
+    for (size_t k = 0; k < keyOrder.size() && valid; k++) {
+        valid = writeKeyValue<ReducedValue>(output, mappedColumns.keyName(keyOrder[k]),
+                                            reducedValues[k]);
+    }
+    
+    return valid ? 0 : 1;
+}
+
+// write reduced data for the window ended by the last pane closed, if it has any rows; returns the
+// time from closeNanos, when it ended, until it was written, or -1 if it was empty
+long long SumSquare::writeWindow(const WindowedAggregates<MappedValue>& windows,
+                                 long long closeNanos, std::ostream& output)
+{
+    if (windows.getWindowRows() == 0) {
+        return -1;
+    }
+    
+    WindowedAggregates<MappedValue>::KeyAggregators aggregates;
+    windows.windowAggregates(aggregates);
+    
+    long long index = windows.getPaneCount() - 1;
+    writeKeyValue<long long>(output, "window", index);
+    
+    WindowedAggregates<MappedValue>::KeyAggregators::const_iterator iter = aggregates.begin();
+    while (iter != aggregates.end()) {
+        writeKeyValue<ReducedValue>(output, iter->first, iter->second.result());
+        
+        iter++;
+    }
+    
+    // a reader downstream sees each window as soon as it ends
+    output.flush();
+    
+    long long latency = max(nanosecondClock() - closeNanos, 0LL);
+    
+    if (stats != NULL) {
+        ostringstream key;
+        key << "stream.window." << index << ".latencyNsec";
+        writeKeyValue<long long>(*stats, key.str(), latency);
+    }
+    
+    return latency;
+}
+
+// generate, map and reduce each row in one pass, with startRow, mapValue and an Aggregator per
+// key, without intermediate containers; for use only if isFusedDirect
+int SumSquare::fusedDirect(int nrows, std::ostream& output)
+{
+    ScopedPhase scopedPhase(phaseStats, PHASE_MAP);
+    
+    AggregateKind kind = reduceAggregate();
+    SketchOptions sketch = reduceSketchOptions();
+    map<string, Aggregator<MappedValue> > accumulators;
+    
+    // reused from row to row
+    string key;
+    StartValue value;
+    
+    for (int row = 1; row <= nrows; row++) {
+        startRow(row, key, value);
+        
+        map<string, Aggregator<MappedValue> >::iterator iter = accumulators.find(key);
+        if (iter == accumulators.end()) {
+            iter = accumulators.insert(make_pair(key, Aggregator<MappedValue>(kind, sketch))).first;
+        }
+        
+        iter->second.update(mapValue(key, value));
+    }
+    
+    // output
+    scopedPhase.change(PHASE_OUTPUT);
+    
+    map<string, Aggregator<MappedValue> >::const_iterator iterOut = accumulators.begin();
+    bool valid = true;
+    while (iterOut != accumulators.end() && valid) {
+        valid = writeKeyValue<ReducedValue>(output, iterOut->first, iterOut->second.result());
+        
+        iterOut++;
+    }
+    
+    return valid ? 0 : 1;
+}
+
+// combine two partial results for a key of a reduce written by hand, if isAssociativeReduce; by
+// default their sum. Standard aggregates merge their states instead.
+SumSquare::ReducedValue SumSquare::combine(const std::string& keyMapped, ReducedValue partial1,
+                                           ReducedValue partial2)
+{
+    return combineResults(reduceAggregate(), partial1, partial2);
+}
+
+// read partial results saved by incrementalDirect, if they are for this calculation, map version,
+// aggregate and sketch options; rows is set to the number of rows they cover (rows 1 to rows)
+bool SumSquare::readPartials(const std::string& path, int& rows, PartialPairs& partialPairs)
+{
+    ifstream input(path.c_str());
+    if (!input.is_open()) {
+        return false;
+    }
+    
+    // header lines, then key/value lines
+    string key;
+    string calcName;
+    int version = 0;
+    string aggregate;
+    string sketch;
+    int firstRow = 0;
+    int lastRow = 0;
+    
+    bool valid = readKeyValue<string>(input, key, calcName) && key == "calc" &&
+                 readKeyValue<int>(input, key, version) && key == "mapVersion" &&
+                 readKeyValue<string>(input, key, aggregate) && key == "aggregate" &&
+                 readKeyValue<string>(input, key, sketch) && key == "sketch" &&
+                 readKeyValue<int>(input, key, firstRow) && key == "firstRow" &&
+                 readKeyValue<int>(input, key, lastRow) && key == "lastRow";
+    
+    if (!valid || calcName != name() || version != mapVersion() ||
+        aggregate != aggregateName(reduceAggregate()) || sketch != sketchTag() || firstRow != 1 ||
+        lastRow < 0) {
+        return false;
+    }
+    
+    if (!readPartialPairs(input, partialPairs)) {
+        return false;
+    }
+    
+    rows = lastRow;
+    
+    return true;
+}
+
+// save partial results covering rows 1 to rows, replacing any earlier ones
+void SumSquare::writePartials(const std::string& path, int rows, const PartialPairs& partialPairs)
+{
+    // written to a temporary file of its own and renamed, so that a crash can't leave half a
+    // file, and runs at once can't write into each other's
+    string tempPath = makeTempFile(path);
+    
+    bool written = false;
+    {
+        ofstream output(tempPath.c_str());
+        
+        writeKeyValue<string>(output, "calc", name());
+        writeKeyValue<int>(output, "mapVersion", mapVersion());
+        writeKeyValue<string>(output, "aggregate", aggregateName(reduceAggregate()));
+        writeKeyValue<string>(output, "sketch", sketchTag());
+        writeKeyValue<int>(output, "firstRow", 1);
+        writeKeyValue<int>(output, "lastRow", rows);
+        
+        writePartialPairs(output, partialPairs);
+        
+        written = output.is_open() && !output.fail();
+    }
+    
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+        remove(tempPath.c_str());
+        RUNTIME_ERROR_IF(true, "can't write partial results to " + path);
+    }
+}
+
+// the sketch options of reduceAggregate, as written with partial results
+std::string SumSquare::sketchTag()
+{
+    SketchOptions sketch = reduceSketchOptions();
+    
+    ostringstream oss;
+    oss << setprecision(17) << sketch.relativeError << "," << sketch.quantile;
+    
+    return oss.str();
+}
+
+#if USE_THREADS
+// map chunks of rows on a worker thread pinned as planned for thread k: chunk k, then chunks
+// claimed from nextChunk until there are none left. With an affinity policy, the rows of each
+// chunk are generated on this thread into startSlice if isStartRange, or else copied there from
+// startPairs, so that the rows it maps are first touched on its NUMA node; otherwise they are
+// read from startPairs. With checkpoints, each chunk's output is saved, or read back if an earlier
+// run of the job saved it. Counts into workerStats whatever phaseStats has enabled.
+void SumSquare::workerMapChunks(
+    const AffinityPlan& plan,
+    int threadIndex,
+    const vector<int>& chunkOffsets,
+    atomic<int>& nextChunk,
+    const vector< pair<string, StartValue> >& startPairs,
+    vector< pair<string, StartValue> >& startSlice,
+    multimap<string, MappedValue>& mappedValues,
+    WorkerStats& workerStats)
+{
+    plan.pin(threadIndex);
+    traceThreadName("map worker");
+    
+    bool pinned = plan.getPolicy() != AFFINITY_NONE;
+    bool firstTouch = pinned && isStartRange();
+    int chunkCount = (int)chunkOffsets.size() - 1;
+    long long rows = 0;
+    
+    {
+        ScopedWorker scopedWorker(phaseStats, workerStats);
+        
+        for (int chunk = threadIndex; chunk < chunkCount; chunk = nextChunk++) {
+            int beginRow = chunkOffsets[chunk];
+            int endRow = chunkOffsets[chunk + 1];
+            
+            // a chunk finished by an earlier run of the same job is read back instead
+            ostringstream part;
+            part << "map." << chunk;
+            
+            string contents;
+            if (checkpoint != NULL && checkpoint->load(part.str(), contents)) {
+                istringstream iss(contents);
+                if (readCompacted<MappedValue>(iss, mappedValues)) {
+                    continue;
+                }
+            }
+            
+            // with checkpoints, the chunk's output is kept apart until it has been queued for
+            // saving
+            multimap<string, MappedValue> chunkValues;
+            multimap<string, MappedValue>& chunkOutput =
+                checkpoint != NULL ? chunkValues : mappedValues;
+            
+            if (pinned) {
+                size_t first = startSlice.size();
+                if (firstTouch) {
+                    startRange(beginRow + 1, endRow + 1, startSlice);
+                    
+                } else {
+                    startSlice.insert(startSlice.end(), startPairs.begin() + beginRow,
+                                      startPairs.begin() + endRow);
+                }
+                
+                ScopedTrace scopedTrace("mapRange", "worker", "rows", endRow - beginRow);
+                mapRangeCached(startSlice.begin() + first, startSlice.end(), chunkOutput);
+                
+            } else {
+                ScopedTrace scopedTrace("mapRange", "worker", "rows", endRow - beginRow);
+                mapRangeCached(startPairs.begin() + beginRow, startPairs.begin() + endRow,
+                               chunkOutput);
+            }
+            
+            if (checkpoint != NULL) {
+                ostringstream oss;
+                writeCompacted<MappedValue>(oss, chunkValues);
+                checkpoint->save(part.str(), oss.str());
+                
+                mappedValues.insert(chunkValues.begin(), chunkValues.end());
+            }
+            
+            rows += endRow - beginRow;
+        }
+    }
+    
+    // load-imbalance report, outside the busy time
+    if (phaseStats != NULL) {
+        workerStats.cpu = currentCpu();
+        workerStats.rows = rows;
+        workerStats.keys = countKeys(mappedValues, mappedValues.begin(), mappedValues.end());
+        workerStats.values = mappedValues.size();
+    }
+}
+#endif
+
+// reduceRange (or reducePartialRange, if partial) on a worker thread, pinned as planned for
+// thread k, counting into workerStats whatever phaseStats has enabled; with checkpoints, the
+// results are saved as checkpointPart, or read back if an earlier run of the job saved them
+void SumSquare::workerReduceRange(
+    const AffinityPlan& plan,
+    int threadIndex,
+    bool partial,
+    const multimap<string, MappedValue>& mappedPairs,
+    const multimap<string, MappedValue>::const_iterator& beginMappedPairs,
+    const multimap<string, MappedValue>::const_iterator& endMappedPairs,
+    const string& checkpointPart,
+    multimap<string, ReducedValue>& reducedPairs,
+    PartialPairs& partialPairs,
+    WorkerStats& workerStats)
+{
+    plan.pin(threadIndex);
+    
+    // counting values takes a pass over the range, so only when tracing
+    long long values = isTraceEnabled() ? distance(beginMappedPairs, endMappedPairs) : 0;
+    
+    traceThreadName("reduce worker");
+    ScopedTrace scopedTrace("reduceRange", "worker", "values", values);
+    
+    {
+        ScopedWorker scopedWorker(phaseStats, workerStats);
+        
+        // a part finished by an earlier run of the same job is read back instead
+        string contents;
+        bool resumed = false;
+        if (checkpoint != NULL && checkpoint->load(checkpointPart, contents)) {
+            istringstream iss(contents);
+            resumed = partial ? readPartialPairs(iss, partialPairs) :
+                                readCompacted<ReducedValue>(iss, reducedPairs);
+            
+            // one that can't be read is calculated again
+            if (!resumed) {
+                reducedPairs.clear();
+                partialPairs.clear();
+            }
+        }
+        
+        if (resumed) {
+            // done
+            
+        } else if (partial) {
+            reducePartialRange(mappedPairs, beginMappedPairs, endMappedPairs, partialPairs);
+            
+        } else {
+            reduceRange(mappedPairs, beginMappedPairs, endMappedPairs, reducedPairs);
+        }
+        
+        if (checkpoint != NULL && !resumed) {
+            ostringstream oss;
+            if (partial) {
+                writePartialPairs(oss, partialPairs);
+                
+            } else {
+                writeCompacted<ReducedValue>(oss, reducedPairs);
+            }
+            
+            checkpoint->save(checkpointPart, oss.str());
+        }
+    }
+    
+    // load-imbalance report, outside the busy time
+    if (phaseStats != NULL) {
+        workerStats.cpu = currentCpu();
+        workerStats.rows = partial ? partialPairs.size() : reducedPairs.size();
+        workerStats.keys = countKeys(mappedPairs, beginMappedPairs, endMappedPairs);
+        workerStats.values = distance(beginMappedPairs, endMappedPairs);
+    }
+}
+
+// mergePartials on a worker thread
+void SumSquare::workerMergePartials(PartialPairs& partialPairs, const PartialPairs& otherPairs)
+{
+    traceThreadName("merge worker");
+    ScopedTrace scopedTrace("mergePartials", "worker", "keys", otherPairs.size());
+    
+    mergePartials(partialPairs, otherPairs);
+}
+
+// formatRange on a worker thread
+void SumSquare::workerFormatRange(
+    const std::multimap<std::string, ReducedValue>::const_iterator& beginReducedPairs,
+    const std::multimap<std::string, ReducedValue>::const_iterator& endReducedPairs,
+    std::string& buffer)
+{
+    traceThreadName("output worker");
+    ScopedTrace scopedTrace("formatRange", "worker");
+    
+    formatRange(beginReducedPairs, endReducedPairs, buffer);
+}
+
+#if USE_THREADS
+// generate chunks of rows of the starting data, chunk k starting at row startRows[k], and mapRange
+// them in batches on a worker thread: chunk threadIndex, then chunks claimed from nextChunk until
+// there are none left. Each batch's bytes are taken from budget, then each mapped row is pushed to
+// queues[k] for reduce thread k: the next thread in turn if isAssociativeReduce, else the thread
+// whose range of keys, split at splitKeys, its key falls in. Closes the queues when done, and
+// counts into pushWaits the times a queue was full.
+void SumSquare::workerMapToQueues(int threadIndex,
+                                  const std::vector<int>& startRows,
+                                  std::atomic<int>& nextChunk,
+                                  const std::vector<std::string>& splitKeys,
+                                  const std::vector<ShuffleQueue *>& queues,
+                                  MemoryBudget& budget,
+                                  long long& pushWaits)
+{
+    const int BATCH_ROWS = 256;
+    
+    traceThreadName("map worker");
+    ScopedTrace scopedTrace("mapToQueues", "worker");
+    
+    // rows of a batch, the rows mapped from them, then the mapped rows for each queue
+    vector< pair<string, StartValue> > startPairs;
+    multimap<string, MappedValue> mappedPairs;
+    vector< vector< pair<string, MappedValue> > > queueRows(queues.size());
+    
+    // the rows of a key are spread over the reduce threads if their partial results can be merged
+    bool spread = isAssociativeReduce();
+    size_t nextQueue = threadIndex % queues.size();
+    
+    int chunkCount = (int)startRows.size() - 1;
+    for (int chunk = threadIndex; chunk < chunkCount; chunk = nextChunk++) {
+        int row = startRows[chunk];
+        int endRow = startRows[chunk + 1];
+        while (row < endRow) {
+            int n = min(BATCH_ROWS, endRow - row);
+            
+            startPairs.clear();
+            startRange(row, row + n, startPairs);
+            row += n;
+            
+            mappedPairs.clear();
+            mapRange(startPairs.begin(), startPairs.end(), mappedPairs);
+            
+            long long batchBytes = 0;
+            multimap<string, MappedValue>::const_iterator iterMapped = mappedPairs.begin();
+            while (iterMapped != mappedPairs.end()) {
+                const string& key = iterMapped->first;
+                size_t k = nextQueue;
+                if (spread) {
+                    nextQueue = (nextQueue + 1) % queues.size();
+                    
+                } else {
+                    k = upper_bound(splitKeys.begin(), splitKeys.end(), key) - splitKeys.begin();
+                }
+                
+                queueRows[k].push_back(*iterMapped);
+                batchBytes += pairBytes(key, sizeof(MappedValue));
+                
+                iterMapped++;
+            }
+            
+            // waits while the queues and reduce threads hold as much as the limit allows
+            budget.acquire(batchBytes);
+            
+            for (size_t k = 0; k < queues.size(); k++) {
+                size_t pushed = 0;
+                while (pushed < queueRows[k].size()) {
+                    size_t count = queues[k]->tryPushBatch(&queueRows[k][pushed],
+                                                           queueRows[k].size() - pushed);
+                    if (count == 0) {
+                        pushWaits++;
+                        this_thread::yield();
+                    }
+                    
+                    pushed += count;
+                }
+                
+                queueRows[k].clear();
+            }
+        }
+    }
+    
+    for (size_t k = 0; k < queues.size(); k++) {
+        queues[k]->close();
+    }
+}
+
+// pop mapped rows from queues on a worker thread until each is closed and empty, counting into
+// popWaits the times every queue was empty. If isAssociativeReduce, the rows popped from all the
+// queues each time are folded into partialPairs, and their bytes given back, at once; else they are
+// held, then reduceRange'd into reducedPairs. While budget is pressed, rows held are spilled, once
+// there are at least spillBytes of them (or a quarter of that, if nothing is left to pop), to a
+// sorted run in spillDir named for threadIndex, and their bytes given back. An error is kept in
+// error, and the rest of the rows only drained, so that the map threads still finish; the runs are
+// left for the caller to remove with spillDir.
+void SumSquare::workerReduceFromQueues(int threadIndex,
+                                       const std::vector<ShuffleQueue *>& queues,
+                                       MemoryBudget& budget,
+                                       long long spillBytes,
+                                       const std::string& spillDir,
+                                       std::multimap<std::string, ReducedValue>& reducedPairs,
+                                       PartialPairs& partialPairs,
+                                       std::string& error,
+                                       long long& popWaits)
+{
+    const size_t BATCH_ROWS = 256;
+    
+    traceThreadName("reduce worker");
+    ScopedTrace scopedTrace("reduceFromQueues", "worker");
+    
+    bool foldable = isAssociativeReduce();
+    
+    // runs are no smaller than this, even when nothing is left to pop, so that a thread holding
+    // few rows doesn't spill a run of them each time round
+    long long minRunBytes = spillBytes / 4;
+    
+    ostringstream runPrefix;
+    runPrefix << spillDir << "/run." << threadIndex;
+    
+    // rows popped and not yet freed, and their bytes taken from budget; the runs spilled so far
+    multimap<string, MappedValue> mappedPairs;
+    long long heldBytes = 0;
+    vector<string> spillPaths;
+    
+    vector< pair<string, MappedValue> > rows(BATCH_ROWS);
+    vector<bool> finished(queues.size(), false);
+    size_t finishedCount = 0;
+    
+    while (finishedCount < queues.size()) {
+        size_t poppedCount = 0;
+        
+        for (size_t k = 0; k < queues.size(); k++) {
+            if (finished[k]) {
+                continue;
+            }
+            
+            // closed before the pop, so a pop that finds nothing after it means nothing is left
+            bool closed = queues[k]->isClosed();
+            
+            size_t count = queues[k]->tryPopBatch(&rows[0], rows.size());
+            for (size_t j = 0; j < count; j++) {
+                heldBytes += pairBytes(rows[j].first, sizeof(MappedValue));
+                mappedPairs.insert(rows[j]);
+            }
+            
+            if (count == 0 && closed) {
+                finished[k] = true;
+                finishedCount++;
+            }
+            
+            poppedCount += count;
+        }
+        
+        bool failed = !error.empty();
+        bool foldHeld = heldBytes > 0 && foldable && !failed;
+        bool spillHeld = heldBytes > 0 && !foldable && !failed && finishedCount < queues.size() &&
+                         budget.isPressed() && (heldBytes >= spillBytes ||
+                                                (poppedCount == 0 && heldBytes >= minRunBytes));
+        
+        try {
+            if (foldHeld) {
+                reducePartialRange(mappedPairs, mappedPairs.begin(), mappedPairs.end(),
+                                   partialPairs);
+                
+            } else if (spillHeld) {
+                string path = makeTempFile(runPrefix.str());
+                spillPaths.push_back(path);
+                writeSpill(path, mappedPairs);
+                
+                budget.addSpill(heldBytes);
+            }
+            
+        } catch (const exception& x) {
+            error = x.what();
+        }
+        
+        if (foldHeld || spillHeld || failed) {
+            mappedPairs.clear();
+            budget.release(heldBytes);
+            heldBytes = 0;
+        }
+        
+        if (poppedCount == 0 && finishedCount < queues.size()) {
+            popWaits++;
+            this_thread::yield();
+        }
+    }
+    
+    try {
+        if (!error.empty() || foldable) {
+            // nothing more to do
+            
+        } else if (!spillPaths.empty()) {
+            reduceSpills(spillPaths, runPrefix.str(), mappedPairs, reducedPairs);
+            
+        } else {
+            reduceRange(mappedPairs, mappedPairs.begin(), mappedPairs.end(), reducedPairs);
+        }
+        
+    } catch (const exception& x) {
+        error = x.what();
+    }
+    
+    mappedPairs.clear();
+    budget.release(heldBytes);
+}
+
+// read rows of starting data from input into rows on a worker thread until the end of input, then
+// set ended, notifying rowsChanged of each, so that streamWorker can end windows by time while it
+// waits for the next row
+void SumSquare::workerReadStream(std::istream& input,
+                                 std::deque< std::pair<std::string, StartValue> >& rows,
+                                 bool& ended,
+                                 std::mutex& rowsMutex,
+                                 std::condition_variable& rowsChanged)
+{
+    string startKey;
+    StartValue startValue;
+    
+    while (readKeyValue<StartValue>(input, startKey, startValue)) {
+        {
+            lock_guard<mutex> lock(rowsMutex);
+            rows.push_back(make_pair(startKey, startValue));
+        }
+        
+        rowsChanged.notify_all();
+    }
+    
+    {
+        lock_guard<mutex> lock(rowsMutex);
+        ended = true;
+    }
+    
+    rowsChanged.notify_all();
+}
+#endif
+
+// write mapped data to a file, as a run sorted by key for reduceSpills
+void SumSquare::writeSpill(const std::string& path,
+                           const std::multimap<std::string, MappedValue>& mappedPairs)
+{
+    ofstream output(path.c_str());
+    RUNTIME_ERROR_IF(!output.is_open(), badPathErrorMessage(path));
+    
+    multimap<string, MappedValue>::const_iterator iter = mappedPairs.begin();
+    while (iter != mappedPairs.end()) {
+        writeKeyValue<MappedValue>(output, iter->first, iter->second);
+        
+        iter++;
+    }
+    
+    RUNTIME_ERROR_IF(output.fail(), "can't spill mapped data to " + path);
+}
+
+// reduceRange the mapped data in sorted runs written by writeSpill together with mappedPairs,
+// with mergeSpills; with more runs than can be open at once, groups of them are first merged into
+// longer runs named for runPrefix. The files are removed.
+void SumSquare::reduceSpills(const std::vector<std::string>& paths,
+                             const std::string& runPrefix,
+                             const std::multimap<std::string, MappedValue>& mappedPairs,
+                             std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    // well within the files a process may have open
+    const size_t MERGE_RUNS = 64;
+    
+    vector<string> runPaths(paths);
+    multimap<string, MappedValue> noPairs;
+    
+    while (runPaths.size() > MERGE_RUNS) {
+        vector<string> mergedPaths;
+        
+        for (size_t k = 0; k < runPaths.size(); k += MERGE_RUNS) {
+            vector<string> group(runPaths.begin() + k,
+                                 runPaths.begin() + min(k + MERGE_RUNS, runPaths.size()));
+            
+            if (group.size() == 1) {
+                mergedPaths.push_back(group[0]);
+                continue;
+            }
+            
+            string path = makeTempFile(runPrefix);
+            mergedPaths.push_back(path);
+            
+            ofstream output(path.c_str());
+            RUNTIME_ERROR_IF(!output.is_open(), badPathErrorMessage(path));
+            
+            mergeSpills(group, noPairs, &output, reducedPairs);
+            RUNTIME_ERROR_IF(output.fail(), "can't spill mapped data to " + path);
+        }
+        
+        runPaths.swap(mergedPaths);
+    }
+    
+    mergeSpills(runPaths, mappedPairs, NULL, reducedPairs);
+}
+
+// merge sorted runs written by writeSpill together with mappedPairs a key at a time, so that only
+// one key's values are held at once, writing each key's values to runOutput as a longer run if it
+// isn't NULL, else reduceRange'ing them into reducedPairs; the files are removed once read
+void SumSquare::mergeSpills(const std::vector<std::string>& paths,
+                            const std::multimap<std::string, MappedValue>& mappedPairs,
+                            std::ostream *runOutput,
+                            std::multimap<std::string, ReducedValue>& reducedPairs)
+{
+    // each run, with the next row read from it, if any
+    vector<ifstream *> runs;
+    vector< pair<string, MappedValue> > nextRows(paths.size());
+    vector<bool> hasNext(paths.size(), false);
+    
+    // the runs are closed on an error too, so that their files can be removed
+    try {
+        for (size_t k = 0; k < paths.size(); k++) {
+            runs.push_back(new ifstream(paths[k].c_str()));
+            RUNTIME_ERROR_IF(!runs[k]->is_open(), badPathErrorMessage(paths[k]));
+            
+            hasNext[k] = readKeyValue<MappedValue>(*runs[k], nextRows[k].first,
+                                                   nextRows[k].second);
+        }
+        
+        multimap<string, MappedValue>::const_iterator iterMapped = mappedPairs.begin();
+        multimap<string, MappedValue> keyPairs;
+        
+        while (true) {
+            // the smallest key not yet merged, in the runs or in memory
+            const string *nextKey = NULL;
+            for (size_t k = 0; k < runs.size(); k++) {
+                if (hasNext[k] && (nextKey == NULL || nextRows[k].first < *nextKey)) {
+                    nextKey = &nextRows[k].first;
+                }
+            }
+            
+            if (iterMapped != mappedPairs.end() &&
+                (nextKey == NULL || iterMapped->first < *nextKey)) {
+                nextKey = &iterMapped->first;
+            }
+            
+            if (nextKey == NULL) {
+                break;
+            }
+            
+            // all of its values
+            string key = *nextKey;
+            keyPairs.clear();
+            
+            for (size_t k = 0; k < runs.size(); k++) {
+                while (hasNext[k] && nextRows[k].first == key) {
+                    keyPairs.insert(nextRows[k]);
+                    hasNext[k] = readKeyValue<MappedValue>(*runs[k], nextRows[k].first,
+                                                           nextRows[k].second);
+                }
+            }
+            
+            while (iterMapped != mappedPairs.end() && iterMapped->first == key) {
+                keyPairs.insert(*iterMapped);
+                iterMapped++;
+            }
+            
+            if (runOutput != NULL) {
+                multimap<string, MappedValue>::const_iterator iterKey = keyPairs.begin();
+                while (iterKey != keyPairs.end()) {
+                    writeKeyValue<MappedValue>(*runOutput, iterKey->first, iterKey->second);
+                    
+                    iterKey++;
+                }
+                
+            } else {
+                reduceRange(keyPairs, keyPairs.begin(), keyPairs.end(), reducedPairs);
+            }
+        }
+        
+    } catch (...) {
+        for (size_t k = 0; k < runs.size(); k++) {
+            delete runs[k];
+        }
+        
+        throw;
+    }
+    
+    for (size_t k = 0; k < runs.size(); k++) {
+        delete runs[k];
+        remove(paths[k].c_str());
+    }
+}
+
+// ========== Local Functions ======================================================================
+
+// number of distinct keys in a range of pairs
+template <typename T>
+static long long countKeys(const std::multimap<std::string, T>& pairs,
+                           const typename std::multimap<std::string, T>::const_iterator& begin,
+                           const typename std::multimap<std::string, T>::const_iterator& end)
+{
+    long long keys = 0;
+    
+    typename multimap<string, T>::const_iterator iter = begin;
+    while (iter != end) {
+        keys++;
+        iter = keyRangeEnd(pairs, iter, end);
+    }
+    
+    return keys;
+}
+
+// end of the values for iter's key within a range ending at end, which may be part way through
+// them
+template <typename T>
+static typename std::multimap<std::string, T>::const_iterator keyRangeEnd(
+    const std::multimap<std::string, T>& pairs,
+    const typename std::multimap<std::string, T>::const_iterator& iter,
+    const typename std::multimap<std::string, T>::const_iterator& end)
+{
+    // keys are in order, so end is within iter's key unless its key is greater
+    if (end != pairs.end() && !(iter->first < end->first)) {
+        return end;
+    }
+    
+    return pairs.upper_bound(iter->first);
+}
+
+// split a map into parts ranges of about the same size, in order, appending their ends to begins
+// and ends
+template <typename T>
+static void splitPairs(const std::multimap<std::string, T>& pairs, int parts,
+                       std::vector<typename std::multimap<std::string, T>::const_iterator>& begins,
+                       std::vector<typename std::multimap<std::string, T>::const_iterator>& ends)
+{
+    typename multimap<string, T>::const_iterator iter = pairs.begin();
+    
+    for (int k = 0; k < parts; k++) {
+        begins.push_back(iter);
+        advance(iter, (k + 1) * pairs.size() / parts - k * pairs.size() / parts);
+        ends.push_back(iter);
+    }
+}
+
+// ========== Tests ================================================================================
+
+// SumSquare as if its reduce could not be split within a key
+class KeyedSumSquare : public SumSquare {
+protected:
+    virtual bool isAssociativeReduce() { return false; };
+    virtual bool isStartRange() { return true; };
+};
+
+// KeyedSumSquare whose reduce fails
+class FailingKeyedSumSquare : public KeyedSumSquare {
+protected:
+    virtual void reduce(const std::string& keyMapped,
+                        std::multimap<std::string, MappedValue>::const_iterator& begin,
+                        std::multimap<std::string, MappedValue>::const_iterator& end,
+                        std::vector<ReducedValue>& reducedValues)
+    {
+        RUNTIME_ERROR_IF(true, "reduce failed");
+    };
+};
+
+// largest or mean square instead of the sum
+class MaxSquare : public SumSquare {
+protected:
+    virtual AggregateKind reduceAggregate() { return AGGREGATE_MAX; };
+    virtual bool isStartRange() { return true; };
+};
+
+class MeanSquare : public SumSquare {
+protected:
+    virtual AggregateKind reduceAggregate() { return AGGREGATE_MEAN; };
+    virtual bool isStartRange() { return true; };
+};
+
+// MeanSquare with its rows kept as columns instead of between steps as pairs and multimaps
+class ColumnarMeanSquare : public MeanSquare {
+protected:
+    virtual bool isColumnar() { return true; };
+};
+
+// estimated distinct count or median of the squares, from sketches
+class DistinctSquare : public SumSquare {
+protected:
+    virtual AggregateKind reduceAggregate() { return AGGREGATE_DISTINCT; };
+};
+
+class MedianSquare : public SumSquare {
+protected:
+    virtual AggregateKind reduceAggregate() { return AGGREGATE_QUANTILE; };
+    virtual bool isStartRange() { return true; };
+};
+
+
+// SumSquare counting its calls to mapOne, with its own map cache entries
+class CountingSumSquare : public SumSquare {
+public:
+    CountingSumSquare(int version = 1) : version(version), mapCalls(0) {};
+    
+    virtual std::string name() { return "mapCacheTest"; };
+    virtual int mapVersion() { return version; };
+    
+    int version;
+    int mapCalls;
+    
+protected:
+    virtual bool isStartRange() { return true; };
+    
+    virtual void mapOne(const std::string& keyIn, StartValue valueIn,
+                        std::multimap<std::string, MappedValue>& mappedValues)
+    {
+        mapCalls++;
+        SumSquare::mapOne(keyIn, valueIn, mappedValues);
+    };
+};
+
+// SumSquare mapping and reducing a batch in one loop, counting the batches
+class BatchSumSquare : public SumSquare {
+public:
+    BatchSumSquare() : mapBatches(0), mapRows(0), reduceBatches(0) {};
+    
+    int mapBatches;
+    int mapRows;
+    int reduceBatches;
+    
+protected:
+    virtual void mapBatch(const std::pair<std::string, StartValue> *rows, size_t n,
+                          std::multimap<std::string, MappedValue>& mappedValues)
+    {
+        mapBatches++;
+        mapRows += (int)n;
+        
+        for (size_t k = 0; k < n; k++) {
+            mappedValues.insert(make_pair(rows[k].first, rows[k].second * rows[k].second));
+        }
+    };
+    
+    virtual void reduceBatch(const std::vector<KeyGroup>& groups,
+                             std::multimap<std::string, ReducedValue>& reducedPairs)
+    {
+        reduceBatches++;
+        
+        for (size_t k = 0; k < groups.size(); k++) {
+            ReducedValue sum = 0;
+            
+            multimap<string, MappedValue>::const_iterator iter = groups[k].first;
+            while (iter != groups[k].second) {
+                sum += iter->second;
+                
+                iter++;
+            }
+            
+            reducedPairs.insert(reducedPairs.end(), make_pair(groups[k].first->first, sum));
+        }
+    };
+};
+
+// SumSquare with three keys, by row modulo 3, fused or not
+class ModThreeSumSquare : public SumSquare {
+public:
+    ModThreeSumSquare(bool fused) : fused(fused) {};
+    
+    bool fused;
+    
+protected:
+    virtual void startRow(int row, std::string& key, StartValue& value)
+    {
+        key = (char)('0' + row % 3);
+        value = row;
+    };
+    
+    virtual bool isFusedDirect() { return fused; };
+    virtual bool isStartRange() { return true; };
+};
+
+// SumSquare with one key, whose start is written by hand instead of by startRange
+class StartSumSquare : public SumSquare {
+protected:
+    virtual void start(int nrows, std::vector< std::pair<std::string, StartValue> >& startPairs)
+    {
+        for (int row = 1; row <= nrows; row++) {
+            startPairs.push_back(make_pair(string("ALL"), (StartValue)row));
+        }
+    };
+};
+
+#if USE_THREADS
+// whether a window has been flushed to a GatedOutput
+struct WindowGate {
+    WindowGate() : flushed(false) {};
+    
+    std::mutex gateMutex;
+    std::condition_variable gateChanged;
+    bool flushed;
+};
+
+// rows whose end of input is held back until a window has been flushed, or a second has passed
+class GatedInput : public std::stringbuf {
+public:
+    GatedInput(const std::string& rows, WindowGate& gate) :
+        std::stringbuf(rows, std::ios::in), gate(gate), flushedFirst(false) {};
+    
+    WindowGate& gate;
+    bool flushedFirst;                  // a window was flushed before the end of input
+    
+protected:
+    virtual int_type underflow()
+    {
+        int_type next = std::stringbuf::underflow();
+        
+        if (traits_type::eq_int_type(next, traits_type::eof())) {
+            unique_lock<mutex> lock(gate.gateMutex);
+            
+            long long deadline = nanosecondClock() + 1000000000LL;
+            while (!gate.flushed && nanosecondClock() < deadline) {
+                gate.gateChanged.wait_for(lock, chrono::nanoseconds(deadline - nanosecondClock()));
+            }
+            
+            flushedFirst = gate.flushed;
+        }
+        
+        return next;
+    };
+};
+
+// output that opens a WindowGate when flushed
+class GatedOutput : public std::stringbuf {
+public:
+    GatedOutput(WindowGate& gate) : std::stringbuf(std::ios::out), gate(gate) {};
+    
+    WindowGate& gate;
+    
+protected:
+    virtual int sync()
+    {
+        {
+            lock_guard<mutex> lock(gate.gateMutex);
+            gate.flushed = true;
+        }
+        
+        gate.gateChanged.notify_all();
+        
+        return std::stringbuf::sync();
+    };
+};
+#endif
+
+// component tests
+void ctest_sumSquare(int& totalPassed, int& totalFailed, bool useHadoop, bool verbose)
 {
     int passed = 0;
     int failed = 0;
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::startWorker
+    // SumSquare::startWorker
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::mapWorker
+    
+    {
+        SumSquare sumSquare;
+        
+        ostringstream report;
+        sumSquare.setReport(&report);
+        
+        istringstream iss("ODD \t3\nEVEN\t4\n");
+        ostringstream oss;
+        int status = sumSquare.mapWorker(iss, oss);
+        string outStr = oss.str();
+        string reportStr = report.str();
+        const string expected = "ODD \t9\nEVEN\t16\n";
+        
+        if (status == 0 && outStr == expected &&
+            reportStr.find("reporter:counter:parallelCalc,mapRowsRead,2\n") != string::npos &&
+            reportStr.find("reporter:counter:parallelCalc,mapBytesParsed,14\n") != string::npos &&
+            reportStr.find("reporter:status:") != string::npos) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::reduceWorker
+    
+    {
+        SumSquare sumSquare;
+        
+        ostringstream report;
+        sumSquare.setReport(&report);
+        
+        istringstream iss("EVEN\t4\nEVEN\t16\nODD \t9\n");
+        ostringstream oss;
+        int status = sumSquare.reduceWorker(iss, oss);
+        string outStr = oss.str();
+        string reportStr = report.str();
+        const string expected = "EVEN\t20\nODD \t9\n";
+        
+        if (status == 0 && outStr == expected &&
+            reportStr.find("reporter:counter:parallelCalc,reduceRowsRead,3\n") != string::npos &&
+            reportStr.find("reporter:counter:parallelCalc,reduceKeys,2\n") != string::npos)
+            passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::streamWorker
+    // SumSquare::writeWindow
+    
+    {
+        // windows of 4 rows every 2 rows; the fifth row is a last window on its own pane
+        SumSquare sumSquare;
+        
+        ostringstream stats;
+        sumSquare.setStats(&stats);
+        
+        StreamWindow window;
+        window.size = 4;
+        window.slide = 2;
+        
+        istringstream iss("ODD \t1\nEVEN\t2\nODD \t3\nEVEN\t4\nODD \t5\n");
+        ostringstream oss;
+        int status = sumSquare.streamWorker(iss, oss, window);
+        string outStr = oss.str();
+        string statsStr = stats.str();
+        
+        const string expected = "window\t0\nEVEN\t4\nODD \t1\n"
+                                "window\t1\nEVEN\t20\nODD \t10\n"
+                                "window\t2\nEVEN\t16\nODD \t34\n";
+        
+        if (status == 0 && outStr == expected &&
+            statsStr.find("stream.window.2.latencyNsec\t") != string::npos &&
+            statsStr.find("stream.rows\t5\nstream.windows\t3\n") != string::npos) passed++;
+        else failed++;
+    }
+    
+#if USE_THREADS
+    {
+        // windows of 10 msec end on time while no more rows come, rather than with the input
+        SumSquare sumSquare;
+        
+        StreamWindow window;
+        window.byTime = true;
+        window.size = 10;
+        window.slide = 10;
+        
+        WindowGate gate;
+        GatedInput gatedInput("EVEN\t2\n", gate);
+        GatedOutput gatedOutput(gate);
+        istream input(&gatedInput);
+        ostream output(&gatedOutput);
+        
+        int status = sumSquare.streamWorker(input, output, window);
+        string outStr = gatedOutput.str();
+        
+        if (status == 0 && gatedInput.flushedFirst && outStr.find("EVEN\t4\n") != string::npos)
+            passed++; else failed++;
+    }
+#endif
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::singleThreadDirect
+
+    {
+        SumSquare sumSquare;
+        
+        int nrows = 10;
+        ostringstream oss;
+        int status = sumSquare.singleThreadDirect(nrows, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        if (status == 0 && outStr == expected) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::multiThread
+    
+#if USE_THREADS
+    {
+        SumSquare sumSquare;
+        
+        int nrows = 10;
+        int nthreads = 2;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        if (status == 0 && outStr == expected) passed++; else failed++;
+    }
+    
+    {
+        SumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        int nrows = 10;
+        int nthreads = 2;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        // map and reduce results are each merged once
+        if (status == 0 && outStr == expected &&
+            phaseStats.getCount(PHASE_START) == 1 && phaseStats.getCount(PHASE_MAP) == 1 &&
+            phaseStats.getCount(PHASE_MERGE) == 2 && phaseStats.getCount(PHASE_KEYS) == 1 &&
+            phaseStats.getCount(PHASE_REDUCE) == 1 && phaseStats.getCount(PHASE_OUTPUT) == 1)
+            passed++; else failed++;
+    }
+    
+    {
+        SumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        phaseStats.enablePerf();
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        int nrows = 10;
+        int nthreads = 2;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        // worker threads' counts are added to map and reduce, if counters are available at all
+        const PerfCounts& mapPerf = phaseStats.getPerf(PHASE_MAP);
+        bool counted = !mapPerf.valid[PERF_INSTRUCTIONS] || mapPerf.values[PERF_INSTRUCTIONS] > 0;
+        
+        if (status == 0 && outStr == expected && counted) passed++; else failed++;
+    }
+    
+    {
+        SumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        phaseStats.enableMemory();
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        int nrows = 10;
+        int nthreads = 2;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        
+        // at least one multimap node per row, allocated by the map threads
+        bool counted = phaseStats.getAlloc(PHASE_MAP).allocations >= nrows;
+        
+        if (status == 0 && (counted || !isAllocHookEnabled())) passed++; else failed++;
+    }
+    
+    {
+        KeyedSumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        int nrows = 10;
+        int nthreads = 4;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        
+        // four map threads, but only two keys and so two reduce threads
+        const vector<WorkerStats>& mapWorkers = phaseStats.getWorkers(PHASE_MAP);
+        const vector<WorkerStats>& reduceWorkers = phaseStats.getWorkers(PHASE_REDUCE);
+        
+        long long mapRows = 0;
+        for (size_t k = 0; k < mapWorkers.size(); k++) {
+            mapRows += mapWorkers[k].rows;
+        }
+        
+        if (status == 0 && mapWorkers.size() == 4 && mapRows == nrows &&
+            reduceWorkers.size() == 2 && reduceWorkers[0].keys == 1 &&
+            reduceWorkers[0].values == 5 && reduceWorkers[1].rows == 1) passed++; else failed++;
+    }
+    
+    {
+        SumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        int nrows = 10;
+        int nthreads = 3;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        // more threads than keys, so values are split 3, 4, 3 and the middle thread has the
+        // last two EVEN and first two ODD values
+        const vector<WorkerStats>& reduceWorkers = phaseStats.getWorkers(PHASE_REDUCE);
+        
+        if (status == 0 && outStr == expected && reduceWorkers.size() == 3 &&
+            reduceWorkers[0].keys == 1 && reduceWorkers[0].values == 3 &&
+            reduceWorkers[1].keys == 2 && reduceWorkers[1].values == 4 &&
+            reduceWorkers[1].rows == 2) passed++; else failed++;
+    }
+    
+    {
+        // tree of merges over more threads than values
+        SumSquare sumSquare;
+        
+        int nrows = 5;
+        int nthreads = 8;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t20\nODD \t35\n";
+        
+        if (status == 0 && outStr == expected) passed++; else failed++;
+    }
+    
+    {
+        SumSquare sumSquare;
+        
+        PhaseStats phaseStats;
+        sumSquare.setPhaseStats(&phaseStats);
+        
+        traceEnable();
+        
+        int nrows = 10;
+        int nthreads = 2;
+        ostringstream oss;
+        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        
+        traceDisable();
+        
+        ostringstream traceOutput;
+        traceWrite(traceOutput);
+        string traceStr = traceOutput.str();
+        
+        // phases on this thread, ranges on worker threads
+        if (status == 0 && traceStr.find("\"name\": \"merge\"") != string::npos &&
+            traceStr.find("\"name\": \"mapRange\"") != string::npos &&
+            traceStr.find("\"args\": {\"values\": 5}") != string::npos &&
+            traceStr.find("\"name\": \"reduce worker\"") != string::npos) passed++; else failed++;
+    }
+    
+    {
+        // each map thread generates its own rows
+        const AffinityPolicy policies[] = {AFFINITY_COMPACT, AFFINITY_SCATTER, AFFINITY_NUMA};
+        
+        int good = 0;
+        for (int p = 0; p < 3; p++) {
+            SumSquare sumSquare;
+            sumSquare.setAffinity(policies[p]);
+            
+            PhaseStats phaseStats;
+            sumSquare.setPhaseStats(&phaseStats);
+            
+            int nrows = 10;
+            int nthreads = 3;
+            ostringstream oss;
+            int status = sumSquare.multiThread(nrows, nthreads, oss);
+            string outStr = oss.str();
+            const string expected = "EVEN\t220\nODD \t165\n";
+            
+            const vector<WorkerStats>& mapWorkers = phaseStats.getWorkers(PHASE_MAP);
+            
+            if (status == 0 && outStr == expected && mapWorkers.size() == 3 &&
+                mapWorkers[0].rows == 3 && mapWorkers[1].rows == 4 && mapWorkers[2].rows == 3) {
+                good++;
+            }
+        }
+        
+        if (good == 3) passed++; else failed++;
+    }
+    
+    {
+        // more chunks than threads, with and without first touch
+        int good = 0;
+        for (int p = 0; p < 2; p++) {
+            SumSquare sumSquare;
+            sumSquare.setChunkRows(3);
+            sumSquare.setAffinity(p == 0 ? AFFINITY_NONE : AFFINITY_COMPACT);
+            
+            PhaseStats phaseStats;
+            sumSquare.setPhaseStats(&phaseStats);
+            
+            int nrows = 10;
+            int nthreads = 2;
+            ostringstream oss;
+            int status = sumSquare.multiThread(nrows, nthreads, oss);
+            string outStr = oss.str();
+            const string expected = "EVEN\t220\nODD \t165\n";
+            
+            const vector<WorkerStats>& mapWorkers = phaseStats.getWorkers(PHASE_MAP);
+            
+            if (status == 0 && outStr == expected && mapWorkers.size() == 2 &&
+                mapWorkers[0].rows + mapWorkers[1].rows == nrows) {
+                good++;
+            }
+        }
+        
+        if (good == 2) passed++; else failed++;
+    
+    {
+        // a start written by hand is called, and its rows copied on each pinned thread
+        int good = 0;
+        for (int p = 0; p < 2; p++) {
+            StartSumSquare startSumSquare;
+            startSumSquare.setAffinity(p == 0 ? AFFINITY_NONE : AFFINITY_COMPACT);
+            
+            int nrows = 10;
+            int nthreads = 3;
+            ostringstream oss;
+            int status = startSumSquare.multiThread(nrows, nthreads, oss);
+            string outStr = oss.str();
+            const string expected = "ALL\t385\n";
+            
+            if (status == 0 && outStr == expected) {
+                good++;
+            }
+        }
+        
+        if (good == 2) passed++; else failed++;
+    }
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Calc::multiThreadAuto
+    
+    {
+        SumSquare sumSquare;
+        
+        ostringstream stats;
+        sumSquare.setStats(&stats);
+        
+        int nrows = 10;
+        ostringstream oss;
+        int status = sumSquare.multiThreadAuto(nrows, oss);
+        string outStr = oss.str();
+        const string expected = "EVEN\t220\nODD \t165\n";
+        
+        if (status == 0 && outStr == expected && sumSquare.getChunkRows() == 0 &&
+            stats.str().find("threads.auto.threads\t") != string::npos) passed++; else failed++;
+    }
+#endif
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::mapWorker
+    // SumSquare::reduceAggregate
+    
+    {
+        MaxSquare maxSquare;
+        MeanSquare meanSquare;
+        
+        int nrows = 10;
+        ostringstream maxDirect;
+        ostringstream meanDirect;
+        int status = maxSquare.singleThreadDirect(nrows, maxDirect);
+        status |= meanSquare.singleThreadDirect(nrows, meanDirect);
+        
+        // both split within a key over threads, mean by merging count and mean of each part
+        bool threaded = true;
+#if USE_THREADS
+        int nthreads = 4;
+        ostringstream maxThreads;
+        ostringstream meanThreads;
+        status |= maxSquare.multiThread(nrows, nthreads, maxThreads);
+        status |= meanSquare.multiThread(nrows, nthreads, meanThreads);
+        
+        threaded = maxThreads.str() == maxDirect.str() && meanThreads.str() == meanDirect.str();
+#endif
+        
+        if (status == 0 && maxDirect.str() == "EVEN\t100\nODD \t81\n" &&
+            meanDirect.str() == "EVEN\t44\nODD \t33\n" && threaded) passed++; else failed++;
+    }
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::reduceWorker
+    // SumSquare::reduceSketchOptions
+    
+    {
+        // 500 distinct squares per key; the median of the even squares is 251001 (501 squared)
+        DistinctSquare distinctSquare;
+        MedianSquare medianSquare;
+        
+        int nrows = 1000;
+        ostringstream distinctDirect;
+        ostringstream medianDirect;
+        int status = distinctSquare.singleThreadDirect(nrows, distinctDirect);
+        status |= medianSquare.singleThreadDirect(nrows, medianDirect);
+        
+        string key;
+        unsigned long distinctEven = 0;
+        unsigned long medianEven = 0;
+        istringstream distinctIss(distinctDirect.str());
+        istringstream medianIss(medianDirect.str());
+        bool valid = readKeyValue(distinctIss, key, distinctEven) && key == "EVEN" &&
+                     readKeyValue(medianIss, key, medianEven) && key == "EVEN";
+        
+        // keys split over reduce threads, their sketches merged: registers exactly, centroids
+        // within the same error
+        bool threaded = true;
+#if USE_THREADS
+        ostringstream distinctThreads;
+        ostringstream medianThreads;
+        status |= distinctSquare.multiThread(nrows, 4, distinctThreads);
+        status |= medianSquare.multiThread(nrows, 4, medianThreads);
+        
+        unsigned long medianThreadsEven = 0;
+        istringstream medianThreadsIss(medianThreads.str());
+        threaded = distinctThreads.str() == distinctDirect.str() &&
+                   readKeyValue(medianThreadsIss, key, medianThreadsEven) && key == "EVEN" &&
+                   medianThreadsEven >= 241081 && medianThreadsEven <= 261121;
+#endif
+        
+        if (status == 0 && valid && distinctEven >= 495 && distinctEven <= 505 &&
+            medianEven >= 241081 && medianEven <= 261121 && threaded) passed++; else failed++;
+    }
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::singleThreadDirect
-
+    // SumSquare::start
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::mapRange
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // Calc::singleThreadWorkers
+    
     {
         SumSquare sumSquare;
         
         int nrows = 10;
         ostringstream oss;
-        int status = sumSquare.singleThreadDirect(nrows, oss);
+        int status = sumSquare.singleThreadWorkers(nrows, oss);
         string outStr = oss.str();
         const string expected = "EVEN\t220\nODD \t165\n";
         
@@ -443,42 +3124,554 @@ void ctest_sumSquare(int& totalPassed, int& totalFailed, bool useHadoop, bool ve
     }
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::multiThread
+    // SumSquare::fusedDirect
+    // SumSquare::startRow
+    // SumSquare::mapValue
+    
+    {
+        // the same results as with the rows kept between steps
+        SumSquare sumSquare;
+        KeyedSumSquare keyedSumSquare;
+        ModThreeSumSquare fused(true);
+        ModThreeSumSquare unfused(false);
+        
+        ostringstream fusedOut;
+        int status = sumSquare.singleThreadDirect(1000, fusedOut);
+        
+        ostringstream unfusedOut;
+        status += keyedSumSquare.singleThreadDirect(1000, unfusedOut);
+        
+        ostringstream fusedThree;
+        status += fused.singleThreadDirect(10, fusedThree);
+        
+        ostringstream unfusedThree;
+        status += unfused.singleThreadDirect(10, unfusedThree);
+        
+        // a derived class's mapOne isn't bypassed unless it opts in
+        CountingSumSquare counting;
+        ostringstream countingOut;
+        status += counting.singleThreadDirect(10, countingOut);
+        
+        if (status == 0 && fusedOut.str() == unfusedOut.str() &&
+            fusedThree.str() == "0\t126\n1\t166\n2\t93\n" &&
+            unfusedThree.str() == fusedThree.str() && counting.mapCalls == 10) passed++;
+        else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::columnarDirect
+    // SumSquare::mapColumns
+    
+    {
+        // the same results as with the rows kept as pairs and multimaps
+        ColumnarMeanSquare columnar;
+        MeanSquare rows;
+        
+        ostringstream columnarOut;
+        int status = columnar.singleThreadDirect(1000, columnarOut);
+        
+        ostringstream rowsOut;
+        status += rows.singleThreadDirect(1000, rowsOut);
+        
+        ostringstream empty;
+        status += columnar.singleThreadDirect(0, empty);
+        
+        if (status == 0 && columnarOut.str() == rowsOut.str() &&
+            columnarOut.str() == "EVEN\t334334\nODD \t333333\n" && empty.str().empty()) passed++;
+        else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::mapBatch
+    // SumSquare::reduceBatch
+    
+    {
+        // the same results as one row and one key at a time
+        SumSquare sumSquare;
+        BatchSumSquare batchSumSquare;
+        
+        ostringstream expected;
+        int status = sumSquare.singleThreadDirect(1000, expected);
+        
+        ostringstream direct;
+        status += batchSumSquare.singleThreadDirect(1000, direct);
+        
+        // rows in batches of at most 256, both keys in one batch
+        bool batched = batchSumSquare.mapRows == 1000 && batchSumSquare.mapBatches == 4 &&
+                       batchSumSquare.reduceBatches == 1;
+        
+#if USE_THREADS
+        ostringstream threaded;
+        status += batchSumSquare.multiThread(1000, 4, threaded);
+        bool threadedValid = threaded.str() == expected.str();
+#else
+        bool threadedValid = true;
+#endif
+        
+        if (status == 0 && direct.str() == expected.str() && batched && threadedValid) passed++;
+        else failed++;
+    }
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::mapRangeCached
+    
+    {
+        const string expected = "EVEN\t220\nODD \t165\n";
+        const string dir = makeTempDir("mapRangeCached");
+        MapCache mapCache(dir, 1 << 20, 4);
+        
+        // chunks of rows 1-4, 5-8 and 9-10 are mapped and stored, then found
+        CountingSumSquare sumSquare;
+        sumSquare.setMapCache(&mapCache);
+        
+        ostringstream first;
+        int status = sumSquare.singleThreadDirect(10, first);
+        int firstCalls = sumSquare.mapCalls;
+        
+        ostringstream second;
+        status += sumSquare.singleThreadDirect(10, second);
+        int secondCalls = sumSquare.mapCalls - firstCalls;
+        
 #if USE_THREADS
+        // the same chunks whatever the threads
+        ostringstream threaded;
+        status += sumSquare.multiThread(10, 3, threaded);
+        bool threadedValid = threaded.str() == expected && sumSquare.mapCalls == firstCalls;
+#else
+        bool threadedValid = true;
+#endif
+        
+        // a new map version doesn't use the old entries; one more row only maps the new chunk
+        CountingSumSquare newVersion(2);
+        newVersion.setMapCache(&mapCache);
+        
+        ostringstream third;
+        status += newVersion.singleThreadDirect(10, third);
+        int versionCalls = newVersion.mapCalls;
+        
+        ostringstream fourth;
+        status += newVersion.singleThreadDirect(11, fourth);
+        
+        mapCache.clear();
+        removeDirFiles(dir);
+        
+        if (status == 0 && first.str() == expected && second.str() == expected &&
+            third.str() == expected && fourth.str() == "EVEN\t220\nODD \t286\n" &&
+            firstCalls == 10 && secondCalls == 0 && threadedValid && versionCalls == 10 &&
+            newVersion.mapCalls == 13) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::mapRange
+    // SumSquare::mapBegin
+    // SumSquare::mapEnd
+    
     {
+        // ten rows of 20 msec in flight at once take about 20 msec, not 200
         SumSquare sumSquare;
+        sumSquare.setDelay(20);
+        sumSquare.setMapInFlight(10);
         
-        int nrows = 10;
-        int nthreads = 2;
+        long long startTime = nanosecondClock();
         ostringstream oss;
-        int status = sumSquare.multiThread(nrows, nthreads, oss);
+        int status = sumSquare.singleThreadDirect(10, oss);
+        long long elapsed = nanosecondClock() - startTime;
+        
+#if USE_THREADS
+        ostringstream threaded;
+        status += sumSquare.multiThread(10, 2, threaded);
+        bool threadedValid = threaded.str() == oss.str();
+#else
+        bool threadedValid = true;
+#endif
+        
+        // a derived class that counts its mapOne calls can't have them bypassed
+        bool rejected = false;
+        try {
+            CountingSumSquare counting;
+            counting.setMapInFlight(10);
+            
+        } catch (const logic_error& x) {
+            rejected = true;
+        }
+        
+        if (status == 0 && oss.str() == "EVEN\t220\nODD \t165\n" && threadedValid && rejected &&
+            elapsed >= 20000000LL && elapsed < 150000000LL) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::workerMapChunks
+    // SumSquare::workerReduceRange
+    
+#if USE_THREADS
+    {
+        // an earlier run of the same job saved rows 1-4 before it died
+        const string dir = makeTempDir("checkpointTest");
+        {
+            Checkpoint earlier(dir, false, 4);
+            earlier.begin("mapCacheTest", "calc\tmapCacheTest\nmapVersion\t1\nrows\t10\n"
+                                          "chunkRows\t4\naggregate\tsum\n");
+            earlier.save("map.0", "EVEN\t4 16\nODD \t1 9\n");
+        }
+        
+        Checkpoint checkpoint(dir, true, 4);
+        CountingSumSquare sumSquare;
+        sumSquare.setCheckpoint(&checkpoint);
+        
+        ostringstream oss;
+        int status = sumSquare.multiThread(10, 2, oss);
         string outStr = oss.str();
         const string expected = "EVEN\t220\nODD \t165\n";
         
-        if (status == 0 && outStr == expected) passed++; else failed++;
+        // two map chunks and two reduce threads saved, then removed as the job finished
+        ostringstream statsOss;
+        checkpoint.writeStats(statsOss, "checkpoint");
+        
+        bool removed = !ifstream((dir + "/mapCacheTest.checkpoint").c_str()).is_open();
+        removeDirFiles(dir);
+        
+        if (status == 0 && outStr == expected && sumSquare.mapCalls == 6 &&
+            statsOss.str().find("checkpoint.loadedParts\t1\ncheckpoint.savedParts\t4\n") == 0 &&
+            removed) passed++; else failed++;
     }
 #endif
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::start
+    // SumSquare::formatRange
+    // SumSquare::workerFormatRange
+    
+#if USE_THREADS
+    {
+        // ranges of keys from two threads, and parts of one merged result from eight, some empty
+        ModThreeSumSquare sumSquare(false);
+        
+        ostringstream byKeys;
+        int status = sumSquare.multiThread(10, 2, byKeys);
+        
+        ostringstream byParts;
+        status += sumSquare.multiThread(10, 8, byParts);
+        
+        const string expected = "0\t126\n1\t166\n2\t93\n";
+        
+        if (status == 0 && byKeys.str() == expected && byParts.str() == expected) passed++;
+        else failed++;
+    }
+#endif
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // SumSquare::mapRange
+    // SumSquare::queuedMultiThread
+    // SumSquare::workerMapToQueues
+    // SumSquare::workerReduceFromQueues
+    
+#if USE_THREADS
+    {
+        // the rows of each key spread over all the reduce threads, more threads than keys
+        ModThreeSumSquare sumSquare(false);
+        sumSquare.setShuffleQueues(true);
+        
+        ostringstream two;
+        int status = sumSquare.multiThread(10, 2, two);
+        
+        ostringstream statsOss;
+        sumSquare.setStats(&statsOss);
+        
+        ostringstream eight;
+        status += sumSquare.multiThread(10, 8, eight);
+        
+        const string expected = "0\t126\n1\t166\n2\t93\n";
+        
+        if (status == 0 && two.str() == expected && eight.str() == expected &&
+            statsOss.str().find("queues.reduceThreads\t8\n") != string::npos) passed++;
+        else failed++;
+    }
+    
+    {
+        // a start written by hand is left to multiThread, without queues
+        StartSumSquare startSumSquare;
+        startSumSquare.setShuffleQueues(true);
+        
+        ostringstream statsOss;
+        startSumSquare.setStats(&statsOss);
+        
+        ostringstream oss;
+        int status = startSumSquare.multiThread(10, 3, oss);
+        
+        if (status == 0 && oss.str() == "ALL\t385\n" &&
+            statsOss.str().find("queues.") == string::npos) passed++; else failed++;
+    }
+    
+    {
+        // more rows than the queues hold, with a reduce that needs all of a key's values, mapped in
+        // more chunks than threads; a reduce thread for each of the two ranges of keys
+        KeyedSumSquare queued;
+        queued.setShuffleQueues(true);
+        queued.setChunkRows(1000);
+        
+        ostringstream statsOss;
+        queued.setStats(&statsOss);
+        
+        PhaseStats phaseStats;
+        queued.setPhaseStats(&phaseStats);
+        
+        ostringstream queuedOut;
+        int status = queued.multiThread(100000, 3, queuedOut);
+        
+        SumSquare direct;
+        ostringstream directOut;
+        status += direct.singleThreadDirect(100000, directOut);
+        
+        if (status == 0 && queuedOut.str() == directOut.str() &&
+            statsOss.str().find("queues.mapThreads\t3\nqueues.reduceThreads\t2\n") == 0 &&
+            phaseStats.getCount(PHASE_MAP) == 1 && phaseStats.getCount(PHASE_REDUCE) == 1)
+            passed++; else failed++;
+    }
+    
+    {
+        // a mean, folded into partial results as the rows arrive
+        MeanSquare queued;
+        queued.setShuffleQueues(true);
+        
+        ostringstream queuedOut;
+        int status = queued.multiThread(100000, 3, queuedOut);
+        
+        MeanSquare direct;
+        ostringstream directOut;
+        status += direct.singleThreadDirect(100000, directOut);
+        
+        if (status == 0 && queuedOut.str() == directOut.str()) passed++; else failed++;
+    }
+#endif
     
     // ~~~~~~~~~~~~~~~~~~~~~~
-    // Calc::singleThreadWorkers
+    // SumSquare::workerReduceFromQueues
+    // SumSquare::writeSpill
+    // SumSquare::reduceSpills
+    
+#if USE_THREADS
+    {
+        // far more mapped rows than the limit, folded into partial results as they arrive
+        SumSquare limited;
+        limited.setMemoryLimit(64 * 1024);
+        
+        ostringstream statsOss;
+        limited.setStats(&statsOss);
+        
+        ostringstream limitedOut;
+        int status = limited.multiThread(100000, 2, limitedOut);
+        
+        SumSquare direct;
+        ostringstream directOut;
+        status += direct.singleThreadDirect(100000, directOut);
+        
+        const string statsStr = statsOss.str();
+        
+        if (status == 0 && limitedOut.str() == directOut.str() &&
+            statsStr.find("memory.limitBytes\t65536\n") != string::npos &&
+            statsStr.find("memory.spills\t0\n") != string::npos) passed++; else failed++;
+    }
+    
+    {
+        // sketches too; the median of the even squares is 2500000000 (50000
+        // squared), and within 1% of its rank is 49000 to 51000 squared
+        MedianSquare limited;
+        limited.setMemoryLimit(64 * 1024);
+        
+        ostringstream statsOss;
+        limited.setStats(&statsOss);
+        
+        ostringstream limitedOut;
+        int status = limited.multiThread(100000, 2, limitedOut);
+        
+        string key;
+        double medianEven = 0;
+        istringstream limitedIss(limitedOut.str());
+        bool valid = readKeyValue(limitedIss, key, medianEven) && key == "EVEN";
+        
+        const string statsStr = statsOss.str();
+        
+        if (status == 0 && valid && medianEven >= 2401000000.0 && medianEven <= 2601000000.0 &&
+            statsStr.find("memory.spills\t0\n") != string::npos) passed++; else failed++;
+    }
+    
+    {
+        // spilled instead, when a key's values can't be reduced in parts, to a directory of the
+        // run's own; the runs and their directory are removed
+        const string dir = makeTempDir("spillTest");
+        
+        KeyedSumSquare limited;
+        limited.setMemoryLimit(64 * 1024);
+        limited.setSpillDirectory(dir);
+        
+        ostringstream statsOss;
+        limited.setStats(&statsOss);
+        
+        ostringstream limitedOut;
+        int status = limited.multiThread(20000, 2, limitedOut);
+        
+        SumSquare direct;
+        ostringstream directOut;
+        status += direct.singleThreadDirect(20000, directOut);
+        
+        // more runs than are merged at once, so merged in groups first
+        ostringstream manyStatsOss;
+        limited.setStats(&manyStatsOss);
+        limited.setMemoryLimit(16 * 1024);
+        
+        ostringstream manyOut;
+        status += limited.multiThread(20000, 1, manyOut);
+        
+        string manyStats = manyStatsOss.str();
+        size_t spillsAt = manyStats.find("memory.spills\t");
+        long long spills = spillsAt == string::npos ? 0 : atoll(manyStats.c_str() + spillsAt + 14);
+        
+        bool removed = true;
+        try {
+            removeDir(dir);
+            
+        } catch (runtime_error&) {
+            removed = false;
+            removeDirFiles(dir);
+        }
+        
+        if (status == 0 && limitedOut.str() == directOut.str() &&
+            statsOss.str().find("memory.spills\t0\n") == string::npos &&
+            manyOut.str() == directOut.str() && spills > 64 && removed) passed++; else failed++;
+    }
+    
+    {
+        // a reduce that fails after spilling is reported on the calling thread, and its runs
+        // removed
+        const string dir = makeTempDir("spillTest");
+        
+        FailingKeyedSumSquare limited;
+        limited.setMemoryLimit(64 * 1024);
+        limited.setSpillDirectory(dir);
+        
+        bool thrown = false;
+        try {
+            ostringstream limitedOut;
+            limited.multiThread(20000, 2, limitedOut);
+            
+        } catch (const runtime_error& x) {
+            thrown = string(x.what()).find("reduce failed") != string::npos;
+        }
+        
+        bool removed = true;
+        try {
+            removeDir(dir);
+            
+        } catch (runtime_error&) {
+            removed = false;
+            removeDirFiles(dir);
+        }
+        
+        if (thrown && removed) passed++; else failed++;
+    }
+#endif
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // SumSquare::incrementalDirect
     
     {
         SumSquare sumSquare;
+        const string dir = makeTempDir("incrementalTest");
+        
+        // rows 1..6, then only rows 7..10
+        ostringstream first;
+        int status = sumSquare.incrementalDirect(6, dir, first);
         
-        int nrows = 10;
         ostringstream oss;
-        int status = sumSquare.singleThreadWorkers(nrows, oss);
+        ostringstream statsOss;
+        sumSquare.setStats(&statsOss);
+        status += sumSquare.incrementalDirect(10, dir, oss);
+        sumSquare.setStats(NULL);
         string outStr = oss.str();
         const string expected = "EVEN\t220\nODD \t165\n";
         
-        if (status == 0 && outStr == expected) passed++; else failed++;
+        // fewer rows than saved are calculated from scratch
+        ostringstream fewer;
+        status += sumSquare.incrementalDirect(4, dir, fewer);
+        
+        // as are results saved for a different aggregate
+        MaxSquare maxSquare;
+        ostringstream maxOss;
+        status += maxSquare.incrementalDirect(10, dir, maxOss);
+        
+        // a mean is extended from its saved count and mean, not calculated again
+        MeanSquare meanSquare;
+        ostringstream meanFirst;
+        status += meanSquare.incrementalDirect(6, dir, meanFirst);
+        
+        ostringstream meanOss;
+        ostringstream meanStatsOss;
+        meanSquare.setStats(&meanStatsOss);
+        status += meanSquare.incrementalDirect(10, dir, meanOss);
+        
+        // only the results file is left behind
+        ifstream partials((dir + "/sumSquare.partials").c_str());
+        bool saved = partials.is_open();
+        partials.close();
+        remove((dir + "/sumSquare.partials").c_str());
+        
+        bool removed = true;
+        try {
+            removeDir(dir);
+            
+        } catch (runtime_error&) {
+            removed = false;
+            removeDirFiles(dir);
+        }
+        
+        if (status == 0 && first.str() == "EVEN\t56\nODD \t35\n" && outStr == expected &&
+            statsOss.str().find("incremental.savedRows\t6\n") != string::npos &&
+            statsOss.str().find("incremental.newRows\t4\n") != string::npos &&
+            fewer.str() == "EVEN\t20\nODD \t10\n" &&
+            maxOss.str() == "EVEN\t100\nODD \t81\n" &&
+            meanFirst.str() == "EVEN\t18\nODD \t11\n" &&
+            meanOss.str() == "EVEN\t44\nODD \t33\n" &&
+            meanStatsOss.str().find("incremental.savedRows\t6\n") != string::npos &&
+            saved && removed) passed++; else failed++;
+    }
+    
+    {
+        const string dir = makeTempDir("incrementalTest");
+        
+        // results saved by an earlier map version are calculated again
+        CountingSumSquare counting(1);
+        ostringstream first;
+        int status = counting.incrementalDirect(6, dir, first);
+        
+        CountingSumSquare countingNew(2);
+        ostringstream oss;
+        ostringstream statsOss;
+        countingNew.setStats(&statsOss);
+        status += countingNew.incrementalDirect(10, dir, oss);
+        remove((dir + "/mapCacheTest.partials").c_str());
+        
+        // a start written by hand can't be generated from a row on, so it is all calculated
+        StartSumSquare startSumSquare;
+        ostringstream startFirst;
+        status += startSumSquare.incrementalDirect(6, dir, startFirst);
+        
+        ostringstream startOss;
+        ostringstream startStatsOss;
+        startSumSquare.setStats(&startStatsOss);
+        status += startSumSquare.incrementalDirect(10, dir, startOss);
+        
+        bool removed = true;
+        try {
+            removeDir(dir);
+            
+        } catch (runtime_error&) {
+            removed = false;
+            removeDirFiles(dir);
+        }
+        
+        if (status == 0 && oss.str() == "EVEN\t220\nODD \t165\n" && countingNew.mapCalls == 10 &&
+            statsOss.str().find("incremental.savedRows\t0\n") != string::npos &&
+            startFirst.str() == "ALL\t91\n" && startOss.str() == "ALL\t385\n" &&
+            startStatsOss.str().find("incremental.") == string::npos &&
+            removed) passed++; else failed++;
     }
     
     // ~~~~~~~~~~~~~~~~~~~~~~
@@ -511,6 +3704,26 @@ void ctest_sumSquare(int& totalPassed, int& totalFailed, bool useHadoop, bool ve
         if (status == 0 && outStr == expected) passed++; else failed++;
     }
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // parseHadoopCounters
+    
+    {
+        const string log =
+            "13/07/20 10:00:00 INFO mapred.JobClient: Counters: 3\n"
+            "13/07/20 10:00:00 INFO mapred.JobClient:   parallelCalc\n"
+            "13/07/20 10:00:00 INFO mapred.JobClient:     mapRowsRead=10\n"
+            "13/07/20 10:00:00 INFO mapred.JobClient:     reduceKeys=2\n"
+            "13/07/20 10:00:00 INFO mapred.JobClient:   Job Counters \n"
+            "13/07/20 10:00:00 INFO mapred.JobClient:     Launched map tasks=2\n";
+        
+        vector< pair<string, long long> > counters;
+        parseHadoopCounters(log, "parallelCalc", counters);
+        
+        if (counters.size() == 2 &&
+            counters[0].first == "mapRowsRead" && counters[0].second == 10 &&
+            counters[1].first == "reduceKeys" && counters[1].second == 2) passed++; else failed++;
+    }
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     
     if (verbose) {
@@ -565,6 +3778,16 @@ void cover_sumSquare(bool useHadoop, bool verbose)
         ostringstream oss;
         sumSquare.multiThread(nrows, nthreads, oss);
     }
+    
+    {
+        SumSquare sumSquare;
+        
+        int nrows = 4;
+        int nthreads = 5;
+        sumSquare.setAffinity(AFFINITY_SCATTER);
+        ostringstream oss;
+        sumSquare.multiThread(nrows, nthreads, oss);
+    }
 #endif
 
     // ~~~~~~~~~~~~~~~~~~~~~~
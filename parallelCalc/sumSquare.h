@@ -24,10 +24,19 @@
 #include <vector>
 
 #if USE_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 #endif
 
+#include "aggregators.h"
 #include "calc.h"
+#include "columnBatch.h"
+#include "memBudget.h"
+#include "ringQueues.h"
+#include "windowedAggregates.h"
 
 // ========== Class Declarations ===================================================================
 
@@ -38,6 +47,10 @@ public:
     // name of calculation, in a form usable as a directory name
     virtual std::string name() { return "sumSquare"; };
     
+    // rows each map thread keeps in flight between mapBegin and mapEnd; throws logic_error if
+    // isMapInFlight is false, since mapRange would bypass an overridden mapOne or mapBatch
+    virtual void setMapInFlight(int mapInFlight);
+    
     // write key/value data usable as input to map operation
     virtual int startWorker(int nrows, std::ostream& output);
     
@@ -47,31 +60,94 @@ public:
     // read key/value mapped data, write reduced data
     virtual int reduceWorker(std::istream& input, std::ostream& output);
     
+    // read key/value starting data until the end of input, which may never come, and write
+    // reduced data for each window of rows as it ends, headed by a line window-tab-index; with
+    // stats, the latency of each window; for use only if reduceAggregate is a standard aggregate
+    virtual int streamWorker(std::istream& input, std::ostream& output,
+                             const StreamWindow& window);
+    
     // handle start | map | reduce calculations directly, without writing to and
     // reading from intermediate text strings
     virtual int singleThreadDirect(int nrows, std::ostream& output);
     
     // split map and reduce calculations over multiple threads
     virtual int multiThread(int nrows, int nthreads, std::ostream& output);
+    
+    // singleThreadDirect over only the rows not covered by partial results saved in directory by
+    // an earlier run, merged with those results, which are then replaced; if isAssociativeReduce
+    // and isStartRange, so that the new rows can be generated alone
+    virtual int incrementalDirect(int nrows, const std::string& directory, std::ostream& output);
 
 protected:
     typedef unsigned long StartValue;   // value type of starting data
     typedef unsigned long MappedValue;  // value type of mapped data
     typedef unsigned long ReducedValue; // value type of reduced data
     
+    // all the values of one key, as a range of mapped data
+    typedef std::pair<  std::multimap<std::string, MappedValue>::const_iterator,
+                        std::multimap<std::string, MappedValue>::const_iterator> KeyGroup;
+    
+    // partial result of some of a key's values: the state of an Aggregator of reduceAggregate, so
+    // that partial results of any standard aggregate, sketches included, can be merged; or, for a
+    // reduce written by hand, its result so far, merged by combine
+    struct Partial {
+        Aggregator<MappedValue> state;
+        ReducedValue value;
+        
+        Partial(AggregateKind kind, const SketchOptions& sketch) : state(kind, sketch), value() {};
+    };
+    
+    typedef std::map<std::string, Partial> PartialPairs;
+    
     // write starting data as vector of key-value pairs
     virtual void start(int nrows, std::vector< std::pair<std::string, StartValue> >& startPairs);
     
-    // read a range starting data from vector of key-value pairs, append mapped data to a multimap
+    // append rows beginRow <= row < endRow of the starting data (numbered from 1) to a vector of
+    // key-value pairs, so that a worker thread can generate its own share
+    virtual void startRange(int beginRow, int endRow,
+                            std::vector< std::pair<std::string, StartValue> >& startPairs);
+    
+    // set key and value to row (numbered from 1) of the starting data; startRange and fusedDirect
+    // generate rows with it
+    virtual void startRow(int row, std::string& key, StartValue& value);
+    
+    // read a range starting data from vector of key-value pairs, append mapped data to a multimap;
+    // in batches by mapBatch, or with mapInFlight, up to that many rows at a time between mapBegin
+    // and mapEnd, finished in the order they are ready, which can change the order of a key's
+    // values
     virtual void mapRange(
         const std::vector< std::pair<std::string, StartValue> >::const_iterator& beginStartValues,
         const std::vector< std::pair<std::string, StartValue> >::const_iterator& endStartValues,
         std::multimap<std::string, MappedValue>& mappedValues);
     
-    // map a single key-value pair, append mapped data to a multimap
+    // mapRange, looking the range up in mapCache first if there is one, and storing the mapped
+    // data there if it wasn't found; the range should be one of the cache's chunks of rows
+    void mapRangeCached(
+        const std::vector< std::pair<std::string, StartValue> >::const_iterator& beginStartValues,
+        const std::vector< std::pair<std::string, StartValue> >::const_iterator& endStartValues,
+        std::multimap<std::string, MappedValue>& mappedValues);
+    
+    // map rows[0..n) of starting data, append mapped data to a multimap; by default mapOne for each
+    // row. Override to map a whole batch in one loop, without a virtual call per row.
+    virtual void mapBatch(const std::pair<std::string, StartValue> *rows, size_t n,
+                          std::multimap<std::string, MappedValue>& mappedValues);
+    
+    // map a single key-value pair, append mapped data to a multimap; by default mapBegin, then a
+    // wait until it is ready, then mapEnd
     virtual void mapOne(const std::string& keyIn, StartValue valueIn,
                      std::multimap<std::string, MappedValue>& mappedValues);
     
+    // start mapping a key-value pair whose map waits on latency-bound work (by default the delay),
+    // returning the nanosecondClock time at which mapEnd can finish it
+    virtual long long mapBegin(const std::string& keyIn, StartValue valueIn);
+    
+    // finish mapping a key-value pair started by mapBegin, append mapped data to a multimap
+    virtual void mapEnd(const std::string& keyIn, StartValue valueIn,
+                        std::multimap<std::string, MappedValue>& mappedValues);
+    
+    // value a key-value pair maps to, under the same key; mapEnd and fusedDirect map with it
+    virtual MappedValue mapValue(const std::string& keyIn, StartValue valueIn);
+    
     // read a range of mapped data from a multimap, append reduced data to a multimap; the range of
     // mapped data must include ALL values for a key if ANY values for that key are included
     virtual void reduceRange(
@@ -79,15 +155,266 @@ protected:
         const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
         const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
         std::multimap<std::string, ReducedValue>& reducedPairs);
+    
+    // reduce groups of mapped values, each all the values of one key, append reduced data to a
+    // multimap; by default reduce for each group. Override to reduce a whole batch in one loop.
+    virtual void reduceBatch(const std::vector<KeyGroup>& groups,
+                             std::multimap<std::string, ReducedValue>& reducedPairs);
 
-    // reduce values for a particular key; the range of mapped values must include all the values
-    // for the specified key
+    // standard aggregate computed by reduce; override to use another, or override reduce itself
+    // and return AGGREGATE_NONE
+    virtual AggregateKind reduceAggregate();
+    
+    // error bound of the sketch kept for each key, and the quantile, if reduceAggregate is
+    // distinct or quantile; by default 1% and the median
+    virtual SketchOptions reduceSketchOptions();
+    
+    // reduce values for a particular key with reduceAggregate; the range of mapped values must
+    // include all the values for the specified key
     virtual void reduce(
         const std::string& keyMapped,
         std::multimap<std::string, MappedValue>::const_iterator& beginMappedValues,
         std::multimap<std::string, MappedValue>::const_iterator& endMappedValues,
         std::vector<ReducedValue>& reducedValues);
 
+    // reduce a range of mapped data, which may begin or end part way through a key's values, into
+    // the partial result of each key in partialPairs, one value at a time for a standard
+    // aggregate; for use only if isAssociativeReduce
+    void reducePartialRange(
+        const std::multimap<std::string, MappedValue>& mappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+        PartialPairs& partialPairs);
+
+    // reduceBatch over the keys of a range of mapped data, in batches; a key's values are clipped
+    // to the range
+    void reduceKeyGroups(
+        const std::multimap<std::string, MappedValue>& mappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+        std::multimap<std::string, ReducedValue>& reducedPairs);
+    
+    // merge partial results from reducePartialRange into others, merging the states (or
+    // combining the values) of keys that are in both
+    void mergePartials(PartialPairs& partialPairs, const PartialPairs& otherPairs);
+    
+    // append the reduced data that partial results stand for to a multimap
+    void partialResults(const PartialPairs& partialPairs,
+                        std::multimap<std::string, ReducedValue>& reducedPairs);
+    
+    // write partial results as lines of key, tab, then the state (or value); read returns false if
+    // a line is malformed
+    void writePartialPairs(std::ostream& output, const PartialPairs& partialPairs);
+    bool readPartialPairs(std::istream& input, PartialPairs& partialPairs);
+    
+    // format a range of reduced data as writeKeyValue would write it, into buffer
+    void formatRange(
+        const std::multimap<std::string, ReducedValue>::const_iterator& beginReducedPairs,
+        const std::multimap<std::string, ReducedValue>::const_iterator& endReducedPairs,
+        std::string& buffer);
+
+    // override to return false if reduce does not give one value per key, or if reducing parts
+    // of a key's values and combining the results could differ from reducing them all at once;
+    // if true, multiThread may split a key's values over threads. True if reduceAggregate is a
+    // standard aggregate, whose partial states are merged; a reduce written by hand that
+    // overrides this to return true also overrides combine.
+    virtual bool isAssociativeReduce();
+
+    // override to return true if the steps are still startRow, mapValue or mapColumns, and
+    // reduceAggregate, a standard aggregate; if true, singleThreadDirect (only) may use
+    // columnarDirect. True for SumSquare itself, false for a class derived from it unless it
+    // overrides this.
+    virtual bool isColumnar();
+
+    // override to return true if the steps are still startRow, mapValue and reduceAggregate, and it
+    // is combinable; if true, singleThreadDirect may use fusedDirect. True for SumSquare itself,
+    // false for a class derived from it unless it overrides this.
+    virtual bool isFusedDirect();
+
+    // override to return true if mapBatch still maps each row by mapOne, and mapOne is still
+    // mapBegin, a wait, then mapEnd; if true, mapRange may keep rows between mapBegin and mapEnd.
+    // True for SumSquare itself, false for a class derived from it unless it overrides this.
+    virtual bool isMapInFlight();
+
+    // override to return true if start still generates its rows by startRange; if true, worker
+    // threads may call startRange for their own share of the rows instead of start for them all.
+    // True for SumSquare itself, false for a class derived from it unless it overrides this.
+    virtual bool isStartRange();
+
+    // map the rows of starting data into mapped rows with the same keys; by default mapValue for
+    // each row. Override with a loop over the value arrays, for a map that doesn't depend on the
+    // key, so that compilers can vectorize it.
+    virtual void mapColumns(const ColumnBatch<StartValue>& startColumns,
+                            ColumnBatch<MappedValue>& mappedColumns);
+
+#if USE_THREADS
+    // multiThread with each mapped row pushed, as soon as it is mapped, to a reduce thread through
+    // an SpscQueue per pair of map and reduce threads; for use only if isStartRange, and without a
+    // map cache, checkpoint or affinity policy. If isAssociativeReduce, the rows of each key are
+    // spread over the reduce threads, which fold them into partial results as they arrive, so
+    // that reducing overlaps mapping, and the partial results are merged in a tree. Otherwise
+    // each reduce thread takes a range of keys, split at keys sampled by sampleSplitKeys, and
+    // holds their rows until mapping is done; its results are then written as they are. With a
+    // memory limit, the mapped rows in the queues and held by reduce threads are kept within it.
+    int queuedMultiThread(int nrows, int nthreads, std::ostream& output);
+    
+    // keys at which to split the mapped keys into parts ranges, for a reduce thread each, in
+    // splitKeys: part k takes the keys from splitKeys[k - 1] up to splitKeys[k]. The keys are
+    // those mapped from a sample of rows spread evenly over the starting data, at even shares of
+    // the sampled rows, so there are fewer than parts - 1 of them if the sample has fewer keys.
+    void sampleSplitKeys(int nrows, int parts, std::vector<std::string>& splitKeys);
+    
+    // merge partial results in a tree, into partialPairsVector[0]: in each round, result k takes
+    // in result k + stride, with the pairs merged in parallel
+    void mergePartialsInTree(std::vector<PartialPairs>& partialPairsVector);
+    
+    // format ranges of reduced data that follow one another in key order, each on its own
+    // thread, then write them to output together with writeBuffers; returns 0 if they were
+    // written
+    int writeReducedRanges(
+        const std::vector< std::multimap<std::string, ReducedValue>::const_iterator >& begins,
+        const std::vector< std::multimap<std::string, ReducedValue>::const_iterator >& ends,
+        std::ostream& output);
+#endif
+    
+    // singleThreadDirect with starting and mapped data held as ColumnBatches, and each key's
+    // values reduced by one batch update of an Aggregator; for use only if isColumnar
+    int columnarDirect(int nrows, std::ostream& output);
+
+    // write reduced data for the window ended by the last pane closed, if it has any rows; returns
+    // the time from closeNanos, when it ended, until it was written, or -1 if it was empty
+    long long writeWindow(const WindowedAggregates<MappedValue>& windows, long long closeNanos,
+                          std::ostream& output);
+
+    // generate, map and reduce each row in one pass, with startRow, mapValue and an Aggregator per
+    // key, without intermediate containers; for use only if isFusedDirect
+    int fusedDirect(int nrows, std::ostream& output);
+
+    // combine two partial results for a key of a reduce written by hand, if isAssociativeReduce;
+    // by default their sum. Standard aggregates merge their states instead.
+    virtual ReducedValue combine(const std::string& keyMapped, ReducedValue partial1,
+                                 ReducedValue partial2);
+
+    // read partial results saved by incrementalDirect, if they are for this calculation, map
+    // version, aggregate and sketch options; rows is set to the number of rows they cover (rows 1
+    // to rows)
+    bool readPartials(const std::string& path, int& rows, PartialPairs& partialPairs);
+
+    // save partial results covering rows 1 to rows, replacing any earlier ones
+    void writePartials(const std::string& path, int rows, const PartialPairs& partialPairs);
+
+    // the sketch options of reduceAggregate, as written with partial results
+    std::string sketchTag();
+
+#if USE_THREADS
+    // map chunks of rows on a worker thread pinned as planned for thread k: chunk k, then chunks
+    // claimed from nextChunk until there are none left. With an affinity policy, the rows of each
+    // chunk are generated on this thread into startSlice if isStartRange, or else copied there
+    // from startPairs, so that the rows it maps are first touched on its NUMA node; otherwise they
+    // are read from startPairs. With checkpoints, each chunk's output is saved, or read back if an
+    // earlier run of the job saved it. Counts into workerStats whatever phaseStats has enabled.
+    void workerMapChunks(
+        const AffinityPlan& plan,
+        int threadIndex,
+        const std::vector<int>& chunkOffsets,
+        std::atomic<int>& nextChunk,
+        const std::vector< std::pair<std::string, StartValue> >& startPairs,
+        std::vector< std::pair<std::string, StartValue> >& startSlice,
+        std::multimap<std::string, MappedValue>& mappedValues,
+        WorkerStats& workerStats);
+#endif
+
+    // reduceRange into reducedPairs (or reducePartialRange into partialPairs, if partial) on a
+    // worker thread, pinned as planned for thread k, counting into workerStats whatever
+    // phaseStats has enabled; with checkpoints, the results are saved as checkpointPart, or read
+    // back if an earlier run of the job saved them
+    void workerReduceRange(
+        const AffinityPlan& plan,
+        int threadIndex,
+        bool partial,
+        const std::multimap<std::string, MappedValue>& mappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& beginMappedPairs,
+        const std::multimap<std::string, MappedValue>::const_iterator& endMappedPairs,
+        const std::string& checkpointPart,
+        std::multimap<std::string, ReducedValue>& reducedPairs,
+        PartialPairs& partialPairs,
+        WorkerStats& workerStats);
+
+    // mergePartials on a worker thread
+    void workerMergePartials(PartialPairs& partialPairs, const PartialPairs& otherPairs);
+
+    // formatRange on a worker thread
+    void workerFormatRange(
+        const std::multimap<std::string, ReducedValue>::const_iterator& beginReducedPairs,
+        const std::multimap<std::string, ReducedValue>::const_iterator& endReducedPairs,
+        std::string& buffer);
+
+#if USE_THREADS
+    typedef SpscQueue< std::pair<std::string, MappedValue> > ShuffleQueue;
+    
+    // generate chunks of rows of the starting data, chunk k starting at row startRows[k], and
+    // mapRange them in batches on a worker thread: chunk threadIndex, then chunks claimed from
+    // nextChunk until there are none left. Each batch's bytes are taken from budget, then each
+    // mapped row is pushed to queues[k] for reduce thread k: the next thread in turn if
+    // isAssociativeReduce, else the thread whose range of keys, split at splitKeys, its key falls
+    // in. Closes the queues when done, and counts into pushWaits the times a queue was full.
+    void workerMapToQueues(int threadIndex,
+                           const std::vector<int>& startRows,
+                           std::atomic<int>& nextChunk,
+                           const std::vector<std::string>& splitKeys,
+                           const std::vector<ShuffleQueue *>& queues,
+                           MemoryBudget& budget,
+                           long long& pushWaits);
+    
+    // pop mapped rows from queues on a worker thread until each is closed and empty, counting into
+    // popWaits the times every queue was empty. If isAssociativeReduce, the rows popped from all
+    // the queues each time are folded into partialPairs, and their bytes given back, at once; else
+    // they are held, then reduceRange'd into reducedPairs. While budget is pressed, rows held are
+    // spilled, once there are at least spillBytes of them (or a quarter of that, if nothing is left
+    // to pop), to a sorted run in spillDir named for threadIndex, and their bytes given back. An
+    // error is kept in error, and the rest of the rows only drained, so that the map threads still
+    // finish; the runs are left for the caller to remove with spillDir.
+    void workerReduceFromQueues(int threadIndex,
+                                const std::vector<ShuffleQueue *>& queues,
+                                MemoryBudget& budget,
+                                long long spillBytes,
+                                const std::string& spillDir,
+                                std::multimap<std::string, ReducedValue>& reducedPairs,
+                                PartialPairs& partialPairs,
+                                std::string& error,
+                                long long& popWaits);
+    
+    // read rows of starting data from input into rows on a worker thread until the end of input,
+    // then set ended, notifying rowsChanged of each, so that streamWorker can end windows by time
+    // while it waits for the next row
+    void workerReadStream(std::istream& input,
+                          std::deque< std::pair<std::string, StartValue> >& rows,
+                          bool& ended,
+                          std::mutex& rowsMutex,
+                          std::condition_variable& rowsChanged);
+#endif
+    
+    // write mapped data to a file, as a run sorted by key for reduceSpills
+    void writeSpill(const std::string& path,
+                    const std::multimap<std::string, MappedValue>& mappedPairs);
+    
+    // reduceRange the mapped data in sorted runs written by writeSpill together with mappedPairs,
+    // with mergeSpills; with more runs than can be open at once, groups of them are first merged
+    // into longer runs named for runPrefix. The files are removed.
+    void reduceSpills(const std::vector<std::string>& paths,
+                      const std::string& runPrefix,
+                      const std::multimap<std::string, MappedValue>& mappedPairs,
+                      std::multimap<std::string, ReducedValue>& reducedPairs);
+    
+    // merge sorted runs written by writeSpill together with mappedPairs a key at a time, so that
+    // only one key's values are held at once, writing each key's values to runOutput as a longer
+    // run if it isn't NULL, else reduceRange'ing them into reducedPairs; the files are removed
+    // once read
+    void mergeSpills(const std::vector<std::string>& paths,
+                     const std::multimap<std::string, MappedValue>& mappedPairs,
+                     std::ostream *runOutput,
+                     std::multimap<std::string, ReducedValue>& reducedPairs);
+
 #if USE_THREAD
 protected:
     std::vector<std::thread> threads;
@@ -18,9 +18,25 @@
 
 #include <iostream>
 
+#include "affinity.h"
+#include "aggregators.h"
+#include "bench.h"
 #include "callWithFork.h"
+#include "checkpoint.h"
+#include "columnBatch.h"
+#include "mapCache.h"
+#include "memBudget.h"
+#include "memStats.h"
+#include "perfCounters.h"
+#include "phaseStats.h"
+#include "ringQueues.h"
+#include "sketches.h"
 #include "sumSquare.h"
+#include "timerQueue.h"
+#include "trace.h"
+#include "tuning.h"
 #include "utils.h"
+#include "windowedAggregates.h"
 
 using namespace std;
 
@@ -47,9 +63,25 @@ void test(bool useHadoop, bool verbose)
     int totalPassed = 0;
     int totalFailed = 0;
     
+    ctest_affinity(totalPassed, totalFailed, verbose);
+    ctest_aggregators(totalPassed, totalFailed, verbose);
+    ctest_bench(totalPassed, totalFailed, verbose);
     ctest_callWithFork(totalPassed, totalFailed, verbose);
+    ctest_checkpoint(totalPassed, totalFailed, verbose);
+    ctest_columnBatch(totalPassed, totalFailed, verbose);
+    ctest_mapCache(totalPassed, totalFailed, verbose);
+    ctest_memBudget(totalPassed, totalFailed, verbose);
+    ctest_memStats(totalPassed, totalFailed, verbose);
+    ctest_perfCounters(totalPassed, totalFailed, verbose);
+    ctest_phaseStats(totalPassed, totalFailed, verbose);
+    ctest_ringQueues(totalPassed, totalFailed, verbose);
+    ctest_sketches(totalPassed, totalFailed, verbose);
     ctest_sumSquare(totalPassed, totalFailed, useHadoop, verbose);
+    ctest_timerQueue(totalPassed, totalFailed, verbose);
+    ctest_trace(totalPassed, totalFailed, verbose);
+    ctest_tuning(totalPassed, totalFailed, verbose);
     ctest_utils(totalPassed, totalFailed, verbose);
+    ctest_windowedAggregates(totalPassed, totalFailed, verbose);
     
     if (verbose) {
         cerr << "Total" << "\t\t\t\t" << totalPassed << " passed, " << totalFailed << " failed" << endl;
@@ -62,9 +94,25 @@ void test(bool useHadoop, bool verbose)
         cerr << endl << "Code coverage" << endl;
     }
     
+    cover_affinity(verbose);
+    cover_aggregators(verbose);
+    cover_bench(verbose);
     cover_callWithFork(verbose);
+    cover_checkpoint(verbose);
+    cover_columnBatch(verbose);
+    cover_mapCache(verbose);
+    cover_memBudget(verbose);
+    cover_memStats(verbose);
+    cover_perfCounters(verbose);
+    cover_phaseStats(verbose);
+    cover_ringQueues(verbose);
+    cover_sketches(verbose);
     cover_sumSquare(useHadoop, verbose);
+    cover_timerQueue(verbose);
+    cover_trace(verbose);
+    cover_tuning(verbose);
     cover_utils(verbose);
+    cover_windowedAggregates(verbose);
     
     // ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ ~ 
     // Integration
@@ -0,0 +1,84 @@
+//
+//  timerQueue.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Deadline-ordered queue of operations waiting on latency-bound work, so that one thread can keep
+// many of them in flight: each operation is started, pushed with the time its result will be
+// ready, and finished when it comes off the queue. The thread sleeps only until the earliest is
+// due, instead of once per operation.
+//
+
+#include "timerQueue.h"
+
+#include <iostream>
+#include <string>
+
+#include "utils.h"
+
+using namespace std;
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_timerQueue(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // TimerQueue::push
+    // TimerQueue::waitNext
+
+    {
+        const long long MSEC = 1000000;
+        long long startTime = nanosecondClock();
+
+        TimerQueue<string> queue;
+        queue.push(startTime + 20 * MSEC, "c");
+        queue.push(startTime + 10 * MSEC, "a");
+        queue.push(startTime + 10 * MSEC, "b");
+        size_t size = queue.size();
+
+        string order;
+        while (!queue.empty()) {
+            order += queue.waitNext();
+        }
+
+        // one wait for all three, not one each
+        long long elapsed = nanosecondClock() - startTime;
+
+        if (size == 3 && order == "abc" && elapsed >= 20 * MSEC && elapsed < 1000 * MSEC) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "timerQueue.cpp" << "\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_timerQueue(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // TimerQueue::waitNext
+
+    {
+        // already due
+        TimerQueue<int> queue;
+        queue.push(0, 1);
+        queue.waitNext();
+    }
+}
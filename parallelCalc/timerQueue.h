@@ -0,0 +1,79 @@
+//
+//  timerQueue.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Deadline-ordered queue of operations waiting on latency-bound work, so that one thread can keep
+// many of them in flight: each operation is started, pushed with the time its result will be
+// ready, and finished when it comes off the queue. The thread sleeps only until the earliest is
+// due, instead of once per operation.
+//
+
+#ifndef parallelCalc_timerQueue_h
+#define parallelCalc_timerQueue_h
+
+#include "shim.h"
+
+#include <cstddef>
+#include <map>
+#include <utility>
+
+#include "utils.h"
+
+// ========== Class Templates ======================================================================
+
+template <typename T> class TimerQueue {
+public:
+    TimerQueue() : items() {};
+
+    // add an item that will be due when nanosecondClock reaches readyNanos
+    void push(long long readyNanos, const T& item);
+
+    bool empty() const { return items.empty(); };
+    size_t size() const { return items.size(); };
+
+    // remove the earliest item, sleeping until it is due; items due at the same time come off in
+    // the order they were pushed
+    T waitNext();
+
+protected:
+    std::multimap<long long, T> items;
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// add an item that will be due when nanosecondClock reaches readyNanos
+template <typename T> void TimerQueue<T>::push(long long readyNanos, const T& item)
+{
+    items.insert(items.end(), std::make_pair(readyNanos, item));
+}
+
+// remove the earliest item, sleeping until it is due; items due at the same time come off in the
+// order they were pushed
+template <typename T> T TimerQueue<T>::waitNext()
+{
+    typename std::multimap<long long, T>::iterator first = items.begin();
+    sleepUntil(first->first);
+
+    T item = first->second;
+    items.erase(first);
+
+    return item;
+}
+
+// ========== Function Headers =====================================================================
+
+// component tests
+void ctest_timerQueue(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_timerQueue(bool verbose);
+
+#endif
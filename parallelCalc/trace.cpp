@@ -0,0 +1,345 @@
+//
+//  trace.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Timeline of begin/end events per thread, written in Chrome trace-event format for viewing in
+// chrome://tracing or Perfetto. Each thread appends to its own buffer without locking; a lock is
+// only taken the first time a thread records an event.
+//
+
+#include "trace.h"
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if USE_THREADS
+#include <mutex>
+#include <thread>
+#endif
+
+#include "utils.h"
+
+using namespace std;
+
+// ========== Local Structures =====================================================================
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    char type;                  // 'B' or 'E'
+    long long nanos;            // since traceEnable()
+    const char *argName;        // NULL if none
+    long long argValue;
+};
+
+// events from one thread
+struct TraceBuffer {
+    int tid;
+    const char *threadName;     // NULL if none
+    std::vector<TraceEvent> events;
+};
+
+// ========== Local Headers ========================================================================
+
+// buffer for the calling thread, created and registered on first use after traceEnable()
+static TraceBuffer *threadBuffer();
+
+static void record(char type, const char *name, const char *category, const char *argName,
+                   long long argValue);
+
+// ========== Globals ==============================================================================
+
+// set only when no other thread is recording, so read without locking
+static bool gTraceEnabled = false;
+static int gTraceGeneration = 0;
+static long long gTraceStartTime = 0;
+
+// all buffers since traceEnable(); they outlive their threads
+static std::vector<TraceBuffer*> gTraceBuffers;
+
+#if USE_THREADS
+static std::mutex gTraceMutex;
+#endif
+
+// buffer for this thread, valid if its generation matches gTraceGeneration
+static THREAD_LOCAL TraceBuffer *tTraceBuffer = NULL;
+static THREAD_LOCAL int tTraceGeneration = 0;
+
+// ========== Classes ==============================================================================
+
+// records a begin event on construction and an end event on destruction, if tracing is enabled;
+// name and argName must be string literals (or otherwise outlive the trace)
+ScopedTrace::ScopedTrace(const char *name, const char *category, const char *argName,
+                         long long argValue) :
+name(name),
+category(category),
+enabled(gTraceEnabled)
+{
+    if (enabled) {
+        record('B', name, category, argName, argValue);
+    }
+}
+
+ScopedTrace::~ScopedTrace()
+{
+    if (enabled) {
+        record('E', name, category, NULL, 0);
+    }
+}
+
+// ========== Functions ============================================================================
+
+// start recording, discarding any events already recorded; timestamps are relative to this call;
+// call only when no other thread is recording
+void traceEnable()
+{
+    for (size_t k = 0; k < gTraceBuffers.size(); k++) {
+        delete gTraceBuffers[k];
+    }
+
+    gTraceBuffers.clear();
+    gTraceGeneration++;
+    gTraceStartTime = nanosecondClock();
+    gTraceEnabled = true;
+}
+
+// stop recording, keeping the events recorded so far
+void traceDisable()
+{
+    gTraceEnabled = false;
+}
+
+bool isTraceEnabled()
+{
+    return gTraceEnabled;
+}
+
+// record a begin or end event for the calling thread; names as for ScopedTrace
+void traceBegin(const char *name, const char *category, const char *argName, long long argValue)
+{
+    if (gTraceEnabled) {
+        record('B', name, category, argName, argValue);
+    }
+}
+
+void traceEnd(const char *name, const char *category)
+{
+    if (gTraceEnabled) {
+        record('E', name, category, NULL, 0);
+    }
+}
+
+// name the calling thread's track in the trace
+void traceThreadName(const char *name)
+{
+    if (gTraceEnabled) {
+        threadBuffer()->threadName = name;
+    }
+}
+
+// write all recorded events as a Chrome trace-event JSON object; call only when no other thread
+// is recording
+void traceWrite(std::ostream& output)
+{
+    ios::fmtflags flags = output.flags();
+    output << fixed << setprecision(3);
+
+    output << "{\"traceEvents\": [" << endl;
+
+    bool first = true;
+    for (size_t b = 0; b < gTraceBuffers.size(); b++) {
+        const TraceBuffer *buffer = gTraceBuffers[b];
+
+        if (buffer->threadName != NULL) {
+            output << (first ? "" : ",\n");
+            output << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": ";
+            output << buffer->tid << ", \"args\": {\"name\": \"" << buffer->threadName << "\"}}";
+            first = false;
+        }
+
+        for (size_t k = 0; k < buffer->events.size(); k++) {
+            const TraceEvent& event = buffer->events[k];
+
+            // timestamps in microseconds
+            output << (first ? "" : ",\n");
+            output << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category;
+            output << "\", \"ph\": \"" << event.type << "\", \"ts\": " << 0.001 * event.nanos;
+            output << ", \"pid\": 1, \"tid\": " << buffer->tid;
+
+            if (event.argName != NULL) {
+                output << ", \"args\": {\"" << event.argName << "\": " << event.argValue << "}";
+            }
+
+            output << "}";
+            first = false;
+        }
+    }
+
+    output << endl << "], \"displayTimeUnit\": \"ms\"}" << endl;
+
+    output.flags(flags);
+}
+
+// ========== Local Functions ======================================================================
+
+// buffer for the calling thread, created and registered on first use after traceEnable()
+static TraceBuffer *threadBuffer()
+{
+    if (tTraceBuffer == NULL || tTraceGeneration != gTraceGeneration) {
+        TraceBuffer *buffer = new TraceBuffer();
+        buffer->threadName = NULL;
+
+        {
+#if USE_THREADS
+            lock_guard<mutex> lock(gTraceMutex);
+#endif
+            gTraceBuffers.push_back(buffer);
+            buffer->tid = (int)gTraceBuffers.size();
+        }
+
+        tTraceBuffer = buffer;
+        tTraceGeneration = gTraceGeneration;
+    }
+
+    return tTraceBuffer;
+}
+
+static void record(char type, const char *name, const char *category, const char *argName,
+                   long long argValue)
+{
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.type = type;
+    event.nanos = nanosecondClock() - gTraceStartTime;
+    event.argName = argName;
+    event.argValue = argValue;
+
+    threadBuffer()->events.push_back(event);
+}
+
+// ========== Tests ================================================================================
+
+#if USE_THREADS
+// record a range on another thread
+static void traceOtherThread()
+{
+    traceThreadName("other");
+    ScopedTrace scopedTrace("otherRange", "test", "rows", 7);
+}
+#endif
+
+// component tests
+void ctest_trace(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // traceEnable
+    // traceDisable
+    // traceWrite
+
+    {
+        traceEnable();
+        traceThreadName("test");
+
+        {
+            ScopedTrace scopedTrace("outer", "test", "rows", 5);
+            traceBegin("inner", "test");
+            traceEnd("inner", "test");
+        }
+
+#if USE_THREADS
+        thread other(traceOtherThread);
+        other.join();
+#endif
+
+        traceDisable();
+        traceBegin("ignored", "test");
+
+        ostringstream oss;
+        traceWrite(oss);
+        string outStr = oss.str();
+
+        size_t begins = 0;
+        size_t ends = 0;
+        for (size_t pos = outStr.find("\"ph\": \"B\""); pos != string::npos;
+             pos = outStr.find("\"ph\": \"B\"", pos + 1)) {
+            begins++;
+        }
+
+        for (size_t pos = outStr.find("\"ph\": \"E\""); pos != string::npos;
+             pos = outStr.find("\"ph\": \"E\"", pos + 1)) {
+            ends++;
+        }
+
+#if USE_THREADS
+        bool otherThread = outStr.find("\"tid\": 2, \"args\": {\"name\": \"other\"}") !=
+                           string::npos && begins == 3;
+#else
+        bool otherThread = begins == 2;
+#endif
+
+        if (outStr.find("{\"traceEvents\": [") == 0 && begins == ends && otherThread &&
+            outStr.find("\"name\": \"outer\", \"cat\": \"test\", \"ph\": \"B\"") != string::npos &&
+            outStr.find("\"args\": {\"rows\": 5}") != string::npos &&
+            outStr.find("ignored") == string::npos && !isTraceEnabled()) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ScopedTrace
+
+    {
+        // nothing recorded while disabled
+        traceEnable();
+        traceDisable();
+
+        {
+            ScopedTrace scopedTrace("disabled", "test");
+        }
+
+        ostringstream oss;
+        traceWrite(oss);
+
+        if (oss.str().find("disabled") == string::npos) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "trace.cpp" << "\t\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_trace(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // traceWrite
+
+    {
+        traceEnable();
+        traceDisable();
+
+        ostringstream oss;
+        traceWrite(oss);
+
+        if (verbose) {
+            cerr << oss.str();
+        }
+    }
+}
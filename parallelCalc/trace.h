@@ -0,0 +1,70 @@
+//
+//  trace.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Timeline of begin/end events per thread, written in Chrome trace-event format for viewing in
+// chrome://tracing or Perfetto. Each thread appends to its own buffer without locking; a lock is
+// only taken the first time a thread records an event.
+//
+
+#ifndef parallelCalc_trace_h
+#define parallelCalc_trace_h
+
+#include "shim.h"
+
+#include <iostream>
+
+// ========== Class Declarations ===================================================================
+
+// records a begin event on construction and an end event on destruction, if tracing is enabled;
+// name and argName must be string literals (or otherwise outlive the trace)
+class ScopedTrace {
+public:
+    ScopedTrace(const char *name, const char *category, const char *argName = NULL,
+                long long argValue = 0);
+    ~ScopedTrace();
+
+protected:
+    const char *name;
+    const char *category;
+    bool enabled;
+};
+
+// ========== Function Headers =====================================================================
+
+// start recording, discarding any events already recorded; timestamps are relative to this call;
+// call only when no other thread is recording
+void traceEnable();
+
+// stop recording, keeping the events recorded so far
+void traceDisable();
+
+bool isTraceEnabled();
+
+// record a begin or end event for the calling thread; names as for ScopedTrace
+void traceBegin(const char *name, const char *category, const char *argName = NULL,
+                long long argValue = 0);
+void traceEnd(const char *name, const char *category);
+
+// name the calling thread's track in the trace
+void traceThreadName(const char *name);
+
+// write all recorded events as a Chrome trace-event JSON object; call only when no other thread
+// is recording
+void traceWrite(std::ostream& output);
+
+// component tests
+void ctest_trace(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_trace(bool verbose);
+
+#endif
@@ -0,0 +1,243 @@
+//
+//  tuning.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Choice of thread count and map chunk size for -threads auto, from the CPUs available and the
+// measured cost of a row and of a thread.
+//
+
+#include "tuning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#if USE_THREADS
+#include <thread>
+#endif
+
+#include "calc.h"
+#include "utils.h"
+
+using namespace std;
+
+// ========== Local Headers ========================================================================
+
+#if USE_THREADS
+static void doNothing();
+#endif
+
+// ========== Classes ==============================================================================
+
+// nothing measured or chosen
+ThreadTuning::ThreadTuning() :
+cpus(1),
+sampleRows(0),
+rowNanos(0),
+threadNanos(0),
+threads(0),
+chunkRows(0)
+{
+}
+
+// write key/value lines <prefix>.cpus, .sampleRows, .rowNsec, .threadNsec, .threads and
+// .chunkRows
+void ThreadTuning::write(std::ostream& output, const std::string& prefix) const
+{
+    writeKeyValue<int>(output, prefix + ".cpus", cpus);
+    writeKeyValue<int>(output, prefix + ".sampleRows", sampleRows);
+    writeKeyValue<double>(output, prefix + ".rowNsec", rowNanos);
+    writeKeyValue<double>(output, prefix + ".threadNsec", threadNanos);
+    writeKeyValue<int>(output, prefix + ".threads", threads);
+    writeKeyValue<int>(output, prefix + ".chunkRows", chunkRows);
+}
+
+// ========== Functions ============================================================================
+
+// set tuning.threads and tuning.chunkRows for nrows from tuning.cpus, .rowNanos and .threadNanos,
+// keeping the cost of starting threads and of handing out chunks under maxOverhead of the work
+void chooseThreads(int nrows, double maxOverhead, ThreadTuning& tuning)
+{
+    // as allowed by -threads
+    const int MAX_THREADS = 64;
+
+    // handing out a chunk is an atomic increment and a mapRange call
+    const double CHUNK_NANOS = 1000;
+
+    // chunks per thread when rows are cheap, so that other threads can make up for a slow one
+    const int CHUNKS_PER_THREAD = 4;
+
+    tuning.threads = 0;
+    tuning.chunkRows = 0;
+
+    if (nrows <= 0 || tuning.rowNanos <= 0 || tuning.threadNanos <= 0) {
+        return;
+    }
+
+    // n threads take n * threadNanos to start and join, while each has work / n to do, so keep
+    // n * threadNanos <= maxOverhead * work / n
+    double work = nrows * tuning.rowNanos;
+    int threads = (int)sqrt(maxOverhead * work / tuning.threadNanos);
+    threads = min(min(threads, tuning.cpus), min(nrows, MAX_THREADS));
+
+    // one thread would be the direct calculation plus overhead
+    if (threads < 2) {
+        return;
+    }
+
+    tuning.threads = threads;
+
+    // the smallest chunk that keeps handing it out under maxOverhead of its work, but no smaller
+    // than needed for CHUNKS_PER_THREAD
+    int minChunkRows = (int)ceil(CHUNK_NANOS / (maxOverhead * tuning.rowNanos));
+    int chunkRows = max(minChunkRows, nrows / (threads * CHUNKS_PER_THREAD));
+
+    // otherwise one chunk per thread
+    if ((long long)chunkRows * threads < nrows) {
+        tuning.chunkRows = chunkRows;
+    }
+}
+
+// cost of starting and joining a thread that does nothing; 0 without threads
+double measureThreadNanos()
+{
+    long long best = 0;
+
+#if USE_THREADS
+    // the first thread may pay for setting up the thread library
+    for (int k = 0; k < 5; k++) {
+        long long startTime = nanosecondClock();
+
+        thread nothing(doNothing);
+        nothing.join();
+
+        long long elapsed = nanosecondClock() - startTime;
+        if (k == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+#endif
+
+    return (double)best;
+}
+
+// ========== Local Functions ======================================================================
+
+#if USE_THREADS
+static void doNothing()
+{
+}
+#endif
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_tuning(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // chooseThreads
+
+    {
+        // cheap rows: thread start-up isn't paid for until there are many
+        ThreadTuning tuning;
+        tuning.cpus = 8;
+        tuning.rowNanos = 1000;
+        tuning.threadNanos = 50000;
+
+        chooseThreads(1000, 0.05, tuning);
+        bool direct = tuning.threads == 0;
+
+        chooseThreads(1000000, 0.05, tuning);
+
+        if (direct && tuning.threads == 8 && tuning.chunkRows == 31250) passed++; else failed++;
+    }
+
+    {
+        // expensive rows: a thread per CPU, one row per chunk
+        ThreadTuning tuning;
+        tuning.cpus = 8;
+        tuning.rowNanos = 1e8;
+        tuning.threadNanos = 50000;
+
+        chooseThreads(10, 0.05, tuning);
+        bool expensive = tuning.threads == 8 && tuning.chunkRows == 1;
+
+        // no more threads than CPUs or rows
+        tuning.cpus = 1;
+        chooseThreads(10, 0.05, tuning);
+        bool oneCpu = tuning.threads == 0;
+
+        tuning.cpus = 8;
+        chooseThreads(3, 0.05, tuning);
+
+        if (expensive && oneCpu && tuning.threads == 3 && tuning.chunkRows == 0) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // measureThreadNanos
+
+    {
+        double threadNanos = measureThreadNanos();
+
+#if USE_THREADS
+        if (threadNanos > 0) passed++; else failed++;
+#else
+        if (threadNanos == 0) passed++; else failed++;
+#endif
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // ThreadTuning::write
+
+    {
+        ThreadTuning tuning;
+        tuning.threads = 4;
+
+        ostringstream oss;
+        tuning.write(oss, "threads.auto");
+        string outStr = oss.str();
+
+        if (outStr.find("threads.auto.cpus\t1\n") == 0 &&
+            outStr.find("threads.auto.threads\t4\n") != string::npos) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "tuning.cpp" << "\t\t\t" << passed << " passed, " << failed << " failed" << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_tuning(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // chooseThreads
+
+    {
+        ThreadTuning tuning;
+        chooseThreads(0, 0.05, tuning);
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // measureThreadNanos
+
+    if (verbose) {
+        cerr << "thread start and join " << measureThreadNanos() << " nsec" << endl;
+    }
+}
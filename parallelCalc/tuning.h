@@ -0,0 +1,58 @@
+//
+//  tuning.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Choice of thread count and map chunk size for -threads auto, from the CPUs available and the
+// measured cost of a row and of a thread.
+//
+
+#ifndef parallelCalc_tuning_h
+#define parallelCalc_tuning_h
+
+#include "shim.h"
+
+#include <iostream>
+#include <string>
+
+// ========== Structures ===========================================================================
+
+struct ThreadTuning {
+    int cpus;               // CPUs available to this process
+    int sampleRows;         // rows timed to measure rowNanos
+    double rowNanos;        // cost of one row, calculated directly
+    double threadNanos;     // cost of starting and joining one thread
+    int threads;            // threads to use; 0 to calculate directly
+    int chunkRows;          // rows per map chunk; 0 for one chunk per thread
+
+    // nothing measured or chosen
+    ThreadTuning();
+
+    // write key/value lines <prefix>.cpus, .sampleRows, .rowNsec, .threadNsec, .threads and
+    // .chunkRows
+    void write(std::ostream& output, const std::string& prefix) const;
+};
+
+// ========== Function Headers =====================================================================
+
+// set tuning.threads and tuning.chunkRows for nrows from tuning.cpus, .rowNanos and .threadNanos,
+// keeping the cost of starting threads and of handing out chunks under maxOverhead of the work
+void chooseThreads(int nrows, double maxOverhead, ThreadTuning& tuning);
+
+// cost of starting and joining a thread that does nothing; 0 without threads
+double measureThreadNanos();
+
+// component tests
+void ctest_tuning(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_tuning(bool verbose);
+
+#endif
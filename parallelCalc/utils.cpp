@@ -23,12 +23,28 @@
 #include <time.h>
 
 #else
+#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 #endif
 
+#if USE_THREADS
+#include <chrono>
+#include <thread>
+
+#elif defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cmath>
+#include <cstdio>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
@@ -36,6 +52,50 @@
 
 using namespace std;
 
+// ========== Classes ==============================================================================
+
+HashingStreambuf::HashingStreambuf(std::streambuf *destination) :
+destination(destination),
+hash(FNV1A_OFFSET_BASIS),
+length(0)
+{
+}
+
+// hash and length as a string, in the form <16 hex digits>-<decimal length>
+std::string HashingStreambuf::digest() const
+{
+    ostringstream oss;
+    oss << hex << setw(16) << setfill('0') << hash << dec << "-" << length;
+    
+    return oss.str();
+}
+
+int HashingStreambuf::overflow(int c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    
+    char ch = (char)c;
+    hash = fnv1aHash(&ch, 1, hash);
+    length++;
+    
+    return destination->sputc(ch);
+}
+
+std::streamsize HashingStreambuf::xsputn(const char *s, std::streamsize n)
+{
+    hash = fnv1aHash(s, (size_t)n, hash);
+    length += n;
+    
+    return destination->sputn(s, n);
+}
+
+int HashingStreambuf::sync()
+{
+    return destination->pubsync();
+}
+
 // ========== Functions ============================================================================
 
 // throw std::logic_error with custom message include source file name and line number
@@ -131,6 +191,19 @@ long toLong(const std::string str)
     return k;
 }
 
+// 64-bit FNV-1a hash of data, continuing from a previous hash value
+unsigned long long fnv1aHash(const char *data, size_t length, unsigned long long hash)
+{
+    const unsigned long long FNV1A_PRIME = 1099511628211ULL;
+    
+    for (size_t k = 0; k < length; k++) {
+        hash ^= (unsigned char)data[k];
+        hash *= FNV1A_PRIME;
+    }
+    
+    return hash;
+}
+
 // write string to file
 void stringToFile(const std::string& str, const std::string& path)
 {
@@ -154,6 +227,69 @@ void fileToString(const std::string& path, std::string& str)
     ifs.close();
 }
 
+// write buffers to output in order, then flush; if output is std::cout, with one writev to stdout
+// where the system supports it, instead of a write per buffer. Returns false on failure.
+bool writeBuffers(std::ostream& output, const std::vector<std::string>& buffers)
+{
+#if !WINDOWS
+    if (&output == &cout) {
+        // anything already written to cout goes first
+        cout.flush();
+        
+        vector<struct iovec> iovecs;
+        for (size_t k = 0; k < buffers.size(); k++) {
+            if (!buffers[k].empty()) {
+                struct iovec iov;
+                iov.iov_base = (void *)buffers[k].data();
+                iov.iov_len = buffers[k].length();
+                iovecs.push_back(iov);
+            }
+        }
+        
+#ifdef IOV_MAX
+        const size_t maxCount = IOV_MAX;
+#else
+        const size_t maxCount = 16;
+#endif
+        
+        // writev may write only part of the buffers, or be limited to maxCount of them at a time
+        size_t first = 0;
+        while (first < iovecs.size()) {
+            size_t count = min(iovecs.size() - first, maxCount);
+            ssize_t written = writev(STDOUT_FILENO, &iovecs[first], (int)count);
+            
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                
+                return false;
+            }
+            
+            while (first < iovecs.size() && (size_t)written >= iovecs[first].iov_len) {
+                written -= iovecs[first].iov_len;
+                first++;
+            }
+            
+            if (written > 0) {
+                iovecs[first].iov_base = (char *)iovecs[first].iov_base + written;
+                iovecs[first].iov_len -= written;
+            }
+        }
+        
+        return true;
+    }
+#endif
+    
+    for (size_t k = 0; k < buffers.size(); k++) {
+        output.write(buffers[k].data(), buffers[k].length());
+    }
+    
+    output.flush();
+    
+    return !output.fail();
+}
+
 // return current working directory
 std::string getWorkingDirectory()
 {
@@ -224,6 +360,79 @@ long long millisecondTime()
     return msec;
 }
 
+// for debugging and testing; epoch time in microseconds
+long long microsecondTime()
+{
+    long long usec;
+    
+#if WINDOWS
+    // number of 100-nanosecond intervals since January 1, 1601 (UTC).
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    
+    _ULARGE_INTEGER uli;
+    uli.u.LowPart = ft.dwLowDateTime;
+    uli.u.HighPart = ft.dwHighDateTime;
+    usec = (uli.QuadPart + 10LL / 2) / 10LL;
+    
+#else
+    // seconds and microseconds since the Epoch (00:00:00 UTC, January 1 1970)
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    usec = (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+#endif
+    
+    return usec;
+}
+
+// monotonic clock in nanoseconds, for measuring intervals; the zero point is arbitrary
+long long nanosecondClock()
+{
+#if USE_THREADS
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+    
+#elif WINDOWS
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    
+    return (long long)(counter.QuadPart * (1.0e9 / frequency.QuadPart));
+    
+#elif defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    
+    return (long long)(mach_absolute_time() * timebase.numer / timebase.denom);
+    
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+// sleep until nanosecondClock reaches clockNanos; returns at once if it already has
+void sleepUntil(long long clockNanos)
+{
+    long long remaining = clockNanos - nanosecondClock();
+    if (remaining <= 0) {
+        return;
+    }
+    
+#if USE_THREADS
+    this_thread::sleep_for(chrono::nanoseconds(remaining));
+    
+#else
+    // whole milliseconds, rounded up so as not to wake early
+    sleepFor((int)((remaining + 999999) / 1000000));
+#endif
+}
+
 // for debugging and testing; create directory
 void makeDir(const std::string& path)
 {
@@ -252,6 +461,114 @@ void removeDir(const std::string& path)
 #endif
 }
 
+// create a new, empty directory with a unique name beginning with prefix in the system's temporary
+// directory (TMPDIR, else /tmp), for the files of one run or test; returns its path
+std::string makeTempDir(const std::string& prefix)
+{
+#if WINDOWS
+    char tempDir[MAX_PATH];
+    RUNTIME_ERROR_IF(GetTempPath(MAX_PATH, tempDir) == 0, "can't make a temporary directory");
+    
+    return makeTempDirIn(tempDir, prefix);
+    
+#else
+    const char *tempDir = getenv("TMPDIR");
+    
+    return makeTempDirIn(tempDir != NULL && *tempDir != 0 ? tempDir : "/tmp", prefix);
+#endif
+}
+
+// create a new, empty directory with a unique name beginning with prefix in parent; returns its
+// path
+std::string makeTempDirIn(const std::string& parent, const std::string& prefix)
+{
+#if WINDOWS
+    char tempName[MAX_PATH];
+    RUNTIME_ERROR_IF(GetTempFileName(parent.c_str(), prefix.c_str(), 0, tempName) == 0,
+                     badPathErrorMessage(parent));
+    
+    // the unique name is taken by a file, which the directory replaces
+    DeleteFile(tempName);
+    RUNTIME_ERROR_IF(!CreateDirectory(tempName, NULL), badPathErrorMessage(tempName));
+    
+    return tempName;
+    
+#else
+    string pattern = parent + "/" + prefix + ".XXXXXX";
+    
+    vector<char> path(pattern.begin(), pattern.end());
+    path.push_back(0);
+    
+    RUNTIME_ERROR_IF(mkdtemp(&path[0]) == NULL, badPathErrorMessage(pattern));
+    
+    return &path[0];
+#endif
+}
+
+// create a new, empty file with a unique name beginning with pathPrefix, so that runs or threads
+// writing at once never share one; returns its path
+std::string makeTempFile(const std::string& pathPrefix)
+{
+    string pattern = pathPrefix + ".XXXXXX";
+    
+    vector<char> path(pattern.begin(), pattern.end());
+    path.push_back(0);
+    
+#if WINDOWS
+    RUNTIME_ERROR_IF(_mktemp_s(&path[0], path.size()) != 0, badPathErrorMessage(pattern));
+    
+    ofstream output(&path[0]);
+    RUNTIME_ERROR_IF(!output.is_open(), badPathErrorMessage(&path[0]));
+    
+#else
+    int fd = mkstemp(&path[0]);
+    RUNTIME_ERROR_IF(fd < 0, badPathErrorMessage(pattern));
+    close(fd);
+#endif
+    
+    return &path[0];
+}
+
+// remove the files in a directory, then the directory itself; false if any can't be removed
+bool removeDirFiles(const std::string& path)
+{
+    bool removed = true;
+    
+#if WINDOWS
+    WIN32_FIND_DATA found;
+    HANDLE find = FindFirstFile((path + "/*").c_str(), &found);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                removed = DeleteFile((path + "/" + found.cFileName).c_str()) && removed;
+            }
+        } while (FindNextFile(find, &found));
+        
+        FindClose(find);
+    }
+    
+    return RemoveDirectory(path.c_str()) && removed;
+    
+#else
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return false;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if (name != "." && name != "..") {
+            removed = remove((path + "/" + name).c_str()) == 0 && removed;
+        }
+    }
+    
+    closedir(dir);
+    
+    return rmdir(path.c_str()) == 0 && removed;
+#endif
+}
+
 // for debugging and testing; location at which to set a breakpoint
 void noop()
 {
@@ -300,6 +617,29 @@ void ctest_utils(int& totalPassed, int& totalFailed, bool verbose)
     
     if (toLong("128") == 128) passed++; else failed++;
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // fnv1aHash
+    
+    if (fnv1aHash("", 0) == 0xcbf29ce484222325ULL) passed++; else failed++;
+    if (fnv1aHash("a", 1) == 0xaf63dc4c8601ec8cULL) passed++; else failed++;
+    if (fnv1aHash("oo", 2, fnv1aHash("f", 1)) == fnv1aHash("foo", 3)) passed++; else failed++;
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // HashingStreambuf
+    
+    {
+        ostringstream oss;
+        HashingStreambuf hashBuf(oss.rdbuf());
+        ostream hashStream(&hashBuf);
+        
+        hashStream << "EVEN" << '\t' << 4 << endl;
+        string outStr = oss.str();
+        
+        if (outStr == "EVEN\t4\n" &&
+            hashBuf.getHash() == fnv1aHash(outStr.c_str(), outStr.length()) &&
+            hashBuf.digest().length() == 16 + 2) passed++; else failed++;
+    }
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // stringToFile
     // fileToString
@@ -314,6 +654,21 @@ void ctest_utils(int& totalPassed, int& totalFailed, bool verbose)
     
     if (outStr == inStr) passed++; else failed++;
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // writeBuffers
+    
+    {
+        vector<string> buffers;
+        buffers.push_back("EVEN\t4\n");
+        buffers.push_back("");
+        buffers.push_back("ODD \t9\n");
+        
+        ostringstream oss;
+        bool valid = writeBuffers(oss, buffers);
+        
+        if (valid && oss.str() == "EVEN\t4\nODD \t9\n") passed++; else failed++;
+    }
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // getWorkingDirectory
     
@@ -326,12 +681,71 @@ void ctest_utils(int& totalPassed, int& totalFailed, bool verbose)
     // ~~~~~~~~~~~~~~~~~~~~~~
     // millisecondTime
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // microsecondTime
+    
+    {
+        long long usec = microsecondTime();
+        long long msec = millisecondTime();
+        
+        // same clock, different units
+        if (msec - usec / 1000 >= 0 && msec - usec / 1000 <= 1000) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // nanosecondClock
+    
+    {
+        long long startTime = nanosecondClock();
+        sleepFor(10);
+        long long elapsed = nanosecondClock() - startTime;
+        
+        if (elapsed >= 10000000LL && elapsed < 10000000000LL) passed++; else failed++;
+    }
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // sleepUntil
+    
+    {
+        long long startTime = nanosecondClock();
+        sleepUntil(startTime + 10000000LL);
+        long long elapsed = nanosecondClock() - startTime;
+        
+        // the past is no wait
+        sleepUntil(startTime);
+        
+        if (elapsed >= 10000000LL && nanosecondClock() - startTime < 10000000000LL) passed++;
+        else failed++;
+    }
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // makeDir
     
     // ~~~~~~~~~~~~~~~~~~~~~~
     // removeDir
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // makeTempDir
+    // makeTempDirIn
+    // makeTempFile
+    // removeDirFiles
+    
+    {
+        string dir = makeTempDir("utilsTest");
+        string otherDir = makeTempDir("utilsTest");
+        string subDir = makeTempDirIn(otherDir, "sub");
+        
+        string file = makeTempFile(dir + "/part");
+        string otherFile = makeTempFile(dir + "/part");
+        stringToFile("x", file);
+        
+        bool removed = removeDirFiles(dir) && removeDirFiles(subDir) && removeDirFiles(otherDir);
+        
+        if (dir != otherDir && file != otherFile && file.find(dir + "/part.") == 0 &&
+            subDir.find(otherDir + "/sub.") == 0 && removed &&
+            !ifstream(file.c_str()).is_open() && !removeDirFiles(dir)) passed++; else failed++;
+    }
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // noop
     
@@ -430,6 +844,11 @@ void cover_utils(bool verbose)
     
     toLong("123");
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // fnv1aHash
+    
+    fnv1aHash("123", 3);
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // stringToFile
     
@@ -461,6 +880,16 @@ void cover_utils(bool verbose)
     
     millisecondTime();
     
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // microsecondTime
+    
+    microsecondTime();
+    
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // nanosecondClock
+    
+    nanosecondClock();
+    
     // ~~~~~~~~~~~~~~~~~~~~~~
     // makeDir
     
@@ -18,6 +18,7 @@
 
 #include "shim.h"
 
+#include <streambuf>
 #include <string>
 #include <vector>
 
@@ -42,6 +43,30 @@
 #define SKIP
 #endif
 
+// ========== Class Declarations ===================================================================
+
+// output stream buffer that passes bytes through to another stream buffer, computing a 64-bit
+// FNV-1a hash of everything written
+class HashingStreambuf : public std::streambuf {
+public:
+    HashingStreambuf(std::streambuf *destination);
+    
+    unsigned long long getHash() const { return hash; };
+    unsigned long long getLength() const { return length; };
+    
+    // hash and length as a string, in the form <16 hex digits>-<decimal length>
+    std::string digest() const;
+    
+protected:
+    virtual int overflow(int c);
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+    virtual int sync();
+    
+    std::streambuf *destination;
+    unsigned long long hash;
+    unsigned long long length;
+};
+
 // ========== Function Headers =====================================================================
 
 // throw std::logic_error with custom message include source file name and line number
@@ -63,12 +88,21 @@ double toDouble(const std::string str);
 // return value from parsing string as long
 long toLong(const std::string str);
 
+// 64-bit FNV-1a hash of data, continuing from a previous hash value
+const unsigned long long FNV1A_OFFSET_BASIS = 14695981039346656037ULL;
+unsigned long long fnv1aHash(const char *data, size_t length,
+                             unsigned long long hash = FNV1A_OFFSET_BASIS);
+
 // write string to file
 void stringToFile(const std::string& str, const std::string& path);
 
 // read string from file
 void fileToString(const std::string& path, std::string& str);
 
+// write buffers to output in order, then flush; if output is std::cout, with one writev to stdout
+// where the system supports it, instead of a write per buffer. Returns false on failure.
+bool writeBuffers(std::ostream& output, const std::vector<std::string>& buffers);
+
 // return current working directory
 std::string getWorkingDirectory();
 
@@ -81,12 +115,36 @@ void sleepFor(int milliseconds);
 // for debugging and testing; epoch time in milliseconds
 long long millisecondTime();
 
+// for debugging and testing; epoch time in microseconds
+long long microsecondTime();
+
+// monotonic clock in nanoseconds, for measuring intervals; the zero point is arbitrary
+long long nanosecondClock();
+
+// sleep until nanosecondClock reaches clockNanos; returns at once if it already has
+void sleepUntil(long long clockNanos);
+
 // for debugging and testing; create directory
 void makeDir(const std::string& path);
 
 // for debugging and testing; remove directory
 void removeDir(const std::string& path);
 
+// create a new, empty directory with a unique name beginning with prefix in the system's temporary
+// directory (TMPDIR, else /tmp), for the files of one run or test; returns its path
+std::string makeTempDir(const std::string& prefix);
+
+// create a new, empty directory with a unique name beginning with prefix in parent; returns its
+// path
+std::string makeTempDirIn(const std::string& parent, const std::string& prefix);
+
+// create a new, empty file with a unique name beginning with pathPrefix, so that runs or threads
+// writing at once never share one; returns its path
+std::string makeTempFile(const std::string& pathPrefix);
+
+// remove the files in a directory, then the directory itself; false if any can't be removed
+bool removeDirFiles(const std::string& path);
+
 // for debugging and testing; location at which to set a breakpoint
 void noop();
 
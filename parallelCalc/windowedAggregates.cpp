@@ -0,0 +1,161 @@
+//
+//  windowedAggregates.cpp
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Aggregates per key over windows of a stream of rows that may never end. Windows are by count of
+// rows or by wall time, and either tumble (one after another) or slide (overlap). A sliding window
+// is made of its last few panes of one slide each: each row is aggregated once, into the pane in
+// progress, and a window only merges the aggregates of its panes.
+//
+
+#include "windowedAggregates.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// ========== Tests ================================================================================
+
+// component tests
+void ctest_windowedAggregates(int& totalPassed, int& totalFailed, bool verbose)
+{
+    int passed = 0;
+    int failed = 0;
+
+    typedef WindowedAggregates<unsigned long>::KeyAggregators KeyAggregators;
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // WindowedAggregates::add
+    // WindowedAggregates::closePane
+    // WindowedAggregates::windowAggregates
+
+    {
+        // windows of 4 rows every 2 rows, of values 1..6 alternating between two keys
+        StreamWindow window;
+        window.size = 4;
+        window.slide = 2;
+
+        WindowedAggregates<unsigned long> windows(AGGREGATE_SUM, window, 0);
+
+        ostringstream sums;
+        for (unsigned long value = 1; value <= 6; value++) {
+            windows.add(value % 2 == 0 ? "EVEN" : "ODD ", value);
+
+            if (windows.isPaneDue(0)) {
+                windows.closePane();
+
+                KeyAggregators aggregates;
+                windows.windowAggregates(aggregates);
+                sums << aggregates.find("ODD ")->second.result() << ",";
+                sums << aggregates.find("EVEN")->second.result() << " ";
+            }
+        }
+
+        // the first window has only one pane
+        if (sums.str() == "1,2 4,6 8,10 " && windows.getPaneCount() == 3 &&
+            windows.getWindowRows() == 4) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // WindowedAggregates::isPaneDue
+
+    {
+        // tumbling windows of 10 msec
+        const long long MSEC = 1000000;
+
+        StreamWindow window;
+        window.byTime = true;
+        window.size = 10;
+        window.slide = 10;
+
+        WindowedAggregates<unsigned long> windows(AGGREGATE_MAX, window, 100 * MSEC);
+        windows.add("EVEN", 4);
+        bool notDue = !windows.isPaneDue(109 * MSEC);
+
+        // a row 25 msec later is in the third pane, after an empty one
+        int closed = 0;
+        while (windows.isPaneDue(125 * MSEC)) {
+            windows.closePane();
+            closed++;
+        }
+
+        if (notDue && closed == 2 && windows.getWindowRows() == 0 &&
+            windows.getPaneEnd() == 130 * MSEC) passed++; else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // WindowedAggregates::skipIdlePanes
+
+    {
+        // windows of 20 msec every 10 msec, idle for a second after one row
+        const long long MSEC = 1000000;
+
+        StreamWindow window;
+        window.byTime = true;
+        window.size = 20;
+        window.slide = 10;
+
+        WindowedAggregates<unsigned long> windows(AGGREGATE_SUM, window, 0);
+        windows.add("EVEN", 4);
+
+        // the row's two windows are closed one pane at a time, then the rest at once
+        int closed = 0;
+        while (windows.isPaneDue(1005 * MSEC)) {
+            windows.closePane();
+            closed++;
+
+            windows.skipIdlePanes(1005 * MSEC);
+        }
+
+        // nothing to skip while the window has rows
+        WindowedAggregates<unsigned long> busy(AGGREGATE_SUM, window, 0);
+        busy.add("ODD ", 1);
+        busy.closePane();
+        busy.skipIdlePanes(1005 * MSEC);
+
+        if (closed == 3 && windows.getPaneCount() == 100 && windows.getPaneEnd() == 1010 * MSEC &&
+            busy.getPaneCount() == 1 && busy.getPaneEnd() == 20 * MSEC) passed++;
+        else failed++;
+    }
+
+    // ~~~~~~~~~~~~~~~~~~~~~~
+
+    if (verbose) {
+        cerr << "windowedAggregates.cpp" << "\t" << passed << " passed, " << failed << " failed";
+        cerr << endl;
+    }
+
+    totalPassed += passed;
+    totalFailed += failed;
+}
+
+// code coverage
+void cover_windowedAggregates(bool verbose)
+{
+    // ~~~~~~~~~~~~~~~~~~~~~~
+    // WindowedAggregates::WindowedAggregates
+
+    try {
+        // size not a multiple of slide
+        StreamWindow window;
+        window.size = 5;
+        window.slide = 2;
+
+        WindowedAggregates<unsigned long> windows(AGGREGATE_SUM, window, 0);
+
+    } catch (const logic_error& x) {
+        if (verbose) {
+            cerr << "logic_error: " << x.what() << endl;
+        }
+    }
+}
@@ -0,0 +1,216 @@
+//
+//  windowedAggregates.h
+//  parallelCalc
+//
+//  Copyright (c) 2013 Quadrivio Corporation. All rights reserved.
+//
+//  License http://opensource.org/licenses/BSD-2-Clause
+//          <YEAR> = 2013
+//          <OWNER> = Quadrivio Corporation
+//
+
+//
+// Aggregates per key over windows of a stream of rows that may never end. Windows are by count of
+// rows or by wall time, and either tumble (one after another) or slide (overlap). A sliding window
+// is made of its last few panes of one slide each: each row is aggregated once, into the pane in
+// progress, and a window only merges the aggregates of its panes.
+//
+
+#ifndef parallelCalc_windowedAggregates_h
+#define parallelCalc_windowedAggregates_h
+
+#include "shim.h"
+
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "aggregators.h"
+#include "utils.h"
+
+// ========== Structures ===========================================================================
+
+// windows of size rows, one every slide rows, or of size and slide msec of wall time if byTime;
+// tumbling if slide equals size, which must be a multiple of slide
+struct StreamWindow {
+    bool byTime;
+    long long size;
+    long long slide;
+
+    // tumbling windows of 1000 rows
+    StreamWindow() : byTime(false), size(1000), slide(1000) {};
+};
+
+// ========== Class Templates ======================================================================
+
+template <typename T> class WindowedAggregates {
+public:
+    typedef std::map<std::string, Aggregator<T> > KeyAggregators;
+
+    // windows of aggregates of kind, with sketch for distinct and quantile aggregates; the first
+    // pane starts at startNanos (from nanosecondClock)
+    WindowedAggregates(AggregateKind kind, const StreamWindow& window, long long startNanos,
+                       const SketchOptions& sketch = SketchOptions());
+
+    // add a key's value to the pane in progress
+    void add(const std::string& key, T value);
+
+    // true if the pane in progress is over by nowNanos: it has slide rows, or, for windows by
+    // time, its slide msec have passed
+    bool isPaneDue(long long nowNanos) const;
+
+    // end the pane in progress, keeping the panes of the window it ends, and start the next
+    void closePane();
+
+    // for windows by time, if the pane in progress and the window ended by the last pane closed
+    // have no rows, close all the panes over by nowNanos at once, since their windows are empty
+    void skipIdlePanes(long long nowNanos);
+
+    // when the pane in progress is over, for windows by time
+    long long getPaneEnd() const { return paneEnd; };
+
+    // panes closed so far
+    long long getPaneCount() const { return paneCount; };
+
+    // rows in the pane in progress, and in the window ended by the last pane closed
+    long long getPaneRows() const { return paneRows; };
+    long long getWindowRows() const { return windowRows; };
+
+    // aggregates per key over the window ended by the last pane closed
+    void windowAggregates(KeyAggregators& aggregates) const;
+
+protected:
+    AggregateKind kind;
+    StreamWindow window;
+    SketchOptions sketch;
+    size_t panesPerWindow;
+    long long paneEnd;
+    long long paneCount;
+    long long paneRows;
+    long long windowRows;
+    KeyAggregators pane;                    // in progress
+    std::deque<KeyAggregators> panes;       // of the last window, oldest first
+    std::deque<long long> panesRows;        // rows in each of panes
+};
+
+// -------------------------------------------------------------------------------------------------
+
+// windows of aggregates of kind, with sketch for distinct and quantile aggregates; the first pane
+// starts at startNanos (from nanosecondClock)
+template <typename T> WindowedAggregates<T>::WindowedAggregates(AggregateKind kind,
+                                                                 const StreamWindow& window,
+                                                                 long long startNanos,
+                                                                 const SketchOptions& sketch) :
+kind(kind),
+window(window),
+sketch(sketch),
+panesPerWindow(0),
+paneEnd(0),
+paneCount(0),
+paneRows(0),
+windowRows(0),
+pane(),
+panes(),
+panesRows()
+{
+    LOGIC_ERROR_IF(window.size <= 0 || window.slide <= 0 || window.size % window.slide != 0,
+                   "window size must be a positive multiple of its slide");
+
+    panesPerWindow = (size_t)(window.size / window.slide);
+
+    if (window.byTime) {
+        paneEnd = startNanos + window.slide * 1000000LL;
+    }
+}
+
+// add a key's value to the pane in progress
+template <typename T> void WindowedAggregates<T>::add(const std::string& key, T value)
+{
+    typename KeyAggregators::iterator iter = pane.find(key);
+    if (iter == pane.end()) {
+        iter = pane.insert(std::make_pair(key, Aggregator<T>(kind, sketch))).first;
+    }
+
+    iter->second.update(value);
+    paneRows++;
+}
+
+// true if the pane in progress is over by nowNanos: it has slide rows, or, for windows by time, its
+// slide msec have passed
+template <typename T> bool WindowedAggregates<T>::isPaneDue(long long nowNanos) const
+{
+    return window.byTime ? nowNanos >= paneEnd : paneRows >= window.slide;
+}
+
+// end the pane in progress, keeping the panes of the window it ends, and start the next
+template <typename T> void WindowedAggregates<T>::closePane()
+{
+    panes.push_back(KeyAggregators());
+    panes.back().swap(pane);
+    panesRows.push_back(paneRows);
+    windowRows += paneRows;
+
+    while (panes.size() > panesPerWindow) {
+        windowRows -= panesRows.front();
+        panes.pop_front();
+        panesRows.pop_front();
+    }
+
+    paneRows = 0;
+    paneCount++;
+
+    if (window.byTime) {
+        paneEnd += window.slide * 1000000LL;
+    }
+}
+
+// for windows by time, if the pane in progress and the window ended by the last pane closed have no
+// rows, close all the panes over by nowNanos at once, since their windows are empty
+template <typename T> void WindowedAggregates<T>::skipIdlePanes(long long nowNanos)
+{
+    if (!window.byTime || paneRows > 0 || windowRows > 0 || nowNanos < paneEnd) {
+        return;
+    }
+
+    long long slideNanos = window.slide * 1000000LL;
+    long long skipped = (nowNanos - paneEnd) / slideNanos + 1;
+
+    pane.clear();
+    panes.clear();
+    panesRows.clear();
+
+    paneCount += skipped;
+    paneEnd += skipped * slideNanos;
+}
+
+// aggregates per key over the window ended by the last pane closed
+template <typename T> void WindowedAggregates<T>::windowAggregates(KeyAggregators& aggregates) const
+{
+    aggregates.clear();
+
+    for (size_t k = 0; k < panes.size(); k++) {
+        typename KeyAggregators::const_iterator iter = panes[k].begin();
+        while (iter != panes[k].end()) {
+            typename KeyAggregators::iterator merged = aggregates.find(iter->first);
+            if (merged == aggregates.end()) {
+                aggregates.insert(*iter);
+
+            } else {
+                merged->second.merge(iter->second);
+            }
+
+            iter++;
+        }
+    }
+}
+
+// ========== Function Headers =====================================================================
+
+// component tests
+void ctest_windowedAggregates(int& totalPassed, int& totalFailed, bool verbose);
+
+// code coverage
+void cover_windowedAggregates(bool verbose);
+
+#endif